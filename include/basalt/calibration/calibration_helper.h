@@ -75,22 +75,41 @@ using CalibInitPoseMap =
     tbb::concurrent_unordered_map<TimeCamId, CalibInitPoseData,
                                   std::hash<TimeCamId>>;
 
+/// Options for the AprilGrid detection in calibration sequences.
+///
+/// With roi_tracking the grid is searched only in the region around the
+/// corners detected in the previous image of the same camera. The region is
+/// the bounding box of these corners grown by roi_margin times its size on
+/// every side. If fewer than roi_min_corner_ratio times the previous number
+/// of corners are found, or after roi_max_frames images tracked this way,
+/// the full image is searched again.
+struct CornerDetectionOptions {
+  bool roi_tracking = false;
+  double roi_margin = 0.3;
+  int roi_downscale = 1;  //!< downscale factor of the region before tag
+                          //! extraction, corners are refined at full res.
+  double roi_min_corner_ratio = 0.8;
+  int roi_max_frames = 10;
+};
+
 class CalibHelper {
  public:
-  static void detectCorners(const VioDatasetPtr& vio_data,
-                            const AprilGrid& april_grid,
-                            CalibCornerMap& calib_corners,
-                            CalibCornerMap& calib_corners_rejected);
+  static void detectCorners(
+      const VioDatasetPtr& vio_data, const AprilGrid& april_grid,
+      CalibCornerMap& calib_corners, CalibCornerMap& calib_corners_rejected,
+      const CornerDetectionOptions& options = CornerDetectionOptions());
 
   static void initCamPoses(
       const Calibration<double>::Ptr& calib,
       const Eigen::aligned_vector<Eigen::Vector4d>& aprilgrid_corner_pos_3d,
       CalibCornerMap& calib_corners, CalibInitPoseMap& calib_init_poses);
 
+  /// If reproj_error is given, it receives the average reprojection error
+  /// of the corners with the returned intrinsics.
   static bool initializeIntrinsics(
       const Eigen::aligned_vector<Eigen::Vector2d>& corners,
       const std::vector<int>& corner_ids, const AprilGrid& aprilgrid, int cols,
-      int rows, Eigen::Vector4d& init_intr);
+      int rows, Eigen::Vector4d& init_intr, double* reproj_error = nullptr);
 
   static bool initializeIntrinsicsPinhole(
       const std::vector<CalibCornerData*> pinhole_corners,
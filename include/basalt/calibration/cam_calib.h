@@ -101,6 +101,10 @@ class CamCalib {
 
   void setOptIntrinsics(bool opt) { opt_intr = opt; }
 
+  void setCornerDetectionOptions(const CornerDetectionOptions &options) {
+    corner_detection_options = options;
+  }
+
  private:
   static constexpr int UI_WIDTH = 300;
 
@@ -133,6 +137,8 @@ class CamCalib {
 
   int skip_images;
 
+  CornerDetectionOptions corner_detection_options;
+
   std::vector<std::string> cam_types;
 
   bool show_gui;
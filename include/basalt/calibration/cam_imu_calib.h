@@ -105,6 +105,10 @@ class CamImuCalib {
 
   void setOptIntrinsics(bool opt) { opt_intr = opt; }
 
+  void setCornerDetectionOptions(const CornerDetectionOptions &options) {
+    corner_detection_options = options;
+  }
+
  private:
   static constexpr int UI_WIDTH = 300;
 
@@ -130,6 +134,8 @@ class CamImuCalib {
 
   int skip_images;
 
+  CornerDetectionOptions corner_detection_options;
+
   bool show_gui;
 
   const size_t MIN_CORNERS = 15;
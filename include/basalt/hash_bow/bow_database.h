@@ -0,0 +1,46 @@
+#pragma once
+
+#include <bitset>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <basalt/utils/common_types.h>
+
+namespace basalt {
+
+/// Bag-of-words image database that the mapper uses to select the image
+/// pairs to match.
+template <size_t N>
+class BowDatabase {
+ public:
+  virtual ~BowDatabase() = default;
+
+  /// Computes the word of every descriptor and the normalized weighted word
+  /// histogram of the image.
+  virtual void compute_bow(const std::vector<std::bitset<N>>& descriptors,
+                           std::vector<FeatureHash>& hashes,
+                           HashBowVector& bow_vector) const = 0;
+
+  virtual void add_to_database(const TimeCamId& tcid,
+                               const HashBowVector& bow_vector) = 0;
+
+  /// Returns up to num_results images with the highest score. If max_t_ns is
+  /// given, only frames before it are returned.
+  virtual void querry_database(
+      const HashBowVector& bow_vector, size_t num_results,
+      std::vector<std::pair<TimeCamId, double>>& results,
+      const int64_t* max_t_ns = nullptr) const = 0;
+
+  /// Computes the direct index group of every feature from its word. Only
+  /// features in the same group need to be compared when matching two
+  /// images. Returns false if the database has no direct index.
+  virtual bool direct_index(const std::vector<FeatureHash>& hashes,
+                            std::vector<uint32_t>& groups) const {
+    (void)hashes;
+    (void)groups;
+    return false;
+  }
+};
+
+}  // namespace basalt
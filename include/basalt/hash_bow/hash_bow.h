@@ -6,6 +6,7 @@
 #include <unordered_map>
 #include <vector>
 
+#include <basalt/hash_bow/bow_database.h>
 #include <basalt/utils/common_types.h>
 
 #include <tbb/concurrent_unordered_map.h>
@@ -14,7 +15,7 @@
 namespace basalt {
 
 template <size_t N>
-class HashBow {
+class HashBow : public BowDatabase<N> {
  public:
   HashBow(size_t num_bits) : num_bits(num_bits < 32 ? num_bits : 32) {
     static_assert(N < 512,
@@ -32,7 +33,7 @@ class HashBow {
 
   inline void compute_bow(const std::vector<std::bitset<N>>& descriptors,
                           std::vector<FeatureHash>& hashes,
-                          HashBowVector& bow_vector) const {
+                          HashBowVector& bow_vector) const override {
     size_t descriptors_size = descriptors.size();
     hashes.resize(descriptors_size);
 
@@ -59,7 +60,7 @@ class HashBow {
   }
 
   inline void add_to_database(const TimeCamId& tcid,
-                              const HashBowVector& bow_vector) {
+                              const HashBowVector& bow_vector) override {
     for (const auto& kv : bow_vector) {
       // std::pair<TimeCamId, double> p = std::make_pair(tcid, kv.second);
       inverted_index[kv.first].emplace_back(tcid, kv.second);
@@ -69,7 +70,7 @@ class HashBow {
   inline void querry_database(
       const HashBowVector& bow_vector, size_t num_results,
       std::vector<std::pair<TimeCamId, double>>& results,
-      const int64_t* max_t_ns = nullptr) const {
+      const int64_t* max_t_ns = nullptr) const override {
     results.clear();
 
     std::unordered_map<TimeCamId, double> scores;
@@ -0,0 +1,383 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <basalt/hash_bow/bow_database.h>
+#include <basalt/utils/common_types.h>
+
+#include <cereal/archives/binary.hpp>
+#include <cereal/types/bitset.hpp>
+#include <cereal/types/vector.hpp>
+
+#include <tbb/blocked_range.h>
+#include <tbb/concurrent_vector.h>
+#include <tbb/parallel_for.h>
+
+namespace basalt {
+
+/// Hierarchical vocabulary of binary descriptors with TF-IDF weighting.
+///
+/// The vocabulary is a complete tree with the given branching factor and
+/// depth, trained offline with k-majority clustering (k-means with the
+/// Hamming distance and the per-bit majority as the cluster center). The
+/// words are the leaves. A descriptor is quantized by descending from the
+/// root to the closest child at every level. The nodes at
+/// direct_index_level serve as a direct index: descriptors quantized to
+/// different nodes at that level are unlikely to match, so only descriptors
+/// in the same node have to be compared.
+template <size_t N>
+class VocabularyTree : public BowDatabase<N> {
+ public:
+  VocabularyTree() = default;
+
+  /// Trains the vocabulary on the descriptors of a set of images. The IDF
+  /// weight of every word is computed from the number of images it appears
+  /// in.
+  void train(const std::vector<std::vector<std::bitset<N>>>& images,
+             size_t branching, size_t depth, int max_iterations = 10) {
+    this->branching = branching;
+    this->depth = depth;
+
+    size_t num_nodes = 1, level_nodes = 1;
+    for (size_t l = 0; l < depth; l++) {
+      level_nodes *= branching;
+      num_nodes += level_nodes;
+    }
+    nodes.assign(num_nodes, std::bitset<N>());
+
+    std::vector<const std::bitset<N>*> descriptors;
+    for (const auto& image : images) {
+      for (const auto& d : image) descriptors.emplace_back(&d);
+    }
+
+    std::vector<uint32_t> idx(descriptors.size());
+    std::iota(idx.begin(), idx.end(), 0);
+    cluster(0, 0, idx, descriptors, max_iterations);
+
+    // IDF weights
+    std::vector<size_t> num_images_with_word(num_words(), 0);
+    for (const auto& image : images) {
+      std::unordered_set<uint32_t> words;
+      for (const auto& d : image) words.emplace(compute_word(d));
+      for (uint32_t w : words) num_images_with_word[w]++;
+    }
+
+    weights.assign(num_words(), 0);
+    for (size_t w = 0; w < num_words(); w++) {
+      if (num_images_with_word[w] > 0) {
+        weights[w] = std::log(double(images.size()) / num_images_with_word[w]);
+      }
+    }
+
+    inverted_index.clear();
+    inverted_index.resize(num_words());
+  }
+
+  bool save(const std::string& path) const {
+    std::ofstream os(path, std::ios::binary);
+    if (!os.is_open()) {
+      std::cerr << "Could not open " << path << " to save the vocabulary"
+                << std::endl;
+      return false;
+    }
+
+    cereal::BinaryOutputArchive archive(os);
+    archive(branching, depth, nodes, weights);
+    return true;
+  }
+
+  bool load(const std::string& path) {
+    std::ifstream is(path, std::ios::binary);
+    if (!is.is_open()) {
+      std::cerr << "Could not open vocabulary " << path << std::endl;
+      return false;
+    }
+
+    try {
+      cereal::BinaryInputArchive archive(is);
+      archive(branching, depth, nodes, weights);
+    } catch (const cereal::Exception& e) {
+      std::cerr << "Could not read vocabulary " << path << ": " << e.what()
+                << std::endl;
+      return false;
+    }
+
+    if (branching < 2 || nodes.size() != num_leaves() + first_leaf() ||
+        weights.size() != num_words()) {
+      std::cerr << "Vocabulary " << path << " is inconsistent" << std::endl;
+      return false;
+    }
+
+    inverted_index.clear();
+    inverted_index.resize(num_words());
+
+    std::cout << "Loaded vocabulary with " << num_words() << " words from "
+              << path << std::endl;
+    return true;
+  }
+
+  size_t num_words() const { return num_leaves(); }
+
+  /// Level of the direct index below the root. Level 0 disables it.
+  void set_direct_index_level(size_t level) {
+    direct_index_level = std::min(level, depth);
+  }
+
+  inline uint32_t compute_word(const std::bitset<N>& descriptor) const {
+    size_t node = 0;
+    for (size_t l = 0; l < depth; l++) {
+      const size_t first_child = node * branching + 1;
+
+      size_t best_dist = N + 1;
+      for (size_t c = first_child; c < first_child + branching; c++) {
+        const size_t dist = (nodes[c] ^ descriptor).count();
+        if (dist < best_dist) {
+          best_dist = dist;
+          node = c;
+        }
+      }
+    }
+    return node - first_leaf();
+  }
+
+  inline void compute_bow(const std::vector<std::bitset<N>>& descriptors,
+                          std::vector<FeatureHash>& hashes,
+                          HashBowVector& bow_vector) const override {
+    hashes.resize(descriptors.size());
+
+    std::unordered_map<uint32_t, double> bow_map;
+    bow_map.reserve(descriptors.size());
+
+    for (size_t i = 0; i < descriptors.size(); i++) {
+      const uint32_t word = compute_word(descriptors[i]);
+      hashes[i] = FeatureHash(word);
+      if (weights[word] > 0) bow_map[word] += weights[word];
+    }
+
+    bow_vector.clear();
+
+    double l1_sum = 0;
+    for (const auto& kv : bow_map) {
+      bow_vector.emplace_back(FeatureHash(kv.first), kv.second);
+      l1_sum += kv.second;
+    }
+
+    for (auto& kv : bow_vector) {
+      kv.second /= l1_sum;
+    }
+  }
+
+  inline void add_to_database(const TimeCamId& tcid,
+                              const HashBowVector& bow_vector) override {
+    for (const auto& kv : bow_vector) {
+      inverted_index[kv.first.to_ulong()].emplace_back(tcid, kv.second);
+    }
+  }
+
+  inline void querry_database(
+      const HashBowVector& bow_vector, size_t num_results,
+      std::vector<std::pair<TimeCamId, double>>& results,
+      const int64_t* max_t_ns = nullptr) const override {
+    results.clear();
+
+    std::unordered_map<TimeCamId, double> scores;
+
+    // L1 score, computed from the words present in both vectors
+    for (const auto& kv : bow_vector) {
+      for (const auto& v : inverted_index[kv.first.to_ulong()]) {
+        if (!max_t_ns || v.first.frame_id < (*max_t_ns))
+          scores[v.first] += std::abs(kv.second - v.second) -
+                             std::abs(kv.second) - std::abs(v.second);
+      }
+    }
+
+    results.reserve(scores.size());
+
+    for (const auto& kv : scores)
+      results.emplace_back(kv.first, -kv.second / 2.0);
+
+    if (results.size() > num_results) {
+      std::partial_sort(
+          results.begin(), results.begin() + num_results, results.end(),
+          [](const auto& a, const auto& b) { return a.second > b.second; });
+
+      results.resize(num_results);
+    }
+  }
+
+  inline bool direct_index(const std::vector<FeatureHash>& hashes,
+                           std::vector<uint32_t>& groups) const override {
+    if (direct_index_level == 0) return false;
+
+    groups.resize(hashes.size());
+    for (size_t i = 0; i < hashes.size(); i++) {
+      size_t node = hashes[i].to_ulong() + first_leaf();
+      for (size_t l = depth; l > direct_index_level; l--) {
+        node = (node - 1) / branching;
+      }
+      groups[i] = node;
+    }
+    return true;
+  }
+
+ protected:
+  // Nodes are stored in breadth-first order, so the children of node n are
+  // n * branching + 1 ... n * branching + branching.
+  size_t first_leaf() const { return (num_leaves() - 1) / (branching - 1); }
+
+  size_t num_leaves() const {
+    size_t res = 1;
+    for (size_t l = 0; l < depth; l++) res *= branching;
+    return res;
+  }
+
+  // Splits the descriptors idx of node into the children of node and
+  // recurses into them.
+  void cluster(size_t node, size_t level, const std::vector<uint32_t>& idx,
+               const std::vector<const std::bitset<N>*>& descriptors,
+               int max_iterations) {
+    if (level == depth) return;
+
+    const size_t first_child = node * branching + 1;
+    std::vector<int> assignment(idx.size(), 0);
+
+    if (idx.size() <= branching) {
+      // Too few descriptors to cluster, the remaining children are copies
+      for (size_t c = 0; c < branching; c++) {
+        nodes[first_child + c] =
+            idx.empty() ? nodes[node]
+                        : *descriptors[idx[std::min(c, idx.size() - 1)]];
+      }
+      for (size_t i = 0; i < idx.size(); i++) assignment[i] = i;
+    } else {
+      std::mt19937 gen(node);
+      seedCenters(first_child, idx, descriptors, gen);
+
+      for (int it = 0; it < max_iterations; it++) {
+        const bool changed =
+            assignToCenters(first_child, idx, descriptors, assignment);
+        if (!changed && it > 0) break;
+
+        // Per-bit majority of the assigned descriptors
+        std::vector<std::array<uint32_t, N>> bit_counts(branching);
+        std::vector<uint32_t> cluster_sizes(branching, 0);
+        for (auto& counts : bit_counts) counts.fill(0);
+
+        for (size_t i = 0; i < idx.size(); i++) {
+          const std::bitset<N>& d = *descriptors[idx[i]];
+          cluster_sizes[assignment[i]]++;
+          for (size_t b = 0; b < N; b++) {
+            if (d[b]) bit_counts[assignment[i]][b]++;
+          }
+        }
+
+        for (size_t c = 0; c < branching; c++) {
+          if (cluster_sizes[c] == 0) continue;
+          std::bitset<N>& center = nodes[first_child + c];
+          for (size_t b = 0; b < N; b++) {
+            center[b] = 2 * bit_counts[c][b] > cluster_sizes[c];
+          }
+        }
+      }
+
+      assignToCenters(first_child, idx, descriptors, assignment);
+    }
+
+    std::vector<std::vector<uint32_t>> child_idx(branching);
+    for (size_t i = 0; i < idx.size(); i++) {
+      child_idx[assignment[i]].emplace_back(idx[i]);
+    }
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, branching),
+                      [&](const tbb::blocked_range<size_t>& r) {
+                        for (size_t c = r.begin(); c != r.end(); ++c) {
+                          cluster(first_child + c, level + 1, child_idx[c],
+                                  descriptors, max_iterations);
+                        }
+                      });
+  }
+
+  // k-means++ seeding with the squared Hamming distance
+  void seedCenters(size_t first_child, const std::vector<uint32_t>& idx,
+                   const std::vector<const std::bitset<N>*>& descriptors,
+                   std::mt19937& gen) {
+    std::uniform_int_distribution<size_t> first(0, idx.size() - 1);
+    nodes[first_child] = *descriptors[idx[first(gen)]];
+
+    std::vector<double> min_dist2(idx.size(), double(N * N));
+    for (size_t c = 1; c < branching; c++) {
+      const std::bitset<N>& last = nodes[first_child + c - 1];
+      for (size_t i = 0; i < idx.size(); i++) {
+        const double dist = (*descriptors[idx[i]] ^ last).count();
+        min_dist2[i] = std::min(min_dist2[i], dist * dist);
+      }
+
+      // All remaining descriptors coincide with a center
+      if (std::all_of(min_dist2.begin(), min_dist2.end(),
+                      [](double d) { return d == 0; })) {
+        nodes[first_child + c] = last;
+        continue;
+      }
+
+      std::discrete_distribution<size_t> next(min_dist2.begin(),
+                                              min_dist2.end());
+      nodes[first_child + c] = *descriptors[idx[next(gen)]];
+    }
+  }
+
+  // Assigns every descriptor to the closest center. Returns true if any
+  // assignment changed.
+  bool assignToCenters(size_t first_child, const std::vector<uint32_t>& idx,
+                       const std::vector<const std::bitset<N>*>& descriptors,
+                       std::vector<int>& assignment) const {
+    std::atomic<bool> changed = false;
+
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, idx.size(), 1024),
+        [&](const tbb::blocked_range<size_t>& r) {
+          for (size_t i = r.begin(); i != r.end(); ++i) {
+            int best_c = 0;
+            size_t best_dist = N + 1;
+            for (size_t c = 0; c < branching; c++) {
+              const size_t dist =
+                  (nodes[first_child + c] ^ *descriptors[idx[i]]).count();
+              if (dist < best_dist) {
+                best_dist = dist;
+                best_c = c;
+              }
+            }
+
+            if (assignment[i] != best_c) {
+              assignment[i] = best_c;
+              changed = true;
+            }
+          }
+        });
+
+    return changed;
+  }
+
+  size_t branching = 0;
+  size_t depth = 0;
+  size_t direct_index_level = 0;
+
+  std::vector<std::bitset<N>> nodes;
+  std::vector<double> weights;
+
+  std::vector<tbb::concurrent_vector<std::pair<TimeCamId, double>>>
+      inverted_index;
+};
+
+}  // namespace basalt
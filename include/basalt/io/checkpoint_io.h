@@ -0,0 +1,149 @@
+/**
+BSD 3-Clause License
+
+This file is part of the Basalt project.
+https://gitlab.com/VladyslavUsenko/basalt.git
+
+Copyright (c) 2022, Vladyslav Usenko and Nikolaus Demmel.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the copyright holder nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#include <basalt/io/marg_data_io.h>
+#include <basalt/serialization/headers_serialization.h>
+#include <basalt/utils/imu_types.h>
+#include <basalt/vi_estimator/landmark_database.h>
+
+#include <cereal/cereal.hpp>
+#include <cereal/types/string.hpp>
+
+namespace basalt {
+
+/// Every section of a checkpoint (optical flow, estimator) starts with this
+/// header, so that data of another format, version or scalar type is rejected
+/// instead of misread. Checkpoints are not an archival format: they are meant
+/// to be restored by the same build with the same config and calibration.
+struct CheckpointHeader {
+  static constexpr uint64_t FORMAT_MAGIC = 0xba5ac4ec00000000;
+  static constexpr uint64_t FORMAT_MAGIC_MASK = 0xffffffff00000000;
+  /// Increase with every change of what a section stores.
+  /// 2: images of the window frames kept for the marginalization data.
+  /// 3: whether the estimator has asked the optical flow for new points.
+  static constexpr uint32_t FORMAT_VERSION = 3;
+
+  std::string section;
+  uint32_t scalar_size = 0;
+
+  template <class Archive>
+  void save(Archive& ar) const {
+    const uint64_t header = FORMAT_MAGIC | FORMAT_VERSION;
+    ar(header, section, scalar_size);
+  }
+
+  /// Throws std::runtime_error if the data is not the expected section
+  template <class Archive>
+  void load(Archive& ar) {
+    uint64_t header;
+    ar(header);
+    if ((header & FORMAT_MAGIC_MASK) != FORMAT_MAGIC ||
+        (header & ~FORMAT_MAGIC_MASK) != FORMAT_VERSION) {
+      throw std::runtime_error("Not a checkpoint of this version");
+    }
+
+    const std::string expected_section = section;
+    const uint32_t expected_scalar_size = scalar_size;
+    ar(section, scalar_size);
+    if (section != expected_section || scalar_size != expected_scalar_size) {
+      throw std::runtime_error("Unexpected checkpoint section " + section);
+    }
+  }
+};
+
+/// Writes or reads a (const) PoseVelBiasState without its input images
+template <class Archive, class State>
+void serializeCheckpointState(Archive& ar, State& s) {
+  ar(s.t_ns);
+  ar(s.T_w_i);
+  ar(s.vel_w_i);
+  ar(s.bias_gyro);
+  ar(s.bias_accel);
+}
+
+}  // namespace basalt
+
+namespace cereal {
+
+template <class Archive, class Scalar>
+void serialize(Archive& ar, basalt::MargLinData<Scalar>& m) {
+  ar(m.is_sqrt);
+  ar(m.order);
+  ar(m.H);
+  ar(m.b);
+}
+
+// The database is written as a list of landmarks with their observations and
+// rebuilt through its public interface, which also restores the per host
+// observation index.
+template <class Archive, class Scalar>
+void save(Archive& ar, const basalt::LandmarkDatabase<Scalar>& lmdb) {
+  ar(uint64_t(lmdb.numLandmarks()));
+  for (const auto& [lm_id, kpt] : lmdb.getLandmarks()) {
+    ar(uint64_t(lm_id), kpt.direction, kpt.inv_dist, kpt.host_kf_id);
+    ar(uint64_t(kpt.obs.size()));
+    for (const auto& [tcid, pos] : kpt.obs) ar(tcid, pos);
+  }
+}
+
+template <class Archive, class Scalar>
+void load(Archive& ar, basalt::LandmarkDatabase<Scalar>& lmdb) {
+  uint64_t num_landmarks;
+  ar(num_landmarks);
+  for (uint64_t i = 0; i < num_landmarks; i++) {
+    uint64_t lm_id;
+    basalt::Keypoint<Scalar> kpt;
+    ar(lm_id, kpt.direction, kpt.inv_dist, kpt.host_kf_id);
+    lmdb.addLandmark(lm_id, kpt);
+
+    uint64_t num_obs;
+    ar(num_obs);
+    for (uint64_t j = 0; j < num_obs; j++) {
+      basalt::TimeCamId tcid;
+      basalt::KeypointObservation<Scalar> kobs;
+      kobs.kpt_id = lm_id;
+      ar(tcid, kobs.pos);
+      lmdb.addObservation(tcid, kobs);
+    }
+  }
+}
+
+}  // namespace cereal
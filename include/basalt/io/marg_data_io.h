@@ -34,10 +34,12 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <thread>
 
 #include <basalt/utils/imu_types.h>
+#include <basalt/utils/vio_config.h>
 
 namespace basalt {
 
@@ -45,18 +47,40 @@ class MargDataSaver {
  public:
   using Ptr = std::shared_ptr<MargDataSaver>;
 
-  MargDataSaver(const std::string& path);
+  // What happened to the data pushed into in_marg_queue. Drops only occur
+  // with config.marg_data_bounded_recording.
+  struct Counters {
+    std::atomic<size_t> marg_data_saved{0};
+    std::atomic<size_t> marg_data_dropped{0};
+    std::atomic<size_t> images_saved{0};
+    std::atomic<size_t> images_dropped_queue{0};
+    std::atomic<size_t> images_dropped_budget{0};
+  };
+
+  MargDataSaver(const std::string& path,
+                const VioConfig& config = VioConfig());
   ~MargDataSaver() {
     saving_thread->join();
     saving_img_thread->join();
+    if (saving_marg_thread) saving_marg_thread->join();
+    printCounters();
   }
   tbb::concurrent_bounded_queue<MargData::Ptr> in_marg_queue;
 
+  const Counters& getCounters() const { return counters; }
+  void printCounters() const;
+
  private:
   std::shared_ptr<std::thread> saving_thread;
   std::shared_ptr<std::thread> saving_img_thread;
 
+  // Only used in bounded recording, where saving_thread just dispatches
+  std::shared_ptr<std::thread> saving_marg_thread;
+  tbb::concurrent_bounded_queue<MargData::Ptr> save_marg_queue;
+
   tbb::concurrent_bounded_queue<OpticalFlowResult::Ptr> save_image_queue;
+
+  Counters counters;
 };
 
 class MargDataLoader {
@@ -76,3 +100,49 @@ class MargDataLoader {
   std::shared_ptr<std::thread> processing_thread;
 };
 }  // namespace basalt
+
+// Format of the images and observations in the marginalization data, also
+// used by the checkpoints in checkpoint_io.h
+namespace cereal {
+
+template <class Archive, class T>
+void save(Archive& ar, const basalt::ManagedImage<T>& m) {
+  ar(m.w);
+  ar(m.h);
+  ar(cereal::binary_data(m.ptr, sizeof(T) * m.w * m.h));
+}
+
+template <class Archive, class T>
+void load(Archive& ar, basalt::ManagedImage<T>& m) {
+  size_t w;
+  size_t h;
+  ar(w);
+  ar(h);
+  m.Reinitialise(w, h);
+  ar(cereal::binary_data(m.ptr, sizeof(T) * m.w * m.h));
+}
+
+template <class Archive>
+void serialize(Archive& ar, basalt::OpticalFlowResult& m) {
+  ar(m.t_ns);
+  ar(m.observations);
+  ar(m.input_images);
+}
+
+template <class Archive>
+void serialize(Archive& ar, basalt::OpticalFlowInput& m) {
+  ar(m.t_ns);
+  ar(m.img_data);
+}
+
+template <class Archive>
+void serialize(Archive& ar, basalt::ImageData& m) {
+  ar(m.exposure);
+  ar(m.img);
+}
+
+template <class Archive>
+void serialize(Archive& ar, Eigen::AffineCompact2f& m) {
+  ar(m.matrix());
+}
+}  // namespace cereal
@@ -20,6 +20,10 @@ class LinearizationBase {
   struct Options {
     typename LandmarkBlock<Scalar>::Options lb_options;
     LinearizationType linearization_type;
+
+    // If set, only these landmarks are optimized; all others stay fixed and
+    // their residuals are ignored. Not used for marginalization.
+    const std::unordered_set<KeypointId>* active_landmarks = nullptr;
   };
 
   virtual ~LinearizationBase() = default;
@@ -0,0 +1,181 @@
+/**
+BSD 3-Clause License
+
+This file is part of the Basalt project.
+https://gitlab.com/VladyslavUsenko/basalt.git
+
+Copyright (c) 2022, Vladyslav Usenko and Nikolaus Demmel.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the copyright holder nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <basalt/utils/imu_types.h>
+#include <basalt/vi_estimator/map_localization.h>
+
+namespace basalt {
+
+/// Reprojection residuals of fixed map landmarks in one frame. They only
+/// depend on the pose of that frame.
+template <class Scalar_>
+class MapObsBlock {
+ public:
+  using Scalar = Scalar_;
+
+  using Vec2 = Eigen::Matrix<Scalar, 2, 1>;
+  using Vec3 = Eigen::Matrix<Scalar, 3, 1>;
+  using Vec4 = Eigen::Matrix<Scalar, 4, 1>;
+  using VecX = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+  using Mat2P = Eigen::Matrix<Scalar, 2, POSE_SIZE>;
+  using MatX = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>;
+  using SE3 = Sophus::SE3<Scalar>;
+
+  MapObsBlock(int64_t t_ns, const MapObservations* obs, const AbsOrderMap& aom)
+      : t_ns(t_ns), obs(obs), aom(aom) {
+    Jp.resize(2 * obs->size(), POSE_SIZE);
+    r.resize(2 * obs->size());
+  }
+
+  int64_t getFrameId() const { return t_ns; }
+
+  Scalar linearizeMapObs(const PoseStateWithLin<Scalar>& state,
+                         const Calibration<Scalar>& calib, Scalar obs_std_dev,
+                         Scalar huber_thresh) {
+    Jp.setZero();
+    r.setZero();
+
+    Scalar error = 0;
+    for (size_t k = 0; k < obs->size(); k++) {
+      Vec2 res;
+      Mat2P d_res_d_xi;
+      bool valid =
+          linearizeMapPoint(obs->at(k), state.getPoseLin(), calib, res,
+                            &d_res_d_xi);
+
+      // As for landmarks, the Jacobian is evaluated at the linearization
+      // point and the residual at the current estimate.
+      if (valid && state.isLinearized()) {
+        valid = linearizeMapPoint(obs->at(k), state.getPose(), calib, res);
+      }
+
+      if (!valid) continue;
+
+      const Scalar e = res.norm();
+      const Scalar huber_weight =
+          e < huber_thresh ? Scalar(1.0) : huber_thresh / e;
+      const Scalar obs_weight = huber_weight / (obs_std_dev * obs_std_dev);
+
+      error += Scalar(0.5) * (2 - huber_weight) * obs_weight * e * e;
+
+      const Scalar sqrt_obs_weight = std::sqrt(obs_weight);
+      Jp.template block<2, POSE_SIZE>(2 * k, 0) = sqrt_obs_weight * d_res_d_xi;
+      r.template segment<2>(2 * k) = sqrt_obs_weight * res;
+    }
+
+    return error;
+  }
+
+  Scalar computeError(const PoseStateWithLin<Scalar>& state,
+                      const Calibration<Scalar>& calib, Scalar obs_std_dev,
+                      Scalar huber_thresh) const {
+    Scalar error = 0;
+    for (const MapObservation& ob : *obs) {
+      Vec2 res;
+      if (!linearizeMapPoint(ob, state.getPose(), calib, res)) continue;
+
+      const Scalar e = res.norm();
+      const Scalar huber_weight =
+          e < huber_thresh ? Scalar(1.0) : huber_thresh / e;
+      const Scalar obs_weight = huber_weight / (obs_std_dev * obs_std_dev);
+
+      error += Scalar(0.5) * (2 - huber_weight) * obs_weight * e * e;
+    }
+    return error;
+  }
+
+  void add_dense_H_b(MatX& H, VecX& b) const {
+    const size_t idx = aom.abs_order_map.at(t_ns).first;
+
+    H.template block<POSE_SIZE, POSE_SIZE>(idx, idx) += Jp.transpose() * Jp;
+    b.template segment<POSE_SIZE>(idx) += Jp.transpose() * r;
+  }
+
+  void backSubstitute(const VecX& pose_inc, Scalar& l_diff) const {
+    const size_t idx = aom.abs_order_map.at(t_ns).first;
+
+    // model cost change, see ImuBlock::backSubstitute
+    VecX Jinc = Jp * pose_inc.template segment<POSE_SIZE>(idx);
+    l_diff -= Jinc.transpose() * (Scalar(0.5) * Jinc + r);
+  }
+
+  /// Residual of a map landmark and its Jacobian w.r.t. the pose increment
+  /// of T_w_i (see PoseState::incPose)
+  static bool linearizeMapPoint(const MapObservation& ob, const SE3& T_w_i,
+                                const Calibration<Scalar>& calib, Vec2& res,
+                                Mat2P* d_res_d_xi = nullptr) {
+    const SE3& T_i_c = calib.T_i_c[ob.cam_id];
+    const Vec3 p_w = ob.p_w.template cast<Scalar>();
+    const Vec3 p_w_rel = p_w - T_w_i.translation();
+    const Eigen::Matrix<Scalar, 3, 3> R_c_w =
+        (T_w_i.so3() * T_i_c.so3()).inverse().matrix();
+
+    const Vec3 p_i = T_w_i.so3().inverse() * p_w_rel;
+
+    Vec4 p_c;
+    p_c.template head<3>() = T_i_c.inverse() * p_i;
+    p_c[3] = 1;
+
+    Eigen::Matrix<Scalar, 2, 4> Jp;
+    bool valid = calib.intrinsics[ob.cam_id].project(p_c, res, &Jp);
+    valid &= res.array().isFinite().all();
+    if (!valid) return false;
+
+    res -= ob.pos.template cast<Scalar>();
+
+    if (d_res_d_xi) {
+      Eigen::Matrix<Scalar, 3, POSE_SIZE> d_p_d_xi;
+      d_p_d_xi.template leftCols<3>() = -R_c_w;
+      d_p_d_xi.template rightCols<3>() =
+          R_c_w * Sophus::SO3<Scalar>::hat(p_w_rel);
+
+      *d_res_d_xi = Jp.template leftCols<3>() * d_p_d_xi;
+    }
+
+    return true;
+  }
+
+ protected:
+  int64_t t_ns;
+  MatX Jp;
+  VecX r;
+
+  const MapObservations* obs;
+  const AbsOrderMap& aom;
+};
+
+}  // namespace basalt
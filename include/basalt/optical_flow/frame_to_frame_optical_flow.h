@@ -35,7 +35,11 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #pragma once
 
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
 #include <memory>
+#include <mutex>
 #include <thread>
 
 #include <sophus/se2.hpp>
@@ -49,12 +53,17 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <tbb/concurrent_unordered_map.h>
 #include <tbb/parallel_for.h>
 
+#include <basalt/optical_flow/gradient_pyramid.h>
 #include <basalt/optical_flow/optical_flow.h>
 #include <basalt/optical_flow/patch.h>
+#include <basalt/optical_flow/patch_batch.h>
 
 #include <basalt/image/image_pyr.h>
+#include <basalt/io/checkpoint_io.h>
 #include <basalt/utils/keypoints.h>
 
+#include <cereal/archives/binary.hpp>
+
 namespace basalt {
 
 /// Unlike PatchOpticalFlow, FrameToFrameOpticalFlow always tracks patches
@@ -66,6 +75,26 @@ class FrameToFrameOpticalFlow : public OpticalFlowBase {
  public:
   typedef OpticalFlowPatch<Scalar, Pattern<Scalar>> PatchT;
 
+  /// Patches of a point for all pyramid levels
+  typedef Eigen::aligned_vector<PatchT> Patches;
+  typedef std::unordered_map<KeypointId, Patches> PatchCache;
+
+  /// Number of points tracked together, see trackPointBatch. One lane per
+  /// float of a SIMD register.
+#ifdef __AVX512F__
+  static constexpr int BATCH_SIZE = 16;
+#else
+  static constexpr int BATCH_SIZE = 8;
+#endif
+
+  /// Maximum number of candidates per point, see matchPointsEpipolar
+  static constexpr int EPIPOLAR_MAX_SAMPLES = 32;
+  typedef OpticalFlowPatchBatch<Scalar, Pattern<Scalar>, BATCH_SIZE>
+      PatchBatchT;
+  typedef typename PatchBatchT::LaneMask LaneMask;
+  template <typename T>
+  using Batch = std::array<T, BATCH_SIZE>;
+
   typedef Eigen::Matrix<Scalar, 2, 1> Vector2;
   typedef Eigen::Matrix<Scalar, 2, 2> Matrix2;
 
@@ -84,6 +113,10 @@ class FrameToFrameOpticalFlow : public OpticalFlowBase {
       : t_ns(-1),
         frame_counter(0),
         last_keypoint_id(0),
+        replenish_requested(true),
+        frames_since_detection(0),
+        detection_regions_left(0),
+        next_detection_region(0),
         config(config),
         accel_cov(calib.dicrete_time_accel_noise_std()
                       .template cast<double>()
@@ -97,17 +130,39 @@ class FrameToFrameOpticalFlow : public OpticalFlowBase {
     input_imu_queue.set_capacity(300);
 
     this->calib = calib.cast<Scalar>();
+    this->config.optical_flow_base_level = std::clamp(
+        config.optical_flow_base_level, 0, config.optical_flow_levels);
+    this->config.optical_flow_skipped_frames_level = std::min(
+        config.optical_flow_skipped_frames_level, config.optical_flow_levels);
+    base_level = this->config.optical_flow_base_level;
+    base_refinement = config.optical_flow_base_refinement;
+
+    if (config.optical_flow_matching_epipolar &&
+        !(config.optical_flow_matching_min_depth > 0)) {
+      std::cerr << "config.optical_flow_matching_min_depth "
+                << config.optical_flow_matching_min_depth
+                << " must be positive for epipolar matching." << std::endl;
+      std::abort();
+    }
 
     patch_coord = PatchT::pattern2.template cast<float>();
     depth_guess = config.optical_flow_matching_default_depth;
     latest_state = std::make_shared<PoseVelBiasState<double>>();
     predicted_state = std::make_shared<PoseVelBiasState<double>>();
 
-    if (calib.intrinsics.size() > 1) {
+    const size_t NUM_CAMS = calib.intrinsics.size();
+    match_source.resize(NUM_CAMS, 0);
+    E.resize(NUM_CAMS);
+    for (size_t i = 1; i < NUM_CAMS; i++) {
+      if (config.optical_flow_matching_pairwise) {
+        match_source[i] = mostOverlappingCamera(i);
+      }
+
       Eigen::Matrix4d Ed;
-      Sophus::SE3d T_i_j = calib.T_i_c[0].inverse() * calib.T_i_c[1];
+      Sophus::SE3d T_i_j =
+          calib.T_i_c[match_source[i]].inverse() * calib.T_i_c[i];
       computeEssential(T_i_j, Ed);
-      E = Ed.cast<Scalar>();
+      E[i] = Ed.cast<Scalar>();
     }
 
     processing_thread.reset(
@@ -128,10 +183,18 @@ class FrameToFrameOpticalFlow : public OpticalFlowBase {
         break;
       }
       input_ptr->addTime("frames_received");
+      input_ptr->chargeImageMemory();
+
+      std::lock_guard<std::mutex> lock(state_mutex);
 
       while (input_depth_queue.try_pop(depth_guess)) continue;
       if (show_gui) input_ptr->depth_guess = depth_guess;
 
+      int64_t kf_request_t_ns;
+      while (input_kf_request_queue.try_pop(kf_request_t_ns)) {
+        replenish_requested = true;
+      }
+
       if (!input_state_queue.empty()) {
         while (input_state_queue.try_pop(latest_state)) continue;  // Flush
         first_state_arrived = true;
@@ -144,8 +207,104 @@ class FrameToFrameOpticalFlow : public OpticalFlowBase {
         pim.predictState(*latest_state, constants::g, *predicted_state);
       }
 
-      processFrame(input_ptr->t_ns, input_ptr);
+      executeScheduled(scheduler_instance, TrackerScheduler::OPTICAL_FLOW,
+                       [&] { processFrame(input_ptr->t_ns, input_ptr); });
+    }
+  }
+
+  bool saveCheckpoint(std::ostream& os) override {
+    std::lock_guard<std::mutex> lock(state_mutex);
+    if (t_ns < 0) return false;
+
+    cereal::BinaryOutputArchive ar(os);
+    ar(CheckpointHeader{"frame_to_frame", sizeof(Scalar)});
+    ar(t_ns, frame_counter, last_keypoint_id);
+    ar(replenish_requested, frames_since_detection, detection_regions_left,
+       next_detection_region);
+    ar(transforms);
+    ar(depth_guess, first_state_arrived);
+    serializeCheckpointState(ar, *latest_state);
+    serializeCheckpointState(ar, *predicted_state);
+    return true;
+  }
+
+  std::function<void()> prepareRestore(std::istream& is) override {
+    const size_t NUM_CAMS = calib.intrinsics.size();
+
+    int64_t new_t_ns;
+    size_t new_frame_counter;
+    KeypointId new_last_keypoint_id;
+    bool new_replenish_requested;
+    int new_frames_since_detection, new_detection_regions_left,
+        new_next_detection_region;
+    OpticalFlowResult::Ptr new_transforms;
+    double new_depth_guess;
+    bool new_first_state_arrived;
+    auto new_latest_state = std::make_shared<PoseVelBiasState<double>>();
+    auto new_predicted_state = std::make_shared<PoseVelBiasState<double>>();
+
+    try {
+      cereal::BinaryInputArchive ar(is);
+      CheckpointHeader header{"frame_to_frame", sizeof(Scalar)};
+      ar(header);
+      ar(new_t_ns, new_frame_counter, new_last_keypoint_id);
+      ar(new_replenish_requested, new_frames_since_detection,
+         new_detection_regions_left, new_next_detection_region);
+      ar(new_transforms);
+      ar(new_depth_guess, new_first_state_arrived);
+      serializeCheckpointState(ar, *new_latest_state);
+      serializeCheckpointState(ar, *new_predicted_state);
+    } catch (const std::exception& e) {
+      std::cerr << "Could not restore optical flow checkpoint: " << e.what()
+                << std::endl;
+      return {};
+    }
+
+    OpticalFlowInput::Ptr images =
+        new_transforms ? new_transforms->input_images : nullptr;
+    bool valid = images && images->img_data.size() == NUM_CAMS &&
+                 new_transforms->observations.size() == NUM_CAMS;
+    for (size_t i = 0; valid && i < NUM_CAMS; i++) {
+      valid = images->img_data[i].img != nullptr;
+    }
+    if (!valid) {
+      std::cerr << "Optical flow checkpoint does not match the calibration"
+                << std::endl;
+      return {};
     }
+
+    return [=] {
+      std::lock_guard<std::mutex> lock(state_mutex);
+
+      t_ns = new_t_ns;
+      frame_counter = new_frame_counter;
+      last_keypoint_id = new_last_keypoint_id;
+      replenish_requested = new_replenish_requested;
+      frames_since_detection = new_frames_since_detection;
+      detection_regions_left = new_detection_regions_left;
+      next_detection_region = new_next_detection_region;
+
+      transforms = new_transforms;
+      transforms->tracking_guesses.resize(NUM_CAMS);
+      transforms->matching_guesses.resize(NUM_CAMS);
+      images->masks.resize(NUM_CAMS);
+
+      depth_guess = new_depth_guess;
+      first_state_arrived = new_first_state_arrived;
+      latest_state = new_latest_state;
+      predicted_state = new_predicted_state;
+
+      // Patches are computed again as the restored points are tracked
+      setPyramids(*images);
+      old_pyramid.reset();
+      old_grad_pyramid.reset();
+      patch_cache = std::make_shared<std::vector<PatchCache>>(NUM_CAMS);
+      old_patch_cache.reset();
+      anchor.reset();
+      anchor_pyramid.reset();
+      anchor_grad_pyramid.reset();
+      anchor_patch_cache.reset();
+    };
   }
 
   IntegratedImuMeasurement<double> processImu(int64_t curr_t_ns) {
@@ -193,12 +352,56 @@ class FrameToFrameOpticalFlow : public OpticalFlowBase {
     return pim;
   }
 
+  /// Build the image pyramids of the new frame and, with
+  /// optical_flow_gradient_pyramid, their gradient pyramids
+  void setPyramids(const OpticalFlowInput& img_vec) {
+    const size_t NUM_CAMS = calib.intrinsics.size();
+    const bool gradients = config.optical_flow_gradient_pyramid;
+
+    pyramid.reset(new std::vector<basalt::ManagedImagePyr<uint16_t>>);
+    pyramid->resize(NUM_CAMS);
+    grad_pyramid.reset(new std::vector<GradientPyramid>);
+    if (gradients) grad_pyramid->resize(NUM_CAMS);
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, NUM_CAMS),
+                      [&](const tbb::blocked_range<size_t>& r) {
+                        for (size_t i = r.begin(); i != r.end(); ++i) {
+                          pyramid->at(i).setFromImage(
+                              *img_vec.img_data[i].img,
+                              config.optical_flow_levels);
+                          if (gradients) {
+                            grad_pyramid->at(i).setFromPyramid(
+                                pyramid->at(i), config.optical_flow_levels);
+                          }
+                        }
+                      });
+  }
+
+  /// Gradient pyramid of pyr if it is one of the current or previous image
+  /// pyramids and gradients are precomputed, nullptr otherwise
+  const GradientPyramid* gradientPyramid(
+      const basalt::ManagedImagePyr<uint16_t>& pyr) const {
+    auto find = [&](const auto& pyrs,
+                    const auto& grads) -> const GradientPyramid* {
+      if (!pyrs || !grads || grads->empty()) return nullptr;
+      for (size_t i = 0; i < pyrs->size(); i++) {
+        if (&pyrs->at(i) == &pyr) return &grads->at(i);
+      }
+      return nullptr;
+    };
+
+    const GradientPyramid* grads = find(pyramid, grad_pyramid);
+    if (!grads) grads = find(old_pyramid, old_grad_pyramid);
+    return grads ? grads : find(anchor_pyramid, anchor_grad_pyramid);
+  }
+
   void processFrame(int64_t curr_t_ns, OpticalFlowInput::Ptr& new_img_vec) {
     for (const auto& v : new_img_vec->img_data) {
       if (!v.img.get()) return;
     }
 
     size_t NUM_CAMS = calib.intrinsics.size();
+    const bool emitted = frame_counter % config.optical_flow_skip_frames == 0;
 
     if (t_ns < 0) {
       t_ns = curr_t_ns;
@@ -209,37 +412,49 @@ class FrameToFrameOpticalFlow : public OpticalFlowBase {
       transforms->matching_guesses.resize(NUM_CAMS);
       transforms->t_ns = t_ns;
 
-      pyramid.reset(new std::vector<basalt::ManagedImagePyr<uint16_t>>);
-      pyramid->resize(NUM_CAMS);
-
-      tbb::parallel_for(tbb::blocked_range<size_t>(0, NUM_CAMS),
-                        [&](const tbb::blocked_range<size_t>& r) {
-                          for (size_t i = r.begin(); i != r.end(); ++i) {
-                            pyramid->at(i).setFromImage(
-                                *new_img_vec->img_data[i].img,
-                                config.optical_flow_levels);
-                          }
-                        });
+      setPyramids(*new_img_vec);
 
       transforms->input_images = new_img_vec;
 
+      patch_cache = std::make_shared<std::vector<PatchCache>>(NUM_CAMS);
+
       addPoints();
       filterPoints();
     } else {
       t_ns = curr_t_ns;
 
-      old_pyramid = pyramid;
+      // Frames that are not output are only tracked on the coarse levels to
+      // bridge the motion to the next output frame
+      const bool coarse =
+          !emitted && config.optical_flow_skipped_frames_level >= 0;
+      base_level = config.optical_flow_base_level;
+      base_refinement = config.optical_flow_base_refinement;
+      if (coarse) {
+        base_level = std::max(base_level,
+                              config.optical_flow_skipped_frames_level);
+        base_refinement = false;
+      }
 
-      pyramid.reset(new std::vector<basalt::ManagedImagePyr<uint16_t>>);
-      pyramid->resize(NUM_CAMS);
-      tbb::parallel_for(tbb::blocked_range<size_t>(0, NUM_CAMS),
-                        [&](const tbb::blocked_range<size_t>& r) {
-                          for (size_t i = r.begin(); i != r.end(); ++i) {
-                            pyramid->at(i).setFromImage(
-                                *new_img_vec->img_data[i].img,
-                                config.optical_flow_levels);
-                          }
-                        });
+      // An output frame after coarsely tracked frames is tracked from the
+      // last output frame, with the coarse positions only as initial
+      // guesses, so that the coarse errors do not accumulate in the templates
+      const bool from_anchor = !coarse && anchor && anchor != transforms;
+      OpticalFlowResult::Ptr prev_transforms = transforms;
+      SE3 T_i1 = latest_state->T_w_i.cast<Scalar>();
+      if (from_anchor) {
+        prev_transforms = anchor;
+        T_i1 = anchor_T_w_i;
+        old_pyramid = anchor_pyramid;
+        old_grad_pyramid = anchor_grad_pyramid;
+        old_patch_cache = anchor_patch_cache;
+      } else {
+        old_pyramid = pyramid;
+        old_grad_pyramid = grad_pyramid;
+        // Patches of the previous frame were built during its backward checks
+        old_patch_cache = patch_cache;
+      }
+
+      setPyramids(*new_img_vec);
 
       OpticalFlowResult::Ptr new_transforms;
       new_transforms.reset(new OpticalFlowResult);
@@ -248,7 +463,8 @@ class FrameToFrameOpticalFlow : public OpticalFlowBase {
       new_transforms->matching_guesses.resize(NUM_CAMS);
       new_transforms->t_ns = t_ns;
 
-      SE3 T_i1 = latest_state->T_w_i.cast<Scalar>();
+      patch_cache = std::make_shared<std::vector<PatchCache>>(NUM_CAMS);
+
       SE3 T_i2 = predicted_state->T_w_i.cast<Scalar>();
       for (size_t i = 0; i < NUM_CAMS; i++) {
         SE3 T_c1 = T_i1 * calib.T_i_c[i];
@@ -256,19 +472,32 @@ class FrameToFrameOpticalFlow : public OpticalFlowBase {
         SE3 T_c1_c2 = T_c1.inverse() * T_c2;
         trackPoints(
             old_pyramid->at(i), pyramid->at(i),  //
-            transforms->observations[i], new_transforms->observations[i],
+            prev_transforms->observations[i], new_transforms->observations[i],
             new_transforms->tracking_guesses[i],  //
-            new_img_vec->masks.at(i), new_img_vec->masks.at(i), T_c1_c2, i, i);
+            new_img_vec->masks.at(i), new_img_vec->masks.at(i), T_c1_c2, i, i,
+            &old_patch_cache->at(i), &patch_cache->at(i),
+            from_anchor ? &transforms->observations[i] : nullptr);
       }
 
       transforms = new_transforms;
       transforms->input_images = new_img_vec;
 
-      addPoints();
-      filterPoints();
+      if (!coarse) {
+        addPoints();
+        filterPoints();
+      }
+    }
+
+    if (emitted && config.optical_flow_skipped_frames_level >= 0 &&
+        config.optical_flow_skip_frames > 1) {
+      anchor = transforms;
+      anchor_T_w_i = predicted_state->T_w_i.cast<Scalar>();
+      anchor_pyramid = pyramid;
+      anchor_grad_pyramid = grad_pyramid;
+      anchor_patch_cache = patch_cache;
     }
 
-    if (output_queue && frame_counter % config.optical_flow_skip_frames == 0) {
+    if (output_queue && emitted) {
       transforms->input_images->addTime("opticalflow_produced");
       output_queue->push(transforms);
     }
@@ -276,11 +505,18 @@ class FrameToFrameOpticalFlow : public OpticalFlowBase {
     frame_counter++;
   }
 
+  /// Track points from pyr_1 to pyr_2. If given, patches_1 holds already
+  /// computed patches of pyr_1 and patches of pyr_2 for the successfully
+  /// tracked points are added to patches_2. Points in initial_guesses start
+  /// from the given position in pyr_2 instead of the depth based prediction.
   void trackPoints(const basalt::ManagedImagePyr<uint16_t>& pyr_1,
                    const basalt::ManagedImagePyr<uint16_t>& pyr_2,
                    const Keypoints& transform_map_1, Keypoints& transform_map_2,
                    Keypoints& guesses, const Masks& masks1, const Masks& masks2,
-                   const SE3& T_c1_c2, size_t cam1, size_t cam2) const {
+                   const SE3& T_c1_c2, size_t cam1, size_t cam2,
+                   const PatchCache* patches_1 = nullptr,
+                   PatchCache* patches_2 = nullptr,
+                   const Keypoints* initial_guesses = nullptr) const {
     size_t num_points = transform_map_1.size();
 
     std::vector<KeypointId> ids;
@@ -297,6 +533,8 @@ class FrameToFrameOpticalFlow : public OpticalFlowBase {
     tbb::concurrent_unordered_map<KeypointId, Eigen::AffineCompact2f,
                                   std::hash<KeypointId>>
         result, guesses_tbb;
+    tbb::concurrent_unordered_map<KeypointId, Patches, std::hash<KeypointId>>
+        result_patches;
 
     bool tracking = cam1 == cam2;
     bool matching = cam1 != cam2;
@@ -305,61 +543,281 @@ class FrameToFrameOpticalFlow : public OpticalFlowBase {
     const bool use_depth = tracking || (matching && match_guess_uses_depth);
     const double depth = depth_guess;
 
+    const RecoveryCheckType check_type = config.optical_flow_recovery_check;
+    const bool residual_check = check_type == RecoveryCheckType::RESIDUAL;
+    const int backward_max_level = check_type == RecoveryCheckType::FINEST_LEVEL
+                                       ? 0
+                                       : config.optical_flow_levels;
+
+    // Points are processed in batches, which trackPointBatch may track in
+    // lockstep
     auto compute_func = [&](const tbb::blocked_range<size_t>& range) {
-      for (size_t r = range.begin(); r != range.end(); ++r) {
-        const KeypointId id = ids[r];
+      for (size_t r0 = range.begin(); r0 < range.end(); r0 += BATCH_SIZE) {
+        const size_t n = std::min<size_t>(BATCH_SIZE, range.end() - r0);
+
+        Batch<Eigen::AffineCompact2f> transforms_1, transforms_2,
+            transforms_1_recovered;
+        Batch<Eigen::Vector2f> offs;
+        Batch<const Patches*> patches_fw{};
+        Batch<Patches*> built_fw{}, built_bw{};
+        Batch<Patches> patches_fw_built, patches_bw;
+        LaneMask valid = LaneMask::Constant(false);
+
+        for (size_t l = 0; l < n; l++) {
+          const KeypointId id = ids[r0 + l];
+
+          transforms_1[l] = init_vec[r0 + l];
+          transforms_2[l] = transforms_1[l];
+
+          auto t1 = transforms_1[l].translation();
+          auto t2 = transforms_2[l].translation();
+
+          if (masks1.inBounds(t1.x(), t1.y())) continue;
+
+          Eigen::Vector2f off{0, 0};
+
+          const Eigen::AffineCompact2f* initial_guess = nullptr;
+          if (initial_guesses) {
+            auto it = initial_guesses->find(id);
+            if (it != initial_guesses->end()) initial_guess = &it->second;
+          }
+
+          if (initial_guess) {
+            off = t2 - initial_guess->translation();
+          } else if (use_depth) {
+            Vector2 t2_guess;
+            Scalar _;
+            calib.projectBetweenCams(t1, depth, t2_guess, _, T_c1_c2, cam1,
+                                     cam2);
+            off = t2 - t2_guess;
+          }
+
+          t2 -= off;  // This modifies transforms_2[l]
+          offs[l] = off;
+
+          if (show_gui) {
+            guesses_tbb[id] = transforms_2[l];
+          }
+
+          bool in_bounds = t2(0) >= 0 && t2(1) >= 0 &&
+                           t2(0) < pyr_2.lvl(0).w && t2(1) < pyr_2.lvl(0).h;
+          if (!in_bounds) continue;
+
+          if (patches_1) {
+            auto it = patches_1->find(id);
+            if (it != patches_1->end()) patches_fw[l] = &it->second;
+          }
+          if (residual_check) built_fw[l] = &patches_fw_built[l];
+
+          valid[l] = true;
+        }
 
-        const Eigen::AffineCompact2f& transform_1 = init_vec[r];
-        Eigen::AffineCompact2f transform_2 = transform_1;
+        trackPointBatch(pyr_1, pyr_2, transforms_1, transforms_2, patches_fw,
+                        built_fw, valid);
+
+        for (size_t l = 0; l < n; l++) {
+          if (!valid[l]) continue;
+
+          const KeypointId id = ids[r0 + l];
+          auto t2 = transforms_2[l].translation();
+
+          if (masks2.inBounds(t2.x(), t2.y())) {
+            valid[l] = false;
+            continue;
+          }
+
+          if (residual_check) {
+            const int finest = finestLevel();
+            const PatchT& p0 = patches_fw_built[l].at(finest).valid
+                                   ? patches_fw_built[l].at(finest)
+                                   : patches_fw[l]->at(finest);
+            Eigen::AffineCompact2f rel_transform = transforms_2[l];
+            rel_transform.linear() =
+                transforms_1[l].linear().inverse() * transforms_2[l].linear();
+            if (residualCheck(pyr_2, p0, rel_transform, finest)) {
+              result[id] = transforms_2[l];
+              // There is no backward check to build the templates for the
+              // next frame
+              if (patches_2) {
+                result_patches[id] = buildPatches(pyr_2, transforms_2[l]);
+              }
+            }
+            continue;
+          }
+
+          transforms_1_recovered[l] = transforms_2[l];
+          transforms_1_recovered[l].translation() += offs[l];
+
+          if (patches_2) built_bw[l] = &patches_bw[l];
+        }
 
-        auto t1 = transform_1.translation();
-        auto t2 = transform_2.translation();
+        if (residual_check) continue;
 
-        if (masks1.inBounds(t1.x(), t1.y())) continue;
+        // The backward check builds the patches of pyr_2 at the tracked
+        // location, which are the templates for tracking in the next frame.
+        trackPointBatch(pyr_2, pyr_1, transforms_2, transforms_1_recovered, {},
+                        built_bw, valid, backward_max_level);
 
-        bool valid = true;
+        for (size_t l = 0; l < n; l++) {
+          if (!valid[l]) continue;
 
-        Eigen::Vector2f off{0, 0};
+          const KeypointId id = ids[r0 + l];
+          Scalar dist2 = (transforms_1[l].translation() -
+                          transforms_1_recovered[l].translation())
+                             .squaredNorm();
 
-        if (use_depth) {
-          Vector2 t2_guess;
-          Scalar _;
-          calib.projectBetweenCams(t1, depth, t2_guess, _, T_c1_c2, cam1, cam2);
-          off = t2 - t2_guess;
+          if (dist2 < config.optical_flow_max_recovered_dist2) {
+            result[id] = transforms_2[l];
+            if (patches_2) result_patches[id] = std::move(patches_bw[l]);
+          }
         }
+      }
+    };
 
-        t2 -= off;  // This modifies transform_2
+    tbb::blocked_range<size_t> range(0, num_points);
+    tbb::parallel_for(range, compute_func);
 
-        if (show_gui) {
-          guesses_tbb[id] = transform_2;
-        }
+    transform_map_2.clear();
+    transform_map_2.insert(result.begin(), result.end());
+    guesses.clear();
+    guesses.insert(guesses_tbb.begin(), guesses_tbb.end());
+    if (patches_2) {
+      for (auto& kv : result_patches) {
+        patches_2->emplace(kv.first, std::move(kv.second));
+      }
+    }
+  }
 
-        valid = t2(0) >= 0 && t2(1) >= 0 && t2(0) < pyr_2.lvl(0).w &&
-                t2(1) < pyr_2.lvl(0).h;
-        if (!valid) continue;
+  /// Match points from cam1 to cam2 by searching along their epipolar curve
+  /// between optical_flow_matching_min_depth and
+  /// optical_flow_matching_max_depth. The patch residual is evaluated at
+  /// candidates about one pixel apart, on the finest pyramid level from
+  /// optical_flow_base_level on where at most EPIPOLAR_MAX_SAMPLES candidates
+  /// cover the curve. The best one is tracked from that level down with the
+  /// usual optical_flow_max_iterations per level and accepted with the
+  /// residual check instead of tracking it back.
+  void matchPointsEpipolar(const basalt::ManagedImagePyr<uint16_t>& pyr_1,
+                           const basalt::ManagedImagePyr<uint16_t>& pyr_2,
+                           const Keypoints& transform_map_1,
+                           Keypoints& transform_map_2, Keypoints& guesses,
+                           const Masks& masks1, const Masks& masks2,
+                           const SE3& T_c1_c2, size_t cam1,
+                           size_t cam2) const {
+    std::vector<KeypointId> ids;
+    Eigen::aligned_vector<Eigen::AffineCompact2f> init_vec;
 
-        valid = trackPoint(pyr_1, pyr_2, transform_1, transform_2);
-        if (!valid) continue;
+    ids.reserve(transform_map_1.size());
+    init_vec.reserve(transform_map_1.size());
 
-        if (masks2.inBounds(t2.x(), t2.y())) continue;
+    for (const auto& kv : transform_map_1) {
+      ids.push_back(kv.first);
+      init_vec.push_back(kv.second);
+    }
+
+    tbb::concurrent_unordered_map<KeypointId, Eigen::AffineCompact2f,
+                                  std::hash<KeypointId>>
+        result, guesses_tbb;
 
-        Eigen::AffineCompact2f transform_1_recovered = transform_2;
-        auto t1_recovered = transform_1_recovered.translation();
+    const SE3 T_c2_c1 = T_c1_c2.inverse();
+    const Scalar max_depth = config.optical_flow_matching_max_depth;
+    const Scalar min_inv_depth = max_depth > 0 ? 1 / max_depth : 0;
+    const Scalar max_inv_depth = 1 / config.optical_flow_matching_min_depth;
 
-        t1_recovered += off;
+    auto compute_func = [&](const tbb::blocked_range<size_t>& range) {
+      for (size_t r = range.begin(); r != range.end(); ++r) {
+        const KeypointId id = ids[r];
+        const Eigen::AffineCompact2f& transform_1 = init_vec[r];
+        const Vector2 p1 = transform_1.translation().template cast<Scalar>();
+
+        if (masks1.inBounds(p1.x(), p1.y())) continue;
+
+        Vector4 p1_3d;
+        if (!calib.intrinsics[cam1].unproject(p1, p1_3d)) continue;
+
+        // Projection in cam2 of the point at the given inverse depth. Scaling
+        // the point by the inverse depth keeps it finite at infinity.
+        const Vector3 R_p1 = T_c2_c1.so3() * p1_3d.template head<3>();
+        auto project = [&](Scalar inv_depth, Vector2& p2) {
+          Vector4 p2_3d;
+          p2_3d << R_p1 + inv_depth * T_c2_c1.translation(), 0;
+          return calib.intrinsics[cam2].project(p2_3d, p2);
+        };
+
+        Vector2 p2_far, p2_near;
+        if (!project(min_inv_depth, p2_far)) continue;
+
+        // Move the near end of the search range away until it projects
+        Scalar inv_depth_near = max_inv_depth;
+        bool near_valid = project(inv_depth_near, p2_near);
+        for (int i = 0; i < 8 && !near_valid; i++) {
+          inv_depth_near = (inv_depth_near + min_inv_depth) / 2;
+          near_valid = project(inv_depth_near, p2_near);
+        }
+        if (!near_valid) continue;
 
-        valid = trackPoint(pyr_2, pyr_1, transform_2, transform_1_recovered);
-        if (!valid) continue;
+        const Scalar length = (p2_near - p2_far).norm();
+        int level = config.optical_flow_base_level;
+        while (level < config.optical_flow_levels &&
+               length / (1 << level) > EPIPOLAR_MAX_SAMPLES) {
+          level++;
+        }
+        const Scalar scale = 1 << level;
+        const int num_samples =
+            std::min<int>(std::ceil(length / scale) + 1, EPIPOLAR_MAX_SAMPLES);
+
+        PatchT dp(pyr_1.lvl(level), p1 / scale);
+        if (!dp.valid) continue;
+
+        Scalar best_score = std::numeric_limits<Scalar>::max();
+        Vector2 best_p2;
+        for (int i = 0; i < num_samples; i++) {
+          const Scalar t = num_samples > 1 ? Scalar(i) / (num_samples - 1) : 0;
+          Vector2 p2;
+          if (!project(min_inv_depth + t * (inv_depth_near - min_inv_depth),
+                       p2)) {
+            continue;
+          }
+
+          typename PatchT::Matrix2P transformed_pat = PatchT::pattern2;
+          transformed_pat.colwise() += p2 / scale;
+
+          typename PatchT::VectorP res;
+          if (!dp.residual(pyr_2.lvl(level), transformed_pat, res)) continue;
+
+          const Scalar score = res.squaredNorm();
+          if (score < best_score) {
+            best_score = score;
+            best_p2 = p2;
+          }
+        }
+        if (best_score == std::numeric_limits<Scalar>::max()) continue;
 
-        Scalar dist2 = (t1 - t1_recovered).squaredNorm();
+        Eigen::AffineCompact2f transform_2 = transform_1;
+        transform_2.translation() = best_p2.template cast<float>();
 
-        if (dist2 < config.optical_flow_max_recovered_dist2) {
+        if (show_gui) guesses_tbb[id] = transform_2;
+
+        Patches patches_1;
+        if (!trackPoint(pyr_1, pyr_2, transform_1, transform_2, nullptr,
+                        &patches_1, level)) {
+          continue;
+        }
+
+        auto t2 = transform_2.translation();
+        if (masks2.inBounds(t2.x(), t2.y())) continue;
+
+        Eigen::AffineCompact2f rel_transform = transform_2;
+        rel_transform.linear() =
+            transform_1.linear().inverse() * transform_2.linear();
+        const int finest = finestLevel();
+        if (residualCheck(pyr_2, patches_1.at(finest), rel_transform,
+                          finest)) {
           result[id] = transform_2;
         }
       }
     };
 
-    tbb::blocked_range<size_t> range(0, num_points);
+    tbb::blocked_range<size_t> range(0, ids.size());
     tbb::parallel_for(range, compute_func);
 
     transform_map_2.clear();
@@ -368,26 +826,146 @@ class FrameToFrameOpticalFlow : public OpticalFlowBase {
     guesses.insert(guesses_tbb.begin(), guesses_tbb.end());
   }
 
+  /// Patch of old_pyr at old_transform on the given level. Taken from
+  /// cached_patches if available, otherwise computed into built_patches if
+  /// given or into tmp.
+  inline const PatchT& getPatch(
+      const basalt::ManagedImagePyr<uint16_t>& old_pyr,
+      const Eigen::AffineCompact2f& old_transform, int level,
+      const Patches* cached_patches, Patches* built_patches,
+      PatchT& tmp) const {
+    if (cached_patches && cached_patches->at(level).valid) {
+      return cached_patches->at(level);
+    }
+
+    const Scalar scale = 1 << level;
+    const Vector2 pos = old_transform.translation() / scale;
+    PatchT& p = built_patches ? built_patches->at(level) : tmp;
+    if (const GradientPyramid* grads = gradientPyramid(old_pyr)) {
+      p.setFromImage(grads->lvl(level), pos);
+    } else {
+      p.setFromImage(old_pyr.lvl(level), pos);
+    }
+    return p;
+  }
+
+  /// Patches of pyr at transform on all levels a point is tracked from, as
+  /// trackPoint would build them.
+  Patches buildPatches(const basalt::ManagedImagePyr<uint16_t>& pyr,
+                       const Eigen::AffineCompact2f& transform) const {
+    Patches patches(config.optical_flow_levels + 1);
+    const int max_level = std::max(config.optical_flow_levels, base_level);
+    for (int level = max_level; level >= 0; level = nextLevel(level)) {
+      PatchT tmp;
+      getPatch(pyr, transform, level, nullptr, &patches, tmp);
+    }
+    return patches;
+  }
+
+  /// Batched version of trackPoint. Only points set in valid are tracked and
+  /// valid is cleared for the ones that fail. With
+  /// optical_flow_batch_tracking, the points are tracked in lockstep level by
+  /// level with OpticalFlowPatchBatch, otherwise one after the other.
+  void trackPointBatch(const basalt::ManagedImagePyr<uint16_t>& old_pyr,
+                       const basalt::ManagedImagePyr<uint16_t>& pyr,
+                       const Batch<Eigen::AffineCompact2f>& old_transforms,
+                       Batch<Eigen::AffineCompact2f>& transforms,
+                       const Batch<const Patches*>& cached_patches,
+                       const Batch<Patches*>& built_patches, LaneMask& valid,
+                       int max_level = -1) const {
+    if (!config.optical_flow_batch_tracking) {
+      for (int l = 0; l < BATCH_SIZE; l++) {
+        if (!valid[l]) continue;
+        valid[l] = trackPoint(old_pyr, pyr, old_transforms[l], transforms[l],
+                              cached_patches[l], built_patches[l], max_level);
+      }
+      return;
+    }
+
+    if (max_level < 0) max_level = config.optical_flow_levels;
+    max_level = std::max(max_level, base_level);
+
+    // Lanes that are not tracked may hold uninitialized transforms, but the
+    // batch still reads all lanes
+    const LaneMask tracked = valid;
+    for (int l = 0; l < BATCH_SIZE; l++) {
+      if (!tracked[l]) {
+        transforms[l].setIdentity();
+        continue;
+      }
+      transforms[l].linear().setIdentity();
+      if (built_patches[l]) {
+        built_patches[l]->resize(config.optical_flow_levels + 1);
+      }
+    }
+
+    for (int level = max_level; level >= 0 && valid.any();
+         level = nextLevel(level)) {
+      const Scalar scale = 1 << level;
+
+      PatchBatchT batch;
+      for (int l = 0; l < BATCH_SIZE; l++) {
+        if (!valid[l]) continue;
+
+        transforms[l].translation() /= scale;
+
+        PatchT new_p;
+        const PatchT& p = getPatch(old_pyr, old_transforms[l], level,
+                                   cached_patches[l], built_patches[l], new_p);
+        valid[l] = p.valid;
+        if (valid[l]) batch.setLane(l, p);
+      }
+
+      // Perform tracking of all points on current level
+      batch.track(pyr.lvl(level), iterationsAtLevel(level), transforms,
+                  valid);
+
+      for (int l = 0; l < BATCH_SIZE; l++) {
+        if (valid[l]) transforms[l].translation() *= scale;
+      }
+    }
+
+    for (int l = 0; l < BATCH_SIZE; l++) {
+      if (!tracked[l]) continue;
+      transforms[l].linear() =
+          old_transforms[l].linear() * transforms[l].linear();
+    }
+  }
+
+  /// Track a point from old_pyr to pyr, starting at pyramid level max_level
+  /// (all levels if negative) and ending at the levels given by nextLevel.
+  /// Patches of old_pyr are taken from cached_patches where available,
+  /// otherwise they are computed and, if built_patches is given, stored there.
   inline bool trackPoint(const basalt::ManagedImagePyr<uint16_t>& old_pyr,
                          const basalt::ManagedImagePyr<uint16_t>& pyr,
                          const Eigen::AffineCompact2f& old_transform,
-                         Eigen::AffineCompact2f& transform) const {
+                         Eigen::AffineCompact2f& transform,
+                         const Patches* cached_patches = nullptr,
+                         Patches* built_patches = nullptr,
+                         int max_level = -1) const {
     bool patch_valid = true;
 
     transform.linear().setIdentity();
 
-    for (int level = config.optical_flow_levels; level >= 0 && patch_valid;
-         level--) {
+    if (built_patches) built_patches->resize(config.optical_flow_levels + 1);
+    if (max_level < 0) max_level = config.optical_flow_levels;
+    max_level = std::max(max_level, base_level);
+
+    for (int level = max_level; level >= 0 && patch_valid;
+         level = nextLevel(level)) {
       const Scalar scale = 1 << level;
 
       transform.translation() /= scale;
 
-      PatchT p(old_pyr.lvl(level), old_transform.translation() / scale);
+      PatchT new_p;
+      const PatchT& p = getPatch(old_pyr, old_transform, level, cached_patches,
+                                 built_patches, new_p);
 
       patch_valid &= p.valid;
       if (patch_valid) {
         // Perform tracking on current level
-        patch_valid &= trackPointAtLevel(pyr.lvl(level), p, transform);
+        patch_valid &= trackPointAtLevel(pyr.lvl(level), p, transform,
+                                         iterationsAtLevel(level));
       }
 
       transform.translation() *= scale;
@@ -398,13 +976,60 @@ class FrameToFrameOpticalFlow : public OpticalFlowBase {
     return patch_valid;
   }
 
+  /// Check that the position uncertainty of a point tracked with patch dp to
+  /// transform (relative to the patch) is within the recovery threshold. The
+  /// covariance of the SE2 estimate for unit residual variance is
+  /// H^-1 = (H^-1 J^T) (H^-1 J^T)^T and is scaled by the residual variance.
+  /// dp is a patch of the given pyramid level, transform is in level 0
+  /// coordinates.
+  inline bool residualCheck(const basalt::ManagedImagePyr<uint16_t>& pyr_2,
+                            const PatchT& dp,
+                            const Eigen::AffineCompact2f& transform,
+                            int level = 0) const {
+    typename PatchT::VectorP res;
+
+    const Scalar scale = 1 << level;
+    typename PatchT::Matrix2P transformed_pat =
+        transform.linear().matrix() * PatchT::pattern2;
+    transformed_pat.colwise() += transform.translation() / scale;
+
+    if (!dp.residual(pyr_2.lvl(level), transformed_pat, res)) return false;
+
+    const auto H_inv_J_T_t = dp.H_se2_inv_J_se2_T.template topRows<2>();
+    const Matrix2 cov_t = H_inv_J_T_t * H_inv_J_T_t.transpose();
+    const Scalar res_var = res.squaredNorm() / PatchT::PATTERN_SIZE;
+
+    Eigen::SelfAdjointEigenSolver<Matrix2> es(cov_t, Eigen::EigenvaluesOnly);
+    const Scalar max_var = res_var * es.eigenvalues()(1) * scale * scale;
+
+    return std::isfinite(max_var) &&
+           max_var < config.optical_flow_max_recovered_dist2;
+  }
+
+  /// Pyramid level tracked after level, or -1 after the last one. Tracking
+  /// stops at base_level, optionally followed by a refinement on level 0.
+  inline int nextLevel(int level) const {
+    if (level > base_level) return level - 1;
+    if (level == base_level && base_level > 0 && base_refinement) return 0;
+    return -1;
+  }
+
+  /// Finest pyramid level points are tracked on
+  inline int finestLevel() const { return base_refinement ? 0 : base_level; }
+
+  /// Gauss-Newton iterations on level, a single one for the refinement below
+  /// the base level
+  inline int iterationsAtLevel(int level) const {
+    return level < base_level ? 1 : config.optical_flow_max_iterations;
+  }
+
   inline bool trackPointAtLevel(const Image<const uint16_t>& img_2,
                                 const PatchT& dp,
-                                Eigen::AffineCompact2f& transform) const {
+                                Eigen::AffineCompact2f& transform,
+                                int max_iterations) const {
     bool patch_valid = true;
 
-    for (int iteration = 0;
-         patch_valid && iteration < config.optical_flow_max_iterations;
+    for (int iteration = 0; patch_valid && iteration < max_iterations;
          iteration++) {
       typename PatchT::VectorP res;
 
@@ -436,21 +1061,61 @@ class FrameToFrameOpticalFlow : public OpticalFlowBase {
     return patch_valid;
   }
 
-  Keypoints addPointsForCamera(size_t cam_id) {
+  /// Detects new points in the cells of cam_id without tracked points. If
+  /// region is not negative, only cells of that vertical stripe of the grid
+  /// are considered, see scheduleDetection.
+  KeypointsData detectPointsForCamera(size_t cam_id, const Masks& masks,
+                                      int region = -1) const {
     Eigen::aligned_vector<Eigen::Vector2d> pts;  // Current points
     for (const auto& kv : transforms->observations.at(cam_id)) {
       pts.emplace_back(kv.second.translation().cast<double>());
     }
 
+    // Cells outside the region get a point at their center, so that
+    // detectKeypoints skips them
+    if (region >= 0) {
+      const int C = config.optical_flow_detection_grid_size;
+      const int w = calib.resolution.at(cam_id).x();
+      const int h = calib.resolution.at(cam_id).y();
+      const int cols = w / C;
+      const int rows = h / C;
+      const int num_regions = config.optical_flow_detection_regions;
+      const int col_begin = region * cols / num_regions;
+      const int col_end = (region + 1) * cols / num_regions;
+
+      for (int x = 0; x < cols; x++) {
+        if (x >= col_begin && x < col_end) continue;
+        for (int y = 0; y < rows; y++) {
+          pts.emplace_back((w % C) / 2 + x * C + C / 2,
+                           (h % C) / 2 + y * C + C / 2);
+        }
+      }
+    }
+
+    // Detection runs on the base level, points and masks are scaled to it
+    const int level = config.optical_flow_base_level;
+    const Scalar scale = 1 << level;
+    Masks level_masks;
+    for (const Rect& m : masks.masks) {
+      level_masks.masks.emplace_back(m.x / scale, m.y / scale, m.w / scale,
+                                     m.h / scale);
+    }
+    for (auto& p : pts) p /= scale;
+
     KeypointsData kd;  // Detected new points
-    detectKeypoints(pyramid->at(cam_id).lvl(0), kd,
-                    config.optical_flow_detection_grid_size,
+    detectKeypoints(pyramid->at(cam_id).lvl(level), kd,
+                    config.optical_flow_detection_grid_size >> level,
                     config.optical_flow_detection_num_points_cell,
                     config.optical_flow_detection_min_threshold,
-                    config.optical_flow_detection_max_threshold,
-                    transforms->input_images->masks.at(cam_id), pts);
+                    config.optical_flow_detection_max_threshold, level_masks,
+                    pts);
+    for (auto& corner : kd.corners) corner *= scale;
+    return kd;
+  }
 
+  Keypoints addPointsForCamera(size_t cam_id, const KeypointsData& kd) {
     Keypoints new_poses;
+    std::vector<KeypointId> new_ids;
     for (auto& corner : kd.corners) {  // Set new points as keypoints
       Eigen::AffineCompact2f transform;
       transform.setIdentity();
@@ -458,18 +1123,38 @@ class FrameToFrameOpticalFlow : public OpticalFlowBase {
 
       transforms->observations.at(cam_id)[last_keypoint_id] = transform;
       new_poses[last_keypoint_id] = transform;
+      new_ids.push_back(last_keypoint_id);
 
       last_keypoint_id++;
     }
 
+    // The patches of the new points are the templates for matching them to
+    // the other cameras and for tracking them in the next frame
+    std::vector<Patches> new_patches(new_ids.size());
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, new_ids.size()),
+                      [&](const tbb::blocked_range<size_t>& r) {
+                        for (size_t i = r.begin(); i != r.end(); ++i) {
+                          new_patches[i] = buildPatches(
+                              pyramid->at(cam_id), new_poses.at(new_ids[i]));
+                        }
+                      });
+    for (size_t i = 0; i < new_ids.size(); i++) {
+      (*patch_cache)[cam_id][new_ids[i]] = std::move(new_patches[i]);
+    }
+
     return new_poses;
   }
 
-  Masks cam0OverlapCellsMasksForCam(size_t cam_id) {
+  /// Cells of the detection grid of cam_id that, at the given depth, project
+  /// inside the image of other_cam_id.
+  Masks overlapCellsMasksForCam(size_t cam_id, size_t other_cam_id,
+                                Scalar depth) const {
     int C = config.optical_flow_detection_grid_size;  // cell size
 
-    int w = transforms->input_images->img_data.at(cam_id).img->w;
-    int h = transforms->input_images->img_data.at(cam_id).img->h;
+    int w = calib.resolution.at(cam_id).x();
+    int h = calib.resolution.at(cam_id).y();
+    int other_w = calib.resolution.at(other_cam_id).x();
+    int other_h = calib.resolution.at(other_cam_id).y();
 
     int x_start = (w % C) / 2;
     int y_start = (h % C) / 2;
@@ -487,12 +1172,12 @@ class FrameToFrameOpticalFlow : public OpticalFlowBase {
     for (int y = y_first; y <= y_last; y += C) {
       for (int x = x_first; x <= x_last; x += C) {
         Vector2 ci_uv{x, y};
-        Vector2 c0_uv;
+        Vector2 cj_uv;
         Scalar _;
-        bool projected =
-            calib.projectBetweenCams(ci_uv, depth_guess, c0_uv, _, cam_id, 0);
-        bool in_bounds =
-            c0_uv.x() >= 0 && c0_uv.x() < w && c0_uv.y() >= 0 && c0_uv.y() < h;
+        bool projected = calib.projectBetweenCams(ci_uv, depth, cj_uv, _,
+                                                  cam_id, other_cam_id);
+        bool in_bounds = cj_uv.x() >= 0 && cj_uv.x() < other_w &&
+                         cj_uv.y() >= 0 && cj_uv.y() < other_h;
         bool valid = projected && in_bounds;
         if (valid) {
           Rect cell_mask(x - C / 2, y - C / 2, C, C);
@@ -503,27 +1188,164 @@ class FrameToFrameOpticalFlow : public OpticalFlowBase {
     return masks;
   }
 
+  /// Among the cameras before cam_id, the one sharing the most detection cells
+  /// with it at the default matching depth. Falls back to cam0.
+  size_t mostOverlappingCamera(size_t cam_id) const {
+    Scalar depth = config.optical_flow_matching_default_depth;
+    size_t best_cam = 0;
+    size_t best_cells = 0;
+    for (size_t j = 0; j < cam_id; j++) {
+      size_t cells = overlapCellsMasksForCam(cam_id, j, depth).masks.size();
+      if (cells > best_cells) {
+        best_cells = cells;
+        best_cam = j;
+      }
+    }
+    return best_cam;
+  }
+
+  /// Fraction of the detection cells of cam_id that are not masked and hold
+  /// at least one tracked point.
+  Scalar cellOccupancy(size_t cam_id, const Masks& masks) const {
+    const int C = config.optical_flow_detection_grid_size;
+    const int w = calib.resolution.at(cam_id).x();
+    const int h = calib.resolution.at(cam_id).y();
+    const int x_start = (w % C) / 2;
+    const int y_start = (h % C) / 2;
+
+    Eigen::MatrixXi cells;
+    cells.setZero(h / C, w / C);
+    for (const auto& kv : transforms->observations.at(cam_id)) {
+      const int x = std::floor((kv.second.translation().x() - x_start) / C);
+      const int y = std::floor((kv.second.translation().y() - y_start) / C);
+      if (x >= 0 && y >= 0 && x < cells.cols() && y < cells.rows()) {
+        cells(y, x) = 1;
+      }
+    }
+
+    int num_cells = 0;
+    int num_occupied = 0;
+    for (int y = 0; y < cells.rows(); y++) {
+      for (int x = 0; x < cells.cols(); x++) {
+        if (masks.inBounds(x_start + x * C + C / 2, y_start + y * C + C / 2)) {
+          continue;
+        }
+        num_cells++;
+        num_occupied += cells(y, x);
+      }
+    }
+
+    return num_cells > 0 ? Scalar(num_occupied) / num_cells : Scalar(1);
+  }
+
+  /// Whether new points are detected in the current frame, and in which
+  /// region of the detection grid (-1 for the whole grid). Replenishment
+  /// starts when the cell occupancy of a detecting camera drops below
+  /// optical_flow_detection_min_occupancy, when the estimator asks for points
+  /// for an upcoming keyframe, or after optical_flow_detection_max_frames
+  /// frames. It then visits the optical_flow_detection_regions stripes of the
+  /// grid one per frame, which spreads the cost of detecting and matching new
+  /// points over several frames.
+  bool scheduleDetection(const std::vector<Masks>& detection_masks,
+                         size_t num_detecting_cams, int& region) {
+    const int num_regions = std::max(config.optical_flow_detection_regions, 1);
+    const int max_frames = config.optical_flow_detection_max_frames;
+
+    frames_since_detection++;
+
+    if (detection_regions_left == 0) {
+      bool replenish = replenish_requested ||
+                       (max_frames > 0 && frames_since_detection >= max_frames);
+      for (size_t i = 0; i < num_detecting_cams && !replenish; i++) {
+        replenish = cellOccupancy(i, detection_masks[i]) <
+                    config.optical_flow_detection_min_occupancy;
+      }
+      if (!replenish) return false;
+
+      replenish_requested = false;
+      frames_since_detection = 0;
+      detection_regions_left = num_regions;
+    }
+
+    detection_regions_left--;
+    region = num_regions > 1 ? next_detection_region : -1;
+    next_detection_region = (next_detection_region + 1) % num_regions;
+    return true;
+  }
+
   void addPoints() {
-    Masks& ms0 = transforms->input_images->masks.at(0);
-    Keypoints kps0 = addPointsForCamera(0);
+    const size_t NUM_CAMS = calib.intrinsics.size();
+    const bool nonoverlap = config.optical_flow_detection_nonoverlap;
+    auto& input_masks = transforms->input_images->masks;
+
+    // Cameras other than cam0 only detect features on areas not overlapping
+    // with the camera they match from
+    std::vector<Masks> detection_masks(NUM_CAMS);
+    std::vector<Masks> overlap_masks(NUM_CAMS);
+    for (size_t i = 0; i < NUM_CAMS; i++) {
+      detection_masks[i] = input_masks.at(i);
+      if (i == 0 || !nonoverlap) continue;
+      overlap_masks[i] =
+          overlapCellsMasksForCam(i, match_source[i], depth_guess);
+      detection_masks[i] += overlap_masks[i];
+    }
 
-    const int NUM_CAMS = calib.intrinsics.size();
-    for (int i = 1; i < NUM_CAMS; i++) {
-      Masks& ms = transforms->input_images->masks.at(i);
+    const size_t num_detecting_cams = nonoverlap ? NUM_CAMS : 1;
+    int region;
+    if (!scheduleDetection(detection_masks, num_detecting_cams, region)) {
+      for (size_t i = 1; i < NUM_CAMS; i++) {
+        input_masks.at(i) += overlap_masks[i];
+      }
+      return;
+    }
+
+    // With pairwise matching, detection does not depend on the other cameras
+    // and runs in parallel up front. Otherwise a camera other than cam0
+    // detects after matching from cam0, so it does not detect next to the
+    // matched points.
+    const bool parallel_detection = config.optical_flow_matching_pairwise;
+    std::vector<KeypointsData> kds(NUM_CAMS);
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, parallel_detection ? num_detecting_cams
+                                                         : size_t(1)),
+        [&](const tbb::blocked_range<size_t>& r) {
+          for (size_t i = r.begin(); i != r.end(); ++i) {
+            kds[i] = detectPointsForCamera(i, detection_masks[i], region);
+          }
+        });
+
+    std::vector<Keypoints> new_kps(NUM_CAMS);
+    new_kps[0] = addPointsForCamera(0, kds[0]);
+
+    for (size_t i = 1; i < NUM_CAMS; i++) {
+      const size_t j = match_source[i];
       Keypoints& mgs = transforms->matching_guesses.at(i);
 
-      // Match features on areas that overlap with cam0 using optical flow
-      auto& pyr0 = pyramid->at(0);
-      auto& pyri = pyramid->at(i);
+      // Match new features of the source camera using optical flow
       Keypoints kps;
-      SE3 T_c0_ci = calib.T_i_c[0].inverse() * calib.T_i_c[i];
-      trackPoints(pyr0, pyri, kps0, kps, mgs, ms0, ms, T_c0_ci, 0, i);
+      SE3 T_cj_ci = calib.T_i_c[j].inverse() * calib.T_i_c[i];
+      if (config.optical_flow_matching_epipolar) {
+        matchPointsEpipolar(pyramid->at(j), pyramid->at(i), new_kps[j], kps,
+                            mgs, input_masks.at(j), input_masks.at(i),
+                            T_cj_ci, j, i);
+      } else {
+        trackPoints(pyramid->at(j), pyramid->at(i), new_kps[j], kps, mgs,
+                    input_masks.at(j), input_masks.at(i), T_cj_ci, j, i,
+                    &patch_cache->at(j), &patch_cache->at(i));
+      }
       transforms->observations.at(i).insert(kps.begin(), kps.end());
+      new_kps[i] = kps;
+
+      if (!nonoverlap) continue;
+      if (!parallel_detection) {
+        kds[i] = detectPointsForCamera(i, detection_masks[i], region);
+      }
+      Keypoints kps_no = addPointsForCamera(i, kds[i]);
+      new_kps[i].insert(kps_no.begin(), kps_no.end());
+    }
 
-      // Update masks and detect features on area not overlapping with cam0
-      if (!config.optical_flow_detection_nonoverlap) continue;
-      ms += cam0OverlapCellsMasksForCam(i);
-      Keypoints kps_no = addPointsForCamera(i);
+    for (size_t i = 1; i < NUM_CAMS; i++) {
+      input_masks.at(i) += overlap_masks[i];
     }
   }
 
@@ -535,10 +1357,11 @@ class FrameToFrameOpticalFlow : public OpticalFlowBase {
     std::vector<KeypointId> kpid;
     Eigen::aligned_vector<Eigen::Vector2f> proj0, proj1;
 
+    const size_t src_id = match_source[cam_id];
     for (const auto& kv : transforms->observations.at(cam_id)) {
-      auto it = transforms->observations.at(0).find(kv.first);
+      auto it = transforms->observations.at(src_id).find(kv.first);
 
-      if (it != transforms->observations.at(0).end()) {
+      if (it != transforms->observations.at(src_id).end()) {
         proj0.emplace_back(it->second.translation());
         proj1.emplace_back(kv.second.translation());
         kpid.emplace_back(kv.first);
@@ -548,13 +1371,13 @@ class FrameToFrameOpticalFlow : public OpticalFlowBase {
     Eigen::aligned_vector<Eigen::Vector4f> p3d0, p3d1;
     std::vector<bool> p3d0_success, p3d1_success;
 
-    calib.intrinsics[0].unproject(proj0, p3d0, p3d0_success);
+    calib.intrinsics[src_id].unproject(proj0, p3d0, p3d0_success);
     calib.intrinsics[cam_id].unproject(proj1, p3d1, p3d1_success);
 
     for (size_t i = 0; i < p3d0_success.size(); i++) {
       if (p3d0_success[i] && p3d1_success[i]) {
         const double epipolar_error =
-            std::abs(p3d0[i].transpose() * E * p3d1[i]);
+            std::abs(p3d0[i].transpose() * E[cam_id] * p3d1[i]);
 
         if (epipolar_error > config.optical_flow_epipolar_error) {
           lm_to_remove.emplace(kpid[i]);
@@ -584,17 +1407,48 @@ class FrameToFrameOpticalFlow : public OpticalFlowBase {
 
   KeypointId last_keypoint_id;
 
+  // Finest tracked level and level 0 refinement of the current frame, from
+  // the config or coarser on frames skipped by optical_flow_skip_frames
+  int base_level;
+  bool base_refinement;
+
+  // Scheduling of the detection of new points, see scheduleDetection
+  bool replenish_requested;
+  int frames_since_detection;
+  int detection_regions_left;
+  int next_detection_region;
+
   VioConfig config;
   basalt::Calibration<Scalar> calib;
 
   OpticalFlowResult::Ptr transforms;
   std::shared_ptr<std::vector<basalt::ManagedImagePyr<uint16_t>>> old_pyramid,
       pyramid;
-
-  Matrix4 E;
+  // Empty unless optical_flow_gradient_pyramid is set
+  std::shared_ptr<std::vector<GradientPyramid>> old_grad_pyramid, grad_pyramid;
+
+  // Per camera patches of the points tracked in the current and previous
+  // frame. Only the current frame adds patches, so the caches of earlier
+  // frames can be shared.
+  std::shared_ptr<std::vector<PatchCache>> patch_cache, old_patch_cache;
+
+  // Last output frame while optical_flow_skipped_frames_level is in use, from
+  // which the next output frame is tracked
+  OpticalFlowResult::Ptr anchor;
+  SE3 anchor_T_w_i;
+  std::shared_ptr<std::vector<basalt::ManagedImagePyr<uint16_t>>>
+      anchor_pyramid;
+  std::shared_ptr<std::vector<GradientPyramid>> anchor_grad_pyramid;
+  std::shared_ptr<std::vector<PatchCache>> anchor_patch_cache;
+
+  std::vector<size_t> match_source;  //!< Camera each camera matches from
+  Eigen::aligned_vector<Matrix4> E;  //!< Essential matrix wrt match_source
   const Vector3d accel_cov;
   const Vector3d gyro_cov;
 
+  // Held while a frame is processed, so checkpoints are taken between frames
+  std::mutex state_mutex;
+
   std::shared_ptr<std::thread> processing_thread;
 };
 
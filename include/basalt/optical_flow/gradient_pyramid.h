@@ -0,0 +1,153 @@
+/**
+BSD 3-Clause License
+
+This file is part of the Basalt project.
+https://gitlab.com/VladyslavUsenko/basalt.git
+
+Copyright (c) 2022, Vladyslav Usenko and Nikolaus Demmel.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the copyright holder nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include <basalt/image/image.h>
+#include <basalt/image/image_pyr.h>
+
+namespace basalt {
+
+/// Image with the intensity and its central difference gradient stored
+/// interleaved as (I, Ix, Iy) for every pixel. It can be passed to the
+/// templated patch setup in place of the intensity image: interpGrad reads the
+/// four neighbouring texels once instead of the eight extra pixels needed to
+/// compute the gradient on the fly, and the result is identical up to
+/// rounding because bilinear interpolation commutes with central differences.
+/// The gradient of the outermost row and column is zero; it is never read
+/// since patches are only sampled with a border of 2 pixels.
+class GradientImage {
+ public:
+  GradientImage() = default;
+
+  explicit GradientImage(const Image<const uint16_t>& img) {
+    setFromImage(img);
+  }
+
+  void setFromImage(const Image<const uint16_t>& img) {
+    w = img.w;
+    h = img.h;
+    data.assign(3 * size_t(w) * h, 0.0f);
+
+    for (int y = 0; y < h; y++) {
+      float* row = &data[3 * size_t(y) * w];
+      for (int x = 0; x < w; x++) {
+        row[3 * x] = img(x, y);
+      }
+      if (y == 0 || y == h - 1) continue;
+      for (int x = 1; x < w - 1; x++) {
+        row[3 * x + 1] = 0.5f * (float(img(x + 1, y)) - float(img(x - 1, y)));
+        row[3 * x + 2] = 0.5f * (float(img(x, y + 1)) - float(img(x, y - 1)));
+      }
+    }
+  }
+
+  template <typename Derived>
+  inline bool InBounds(const Eigen::MatrixBase<Derived>& p,
+                       const typename Derived::Scalar border) const {
+    return border <= p[0] && p[0] < (w - border - 1) && border <= p[1] &&
+           p[1] < (h - border - 1);
+  }
+
+  template <typename S>
+  inline S interp(const Eigen::Matrix<S, 2, 1>& p) const {
+    return interpGrad<S>(p)[0];
+  }
+
+  /// Bilinear interpolation of intensity and gradient at p
+  template <typename S>
+  inline Eigen::Matrix<S, 3, 1> interpGrad(
+      const Eigen::Matrix<S, 2, 1>& p) const {
+    const int ix = p[0];
+    const int iy = p[1];
+
+    const S dx = p[0] - ix;
+    const S dy = p[1] - iy;
+    const S ddx = S(1.0) - dx;
+    const S ddy = S(1.0) - dy;
+
+    const float* p00 = texel(ix, iy);
+    const float* p01 = p00 + 3 * size_t(w);
+
+    Eigen::Matrix<S, 3, 1> res;
+    for (int c = 0; c < 3; c++) {
+      res[c] = ddy * (ddx * p00[c] + dx * p00[c + 3]) +
+               dy * (ddx * p01[c] + dx * p01[c + 3]);
+    }
+    return res;
+  }
+
+  /// Bytes used by the interleaved data
+  size_t memoryUsage() const { return data.size() * sizeof(float); }
+
+  int w = 0;
+  int h = 0;
+
+ private:
+  inline const float* texel(int x, int y) const {
+    return &data[3 * (size_t(y) * w + x)];
+  }
+
+  std::vector<float> data;
+};
+
+/// GradientImage for every level of an image pyramid
+class GradientPyramid {
+ public:
+  /// Levels 0 to num_levels of pyr, matching ManagedImagePyr::setFromImage
+  void setFromPyramid(const ManagedImagePyr<uint16_t>& pyr, size_t num_levels) {
+    levels.resize(num_levels + 1);
+    for (size_t i = 0; i <= num_levels; i++) {
+      levels[i].setFromImage(pyr.lvl(i));
+    }
+  }
+
+  const GradientImage& lvl(size_t level) const { return levels.at(level); }
+
+  size_t memoryUsage() const {
+    size_t bytes = 0;
+    for (const auto& l : levels) bytes += l.memoryUsage();
+    return bytes;
+  }
+
+ private:
+  std::vector<GradientImage> levels;
+};
+
+}  // namespace basalt
@@ -101,6 +101,8 @@ class MultiscaleFrameToFrameOpticalFlow : public OpticalFlowBase {
 
     while (true) {
       while (input_depth_queue.try_pop(depth_guess)) continue;
+      int64_t kf_request_t_ns;  // Only used by FrameToFrameOpticalFlow
+      while (input_kf_request_queue.try_pop(kf_request_t_ns)) continue;
 
       input_queue.pop(input_ptr);
 
@@ -109,8 +111,10 @@ class MultiscaleFrameToFrameOpticalFlow : public OpticalFlowBase {
         break;
       }
       input_ptr->addTime("frames_received");
+      input_ptr->chargeImageMemory();
 
-      processFrame(input_ptr->t_ns, input_ptr);
+      executeScheduled(scheduler_instance, TrackerScheduler::OPTICAL_FLOW,
+                       [&] { processFrame(input_ptr->t_ns, input_ptr); });
     }
   }
 
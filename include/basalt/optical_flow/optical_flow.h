@@ -35,6 +35,8 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #pragma once
 
 #include <chrono>
+#include <functional>
+#include <iosfwd>
 #include <memory>
 
 #include <Eigen/Geometry>
@@ -44,6 +46,8 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <basalt/imu/imu_types.h>
 #include <basalt/io/dataset_io.h>
 #include <basalt/utils/keypoints.h>
+#include <basalt/utils/memory_tracking.h>
+#include <basalt/utils/tracker_scheduler.h>
 #include <basalt/calibration/calibration.hpp>
 #include <basalt/camera/stereographic_param.hpp>
 #include <basalt/utils/sophus_utils.hpp>
@@ -82,6 +86,19 @@ struct OpticalFlowInput {
   void addTime(const char* name, int64_t custom_ts = INT64_MIN) {
     stats.addTime(name, custom_ts);
   }
+
+  MemoryCharge image_memory;  //!< Accounts img_data to MemoryTag::IMAGES
+
+  /// Called by the optical flow when the input arrives. The images are
+  /// accounted until the last result referring to this input is released.
+  void chargeImageMemory() {
+    if constexpr (!MEMORY_TRACKING_ENABLED) return;
+    size_t bytes = 0;
+    for (const auto& d : img_data) {
+      if (d.img) bytes += d.img->pitch * d.img->h;
+    }
+    image_memory = MemoryCharge(MemoryTag::IMAGES, bytes);
+  }
 };
 
 struct OpticalFlowResult {
@@ -95,6 +112,18 @@ struct OpticalFlowResult {
   std::vector<std::map<KeypointId, size_t>> pyramid_levels;
 
   OpticalFlowInput::Ptr input_images;
+
+  /// Copy with only the observations, which is all the estimators need from
+  /// the frames in their sliding window. The input images are shared only if
+  /// keep_images is set, so that they can be released as soon as the optical
+  /// flow and the UI are done with them.
+  Ptr windowCopy(bool keep_images) const {
+    Ptr res = std::make_shared<OpticalFlowResult>();
+    res->t_ns = t_ns;
+    res->observations = observations;
+    if (keep_images) res->input_images = input_images;
+    return res;
+  }
 };
 
 class OpticalFlowBase {
@@ -105,6 +134,7 @@ class OpticalFlowBase {
   tbb::concurrent_bounded_queue<ImuData<double>::Ptr> input_imu_queue;
   tbb::concurrent_queue<double> input_depth_queue;
   tbb::concurrent_queue<PoseVelBiasState<double>::Ptr> input_state_queue;
+  tbb::concurrent_queue<int64_t> input_kf_request_queue;
   tbb::concurrent_bounded_queue<OpticalFlowResult::Ptr>* output_queue = nullptr;
 
   Eigen::MatrixXf patch_coord;
@@ -114,6 +144,34 @@ class OpticalFlowBase {
 
   bool first_state_arrived = false;
   bool show_gui;  //!< Whether we need to store additional info for the UI
+
+  /// Runs the frames in a shared thread pool if set, before the first frame
+  TrackerScheduler::Instance::Ptr scheduler_instance;
+
+  virtual ~OpticalFlowBase() = default;
+
+  /// Writes the tracks of the last frame with its images, so that a new
+  /// instance with the same config and calibration can continue them after
+  /// restoreCheckpoint. Safe to call while running, the state is taken between
+  /// two frames. Returns false if unsupported or nothing is tracked yet.
+  virtual bool saveCheckpoint(std::ostream& /*os*/) { return false; }
+
+  /// Reads and validates a state written by saveCheckpoint without applying
+  /// it. Returns the function that applies it before the first frame is
+  /// pushed, or an empty one if unsupported or if the data is invalid. Lets
+  /// callers restore several components all or nothing.
+  virtual std::function<void()> prepareRestore(std::istream& /*is*/) {
+    return {};
+  }
+
+  /// Restores a state written by saveCheckpoint, before the first frame is
+  /// pushed. Returns false and leaves the state unchanged if it can't.
+  bool restoreCheckpoint(std::istream& is) {
+    std::function<void()> apply = prepareRestore(is);
+    if (!apply) return false;
+    apply();
+    return true;
+  }
 };
 
 class OpticalFlowFactory {
@@ -144,7 +144,9 @@ struct OpticalFlowPatch {
     J_se2 *= mean_inv;
   }
 
-  void setFromImage(const Image<const uint16_t> &img, const Vector2 &pos) {
+  /// ImgT is the intensity image or a GradientImage with precomputed gradients
+  template <typename ImgT>
+  void setFromImage(const ImgT &img, const Vector2 &pos) {
     this->pos = pos;
 
     MatrixP3 J_se2;
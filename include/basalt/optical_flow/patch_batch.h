@@ -0,0 +1,133 @@
+#pragma once
+
+#include <array>
+
+#include <Eigen/Dense>
+#include <sophus/se2.hpp>
+
+#include <basalt/image/image.h>
+#include <basalt/optical_flow/patch.h>
+
+namespace basalt {
+
+/// A batch of LANES patches stored as structure of arrays, with one row per
+/// patch. All patches of the batch are tracked in lockstep on a pyramid level.
+/// The per-pattern-point arithmetic is done on whole columns, so it runs on
+/// LANES patches at once, and lanes whose tracking fails are masked out.
+/// Produces the same result as OpticalFlowPatch::residual plus the
+/// Gauss-Newton loop of the optical flow for each lane.
+template <typename Scalar, typename Pattern, int LANES = 8>
+struct OpticalFlowPatchBatch {
+  typedef OpticalFlowPatch<Scalar, Pattern> PatchT;
+
+  static constexpr int PATTERN_SIZE = PatchT::PATTERN_SIZE;
+
+  typedef Eigen::Array<Scalar, LANES, 1> LaneArray;
+  typedef Eigen::Array<bool, LANES, 1> LaneMask;
+  typedef Eigen::Array<Scalar, LANES, PATTERN_SIZE> LanePatternArray;
+  typedef Eigen::Array<bool, LANES, PATTERN_SIZE> LanePatternMask;
+
+  typedef std::array<Eigen::AffineCompact2f, LANES> Transforms;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  void setLane(int lane, const PatchT& p) {
+    data.row(lane) = p.data.transpose().array();
+    for (int k = 0; k < 3; k++) {
+      H_se2_inv_J_se2_T[k].row(lane) = p.H_se2_inv_J_se2_T.row(k).array();
+    }
+  }
+
+  /// Track the active lanes from their initial transform in img. Lanes for
+  /// which the patch becomes invalid are cleared in active.
+  void track(const Image<const uint16_t>& img, int max_iterations,
+             Transforms& transforms, LaneMask& active) const {
+    const auto& pattern2 = PatchT::pattern2;
+
+    for (int iteration = 0; iteration < max_iterations && active.any();
+         iteration++) {
+      LaneArray r00, r01, r10, r11, tx, ty;
+      for (int l = 0; l < LANES; l++) {
+        const Eigen::Matrix2f R = transforms[l].linear();
+        r00[l] = R(0, 0);
+        r01[l] = R(0, 1);
+        r10[l] = R(1, 0);
+        r11[l] = R(1, 1);
+        tx[l] = transforms[l].translation().x();
+        ty[l] = transforms[l].translation().y();
+      }
+
+      // Transformed pattern of all lanes
+      LanePatternArray px = (r00.matrix() * pattern2.row(0) +
+                             r01.matrix() * pattern2.row(1))
+                                .array()
+                                .colwise() +
+                            tx;
+      LanePatternArray py = (r10.matrix() * pattern2.row(0) +
+                             r11.matrix() * pattern2.row(1))
+                                .array()
+                                .colwise() +
+                            ty;
+
+      // Image sampling is a gather and stays scalar
+      LanePatternArray val;
+      for (int i = 0; i < PATTERN_SIZE; i++) {
+        for (int l = 0; l < LANES; l++) {
+          if (active[l] && img.InBounds(px(l, i), py(l, i), 2)) {
+            val(l, i) = img.template interp<Scalar>(px(l, i), py(l, i));
+          } else {
+            val(l, i) = -1;
+          }
+        }
+      }
+
+      // Normalized residuals, see OpticalFlowPatch::residual
+      const LanePatternMask val_valid = val >= 0;
+      const LaneArray sum = val_valid.select(val, 0).rowwise().sum();
+      const LaneArray num_valid =
+          val_valid.template cast<Scalar>().rowwise().sum();
+      const LanePatternMask res_valid = val_valid && (data >= 0);
+      const LanePatternArray res = res_valid.select(
+          (val.colwise() * (num_valid / sum)) - data, 0);
+      const LaneArray num_res =
+          res_valid.template cast<Scalar>().rowwise().sum();
+
+      active = active && (sum >= std::numeric_limits<Scalar>::epsilon()) &&
+               (num_res > Scalar(PATTERN_SIZE / 2));
+
+      // Gauss-Newton increments of all lanes
+      std::array<LaneArray, 3> inc;
+      for (int k = 0; k < 3; k++) {
+        inc[k] = -(H_se2_inv_J_se2_T[k] * res).rowwise().sum();
+      }
+
+      for (int l = 0; l < LANES; l++) {
+        if (!active[l]) continue;
+
+        const Eigen::Matrix<Scalar, 3, 1> inc_l(inc[0][l], inc[1][l],
+                                                inc[2][l]);
+
+        // avoid NaN in increment (leads to SE2::exp crashing) and very large
+        // increments
+        if (!inc_l.array().isFinite().all() ||
+            inc_l.template lpNorm<Eigen::Infinity>() >= 1e6) {
+          active[l] = false;
+          continue;
+        }
+
+        transforms[l] *= Sophus::SE2<Scalar>::exp(inc_l).matrix();
+
+        const int filter_margin = 2;
+        active[l] = img.InBounds(transforms[l].translation(), filter_margin);
+      }
+    }
+  }
+
+  // negative if the point is not valid
+  LanePatternArray data = LanePatternArray::Constant(-1);
+  std::array<LanePatternArray, 3> H_se2_inv_J_se2_T = {
+      LanePatternArray::Zero(), LanePatternArray::Zero(),
+      LanePatternArray::Zero()};
+};
+
+}  // namespace basalt
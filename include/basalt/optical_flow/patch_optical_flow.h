@@ -50,8 +50,6 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 namespace basalt {
 
-// TODO: patches are currently never erased, so over time memory consumption
-// increases
 // TODO: some changes from FrameToFrameOpticalFlow could be back-ported
 // (adjustments to Scalar=float, tbb parallelization, ...).
 
@@ -107,6 +105,8 @@ class PatchOpticalFlow : public OpticalFlowBase {
 
     while (true) {
       while (input_depth_queue.try_pop(depth_guess)) continue;
+      int64_t kf_request_t_ns;  // Only used by FrameToFrameOpticalFlow
+      while (input_kf_request_queue.try_pop(kf_request_t_ns)) continue;
 
       input_queue.pop(input_ptr);
 
@@ -115,8 +115,10 @@ class PatchOpticalFlow : public OpticalFlowBase {
         break;
       }
       input_ptr->addTime("frames_received");
+      input_ptr->chargeImageMemory();
 
-      processFrame(input_ptr->t_ns, input_ptr);
+      executeScheduled(scheduler_instance, TrackerScheduler::OPTICAL_FLOW,
+                       [&] { processFrame(input_ptr->t_ns, input_ptr); });
     }
   }
 
@@ -172,6 +174,7 @@ class PatchOpticalFlow : public OpticalFlowBase {
 
       addPoints();
       filterPoints();
+      erasePatchesOfLostPoints();
     }
 
     if (output_queue && frame_counter % config.optical_flow_skip_frames == 0) {
@@ -372,6 +375,18 @@ class PatchOpticalFlow : public OpticalFlowBase {
     }
   }
 
+  /// Patches are static for the whole track, so they are only dropped once
+  /// the point is not tracked in any camera anymore
+  void erasePatchesOfLostPoints() {
+    for (auto it = patches.begin(); it != patches.end();) {
+      bool tracked = false;
+      for (const auto& obs : transforms->observations) {
+        tracked |= obs.count(it->first) > 0;
+      }
+      it = tracked ? std::next(it) : patches.erase(it);
+    }
+  }
+
   void filterPoints() {
     if (calib.intrinsics.size() < 2) return;
 
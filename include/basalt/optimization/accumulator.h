@@ -40,6 +40,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <array>
 #include <chrono>
+#include <type_traits>
 #include <unordered_map>
 
 #include <basalt/utils/assert.h>
@@ -49,8 +50,11 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <Eigen/CholmodSupport>
 
+// CHOLMOD only supports double, other scalars fall back to Eigen's LDLT.
 template <class T>
-using SparseLLT = Eigen::CholmodSupernodalLLT<T>;
+using SparseLLT = std::conditional_t<std::is_same_v<typename T::Scalar, double>,
+                                     Eigen::CholmodSupernodalLLT<T>,
+                                     Eigen::SimplicialLDLT<T>>;
 
 #else
 
@@ -185,7 +189,7 @@ class SparseHashAccumulator {
     }
 
     for (int i = 0; i < b.rows(); i++) {
-      triplets.emplace_back(i, i, std::numeric_limits<double>::min());
+      triplets.emplace_back(i, i, std::numeric_limits<Scalar>::min());
     }
 
     smm = SparseMatrix(b.rows(), b.rows());
@@ -209,9 +213,7 @@ class SparseHashAccumulator {
       // (interferes with TBB), the current CG is single-threaded, and we
       // can expect a substantial speedup by switching to a parallel
       // implementation of CG.
-      Eigen::ConjugateGradient<Eigen::SparseMatrix<double>,
-                               Eigen::Lower | Eigen::Upper>
-          cg;
+      Eigen::ConjugateGradient<SparseMatrix, Eigen::Lower | Eigen::Upper> cg;
 
       cg.setTolerance(tolerance);
       cg.compute(sm);
@@ -39,6 +39,8 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <map>
 #include <memory>
 #include <set>
+#include <stdexcept>
+#include <string>
 
 #include <Eigen/Dense>
 #include <sophus/se3.hpp>
@@ -46,6 +48,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <basalt/imu/imu_types.h>
 #include <basalt/optical_flow/optical_flow.h>
 #include <basalt/utils/common_types.h>
+#include <basalt/utils/memory_tracking.h>
 #include <basalt/utils/sophus_utils.hpp>
 
 #include <cereal/cereal.hpp>
@@ -329,9 +332,19 @@ struct MargLinData {
 struct MargData {
   typedef std::shared_ptr<MargData> Ptr;
 
+  /// Serialized files start with FORMAT_MAGIC | FORMAT_VERSION. Version 1
+  /// files have no header and always hold a dense H and b. Since version 3 a
+  /// square-root factor is stored without the zeros below its diagonal.
+  static constexpr uint64_t FORMAT_MAGIC = 0xba5a170000000000;
+  static constexpr uint64_t FORMAT_MAGIC_MASK = 0xffffffff00000000;
+  static constexpr uint32_t FORMAT_VERSION = 3;
+
   AbsOrderMap aom;
   Eigen::MatrixXd abs_H;
   Eigen::VectorXd abs_b;
+  /// If true, abs_H and abs_b are a square-root factor R and r with
+  /// H = R^T R and b = R^T r (see compactMargData).
+  bool is_sqrt = false;
   Eigen::aligned_map<int64_t, PoseVelBiasStateWithLin<double>> frame_states;
   Eigen::aligned_map<int64_t, PoseStateWithLin<double>> frame_poses;
   std::set<int64_t> kfs_all;
@@ -339,6 +352,15 @@ struct MargData {
   bool use_imu;
 
   std::vector<OpticalFlowResult::Ptr> opt_flow_res;
+
+  MemoryCharge memory;  //!< Accounts the prior to MemoryTag::MARG_DATA
+
+  /// Accounts the prior until this MargData is released, called when it is
+  /// handed over to out_marg_queue.
+  void chargeMemory() {
+    memory = MemoryCharge(MemoryTag::MARG_DATA,
+                          (abs_H.size() + abs_b.size()) * sizeof(double));
+  }
 };
 
 struct RelPoseFactor {
@@ -371,9 +393,65 @@ void serialize(Archive& ar, basalt::AbsOrderMap& a) {
 }
 
 template <class Archive>
-void serialize(Archive& ar, basalt::MargData& m) {
+void save(Archive& ar, const basalt::MargData& m) {
+  uint64_t header =
+      basalt::MargData::FORMAT_MAGIC | basalt::MargData::FORMAT_VERSION;
+  ar(header);
+  ar(m.is_sqrt);
   ar(m.aom);
-  ar(m.abs_H);
+  if (m.is_sqrt) {
+    // R is upper triangular (upper trapezoidal if the prior is rank
+    // deficient), so only the entries on and above the diagonal are stored.
+    const int64_t rows = m.abs_H.rows();
+    const int64_t cols = m.abs_H.cols();
+    ar(rows, cols);
+    for (int64_t i = 0; i < rows; i++) {
+      for (int64_t j = i; j < cols; j++) ar(m.abs_H(i, j));
+    }
+  } else {
+    ar(m.abs_H);
+  }
+  ar(m.abs_b);
+  ar(m.frame_poses);
+  ar(m.frame_states);
+  ar(m.kfs_all);
+  ar(m.kfs_to_marg);
+  ar(m.use_imu);
+}
+
+template <class Archive>
+void load(Archive& ar, basalt::MargData& m) {
+  uint64_t header;
+  ar(header);
+
+  uint32_t version = 1;
+  if ((header & basalt::MargData::FORMAT_MAGIC_MASK) ==
+      basalt::MargData::FORMAT_MAGIC) {
+    version = header & ~basalt::MargData::FORMAT_MAGIC_MASK;
+    if (version > basalt::MargData::FORMAT_VERSION) {
+      throw std::runtime_error("Unsupported MargData version " +
+                               std::to_string(version));
+    }
+    ar(m.is_sqrt);
+    ar(m.aom);
+  } else {
+    // Version 1 starts directly with the AbsOrderMap
+    m.is_sqrt = false;
+    m.aom.total_size = header;
+    ar(m.aom.items);
+    ar(m.aom.abs_order_map);
+  }
+
+  if (m.is_sqrt && version >= 3) {
+    int64_t rows, cols;
+    ar(rows, cols);
+    m.abs_H.setZero(rows, cols);
+    for (int64_t i = 0; i < rows; i++) {
+      for (int64_t j = i; j < cols; j++) ar(m.abs_H(i, j));
+    }
+  } else {
+    ar(m.abs_H);
+  }
   ar(m.abs_b);
   ar(m.frame_poses);
   ar(m.frame_states);
@@ -103,6 +103,15 @@ void matchDescriptors(const std::vector<std::bitset<256>>& corner_descriptors_1,
                       std::vector<std::pair<int, int>>& matches, int threshold,
                       double dist_2_best);
 
+/// Same as above, but only descriptors with the same group id are compared,
+/// e.g. with the direct index of a vocabulary tree.
+void matchDescriptors(const std::vector<std::bitset<256>>& corner_descriptors_1,
+                      const std::vector<uint32_t>& groups_1,
+                      const std::vector<std::bitset<256>>& corner_descriptors_2,
+                      const std::vector<uint32_t>& groups_2,
+                      std::vector<std::pair<int, int>>& matches, int threshold,
+                      double dist_2_best);
+
 inline void computeEssential(const Sophus::SE3d& T_0_1, Eigen::Matrix4d& E) {
   E.setZero();
   const Eigen::Vector3d t_0_1 = T_0_1.translation();
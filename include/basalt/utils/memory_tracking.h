@@ -0,0 +1,214 @@
+/**
+BSD 3-Clause License
+
+This file is part of the Basalt project.
+https://gitlab.com/VladyslavUsenko/basalt.git
+
+Copyright (c) 2022, Vladyslav Usenko and Nikolaus Demmel.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the copyright holder nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+
+#include <basalt/utils/time_utils.hpp>
+
+namespace basalt {
+
+/// Subsystems that memory is accounted to. Only memory allocated through a
+/// TrackingAllocator or charged with a MemoryCharge is counted, so the numbers
+/// are a lower bound of what each subsystem holds.
+enum class MemoryTag : int {
+  IMAGES,             //!< Input images, alive while any result refers to them
+  OPTICAL_FLOW,       //!< Optical flow results kept by the estimator
+  LANDMARK_DATABASE,  //!< Landmarks and their observations
+  MARG_DATA,          //!< Marginalization data and its recording queues
+  UI,                 //!< Visualization data queued for the GUI
+  MAPPER,             //!< Containers of the NFR mapper
+  NUM_TAGS
+};
+
+constexpr int NUM_MEMORY_TAGS = static_cast<int>(MemoryTag::NUM_TAGS);
+
+const char* memoryTagName(MemoryTag tag);
+
+// Memory tracking is opt-in at compile time with the BASALT_MEMORY_TRACKING
+// CMake option. When it is off, tracked containers use their base allocator
+// and all accounting compiles to nothing.
+#ifdef BASALT_MEMORY_TRACKING
+constexpr bool MEMORY_TRACKING_ENABLED = true;
+#else
+constexpr bool MEMORY_TRACKING_ENABLED = false;
+#endif
+
+struct MemoryTagCounters {
+  std::atomic<int64_t> bytes{0};              //!< currently allocated
+  std::atomic<int64_t> allocations{0};        //!< currently allocated
+  std::atomic<int64_t> total_allocations{0};  //!< since the start
+};
+
+MemoryTagCounters& memoryTagCounters(MemoryTag tag);
+
+inline void memoryTrackAlloc(MemoryTag tag, size_t bytes) {
+  if constexpr (MEMORY_TRACKING_ENABLED) {
+    MemoryTagCounters& c = memoryTagCounters(tag);
+    c.bytes.fetch_add(bytes, std::memory_order_relaxed);
+    c.allocations.fetch_add(1, std::memory_order_relaxed);
+    c.total_allocations.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+inline void memoryTrackFree(MemoryTag tag, size_t bytes) {
+  if constexpr (MEMORY_TRACKING_ENABLED) {
+    MemoryTagCounters& c = memoryTagCounters(tag);
+    c.bytes.fetch_sub(bytes, std::memory_order_relaxed);
+    c.allocations.fetch_sub(1, std::memory_order_relaxed);
+  }
+}
+
+/// Allocator adaptor that counts all memory allocated through Base for TAG.
+template <class T, MemoryTag TAG, class Base = std::allocator<T>>
+class TrackingAllocator : public Base {
+ public:
+  using value_type = T;
+
+  template <class U>
+  struct rebind {
+    using other = TrackingAllocator<
+        U, TAG, typename std::allocator_traits<Base>::template rebind_alloc<U>>;
+  };
+
+  TrackingAllocator() = default;
+
+  template <class U, class BaseU>
+  TrackingAllocator(const TrackingAllocator<U, TAG, BaseU>& other)
+      : Base(static_cast<const BaseU&>(other)) {}
+
+  T* allocate(size_t n) {
+    T* p = std::allocator_traits<Base>::allocate(*this, n);
+    memoryTrackAlloc(TAG, n * sizeof(T));
+    return p;
+  }
+
+  void deallocate(T* p, size_t n) {
+    memoryTrackFree(TAG, n * sizeof(T));
+    std::allocator_traits<Base>::deallocate(*this, p, n);
+  }
+};
+
+template <class T, class U, MemoryTag TAG, class BaseT, class BaseU>
+bool operator==(const TrackingAllocator<T, TAG, BaseT>& a,
+                const TrackingAllocator<U, TAG, BaseU>& b) {
+  return static_cast<const BaseT&>(a) == static_cast<const BaseU&>(b);
+}
+
+template <class T, class U, MemoryTag TAG, class BaseT, class BaseU>
+bool operator!=(const TrackingAllocator<T, TAG, BaseT>& a,
+                const TrackingAllocator<U, TAG, BaseU>& b) {
+  return !(a == b);
+}
+
+/// TrackingAllocator if memory tracking is enabled, otherwise just Base.
+template <class T, MemoryTag TAG, class Base = std::allocator<T>>
+using tracked_allocator =
+    std::conditional_t<MEMORY_TRACKING_ENABLED,
+                       TrackingAllocator<T, TAG, Base>, Base>;
+
+/// Charges a number of bytes to a tag for the lifetime of the object, for
+/// memory that is not allocated through a TrackingAllocator. Copies don't
+/// carry the charge, since they usually share the charged buffers.
+class MemoryCharge {
+ public:
+  MemoryCharge() = default;
+
+  MemoryCharge(MemoryTag tag, size_t bytes) {
+#ifdef BASALT_MEMORY_TRACKING
+    tag_ = tag;
+    bytes_ = bytes;
+    memoryTrackAlloc(tag_, bytes_);
+#else
+    (void)tag;
+    (void)bytes;
+#endif
+  }
+
+  MemoryCharge(const MemoryCharge&) {}
+  MemoryCharge& operator=(const MemoryCharge&) { return *this; }
+
+  MemoryCharge(MemoryCharge&& other) { *this = std::move(other); }
+
+  MemoryCharge& operator=(MemoryCharge&& other) {
+#ifdef BASALT_MEMORY_TRACKING
+    release();
+    tag_ = other.tag_;
+    bytes_ = other.bytes_;
+    other.bytes_ = 0;
+#else
+    (void)other;
+#endif
+    return *this;
+  }
+
+  ~MemoryCharge() {
+#ifdef BASALT_MEMORY_TRACKING
+    release();
+#endif
+  }
+
+ private:
+#ifdef BASALT_MEMORY_TRACKING
+  void release() {
+    if (bytes_ > 0) memoryTrackFree(tag_, bytes_);
+    bytes_ = 0;
+  }
+
+  MemoryTag tag_ = MemoryTag::NUM_TAGS;
+  size_t bytes_ = 0;
+#endif
+};
+
+/// Periodic memory report of all tags.
+class MemoryStatsReporter {
+ public:
+  /// Adds the allocated bytes, the number of live allocations and the
+  /// allocation rate since the previous call of every tag to stats as
+  /// mem_<tag>_bytes, mem_<tag>_allocs and mem_<tag>_alloc_rate (per second).
+  /// Does nothing if memory tracking is disabled.
+  void addStats(ExecutionStats& stats);
+
+ private:
+  Timer<> timer_;
+  std::array<int64_t, NUM_MEMORY_TAGS> last_total_allocations_{};
+};
+
+}  // namespace basalt
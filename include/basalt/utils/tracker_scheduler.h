@@ -0,0 +1,161 @@
+/**
+BSD 3-Clause License
+
+This file is part of the Basalt project.
+https://gitlab.com/VladyslavUsenko/basalt.git
+
+Copyright (c) 2022, Vladyslav Usenko and Nikolaus Demmel.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the copyright holder nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <tbb/global_control.h>
+#include <tbb/task_arena.h>
+
+namespace basalt {
+
+/// Process-wide scheduler for running several trackers side by side. Every
+/// registered instance runs its per-frame work in its own TBB arena, whose
+/// concurrency is the instance's weighted share of a pool of threads shared by
+/// all instances. This keeps one tracker from taking all workers while others
+/// wait, and the pool size bounds the total number of busy threads.
+class TrackerScheduler {
+ public:
+  /// Stages of a tracker that run their frames through the scheduler
+  enum Stage { OPTICAL_FLOW = 0, VIO = 1, NUM_STAGES };
+
+  /// Wall time of the frames of a stage, including the time spent waiting for
+  /// threads of the arena
+  struct LatencyStats {
+    size_t count = 0;
+    double mean_ms = 0;
+    double max_ms = 0;
+    double last_ms = 0;
+  };
+
+  class Instance {
+   public:
+    using Ptr = std::shared_ptr<Instance>;
+
+    ~Instance();
+
+    /// Runs f, which spawns the parallel work of one frame, in the arena of
+    /// this instance and records how long it took
+    template <class F>
+    void execute(Stage stage, F&& f) {
+      const auto start = std::chrono::steady_clock::now();
+      arena()->execute(f);
+      const auto end = std::chrono::steady_clock::now();
+      addLatency(stage, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            end - start)
+                            .count());
+    }
+
+    LatencyStats getLatency(Stage stage) const;
+
+    const std::string& getName() const { return name; }
+    int getWeight() const { return weight; }
+
+    /// Threads this instance may use at the moment, including the threads of
+    /// its stages
+    int getConcurrency() const;
+
+   private:
+    friend class TrackerScheduler;
+
+    Instance(TrackerScheduler& scheduler, const std::string& name, int weight);
+
+    std::shared_ptr<tbb::task_arena> arena();
+    void addLatency(Stage stage, int64_t ns);
+
+    TrackerScheduler& scheduler;
+    const std::string name;
+    const int weight;
+
+    mutable std::mutex mutex;
+    // Replaced when the shares change, users keep the old one until they leave
+    std::shared_ptr<tbb::task_arena> current_arena;
+    uint64_t arena_generation = 0;
+
+    struct StageLatency {
+      size_t count = 0;
+      int64_t sum_ns = 0;
+      int64_t max_ns = 0;
+      int64_t last_ns = 0;
+    } latency[NUM_STAGES];
+  };
+
+  static TrackerScheduler& get();
+
+  /// Bounds the threads shared by all instances, 0 for the TBB default. The
+  /// limit is process-wide, so the first positive value wins; later calls with
+  /// a different value print a warning and are ignored.
+  void setNumThreads(int num_threads);
+  int getNumThreads() const;
+
+  /// The share of an instance is proportional to its weight. Shares are
+  /// rebalanced at the next frame when instances come and go.
+  Instance::Ptr registerInstance(const std::string& name, int weight = 1);
+
+  std::vector<Instance::Ptr> getInstances() const;
+
+ private:
+  TrackerScheduler() = default;
+
+  void unregisterInstance(const Instance* instance);
+  int concurrencyOf(int weight) const;  // Needs the lock
+
+  mutable std::mutex mutex;
+  std::vector<std::weak_ptr<Instance>> instances;
+  int total_weight = 0;
+  int num_threads = 0;
+  uint64_t generation = 1;
+  std::unique_ptr<tbb::global_control> global_control;
+};
+
+/// Runs f through the scheduler if the tracker has an instance, directly
+/// otherwise
+template <class F>
+void executeScheduled(const TrackerScheduler::Instance::Ptr& instance,
+                      TrackerScheduler::Stage stage, F&& f) {
+  if (instance) {
+    instance->execute(stage, f);
+  } else {
+    f();
+  }
+}
+
+}  // namespace basalt
@@ -41,6 +41,13 @@ namespace basalt {
 enum class LinearizationType { ABS_QR, ABS_SC, REL_SC };
 enum class MatchingGuessType { SAME_PIXEL, REPROJ_FIX_DEPTH, REPROJ_AVG_DEPTH };
 
+/// How tracked points are validated in the optical flow. FULL tracks back
+/// through all pyramid levels and compares with the initial position,
+/// FINEST_LEVEL only tracks back at level 0 starting from the forward result,
+/// and RESIDUAL skips backward tracking and bounds the position uncertainty
+/// estimated from the final residual and the patch Hessian instead.
+enum class RecoveryCheckType { FULL, FINEST_LEVEL, RESIDUAL };
+
 struct VioConfig {
   VioConfig();
   void load(const std::string& filename);
@@ -52,14 +59,27 @@ struct VioConfig {
   int optical_flow_detection_min_threshold;
   int optical_flow_detection_max_threshold;
   bool optical_flow_detection_nonoverlap;
+  float optical_flow_detection_min_occupancy;  // detect below this cell ratio
+  int optical_flow_detection_max_frames;  // detect at least every n frames
+  int optical_flow_detection_regions;     // grid stripes, one per frame
+  bool optical_flow_matching_pairwise;  // match from most overlapping camera
   float optical_flow_max_recovered_dist2;
+  RecoveryCheckType optical_flow_recovery_check;
+  bool optical_flow_batch_tracking;  // track points in lockstep batches
+  bool optical_flow_gradient_pyramid;  // precompute gradients of each level
   int optical_flow_pattern;
   int optical_flow_max_iterations;
   int optical_flow_levels;
+  int optical_flow_base_level;  // finest level for detection and tracking
+  bool optical_flow_base_refinement;  // one final iteration on level 0
   float optical_flow_epipolar_error;
   int optical_flow_skip_frames;
+  int optical_flow_skipped_frames_level;  // -1 fully processes skipped frames
   MatchingGuessType optical_flow_matching_guess_type;
   float optical_flow_matching_default_depth;
+  bool optical_flow_matching_epipolar;  // 1D search along the epipolar curve
+  float optical_flow_matching_min_depth;
+  float optical_flow_matching_max_depth;  // 0 for infinity
 
   LinearizationType vio_linearization_type;
   bool vio_sqrt_marg;
@@ -78,6 +98,8 @@ struct VioConfig {
   double vio_obs_std_dev;
   double vio_obs_huber_thresh;
   double vio_min_triangulation_dist;
+  double vio_min_triangulation_parallax;  // degrees, batch triangulation
+  bool vio_batch_triangulation;  // parallel multi-view triangulation
 
   bool vio_enforce_realtime;
 
@@ -94,6 +116,25 @@ struct VioConfig {
 
   bool vio_marg_lost_landmarks;
   double vio_kf_marg_feature_ratio;
+  int vio_marg_sparsify_interval;  // 0 keeps the dense prior
+
+  int vio_max_landmarks;  // 0 means optimize all landmarks
+  bool vio_balance_landmark_hosts;
+
+  std::string vio_map_path;  // map from the mapper to localize against
+  double vio_map_obs_std_dev;
+  double vio_map_match_radius;  // in pixels around the projected landmark
+  double vio_map_max_dist;  // in meters, landmarks further away are not matched
+  int vio_map_max_hamming_distance;
+  int vio_map_max_matches;  // per keyframe
+  int vio_map_reloc_min_inliers;
+  double vio_map_reloc_min_inlier_ratio;  // of the descriptor matches
+  int vio_map_min_matches;                // per keyframe to keep it
+  int vio_map_max_failed_kfs;             // in a row until relocalization
+
+  bool marg_data_bounded_recording;  // never block the estimator when saving
+  int marg_data_queue_size;          // pending writes in bounded recording
+  double marg_data_max_write_mb_s;   // 0 means no IO budget
 
   double mapper_obs_std_dev;
   double mapper_obs_huber_thresh;
@@ -106,6 +147,8 @@ struct VioConfig {
   double mapper_max_hamming_distance;
   double mapper_second_best_test_ratio;
   int mapper_bow_num_bits;
+  std::string mapper_vocabulary_path;  // vocabulary tree instead of HashBow
+  int mapper_vocabulary_direct_index_level;  // 0 disables the direct index
   double mapper_min_triangulation_dist;
   bool mapper_no_factor_weights;
   bool mapper_use_factors;
@@ -113,6 +156,9 @@ struct VioConfig {
   bool mapper_use_lm;
   double mapper_lm_lambda_min;
   double mapper_lm_lambda_max;
+
+  bool mapper_use_sqrt_ba;         // QR landmark blocks and sparse pose system
+  bool mapper_sqrt_ba_use_double;  // otherwise linearize and solve in float
 };
 
 }  // namespace basalt
@@ -0,0 +1,100 @@
+/**
+BSD 3-Clause License
+
+This file is part of the Basalt project.
+https://gitlab.com/VladyslavUsenko/basalt.git
+
+Copyright (c) 2022, Vladyslav Usenko and Nikolaus Demmel.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the copyright holder nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include <basalt/utils/eigen_utils.hpp>
+
+namespace basalt {
+
+/// Static spatial hash of 3D points for radius and view cone queries.
+///
+/// Points are bucketed into cubic voxels of fixed size. The positions are
+/// stored in single precision and sorted by voxel, so each voxel is a
+/// contiguous range and the memory is about 16 bytes per point plus one hash
+/// entry per occupied voxel. The index is built once and can't be updated.
+class VoxelHash {
+ public:
+  /// Indexes points[i] with id i. Previous contents are discarded.
+  void build(const Eigen::aligned_vector<Eigen::Vector3d>& points,
+             double voxel_size);
+
+  /// Ids of all points with |p - center| <= radius
+  void queryRadius(const Eigen::Vector3d& center, double radius,
+                   std::vector<uint32_t>& ids) const;
+
+  /// Ids of all points within max_dist of apex and at most half_angle away
+  /// from the unit direction dir as seen from apex. A half_angle of pi or
+  /// more is the full ball.
+  void queryCone(const Eigen::Vector3d& apex, const Eigen::Vector3d& dir,
+                 double half_angle, double max_dist,
+                 std::vector<uint32_t>& ids) const;
+
+  size_t size() const { return point_ids.size(); }
+
+  size_t numVoxels() const { return voxels.size(); }
+
+  /// Approximate memory held by the index in bytes
+  size_t memoryBytes() const;
+
+ private:
+  struct VoxelRange {
+    uint32_t begin;
+    uint32_t end;
+  };
+
+  Eigen::Vector3i voxelCoords(const Eigen::Vector3d& p) const;
+
+  static uint64_t voxelKey(const Eigen::Vector3i& v);
+
+  // Calls f(range) for every occupied voxel in [lo, hi] that check(center)
+  // accepts, where center is the center of the voxel.
+  template <class Check, class F>
+  void forEachVoxel(const Eigen::Vector3d& lo, const Eigen::Vector3d& hi,
+                    const Check& check, const F& f) const;
+
+  double voxel_size = 1.0;
+  std::unordered_map<uint64_t, VoxelRange> voxels;
+  Eigen::aligned_vector<Eigen::Vector3f> positions;
+  std::vector<uint32_t> point_ids;
+};
+
+}  // namespace basalt
@@ -34,6 +34,11 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 #pragma once
 
+#include <map>
+#include <unordered_set>
+#include <vector>
+
+#include <basalt/optical_flow/optical_flow.h>
 #include <basalt/vi_estimator/landmark_database.h>
 
 namespace basalt {
@@ -54,10 +59,25 @@ class BundleAdjustmentBase {
 
   using SE3 = Sophus::SE3<Scalar>;
 
+  /// Optical flow results of the frames in the sliding window by timestamp
+  using OpticalFlowWindow = std::map<
+      int64_t, OpticalFlowResult::Ptr, std::less<int64_t>,
+      tracked_allocator<std::pair<const int64_t, OpticalFlowResult::Ptr>,
+                        MemoryTag::OPTICAL_FLOW>>;
+
   void computeError(Scalar& error,
                     std::map<int, std::vector<std::pair<TimeCamId, Scalar>>>*
                         outliers = nullptr,
-                    Scalar outlier_threshold = 0) const;
+                    Scalar outlier_threshold = 0,
+                    const std::unordered_set<KeypointId>* active_landmarks =
+                        nullptr) const;
+
+  /// Selects at most max_landmarks landmarks to be optimized. Landmarks are
+  /// scored by number of observations and parallax, and picked round-robin
+  /// over host frames and image regions to keep a good spatial coverage.
+  void selectActiveLandmarks(
+      size_t max_landmarks,
+      std::unordered_set<KeypointId>& active_landmarks) const;
 
   void filterOutliers(Scalar outlier_threshold, int min_num_obs);
 
@@ -127,6 +147,53 @@ class BundleAdjustmentBase {
     return worldPoint;
   }
 
+  /// Multi-view triangulation of a point observed with the unit bearing f0
+  /// in camera 0 and the unit bearings fs[k] in cameras with poses T_0_k
+  /// relative to camera 0. The linear solution from all views is refined with
+  /// a few Gauss-Newton iterations on the inverse distance along f0. Returns
+  /// the point in the same representation as triangulate.
+  static Vec4 triangulateMultiView(const Vec3& f0,
+                                   const Eigen::aligned_vector<Vec3>& fs,
+                                   const Eigen::aligned_vector<SE3>& T_0_k,
+                                   int num_iterations = 3);
+
+  /// New landmark of a keyframe with the cameras of the keyframe observing
+  /// it and all its observations in the sliding window
+  struct LandmarkCandidate {
+    KeypointId lm_id;
+    std::vector<int> host_cams;
+    std::map<TimeCamId, KeypointObservation<Scalar>> obs;
+  };
+
+  /// New landmarks of a keyframe, with the cameras observing them in
+  /// new_lm_cams, and all their observations in opt_flow_res
+  static std::vector<LandmarkCandidate> collectLandmarkCandidates(
+      const std::map<KeypointId, std::vector<int>>& new_lm_cams,
+      const OpticalFlowWindow& opt_flow_res);
+
+  /// Triangulates the new landmarks of keyframe t_ns in parallel from all
+  /// their observations and adds the accepted ones with their observations
+  /// to lmdb. A landmark is accepted if one observation has a baseline of at
+  /// least min_dist and a parallax angle to the keyframe observation of at
+  /// least min_parallax (radians), and its inverse distance is in (0, 3).
+  /// With balance_hosts it is hosted in the camera with the fewest landmarks
+  /// in num_hosted, otherwise in the first of host_cams. Returns the number
+  /// of added landmarks.
+  int triangulateLandmarks(int64_t t_ns,
+                           const std::vector<LandmarkCandidate>& candidates,
+                           Scalar min_dist, Scalar min_parallax,
+                           bool balance_hosts, std::vector<int>& num_hosted);
+
+  /// Triangulates the new landmarks of keyframe t_ns one after the other from
+  /// two views: the first host camera that has an observation with a baseline
+  /// of at least min_dist and an inverse distance in (0, 3) hosts the
+  /// landmark. With balance_hosts the host cameras are tried in the order of
+  /// their landmarks in num_hosted. Accepted landmarks are added with their
+  /// observations to lmdb. Returns the number of added landmarks.
+  int triangulateLandmarksTwoView(
+      int64_t t_ns, const std::vector<LandmarkCandidate>& candidates,
+      Scalar min_dist, bool balance_hosts, std::vector<int>& num_hosted);
+
   inline void backup() {
     for (auto& kv : frame_states) kv.second.backup();
     for (auto& kv : frame_poses) kv.second.backup();
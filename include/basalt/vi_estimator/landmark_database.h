@@ -35,6 +35,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #pragma once
 
 #include <basalt/utils/imu_types.h>
+#include <basalt/utils/memory_tracking.h>
 #include <basalt/utils/eigen_utils.hpp>
 
 namespace basalt {
@@ -55,7 +56,12 @@ struct Keypoint {
   using Scalar = Scalar_;
   using Vec2 = Eigen::Matrix<Scalar, 2, 1>;
 
-  using ObsMap = Eigen::aligned_map<TimeCamId, Vec2>;
+  using ObsMap = std::map<
+      TimeCamId, Vec2, std::less<TimeCamId>,
+      tracked_allocator<std::pair<const TimeCamId, Vec2>,
+                        MemoryTag::LANDMARK_DATABASE,
+                        Eigen::aligned_allocator<
+                            std::pair<const TimeCamId, Vec2>>>>;
   using MapIter = typename ObsMap::iterator;
 
   // 3D position parameters
@@ -88,6 +94,14 @@ class LandmarkDatabase {
  public:
   using Scalar = Scalar_;
 
+  using KeypointMap = std::unordered_map<
+      KeypointId, Keypoint<Scalar>, std::hash<KeypointId>,
+      std::equal_to<KeypointId>,
+      tracked_allocator<std::pair<const KeypointId, Keypoint<Scalar>>,
+                        MemoryTag::LANDMARK_DATABASE,
+                        Eigen::aligned_allocator<
+                            std::pair<const KeypointId, Keypoint<Scalar>>>>>;
+
   // Non-const
   void addLandmark(KeypointId lm_id, const Keypoint<Scalar>& pos);
 
@@ -114,8 +128,7 @@ class LandmarkDatabase {
                            std::map<TimeCamId, std::set<KeypointId>>>&
   getObservations() const;
 
-  const Eigen::aligned_unordered_map<KeypointId, Keypoint<Scalar>>&
-  getLandmarks() const;
+  const KeypointMap& getLandmarks() const;
 
   bool landmarkExists(int lm_id) const;
 
@@ -138,14 +151,12 @@ class LandmarkDatabase {
   }
 
  private:
-  using MapIter =
-      typename Eigen::aligned_unordered_map<KeypointId,
-                                            Keypoint<Scalar>>::iterator;
+  using MapIter = typename KeypointMap::iterator;
   MapIter removeLandmarkHelper(MapIter it);
   typename Keypoint<Scalar>::MapIter removeLandmarkObservationHelper(
       MapIter it, typename Keypoint<Scalar>::MapIter it2);
 
-  Eigen::aligned_unordered_map<KeypointId, Keypoint<Scalar>> kpts;
+  KeypointMap kpts;
 
   std::unordered_map<TimeCamId, std::map<TimeCamId, std::set<KeypointId>>>
       observations;
@@ -0,0 +1,171 @@
+/**
+BSD 3-Clause License
+
+This file is part of the Basalt project.
+https://gitlab.com/VladyslavUsenko/basalt.git
+
+Copyright (c) 2022, Vladyslav Usenko and Nikolaus Demmel.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the copyright holder nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Eigen/Dense>
+#include <sophus/se3.hpp>
+
+#include <basalt/calibration/calibration.hpp>
+#include <basalt/optical_flow/optical_flow.h>
+#include <basalt/utils/keypoints.h>
+#include <basalt/utils/vio_config.h>
+#include <basalt/utils/voxel_hash.h>
+
+namespace basalt {
+
+/// Landmarks of a map built by the mapper that the VIO can localize against.
+/// Positions are in the world frame of the mapped session.
+struct LocalizationMap {
+  using Ptr = std::shared_ptr<LocalizationMap>;
+
+  Eigen::aligned_vector<Eigen::Vector3d> points;
+  std::vector<Descriptor> descriptors;
+
+  /// Keyframe poses T_w_i of the mapped session
+  Eigen::aligned_map<int64_t, Sophus::SE3d> keyframe_poses;
+
+  /// Spatial indices of the landmarks and the keyframe positions. They are
+  /// not saved, but rebuilt by load().
+  VoxelHash point_index;
+  VoxelHash keyframe_index;
+  std::vector<int64_t> keyframe_index_t_ns;
+
+  bool save(const std::string& path) const;
+  bool load(const std::string& path);
+
+  /// (Re)builds the spatial indices after points or keyframes changed
+  void buildIndex(double voxel_size = 1.0);
+
+  /// Indices of the landmarks at most max_dist away from the camera with
+  /// pose T_w_c that project into its width x height image. If proj is given,
+  /// it receives the corresponding projections.
+  void queryVisiblePoints(const Sophus::SE3d& T_w_c,
+                          const GenericCamera<double>& cam, int width,
+                          int height, double max_dist,
+                          std::vector<uint32_t>& ids,
+                          Eigen::aligned_vector<Eigen::Vector2d>* proj =
+                              nullptr) const;
+
+  /// Timestamps of the keyframes within radius of T_w_i whose orientation
+  /// differs from it by at most max_angle, i.e. keyframes that likely see
+  /// the same landmarks.
+  void queryKeyframes(const Sophus::SE3d& T_w_i, double radius,
+                      double max_angle, std::vector<int64_t>& t_ns) const;
+};
+
+/// Observation of a fixed map landmark in one camera of a frame
+struct MapObservation {
+  size_t cam_id;
+  Eigen::Vector3d p_w;  //!< Landmark position in the VIO world frame
+  Eigen::Vector2d pos;  //!< Observed position in the image
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+using MapObservations = Eigen::aligned_vector<MapObservation>;
+
+/// Finds map landmarks in VIO keyframes.
+///
+/// Until it succeeds, keyframes are relocalized against the whole map with
+/// descriptor matching and absolute pose RANSAC. This runs on a separate
+/// thread, since its cost grows with the size of the map, and always takes
+/// the latest keyframe that was handed over. That gives the alignment T_w_map
+/// between the VIO world and the map. Afterwards the map landmarks are
+/// projected with the current pose estimate and matched by descriptor to
+/// nearby optical flow keypoints, at most one keypoint per landmark and
+/// camera. Keyframes with fewer than vio_map_min_matches matches get no map
+/// observations, and after vio_map_max_failed_kfs of them in a row the
+/// alignment is dropped and the map relocalized again.
+class MapLocalizer {
+ public:
+  using Ptr = std::unique_ptr<MapLocalizer>;
+
+  MapLocalizer(const LocalizationMap::Ptr& map,
+               const Calibration<double>& calib, const VioConfig& config);
+
+  ~MapLocalizer();
+
+  /// Map landmarks observed by the keyframe with body pose T_w_i. Before
+  /// the alignment is known, the keyframe is handed to the relocalization
+  /// thread instead and obs stays empty. Observations made with an earlier
+  /// alignment must be discarded when isLocalized() returns false.
+  void match(const OpticalFlowResult& opt_flow, const Sophus::SE3d& T_w_i,
+             MapObservations& obs);
+
+  bool isLocalized() const { return localized; }
+
+  const Sophus::SE3d& getT_w_map() const { return T_w_map; }
+
+ private:
+  /// Localizes the keyframe against the whole map and returns the alignment
+  /// in T_w_map_reloc on success
+  bool relocalize(const OpticalFlowInput& images, const Sophus::SE3d& T_w_i,
+                  Sophus::SE3d& T_w_map_reloc, size_t& num_inliers) const;
+
+  void relocalizationLoop();
+
+  void matchProjected(const OpticalFlowResult& opt_flow,
+                      const Sophus::SE3d& T_w_i, MapObservations& obs) const;
+
+  LocalizationMap::Ptr map;
+  Calibration<double> calib;
+  VioConfig config;
+
+  bool localized = false;
+  Sophus::SE3d T_w_map;
+  int num_failed_kfs = 0;  //!< Keyframes in a row with too few matches
+
+  // Keyframe waiting for relocalization and the alignment found by the
+  // relocalization thread, guarded by reloc_mutex
+  std::mutex reloc_mutex;
+  std::condition_variable reloc_cv;
+  OpticalFlowInput::Ptr reloc_images;
+  Sophus::SE3d reloc_T_w_i;
+  std::optional<Sophus::SE3d> reloc_result;
+  size_t reloc_num_inliers = 0;
+  bool reloc_stop = false;
+
+  std::thread reloc_thread;
+};
+
+}  // namespace basalt
@@ -37,6 +37,9 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <Eigen/Dense>
 #include <set>
+#include <vector>
+
+#include <basalt/utils/imu_types.h>
 
 namespace basalt {
 
@@ -64,5 +67,21 @@ class MargHelper {
                                           const std::set<int>& idx_to_keep,
                                           const std::set<int>& idx_to_marg,
                                           MatX& marg_sqrt_H, VecX& marg_sqrt_b);
+
+  // Non-linear factor recovery: replaces the prior (H, b) by the factors with
+  // the given Jacobians, all centered at the mean of the prior. The
+  // information of each factor is recovered from the marginal covariance of
+  // the prior, so it should be invariant to the unobservable directions if the
+  // prior is rank deficient. The result has the format (is_sqrt) of the input.
+  static void sparsifyHelper(const MatX& H, const VecX& b, bool is_sqrt,
+                             const std::vector<Eigen::MatrixXd>& factor_J,
+                             MatX& sparse_H, VecX& sparse_b);
 };
+
+// Reduces a marginalization prior to the poses of its keyframes, which is all
+// NfrMapper uses, and stores it as an upper-triangular square-root factor.
+// Velocities and biases, and states of frames that are not keyframes, are
+// marginalized. Accepts both square and square-root input and is a no-op for
+// data that is already compact.
+void compactMargData(MargData& m);
 }  // namespace basalt
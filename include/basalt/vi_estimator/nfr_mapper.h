@@ -41,7 +41,9 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <sophus/se3.hpp>
 
 #include <basalt/utils/common_types.h>
+#include <basalt/utils/memory_tracking.h>
 #include <basalt/utils/nfr.h>
+#include <basalt/vi_estimator/map_localization.h>
 #include <basalt/vi_estimator/sc_ba_base.h>
 #include <basalt/vi_estimator/vio_estimator.h>
 
@@ -53,7 +55,58 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 namespace basalt {
 
 template <size_t N>
-class HashBow;
+class BowDatabase;
+
+// Factors are always evaluated in double and added to the accumulator in its
+// own precision.
+template <class AccumT>
+double linearizeRollPitchFactor(const RollPitchFactor& rpf,
+                                const Sophus::SE3d& pose, int idx,
+                                AccumT& accum) {
+  using AccumScalar = typename AccumT::Scalar;
+
+  Eigen::Matrix<double, 2, POSE_SIZE> J;
+  Sophus::Vector2d res = basalt::rollPitchError(pose, rpf.R_w_i_meas, &J);
+
+  accum.template addH<POSE_SIZE, POSE_SIZE>(
+      idx, idx, (J.transpose() * rpf.cov_inv * J).template cast<AccumScalar>());
+  accum.template addB<POSE_SIZE>(
+      idx, (J.transpose() * rpf.cov_inv * res).template cast<AccumScalar>());
+
+  return res.transpose() * rpf.cov_inv * res;
+}
+
+template <class AccumT>
+double linearizeRelPoseFactor(const RelPoseFactor& rpf,
+                              const Sophus::SE3d& pose_i,
+                              const Sophus::SE3d& pose_j, int idx_i, int idx_j,
+                              AccumT& accum) {
+  using AccumScalar = typename AccumT::Scalar;
+
+  Sophus::Matrix6d Ji, Jj;
+  Sophus::Vector6d res =
+      basalt::relPoseError(rpf.T_i_j, pose_i, pose_j, &Ji, &Jj);
+
+  accum.template addH<POSE_SIZE, POSE_SIZE>(
+      idx_i, idx_i,
+      (Ji.transpose() * rpf.cov_inv * Ji).template cast<AccumScalar>());
+  accum.template addH<POSE_SIZE, POSE_SIZE>(
+      idx_i, idx_j,
+      (Ji.transpose() * rpf.cov_inv * Jj).template cast<AccumScalar>());
+  accum.template addH<POSE_SIZE, POSE_SIZE>(
+      idx_j, idx_i,
+      (Jj.transpose() * rpf.cov_inv * Ji).template cast<AccumScalar>());
+  accum.template addH<POSE_SIZE, POSE_SIZE>(
+      idx_j, idx_j,
+      (Jj.transpose() * rpf.cov_inv * Jj).template cast<AccumScalar>());
+
+  accum.template addB<POSE_SIZE>(
+      idx_i, (Ji.transpose() * rpf.cov_inv * res).template cast<AccumScalar>());
+  accum.template addB<POSE_SIZE>(
+      idx_j, (Jj.transpose() * rpf.cov_inv * res).template cast<AccumScalar>());
+
+  return res.transpose() * rpf.cov_inv * res;
+}
 
 class NfrMapper : public ScBundleAdjustmentBase<double> {
  public:
@@ -112,15 +165,8 @@ class NfrMapper : public ScBundleAdjustmentBase<double> {
 
         int idx = this->aom.abs_order_map.at(rpf.t_ns).first;
 
-        Eigen::Matrix<double, 2, POSE_SIZE> J;
-        Sophus::Vector2d res = basalt::rollPitchError(pose, rpf.R_w_i_meas, &J);
-
-        this->accum.template addH<POSE_SIZE, POSE_SIZE>(
-            idx, idx, J.transpose() * rpf.cov_inv * J);
-        this->accum.template addB<POSE_SIZE>(idx,
-                                             J.transpose() * rpf.cov_inv * res);
-
-        roll_pitch_error += res.transpose() * rpf.cov_inv * res;
+        roll_pitch_error +=
+            linearizeRollPitchFactor(rpf, pose, idx, this->accum);
       }
     }
 
@@ -132,25 +178,8 @@ class NfrMapper : public ScBundleAdjustmentBase<double> {
         int idx_i = this->aom.abs_order_map.at(rpf.t_i_ns).first;
         int idx_j = this->aom.abs_order_map.at(rpf.t_j_ns).first;
 
-        Sophus::Matrix6d Ji, Jj;
-        Sophus::Vector6d res =
-            basalt::relPoseError(rpf.T_i_j, pose_i, pose_j, &Ji, &Jj);
-
-        this->accum.template addH<POSE_SIZE, POSE_SIZE>(
-            idx_i, idx_i, Ji.transpose() * rpf.cov_inv * Ji);
-        this->accum.template addH<POSE_SIZE, POSE_SIZE>(
-            idx_i, idx_j, Ji.transpose() * rpf.cov_inv * Jj);
-        this->accum.template addH<POSE_SIZE, POSE_SIZE>(
-            idx_j, idx_i, Jj.transpose() * rpf.cov_inv * Ji);
-        this->accum.template addH<POSE_SIZE, POSE_SIZE>(
-            idx_j, idx_j, Jj.transpose() * rpf.cov_inv * Jj);
-
-        this->accum.template addB<POSE_SIZE>(
-            idx_i, Ji.transpose() * rpf.cov_inv * res);
-        this->accum.template addB<POSE_SIZE>(
-            idx_j, Jj.transpose() * rpf.cov_inv * res);
-
-        rel_error += res.transpose() * rpf.cov_inv * res;
+        rel_error += linearizeRelPoseFactor(rpf, pose_i, pose_j, idx_i, idx_j,
+                                            this->accum);
       }
     }
 
@@ -170,6 +199,13 @@ class NfrMapper : public ScBundleAdjustmentBase<double> {
 
   void optimize(int num_iterations = 10);
 
+  // Same as optimize(), but landmarks are eliminated with the QR landmark
+  // blocks of the VIO and the reduced pose system is accumulated sparsely.
+  // Linearization and solve run in SqrtScalar, the states stay in double.
+  // Selected with config.mapper_use_sqrt_ba.
+  template <class SqrtScalar>
+  void optimizeSqrt(int num_iterations);
+
   Eigen::aligned_map<int64_t, PoseStateWithLin<Scalar>>& getFramePoses();
 
   void computeRelPose(double& rel_error);
@@ -187,12 +223,21 @@ class NfrMapper : public ScBundleAdjustmentBase<double> {
 
   void setup_opt();
 
+  // Landmarks with the descriptors of their host keypoints, for map-aided
+  // localization in the VIO (config.vio_map_path)
+  void getLocalizationMap(LocalizationMap& map) const;
+
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
   Eigen::aligned_vector<RollPitchFactor> roll_pitch_factors;
   Eigen::aligned_vector<RelPoseFactor> rel_pose_factors;
 
-  std::unordered_map<int64_t, OpticalFlowInput::Ptr> img_data;
+  std::unordered_map<
+      int64_t, OpticalFlowInput::Ptr, std::hash<int64_t>,
+      std::equal_to<int64_t>,
+      tracked_allocator<std::pair<const int64_t, OpticalFlowInput::Ptr>,
+                        MemoryTag::MAPPER>>
+      img_data;
 
   Corners feature_corners;
 
@@ -200,7 +245,12 @@ class NfrMapper : public ScBundleAdjustmentBase<double> {
 
   FeatureTracks feature_tracks;
 
-  std::shared_ptr<HashBow<256>> hash_bow_database;
+  std::shared_ptr<BowDatabase<256>> hash_bow_database;
+
+  /// Image pairs that match_all() selected for matching and how many of them
+  /// were verified by RANSAC
+  size_t num_match_candidates = 0;
+  size_t num_verified_pairs = 0;
 
   VioConfig config;
 
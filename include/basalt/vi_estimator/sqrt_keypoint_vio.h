@@ -34,11 +34,14 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 #pragma once
 
+#include <mutex>
 #include <thread>
 
 #include <basalt/imu/preintegration.h>
+#include <basalt/utils/memory_tracking.h>
 #include <basalt/utils/time_utils.hpp>
 
+#include <basalt/vi_estimator/map_localization.h>
 #include <basalt/vi_estimator/sqrt_ba_base.h>
 #include <basalt/vi_estimator/vio_estimator.h>
 
@@ -76,6 +79,7 @@ class SqrtKeypointVioEstimator : public VioEstimatorBase,
   using BundleAdjustmentBase<Scalar>::restore;
   using BundleAdjustmentBase<Scalar>::getPoseStateWithLin;
   using BundleAdjustmentBase<Scalar>::computeModelCostChange;
+  using BundleAdjustmentBase<Scalar>::selectActiveLandmarks;
 
   using SqrtBundleAdjustmentBase<Scalar>::linearizeHelper;
   using SqrtBundleAdjustmentBase<Scalar>::linearizeAbsHelper;
@@ -128,6 +132,10 @@ class SqrtKeypointVioEstimator : public VioEstimatorBase,
                    const std::unordered_set<KeypointId>& lost_landmaks);
   void optimize();
 
+  /// Replaces the dense marginalization prior by factors recovered from it
+  /// (config.vio_marg_sparsify_interval), see MargHelper::sparsifyHelper
+  void sparsifyMargPrior();
+
   void debug_finalize() override;
 
   void logMargNullspace();
@@ -205,6 +213,9 @@ class SqrtKeypointVioEstimator : public VioEstimatorBase,
     return T_w_i_init.template cast<double>();
   }
 
+  bool saveCheckpoint(std::ostream& os) override;
+  std::function<void()> prepareRestore(std::istream& is) override;
+
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
  private:
@@ -218,25 +229,55 @@ class SqrtKeypointVioEstimator : public VioEstimatorBase,
  private:
   bool take_kf;
   int frames_after_kf;
+  bool kf_requested;  // new points requested from the optical flow since kf
   std::set<int64_t> kf_ids;
 
   int64_t last_state_t_ns;
   Eigen::aligned_map<int64_t, IntegratedImuMeasurement<Scalar>> imu_meas;
 
+  // What was integrated into each of imu_meas, to integrate it again when a
+  // checkpoint is restored
+  struct ImuMeasInput {
+    Vec3 bias_gyro, bias_accel;
+    Eigen::aligned_vector<ImuData<Scalar>> samples;
+
+    template <class Archive>
+    void save(Archive& ar) const {
+      ar(bias_gyro, bias_accel, uint64_t(samples.size()));
+      for (const auto& d : samples) ar(d.t_ns, d.accel, d.gyro);
+    }
+
+    template <class Archive>
+    void load(Archive& ar) {
+      uint64_t num_samples;
+      ar(bias_gyro, bias_accel, num_samples);
+      samples.resize(num_samples);
+      for (auto& d : samples) ar(d.t_ns, d.accel, d.gyro);
+    }
+  };
+  Eigen::aligned_map<int64_t, ImuMeasInput> imu_meas_inputs;
+
   const Vec3 g;
 
   // Input
 
-  Eigen::aligned_map<int64_t, OpticalFlowResult::Ptr> prev_opt_flow_res;
+  typename BundleAdjustmentBase<Scalar>::OpticalFlowWindow prev_opt_flow_res;
 
   std::map<int64_t, int> num_points_kf;
 
+  // Map-aided localization (config.vio_map_path)
+  MapLocalizer::Ptr map_localizer;
+  std::map<int64_t, MapObservations> map_obs;
+
   // Marginalization
   MargLinData<Scalar> marg_data;
 
   // Used only for debug and log purporses.
   MargLinData<Scalar> nullspace_marg_data;
 
+  // Marginalizations since the prior was last sparsified
+  int num_margs_since_sparsify = 0;
+
   Vec3 gyro_bias_sqrt_weight, accel_bias_sqrt_weight;
 
   size_t max_states;
@@ -255,8 +296,12 @@ class SqrtKeypointVioEstimator : public VioEstimatorBase,
 
   std::shared_ptr<std::thread> processing_thread;
 
+  // Held while a frame is processed, so checkpoints are taken between frames
+  std::mutex state_mutex;
+
   // timing and stats
   ExecutionStats stats_all_;
   ExecutionStats stats_sums_;
+  MemoryStatsReporter memory_stats_;
 };
 }  // namespace basalt
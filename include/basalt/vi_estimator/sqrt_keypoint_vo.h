@@ -39,6 +39,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <basalt/vi_estimator/sqrt_ba_base.h>
 #include <basalt/vi_estimator/vio_estimator.h>
 
+#include <basalt/utils/memory_tracking.h>
 #include <basalt/utils/time_utils.hpp>
 
 namespace basalt {
@@ -73,6 +74,7 @@ class SqrtKeypointVoEstimator : public VioEstimatorBase,
   using BundleAdjustmentBase<Scalar>::restore;
   using BundleAdjustmentBase<Scalar>::getPoseStateWithLin;
   using BundleAdjustmentBase<Scalar>::computeModelCostChange;
+  using BundleAdjustmentBase<Scalar>::selectActiveLandmarks;
 
   using SqrtBundleAdjustmentBase<Scalar>::linearizeHelper;
   using SqrtBundleAdjustmentBase<Scalar>::linearizeAbsHelper;
@@ -211,6 +213,7 @@ class SqrtKeypointVoEstimator : public VioEstimatorBase,
  private:
   bool take_kf;              // true if next frame should become kf
   int frames_after_kf;       // number of frames since last kf
+  bool kf_requested;         // new points requested since last kf
   std::set<int64_t> kf_ids;  // sliding window frame ids
 
   // timestamp of latest state in the sliding window
@@ -220,7 +223,7 @@ class SqrtKeypointVoEstimator : public VioEstimatorBase,
 
   // Input
 
-  Eigen::aligned_map<int64_t, OpticalFlowResult::Ptr> prev_opt_flow_res;
+  typename BundleAdjustmentBase<Scalar>::OpticalFlowWindow prev_opt_flow_res;
 
   std::map<int64_t, int> num_points_kf;
 
@@ -248,5 +251,6 @@ class SqrtKeypointVoEstimator : public VioEstimatorBase,
   // timing and stats
   ExecutionStats stats_all_;
   ExecutionStats stats_sums_;
+  MemoryStatsReporter memory_stats_;
 };
 }  // namespace basalt
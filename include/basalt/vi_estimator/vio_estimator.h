@@ -35,6 +35,8 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #pragma once
 
 #include <atomic>
+#include <functional>
+#include <iosfwd>
 
 #include <basalt/optical_flow/optical_flow.h>
 #include <basalt/utils/imu_types.h>
@@ -90,6 +92,10 @@ class VioEstimatorBase {
   tbb::concurrent_queue<PoseVelBiasState<double>::Ptr>* opt_flow_state_queue =
       nullptr;
   tbb::concurrent_queue<Masks>* opt_flow_masks_queue = nullptr;
+  tbb::concurrent_queue<int64_t>* opt_flow_kf_request_queue = nullptr;
+
+  /// Runs the frames in a shared thread pool if set, before the first frame
+  TrackerScheduler::Instance::Ptr scheduler_instance;
 
   virtual void initialize(int64_t t_ns, const Sophus::SE3d& T_w_i,
                           const Eigen::Vector3d& vel_w_i,
@@ -119,6 +125,32 @@ class VioEstimatorBase {
 
   virtual Sophus::SE3d getT_w_i_init() = 0;
 
+  /// Writes the sliding-window state (states, landmarks, marginalization
+  /// prior, IMU measurements and observations of the frames in the window), so
+  /// that a new estimator with the same config and calibration can resume from
+  /// it after restoreCheckpoint. Safe to call while running, the state is
+  /// taken between two frames. Returns false if unsupported or not initialized.
+  virtual bool saveCheckpoint(std::ostream& /*os*/) { return false; }
+
+  /// Reads and validates a state written by saveCheckpoint without applying
+  /// it. Returns the function that applies it, or an empty one if unsupported
+  /// or if the data is invalid. Lets callers restore several components all
+  /// or nothing.
+  virtual std::function<void()> prepareRestore(std::istream& /*is*/) {
+    return {};
+  }
+
+  /// Restores a state written by saveCheckpoint. Use it instead of the
+  /// initialize() overload with the initial state, then start processing with
+  /// initialize(bg, ba), whose biases are ignored. Returns false and leaves
+  /// the state unchanged if it can't.
+  bool restoreCheckpoint(std::istream& is) {
+    std::function<void()> apply = prepareRestore(is);
+    if (!apply) return false;
+    apply();
+    return true;
+  }
+
   // Legacy functions. Should not be used in the new code.
   virtual void setMaxStates(size_t val) = 0;
   virtual void setMaxKfs(size_t val) = 0;
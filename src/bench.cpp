@@ -0,0 +1,971 @@
+/**
+BSD 3-Clause License
+
+This file is part of the Basalt project.
+https://gitlab.com/VladyslavUsenko/basalt.git
+
+Copyright (c) 2022, Vladyslav Usenko and Nikolaus Demmel.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the copyright holder nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Microbenchmarks of the hot kernels of the front end and the back end. All
+// inputs are synthetic and generated from fixed seeds, so results of
+// different commits are comparable. Unless --benchmark_out is given, the
+// results are also written to stats_bench.json in the google benchmark JSON
+// format.
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <basalt/calibration/calibration.hpp>
+#include <basalt/hash_bow/hash_bow.h>
+#include <basalt/hash_bow/vocabulary_tree.h>
+#include <basalt/imu/preintegration.h>
+#include <basalt/optical_flow/frame_to_frame_optical_flow.h>
+#include <basalt/optical_flow/gradient_pyramid.h>
+#include <basalt/optical_flow/patch.h>
+#include <basalt/utils/keypoints.h>
+#include <basalt/utils/tracker_scheduler.h>
+#include <basalt/utils/vio_config.h>
+#include <basalt/vi_estimator/map_localization.h>
+#include <basalt/vi_estimator/marg_helper.h>
+#include <basalt/vi_estimator/vio_estimator.h>
+
+#ifdef BASALT_INSTANTIATIONS_DOUBLE
+#include <basalt/linearization/linearization_base.hpp>
+#endif
+
+namespace {
+
+constexpr int IMG_W = 752;
+constexpr int IMG_H = 480;
+constexpr int NUM_LEVELS = 3;
+
+// Textured image with blobs and edges for corners, shifted by (dx, dy)
+basalt::ManagedImage<uint16_t> makeImage(double dx = 0, double dy = 0) {
+  basalt::ManagedImage<uint16_t> img(IMG_W, IMG_H);
+
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<double> pos_x(0, IMG_W), pos_y(0, IMG_H);
+  std::uniform_real_distribution<double> radius(3, 15), intensity(-1, 1);
+
+  struct Blob {
+    double x, y, r, v;
+  };
+  std::vector<Blob> blobs(400);
+  for (auto& b : blobs) {
+    b = {pos_x(gen), pos_y(gen), radius(gen), intensity(gen)};
+  }
+
+  for (int y = 0; y < IMG_H; y++) {
+    for (int x = 0; x < IMG_W; x++) {
+      const double u = x - dx;
+      const double v = y - dy;
+      double val = 0.5 + 0.1 * std::sin(u / 17.0) * std::cos(v / 11.0);
+      for (const auto& b : blobs) {
+        const double d2 = (u - b.x) * (u - b.x) + (v - b.y) * (v - b.y);
+        if (d2 < b.r * b.r) val += 0.3 * b.v;
+      }
+      val = std::min(1.0, std::max(0.0, val));
+      img(x, y) = uint16_t(val * 65535);
+    }
+  }
+
+  return img;
+}
+
+void makePyr(basalt::ManagedImagePyr<uint16_t>& pyr, double dx = 0,
+             double dy = 0) {
+  pyr.setFromImage(makeImage(dx, dy), NUM_LEVELS);
+}
+
+// Grid of points away from the image border
+Eigen::aligned_vector<Eigen::Vector2f> makePoints(int step = 20) {
+  Eigen::aligned_vector<Eigen::Vector2f> points;
+  for (int y = 40; y < IMG_H - 40; y += step) {
+    for (int x = 40; x < IMG_W - 40; x += step) {
+      points.emplace_back(x + 0.3f, y + 0.7f);
+    }
+  }
+  return points;
+}
+
+basalt::KeypointsData makeKeypoints(
+    const basalt::ManagedImagePyr<uint16_t>& pyr, bool descriptors) {
+  basalt::KeypointsData kd;
+  basalt::detectKeypoints(pyr.lvl(0), kd, 32, 4);
+  if (descriptors) {
+    basalt::computeAngles(pyr.lvl(0), kd, true);
+    basalt::computeDescriptors(pyr.lvl(0), kd);
+  }
+  return kd;
+}
+
+basalt::Calibration<double> makeCalib() {
+  basalt::Calibration<double> calib;
+  basalt::GenericCamera<double> cam;
+  cam.variant = basalt::KannalaBrandtCamera4<double>::getTestProjections()[0];
+  calib.intrinsics.emplace_back(cam);
+  calib.T_i_c.emplace_back();
+  calib.resolution.emplace_back(IMG_W, IMG_H);
+  return calib;
+}
+
+template <class Pattern>
+void BM_PatchSetFromImage(benchmark::State& state) {
+  using PatchT = basalt::OpticalFlowPatch<float, Pattern>;
+
+  basalt::ManagedImagePyr<uint16_t> pyr;
+  makePyr(pyr);
+  const auto points = makePoints();
+
+  for (auto _ : state) {
+    for (const auto& p : points) {
+      PatchT patch(pyr.lvl(0), p);
+      benchmark::DoNotOptimize(patch.valid);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * points.size());
+}
+BENCHMARK_TEMPLATE(BM_PatchSetFromImage, basalt::Pattern24<float>);
+BENCHMARK_TEMPLATE(BM_PatchSetFromImage, basalt::Pattern52<float>);
+
+// Same as BM_PatchSetFromImage with precomputed gradients. Building them is
+// measured separately by BM_GradientPyramidSetFromPyramid.
+template <class Pattern>
+void BM_PatchSetFromGradients(benchmark::State& state) {
+  using PatchT = basalt::OpticalFlowPatch<float, Pattern>;
+
+  basalt::ManagedImagePyr<uint16_t> pyr;
+  makePyr(pyr);
+  basalt::GradientPyramid grads;
+  grads.setFromPyramid(pyr, NUM_LEVELS);
+  const auto points = makePoints();
+
+  for (auto _ : state) {
+    for (const auto& p : points) {
+      PatchT patch;
+      patch.setFromImage(grads.lvl(0), p);
+      benchmark::DoNotOptimize(patch.valid);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * points.size());
+}
+BENCHMARK_TEMPLATE(BM_PatchSetFromGradients, basalt::Pattern24<float>);
+BENCHMARK_TEMPLATE(BM_PatchSetFromGradients, basalt::Pattern52<float>);
+
+template <class Pattern>
+void BM_PatchResidual(benchmark::State& state) {
+  using PatchT = basalt::OpticalFlowPatch<float, Pattern>;
+
+  basalt::ManagedImagePyr<uint16_t> pyr_1;
+  makePyr(pyr_1);
+  basalt::ManagedImagePyr<uint16_t> pyr_2;
+  makePyr(pyr_2, 1.5, -0.5);
+  const auto points = makePoints();
+
+  Eigen::aligned_vector<PatchT> patches;
+  for (const auto& p : points) patches.emplace_back(pyr_1.lvl(0), p);
+
+  typename PatchT::VectorP res;
+
+  for (auto _ : state) {
+    for (const auto& patch : patches) {
+      typename PatchT::Matrix2P transformed_pat = PatchT::pattern2;
+      transformed_pat.colwise() += patch.pos;
+      benchmark::DoNotOptimize(
+          patch.residual(pyr_2.lvl(0), transformed_pat, res));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * patches.size());
+}
+BENCHMARK_TEMPLATE(BM_PatchResidual, basalt::Pattern24<float>);
+BENCHMARK_TEMPLATE(BM_PatchResidual, basalt::Pattern52<float>);
+
+template <template <typename> class Pattern>
+void BM_TrackPoint(benchmark::State& state) {
+  using FlowT = basalt::FrameToFrameOpticalFlow<float, Pattern>;
+
+  basalt::VioConfig config;
+  config.optical_flow_levels = NUM_LEVELS;
+  FlowT flow(config, makeCalib());
+
+  basalt::ManagedImagePyr<uint16_t> pyr_1;
+  makePyr(pyr_1);
+  basalt::ManagedImagePyr<uint16_t> pyr_2;
+  makePyr(pyr_2, 3.5, -2.5);
+  const auto points = makePoints();
+
+  for (auto _ : state) {
+    for (const auto& p : points) {
+      Eigen::AffineCompact2f transform_1, transform_2;
+      transform_1.setIdentity();
+      transform_1.translation() = p;
+      transform_2 = transform_1;
+      benchmark::DoNotOptimize(
+          flow.trackPoint(pyr_1, pyr_2, transform_1, transform_2));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * points.size());
+
+  // Stop the processing thread
+  flow.input_queue.push(nullptr);
+}
+BENCHMARK_TEMPLATE(BM_TrackPoint, basalt::Pattern24);
+BENCHMARK_TEMPLATE(BM_TrackPoint, basalt::Pattern52);
+
+void BM_ImagePyrSetFromImage(benchmark::State& state) {
+  const auto img = makeImage();
+
+  for (auto _ : state) {
+    basalt::ManagedImagePyr<uint16_t> pyr;
+    pyr.setFromImage(img, NUM_LEVELS);
+    benchmark::DoNotOptimize(pyr.lvl(NUM_LEVELS).ptr);
+  }
+  state.SetItemsProcessed(state.iterations() * IMG_W * IMG_H);
+}
+BENCHMARK(BM_ImagePyrSetFromImage);
+
+void BM_GradientPyramidSetFromPyramid(benchmark::State& state) {
+  basalt::ManagedImagePyr<uint16_t> pyr;
+  makePyr(pyr);
+
+  basalt::GradientPyramid grads;
+  for (auto _ : state) {
+    grads.setFromPyramid(pyr, NUM_LEVELS);
+    benchmark::DoNotOptimize(grads.lvl(NUM_LEVELS).w);
+  }
+  state.SetItemsProcessed(state.iterations() * IMG_W * IMG_H);
+  // Six times the memory of the uint16_t image pyramid
+  state.counters["bytes"] = grads.memoryUsage();
+}
+BENCHMARK(BM_GradientPyramidSetFromPyramid);
+
+void BM_DetectKeypoints(benchmark::State& state) {
+  basalt::ManagedImagePyr<uint16_t> pyr;
+  makePyr(pyr);
+
+  for (auto _ : state) {
+    basalt::KeypointsData kd;
+    basalt::detectKeypoints(pyr.lvl(0), kd, 32, 4);
+    benchmark::DoNotOptimize(kd.corners.data());
+  }
+}
+BENCHMARK(BM_DetectKeypoints);
+
+void BM_ComputeDescriptors(benchmark::State& state) {
+  basalt::ManagedImagePyr<uint16_t> pyr;
+  makePyr(pyr);
+  const basalt::KeypointsData kd_init = makeKeypoints(pyr, false);
+
+  for (auto _ : state) {
+    basalt::KeypointsData kd = kd_init;
+    basalt::computeAngles(pyr.lvl(0), kd, true);
+    basalt::computeDescriptors(pyr.lvl(0), kd);
+    benchmark::DoNotOptimize(kd.corner_descriptors.data());
+  }
+  state.SetItemsProcessed(state.iterations() * kd_init.corners.size());
+}
+BENCHMARK(BM_ComputeDescriptors);
+
+void BM_MatchDescriptors(benchmark::State& state) {
+  basalt::ManagedImagePyr<uint16_t> pyr_1, pyr_2;
+  makePyr(pyr_1);
+  makePyr(pyr_2, 4, 2);
+
+  const basalt::KeypointsData kd_1 = makeKeypoints(pyr_1, true);
+  const basalt::KeypointsData kd_2 = makeKeypoints(pyr_2, true);
+
+  std::vector<std::pair<int, int>> matches;
+
+  for (auto _ : state) {
+    basalt::matchDescriptors(kd_1.corner_descriptors, kd_2.corner_descriptors,
+                             matches, 70, 1.2);
+    benchmark::DoNotOptimize(matches.data());
+  }
+  state.SetItemsProcessed(state.iterations() * kd_1.corners.size() *
+                          kd_2.corners.size());
+}
+BENCHMARK(BM_MatchDescriptors);
+
+void BM_HashBowQuery(benchmark::State& state) {
+  const size_t num_frames = state.range(0);
+
+  std::mt19937 gen(42);
+  std::bernoulli_distribution bit;
+
+  auto random_descriptors = [&]() {
+    std::vector<std::bitset<256>> descriptors(300);
+    for (auto& d : descriptors) {
+      for (size_t i = 0; i < d.size(); i++) d[i] = bit(gen);
+    }
+    return descriptors;
+  };
+
+  basalt::HashBow<256> hash_bow(16);
+
+  std::vector<basalt::FeatureHash> hashes;
+  basalt::HashBowVector bow_vector;
+  for (size_t i = 0; i < num_frames; i++) {
+    hash_bow.compute_bow(random_descriptors(), hashes, bow_vector);
+    hash_bow.add_to_database(basalt::TimeCamId(i, 0), bow_vector);
+  }
+
+  hash_bow.compute_bow(random_descriptors(), hashes, bow_vector);
+
+  std::vector<std::pair<basalt::TimeCamId, double>> results;
+
+  for (auto _ : state) {
+    hash_bow.querry_database(bow_vector, 20, results);
+    benchmark::DoNotOptimize(results.data());
+  }
+}
+BENCHMARK(BM_HashBowQuery)->Arg(100)->Arg(1000);
+
+// Synthetic map with num_points landmarks spread over a 200 m x 200 m x 5 m
+// volume, and keyframes every meter on a circle of radius 50 m looking along
+// the trajectory. Each map size is built once.
+const basalt::LocalizationMap& makeLocalizationMap(size_t num_points) {
+  static std::map<size_t, basalt::LocalizationMap> maps;
+
+  auto it = maps.find(num_points);
+  if (it != maps.end()) return it->second;
+
+  basalt::LocalizationMap& map = maps[num_points];
+
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<double> pos(-100, 100), height(0, 5);
+  map.points.resize(num_points);
+  for (auto& p : map.points) {
+    p = Eigen::Vector3d(pos(gen), pos(gen), height(gen));
+  }
+  map.descriptors.resize(num_points);
+
+  const int num_kfs = 2 * M_PI * 50;
+  for (int i = 0; i < num_kfs; i++) {
+    const double a = 2 * M_PI * i / num_kfs;
+    // Camera z axis along the trajectory, y axis down
+    Eigen::Matrix3d R_w_c;
+    R_w_c.col(2) = Eigen::Vector3d(-std::sin(a), std::cos(a), 0);
+    R_w_c.col(1) = -Eigen::Vector3d::UnitZ();
+    R_w_c.col(0) = R_w_c.col(1).cross(R_w_c.col(2));
+    map.keyframe_poses[i] = Sophus::SE3d(
+        R_w_c, Eigen::Vector3d(50 * std::cos(a), 50 * std::sin(a), 1.5));
+  }
+
+  map.buildIndex();
+  return map;
+}
+
+void BM_MapIndexVisiblePoints(benchmark::State& state) {
+  const basalt::LocalizationMap& map = makeLocalizationMap(state.range(0));
+  const basalt::Calibration<double> calib = makeCalib();
+
+  Eigen::aligned_vector<Sophus::SE3d> poses;
+  for (const auto& [t_ns, T_w_i] : map.keyframe_poses) poses.push_back(T_w_i);
+
+  std::vector<uint32_t> ids;
+  size_t i = 0, num_visible = 0;
+  for (auto _ : state) {
+    map.queryVisiblePoints(poses[i++ % poses.size()], calib.intrinsics[0],
+                           IMG_W, IMG_H, 20.0, ids);
+    num_visible += ids.size();
+  }
+
+  state.counters["visible"] = double(num_visible) / state.iterations();
+  state.counters["bytes_per_point"] =
+      double(map.point_index.memoryBytes()) / map.points.size();
+}
+BENCHMARK(BM_MapIndexVisiblePoints)
+    ->Arg(100000)
+    ->Arg(1000000)
+    ->Unit(benchmark::kMicrosecond);
+
+void BM_MapIndexRadius(benchmark::State& state) {
+  const basalt::LocalizationMap& map = makeLocalizationMap(state.range(0));
+
+  Eigen::aligned_vector<Sophus::SE3d> poses;
+  for (const auto& [t_ns, T_w_i] : map.keyframe_poses) poses.push_back(T_w_i);
+
+  std::vector<uint32_t> ids;
+  std::vector<int64_t> kf_ids;
+  size_t i = 0, num_points = 0;
+  for (auto _ : state) {
+    const Sophus::SE3d& T_w_i = poses[i++ % poses.size()];
+    map.point_index.queryRadius(T_w_i.translation(), 5.0, ids);
+    map.queryKeyframes(T_w_i, 5.0, M_PI / 4, kf_ids);
+    num_points += ids.size();
+  }
+
+  state.counters["points"] = double(num_points) / state.iterations();
+}
+BENCHMARK(BM_MapIndexRadius)
+    ->Arg(100000)
+    ->Arg(1000000)
+    ->Unit(benchmark::kMicrosecond);
+
+// Synthetic place recognition problem. The features of every place are drawn
+// from a shared pool of descriptors, and every visit observes a random half
+// of them with 10% of the bits flipped. The database holds the first
+// visit of every place and the queries are the second visits. The vocabulary
+// is trained on visits of other places.
+struct PlaceRecognitionData {
+  std::vector<std::vector<basalt::Descriptor>> database, queries;
+  basalt::VocabularyTree<256> vocabulary;
+};
+
+const PlaceRecognitionData& makePlaceRecognitionData() {
+  static PlaceRecognitionData data;
+  if (!data.database.empty()) return data;
+
+  constexpr int NUM_PLACES = 500;
+  constexpr int NUM_TRAINING_PLACES = 200;
+  constexpr int FEATURES_PER_PLACE = 600;
+
+  std::mt19937 gen(42);
+  std::bernoulli_distribution bit, flip(0.1), observed(0.5);
+
+  // Descriptors of real images are clustered, which is modeled by a pool of
+  // variations of a smaller set of prototypes.
+  std::vector<basalt::Descriptor> prototypes(1000);
+  for (auto& d : prototypes) {
+    for (size_t i = 0; i < d.size(); i++) d[i] = bit(gen);
+  }
+  std::uniform_int_distribution<size_t> prototype_idx(0, prototypes.size() - 1);
+
+  std::vector<basalt::Descriptor> pool(50000);
+  for (auto& d : pool) {
+    d = prototypes[prototype_idx(gen)];
+    for (size_t i = 0; i < d.size(); i++) {
+      if (flip(gen)) d.flip(i);
+    }
+  }
+  std::uniform_int_distribution<size_t> pool_idx(0, pool.size() - 1);
+
+  auto visit = [&](const std::vector<basalt::Descriptor>& place) {
+    std::vector<basalt::Descriptor> res;
+    for (const auto& d : place) {
+      if (!observed(gen)) continue;
+      basalt::Descriptor noisy = d;
+      for (size_t i = 0; i < noisy.size(); i++) {
+        if (flip(gen)) noisy.flip(i);
+      }
+      res.emplace_back(noisy);
+    }
+    return res;
+  };
+
+  std::vector<std::vector<basalt::Descriptor>> training;
+  for (int p = 0; p < NUM_PLACES + NUM_TRAINING_PLACES; p++) {
+    std::vector<basalt::Descriptor> place(FEATURES_PER_PLACE);
+    for (auto& d : place) d = pool[pool_idx(gen)];
+
+    if (p < NUM_PLACES) {
+      data.database.emplace_back(visit(place));
+      data.queries.emplace_back(visit(place));
+    } else {
+      training.emplace_back(visit(place));
+      training.emplace_back(visit(place));
+    }
+  }
+
+  data.vocabulary.train(training, 10, 4);
+  data.vocabulary.set_direct_index_level(2);
+
+  return data;
+}
+
+// Reports the average number of candidates ranked at least as high as the
+// true place, i.e. the number of pairs the mapper would have to verify per
+// loop, and the recall among the 30 best candidates (the default
+// mapper_num_frames_to_match). The timed part is the query of one image.
+template <bool USE_VOCABULARY>
+void BM_PlaceRecognition(benchmark::State& state) {
+  const PlaceRecognitionData& data = makePlaceRecognitionData();
+
+  std::unique_ptr<basalt::BowDatabase<256>> db;
+  if (USE_VOCABULARY) {
+    db.reset(new basalt::VocabularyTree<256>(data.vocabulary));
+  } else {
+    db.reset(new basalt::HashBow<256>(16));
+  }
+
+  std::vector<basalt::FeatureHash> hashes;
+  basalt::HashBowVector bow_vector;
+  for (size_t i = 0; i < data.database.size(); i++) {
+    db->compute_bow(data.database[i], hashes, bow_vector);
+    db->add_to_database(basalt::TimeCamId(i, 0), bow_vector);
+  }
+
+  double rank_sum = 0;
+  int num_recalled = 0;
+  std::vector<std::pair<basalt::TimeCamId, double>> results;
+  for (size_t i = 0; i < data.queries.size(); i++) {
+    db->compute_bow(data.queries[i], hashes, bow_vector);
+    db->querry_database(bow_vector, data.database.size(), results);
+
+    double true_score = -1;
+    for (const auto& r : results) {
+      if (r.first.frame_id == int64_t(i)) true_score = r.second;
+    }
+
+    int rank = data.database.size();
+    if (true_score >= 0) {
+      rank = std::count_if(results.begin(), results.end(), [&](const auto& r) {
+        return r.second >= true_score;
+      });
+    }
+    rank_sum += rank;
+    if (rank <= 30) num_recalled++;
+  }
+
+  size_t i = 0;
+  for (auto _ : state) {
+    db->compute_bow(data.queries[i++ % data.queries.size()], hashes,
+                    bow_vector);
+    db->querry_database(bow_vector, 30, results);
+    benchmark::DoNotOptimize(results.data());
+  }
+
+  state.counters["candidates_per_loop"] = rank_sum / data.queries.size();
+  state.counters["recall_30"] = double(num_recalled) / data.queries.size();
+}
+BENCHMARK_TEMPLATE(BM_PlaceRecognition, false)
+    ->Name("BM_PlaceRecognition/HashBow");
+BENCHMARK_TEMPLATE(BM_PlaceRecognition, true)
+    ->Name("BM_PlaceRecognition/VocabularyTree");
+
+void BM_MatchDescriptorsDirectIndex(benchmark::State& state) {
+  basalt::ManagedImagePyr<uint16_t> pyr_1, pyr_2;
+  makePyr(pyr_1);
+  makePyr(pyr_2, 4, 2);
+
+  const basalt::KeypointsData kd_1 = makeKeypoints(pyr_1, true);
+  const basalt::KeypointsData kd_2 = makeKeypoints(pyr_2, true);
+
+  // Small vocabulary, trained on the first image
+  basalt::VocabularyTree<256> vocabulary;
+  vocabulary.train({kd_1.corner_descriptors}, 4, 3);
+  vocabulary.set_direct_index_level(1);
+
+  std::vector<basalt::FeatureHash> hashes_1, hashes_2;
+  basalt::HashBowVector bow_vector;
+  std::vector<uint32_t> groups_1, groups_2;
+  vocabulary.compute_bow(kd_1.corner_descriptors, hashes_1, bow_vector);
+  vocabulary.compute_bow(kd_2.corner_descriptors, hashes_2, bow_vector);
+  vocabulary.direct_index(hashes_1, groups_1);
+  vocabulary.direct_index(hashes_2, groups_2);
+
+  std::vector<std::pair<int, int>> matches;
+
+  for (auto _ : state) {
+    basalt::matchDescriptors(kd_1.corner_descriptors, groups_1,
+                             kd_2.corner_descriptors, groups_2, matches, 70,
+                             1.2);
+    benchmark::DoNotOptimize(matches.data());
+  }
+
+  state.counters["matches"] = matches.size();
+}
+BENCHMARK(BM_MatchDescriptorsDirectIndex);
+
+#ifdef BASALT_INSTANTIATIONS_DOUBLE
+// Stereo VO problem with 10 landmarks per frame observed in all frames
+void makeVoEstimator(int num_frames,
+                     basalt::BundleAdjustmentBase<double>& estimator,
+                     basalt::AbsOrderMap& aom) {
+  static constexpr int POSE_SIZE = 6;
+
+  std::srand(42);
+
+  estimator.huber_thresh = 0.5;
+  estimator.obs_std_dev = 2.0;
+
+  estimator.calib.T_i_c.emplace_back(
+      Sophus::SE3d::exp(Sophus::Vector6d::Random() / 100));
+  estimator.calib.T_i_c.emplace_back(
+      Sophus::SE3d::exp(Sophus::Vector6d::Random() / 100));
+
+  basalt::GenericCamera<double> cam;
+  cam.variant = basalt::KannalaBrandtCamera4<double>::getTestProjections()[0];
+
+  estimator.calib.intrinsics.emplace_back(cam);
+  estimator.calib.intrinsics.emplace_back(cam);
+
+  Eigen::MatrixXd points_3d;
+  points_3d.setRandom(3, num_frames * 10);
+  points_3d.row(2).array() += 5.0;
+
+  aom.total_size = 0;
+
+  for (int i = 0; i < num_frames; i++) {
+    Sophus::SE3d T_w_i;
+    T_w_i.so3() = Sophus::SO3d::exp(Eigen::Vector3d::Random() / 100);
+    T_w_i.translation()[0] = i * 0.1;
+
+    aom.abs_order_map[i] = std::make_pair(i * POSE_SIZE, POSE_SIZE);
+    aom.total_size += POSE_SIZE;
+
+    estimator.frame_poses[i] = basalt::PoseStateWithLin(i, T_w_i, false);
+
+    for (int j = 0; j < 10; j++) {
+      const int kp_idx = 10 * i + j;
+      Eigen::Vector3d p3d = points_3d.col(kp_idx);
+      basalt::Keypoint<double> kpt;
+
+      Sophus::SE3d T_c_w = estimator.calib.T_i_c[0].inverse() * T_w_i.inverse();
+      Eigen::Vector3d p3d_cam = T_c_w * p3d;
+
+      kpt.direction =
+          basalt::StereographicParam<double>::project(p3d_cam.homogeneous());
+      kpt.inv_dist = 1.0 / p3d_cam.norm();
+      kpt.host_kf_id = basalt::TimeCamId(i, 0);
+
+      estimator.lmdb.addLandmark(kp_idx, kpt);
+    }
+  }
+
+  for (const auto& [kp_idx, kpt] : estimator.lmdb.getLandmarks()) {
+    const Eigen::Vector3d p3d = points_3d.col(kp_idx);
+
+    for (const auto& [frame_id, frame_pose] : estimator.frame_poses) {
+      for (int c = 0; c < 2; c++) {
+        basalt::TimeCamId tcid(frame_id, c);
+        Sophus::SE3d T_c_w =
+            estimator.calib.T_i_c[c].inverse() * frame_pose.getPose().inverse();
+
+        Eigen::Vector2d p2d_cam;
+        if (!cam.project(T_c_w * p3d, p2d_cam)) continue;
+
+        basalt::KeypointObservation<double> ko;
+        ko.kpt_id = kp_idx;
+        ko.pos = p2d_cam + Eigen::Vector2d::Random() / 100;
+
+        estimator.lmdb.addObservation(tcid, ko);
+      }
+    }
+  }
+}
+
+// Linearization of all landmark blocks followed by their in-place QR, which
+// is what LandmarkBlockAbsDynamic spends its time on in every iteration.
+void BM_LandmarkBlockLinearizeQR(benchmark::State& state) {
+  static constexpr int POSE_SIZE = 6;
+
+  basalt::BundleAdjustmentBase<double> estimator;
+  basalt::AbsOrderMap aom;
+  makeVoEstimator(state.range(0), estimator, aom);
+
+  typename basalt::LinearizationBase<double, POSE_SIZE>::Options options;
+  options.lb_options.huber_parameter = estimator.huber_thresh;
+  options.lb_options.obs_std_dev = estimator.obs_std_dev;
+  options.linearization_type = basalt::LinearizationType::ABS_QR;
+
+  auto lin = basalt::LinearizationBase<double, POSE_SIZE>::create(
+      &estimator, aom, options);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(lin->linearizeProblem());
+    lin->performQR();
+  }
+  state.SetItemsProcessed(state.iterations() * estimator.lmdb.numLandmarks());
+}
+BENCHMARK(BM_LandmarkBlockLinearizeQR)->Arg(7)->Arg(12);
+#endif
+
+// Marginalization of one keyframe pose and its velocity and biases from a
+// window of states, as done by the VIO.
+void BM_MargHelperSqrtToSqrt(benchmark::State& state) {
+  const int num_states = state.range(0);
+  const int state_size = 15;
+  const int size = num_states * state_size;
+
+  std::srand(42);
+  Eigen::MatrixXd J_init = Eigen::MatrixXd::Random(2 * size, size);
+  Eigen::VectorXd r_init = Eigen::VectorXd::Random(2 * size);
+
+  std::set<int> idx_to_keep, idx_to_marg;
+  for (int i = 0; i < size; i++) {
+    if (i < state_size) {
+      idx_to_marg.emplace(i);
+    } else {
+      idx_to_keep.emplace(i);
+    }
+  }
+
+  Eigen::MatrixXd marg_sqrt_H;
+  Eigen::VectorXd marg_sqrt_b;
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    Eigen::MatrixXd J = J_init;
+    Eigen::VectorXd r = r_init;
+    state.ResumeTiming();
+
+    basalt::MargHelper<double>::marginalizeHelperSqrtToSqrt(
+        J, r, idx_to_keep, idx_to_marg, marg_sqrt_H, marg_sqrt_b);
+    benchmark::DoNotOptimize(marg_sqrt_H.data());
+  }
+}
+BENCHMARK(BM_MargHelperSqrtToSqrt)->Arg(4)->Arg(8);
+
+// Preintegration of 200 Hz IMU data between two frames at 20 Hz
+void BM_ImuIntegrate(benchmark::State& state) {
+  const int num_samples = 10;
+  const int64_t dt_ns = 5000000;
+
+  std::mt19937 gen(42);
+  std::normal_distribution<double> noise(0, 0.1);
+
+  std::vector<basalt::ImuData<double>> data(num_samples);
+  for (int i = 0; i < num_samples; i++) {
+    data[i].t_ns = (i + 1) * dt_ns;
+    data[i].accel = Eigen::Vector3d(noise(gen), noise(gen), 9.81 + noise(gen));
+    data[i].gyro = Eigen::Vector3d(noise(gen), noise(gen), noise(gen));
+  }
+
+  const Eigen::Vector3d accel_cov = Eigen::Vector3d::Constant(1e-4);
+  const Eigen::Vector3d gyro_cov = Eigen::Vector3d::Constant(1e-6);
+
+  for (auto _ : state) {
+    basalt::IntegratedImuMeasurement<double> meas(0, Eigen::Vector3d::Zero(),
+                                                  Eigen::Vector3d::Zero());
+    for (const auto& d : data) meas.integrate(d, accel_cov, gyro_cov);
+    benchmark::DoNotOptimize(meas.getDeltaState());
+  }
+  state.SetItemsProcessed(state.iterations() * num_samples);
+}
+BENCHMARK(BM_ImuIntegrate);
+
+#ifdef BASALT_INSTANTIATIONS_DOUBLE
+// Stereo observations and 200 Hz IMU data of 3 s of smooth motion under a
+// ceiling of points, replayed into the VIO as the optical flow would
+struct ReplayData {
+  basalt::Calibration<double> calib;
+  std::vector<basalt::ImuData<double>> imu;
+  std::vector<std::pair<int64_t, std::vector<basalt::Keypoints>>> frames;
+  Sophus::SE3d T_w_i_init;
+  Eigen::Vector3d vel_w_i_init;
+};
+
+constexpr int64_t REPLAY_IMU_DT_NS = 5000000;
+
+const ReplayData& makeReplayData() {
+  static const ReplayData data = [] {
+    ReplayData d;
+    for (int i = 0; i < 2; i++) {
+      d.calib.T_i_c.emplace_back(Eigen::Quaterniond::Identity(),
+                                 Eigen::Vector3d(0.1 * i, 0, 0));
+      basalt::GenericCamera<double> cam;
+      cam.variant =
+          basalt::KannalaBrandtCamera4<double>::getTestProjections()[0];
+      d.calib.intrinsics.emplace_back(cam);
+      d.calib.resolution.emplace_back(IMG_W, IMG_H);
+    }
+    d.calib.imu_update_rate = 200;
+    d.calib.accel_noise_std.setConstant(0.01);
+    d.calib.gyro_noise_std.setConstant(0.001);
+    d.calib.accel_bias_std.setConstant(0.001);
+    d.calib.gyro_bias_std.setConstant(0.0001);
+
+    auto pose = [](double t) {
+      return Sophus::SE3d(Sophus::SO3d::rotZ(0.1 * std::sin(t)),
+                          Eigen::Vector3d(0.4 * t, 0.1 * std::sin(2 * t),
+                                          0.05 * std::sin(3 * t)));
+    };
+    d.T_w_i_init = pose(0);
+    d.vel_w_i_init = Eigen::Vector3d(0.4, 0.2, 0.15);
+
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<double> dist_xy(-3, 3), dist_z(3, 7);
+    Eigen::aligned_vector<Eigen::Vector3d> points(400);
+    for (auto& p : points) {
+      p = Eigen::Vector3d(dist_xy(gen) + 3, dist_xy(gen), dist_z(gen));
+    }
+
+    const int64_t t0_ns = 1000000000;
+    const int num_frames = 60;
+    const int64_t frame_dt_ns = 50000000;
+
+    for (int64_t t_ns = t0_ns; t_ns <= t0_ns + num_frames * frame_dt_ns;
+         t_ns += REPLAY_IMU_DT_NS) {
+      const double t = (t_ns - t0_ns) * 1e-9;
+      const Eigen::Vector3d acc(0, -0.4 * std::sin(2 * t),
+                                -0.45 * std::sin(3 * t));
+      basalt::ImuData<double> sample;
+      sample.t_ns = t_ns;
+      sample.accel = pose(t).so3().inverse() * (acc - basalt::constants::g);
+      sample.gyro = Eigen::Vector3d(0, 0, 0.1 * std::cos(t));
+      d.imu.push_back(sample);
+    }
+
+    for (int k = 0; k < num_frames; k++) {
+      const int64_t t_ns = t0_ns + k * frame_dt_ns;
+      const Sophus::SE3d T_w_i = pose((t_ns - t0_ns) * 1e-9);
+      std::vector<basalt::Keypoints> observations(2);
+      for (int i = 0; i < 2; i++) {
+        const Sophus::SE3d T_c_w = (T_w_i * d.calib.T_i_c[i]).inverse();
+        for (size_t j = 0; j < points.size(); j++) {
+          const Eigen::Vector3d p_c = T_c_w * points[j];
+          Eigen::Vector2d uv;
+          if (p_c.z() < 0.1 ||
+              !d.calib.intrinsics[i].project(p_c.homogeneous(), uv) ||
+              uv.x() < 0 || uv.y() < 0 || uv.x() > IMG_W || uv.y() > IMG_H) {
+            continue;
+          }
+          Eigen::AffineCompact2f kp = Eigen::AffineCompact2f::Identity();
+          kp.translation() = uv.cast<float>();
+          observations[i][j] = kp;
+        }
+      }
+      d.frames.emplace_back(t_ns, observations);
+    }
+    return d;
+  }();
+  return data;
+}
+
+// Feeds the whole sequence as fast as the estimator takes it. The samples and
+// frames are copies, as the estimator modifies them in place.
+void replay(const ReplayData& data, basalt::VioEstimatorBase& vio) {
+  size_t imu_i = 0;
+  for (const auto& [t_ns, observations] : data.frames) {
+    for (; imu_i < data.imu.size() &&
+           data.imu[imu_i].t_ns <= t_ns + REPLAY_IMU_DT_NS;
+         imu_i++) {
+      vio.addIMUToQueue(
+          std::make_shared<basalt::ImuData<double>>(data.imu[imu_i]));
+    }
+
+    auto frame = std::make_shared<basalt::OpticalFlowResult>();
+    frame->t_ns = t_ns;
+    frame->observations = observations;
+    frame->input_images = std::make_shared<basalt::OpticalFlowInput>(2);
+    frame->input_images->t_ns = t_ns;
+    vio.addVisionToQueue(frame);
+  }
+  vio.addVisionToQueue(nullptr);
+  vio.addIMUToQueue(nullptr);
+}
+
+// Several VIO instances replaying the same sequence at once, each registered
+// with the TrackerScheduler with the same weight. The counters are the mean
+// and worst per-frame latency over all instances, which should grow slowly
+// with the number of instances as long as there are cores for their shares.
+void BM_MultiInstanceVio(benchmark::State& state) {
+  const int num_instances = state.range(0);
+  const ReplayData& data = makeReplayData();
+  basalt::VioConfig config;
+
+  double mean_ms = 0;
+  double max_ms = 0;
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::vector<basalt::VioEstimatorBase::Ptr> vios;
+    std::vector<basalt::TrackerScheduler::Instance::Ptr> instances;
+    for (int i = 0; i < num_instances; i++) {
+      instances.emplace_back(basalt::TrackerScheduler::get().registerInstance(
+          "bench" + std::to_string(i)));
+
+      auto vio = basalt::VioEstimatorFactory::getVioEstimator(
+          config, data.calib, basalt::constants::g, true, true);
+      vio->scheduler_instance = instances.back();
+      vio->initialize(data.frames.front().first, data.T_w_i_init,
+                      data.vel_w_i_init, Eigen::Vector3d::Zero(),
+                      Eigen::Vector3d::Zero());
+      vios.emplace_back(vio);
+    }
+    state.ResumeTiming();
+
+    std::vector<std::thread> feeders;
+    for (auto& vio : vios) {
+      feeders.emplace_back(replay, std::cref(data), std::ref(*vio));
+    }
+    for (auto& t : feeders) t.join();
+    for (auto& vio : vios) vio->maybe_join();
+
+    state.PauseTiming();
+    for (const auto& instance : instances) {
+      const auto l = instance->getLatency(basalt::TrackerScheduler::VIO);
+      mean_ms += l.mean_ms / num_instances;
+      max_ms = std::max(max_ms, l.max_ms);
+    }
+    vios.clear();
+    instances.clear();
+    state.ResumeTiming();
+  }
+
+  state.counters["mean_frame_ms"] = mean_ms / state.iterations();
+  state.counters["max_frame_ms"] = max_ms;
+  state.SetItemsProcessed(state.iterations() * num_instances *
+                          data.frames.size());
+}
+BENCHMARK(BM_MultiInstanceVio)
+    ->Arg(1)
+    ->Arg(2)
+    ->Arg(4)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+#endif
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::vector<char*> args(argv, argv + argc);
+
+  bool has_out = false;
+  for (int i = 1; i < argc; i++) {
+    if (std::string(argv[i]).rfind("--benchmark_out=", 0) == 0) has_out = true;
+  }
+
+  std::string out_arg = "--benchmark_out=stats_bench.json";
+  std::string format_arg = "--benchmark_out_format=json";
+  if (!has_out) {
+    args.push_back(out_arg.data());
+    args.push_back(format_arg.data());
+  }
+
+  int num_args = args.size();
+  benchmark::Initialize(&num_args, args.data());
+  if (benchmark::ReportUnrecognizedArguments(num_args, args.data())) return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+
+  return 0;
+}
@@ -45,6 +45,7 @@ int main(int argc, char **argv) {
   std::vector<std::string> cam_types;
   std::string cache_dataset_name = "calib-cam";
   int skip_images = 1;
+  basalt::CornerDetectionOptions corner_detection_options;
 
   CLI::App app{"Calibrate IMU"};
 
@@ -66,6 +67,11 @@ int main(int argc, char **argv) {
                  "Type of cameras (eucm, ds, kb4, pinhole)")
       ->required();
 
+  app.add_flag("--roi-tracking", corner_detection_options.roi_tracking,
+               "Search the Aprilgrid only around the previous detection");
+  app.add_option("--roi-downscale", corner_detection_options.roi_downscale,
+                 "Downscale factor of the search region with --roi-tracking");
+
   try {
     app.parse(argc, argv);
   } catch (const CLI::ParseError &e) {
@@ -75,6 +81,8 @@ int main(int argc, char **argv) {
   basalt::CamCalib cv(dataset_path, dataset_type, aprilgrid_path, result_path,
                       cache_dataset_name, skip_images, cam_types);
 
+  cv.setCornerDetectionOptions(corner_detection_options);
+
   cv.renderingLoop();
 
   return 0;
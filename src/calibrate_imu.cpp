@@ -46,6 +46,7 @@ int main(int argc, char **argv) {
   std::string result_path;
   std::string cache_dataset_name = "calib-cam-imu";
   int skip_images = 1;
+  basalt::CornerDetectionOptions corner_detection_options;
 
   double accel_noise_std = 0.016;
   double gyro_noise_std = 0.000282;
@@ -78,6 +79,11 @@ int main(int argc, char **argv) {
 
   app.add_option("--skip-images", skip_images, "Number of images to skip");
 
+  app.add_flag("--roi-tracking", corner_detection_options.roi_tracking,
+               "Search the Aprilgrid only around the previous detection");
+  app.add_option("--roi-downscale", corner_detection_options.roi_downscale,
+                 "Downscale factor of the search region with --roi-tracking");
+
   try {
     app.parse(argc, argv);
   } catch (const CLI::ParseError &e) {
@@ -89,6 +95,8 @@ int main(int argc, char **argv) {
       cache_dataset_name, skip_images,
       {accel_noise_std, gyro_noise_std, accel_bias_std, gyro_bias_std});
 
+  cv.setCornerDetectionOptions(corner_detection_options);
+
   cv.renderingLoop();
 
   return 0;
@@ -37,8 +37,12 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <basalt/utils/apriltag.h>
 
+#include <basalt/utils/time_utils.hpp>
+
 #include <tbb/parallel_for.h>
 
+#include <atomic>
+
 #include <opengv/absolute_pose/CentralAbsoluteAdapter.hpp>
 #include <opengv/absolute_pose/methods.hpp>
 
@@ -108,28 +112,91 @@ bool estimateTransformation(
 void CalibHelper::detectCorners(const VioDatasetPtr &vio_data,
                                 const AprilGrid &april_grid,
                                 CalibCornerMap &calib_corners,
-                                CalibCornerMap &calib_corners_rejected) {
+                                CalibCornerMap &calib_corners_rejected,
+                                const CornerDetectionOptions &options) {
   calib_corners.clear();
   calib_corners_rejected.clear();
 
+  Timer timer;
+
+  std::atomic<size_t> num_images(0);
+  std::atomic<size_t> num_images_detected(0);
+  std::atomic<size_t> num_corners(0);
+  std::atomic<size_t> num_roi(0);
+  std::atomic<size_t> num_roi_fallback(0);
+
+  const size_t num_frames = vio_data->get_image_timestamps().size();
+
+  // With ROI tracking every task processes a contiguous run of frames, so
+  // that the previous detection is available for most of them.
+  const size_t grain_size = options.roi_tracking ? 64 : 1;
+
   tbb::parallel_for(
-      tbb::blocked_range<size_t>(0, vio_data->get_image_timestamps().size()),
+      tbb::blocked_range<size_t>(0, num_frames, grain_size),
       [&](const tbb::blocked_range<size_t> &r) {
         const int numTags = april_grid.getTagCols() * april_grid.getTagRows();
         ApriltagDetector ad(numTags);
 
+        // previous detection and number of images tracked in the ROI since
+        // the last full image search for every camera
+        std::vector<CalibCornerData> prev_detection;
+        std::vector<int> num_roi_frames;
+
         for (size_t j = r.begin(); j != r.end(); ++j) {
           int64_t timestamp_ns = vio_data->get_image_timestamps()[j];
           const std::vector<ImageData> &img_vec =
               vio_data->get_image_data(timestamp_ns);
 
+          if (prev_detection.size() < img_vec.size()) {
+            prev_detection.resize(img_vec.size());
+            num_roi_frames.resize(img_vec.size(), 0);
+          }
+
           for (size_t i = 0; i < img_vec.size(); i++) {
             if (img_vec[i].img.get()) {
               CalibCornerData ccd_good;
               CalibCornerData ccd_bad;
-              ad.detectTags(*img_vec[i].img, ccd_good.corners,
-                            ccd_good.corner_ids, ccd_good.radii,
-                            ccd_bad.corners, ccd_bad.corner_ids, ccd_bad.radii);
+
+              const CalibCornerData &prev = prev_detection[i];
+
+              bool roi_success = false;
+              if (options.roi_tracking && !prev.corners.empty() &&
+                  num_roi_frames[i] < options.roi_max_frames) {
+                Eigen::AlignedBox2d box;
+                for (const Eigen::Vector2d &c : prev.corners) box.extend(c);
+                const Eigen::Vector2d margin =
+                    options.roi_margin * box.sizes() +
+                    Eigen::Vector2d::Constant(1.0);
+                box.min() -= margin;
+                box.max() += margin;
+
+                const int x0 = std::floor(box.min().x());
+                const int y0 = std::floor(box.min().y());
+                const int x1 = std::ceil(box.max().x());
+                const int y1 = std::ceil(box.max().y());
+
+                ad.detectTagsRoi(*img_vec[i].img, x0, y0, x1 - x0, y1 - y0,
+                                 options.roi_downscale, ccd_good.corners,
+                                 ccd_good.corner_ids, ccd_good.radii,
+                                 ccd_bad.corners, ccd_bad.corner_ids,
+                                 ccd_bad.radii);
+                num_roi++;
+
+                roi_success =
+                    ccd_good.corners.size() >=
+                    options.roi_min_corner_ratio * prev.corners.size();
+                if (!roi_success) num_roi_fallback++;
+              }
+
+              if (roi_success) {
+                num_roi_frames[i]++;
+              } else {
+                ad.detectTags(*img_vec[i].img, ccd_good.corners,
+                              ccd_good.corner_ids, ccd_good.radii,
+                              ccd_bad.corners, ccd_bad.corner_ids,
+                              ccd_bad.radii);
+                num_roi_frames[i] = 0;
+              }
 
               //                std::cout << "image (" << timestamp_ns << ","
               //                << i
@@ -139,6 +206,12 @@ void CalibHelper::detectCorners(const VioDatasetPtr &vio_data,
               //                          ccd_bad.corners.size()
               //                          << " rejected)" << std::endl;
 
+              num_images++;
+              if (!ccd_good.corners.empty()) num_images_detected++;
+              num_corners += ccd_good.corners.size();
+
+              if (options.roi_tracking) prev_detection[i] = ccd_good;
+
               TimeCamId tcid(timestamp_ns, i);
 
               calib_corners.emplace(tcid, ccd_good);
@@ -147,6 +220,19 @@ void CalibHelper::detectCorners(const VioDatasetPtr &vio_data,
           }
         }
       });
+
+  const double elapsed = timer.elapsed();
+
+  std::cout << "Detected " << num_corners << " corners in "
+            << num_images_detected << " of " << num_images << " images in "
+            << elapsed << " s ("
+            << (num_images > 0 ? 1e3 * elapsed / num_images : 0.0)
+            << " ms per image)" << std::endl;
+
+  if (options.roi_tracking) {
+    std::cout << "ROI searches: " << num_roi
+              << ", full image fallbacks: " << num_roi_fallback << std::endl;
+  }
 }
 
 void CalibHelper::initCamPoses(
@@ -180,7 +266,7 @@ void CalibHelper::initCamPoses(
 bool CalibHelper::initializeIntrinsics(
     const Eigen::aligned_vector<Eigen::Vector2d> &corners,
     const std::vector<int> &corner_ids, const AprilGrid &aprilgrid, int cols,
-    int rows, Eigen::Vector4d &init_intr) {
+    int rows, Eigen::Vector4d &init_intr, double *reproj_error) {
   // First, initialize the image center at the center of the image.
 
   Eigen::aligned_map<int, Eigen::Vector2d> id_to_corner;
@@ -304,6 +390,7 @@ bool CalibHelper::initializeIntrinsics(
     }    // For each row in the image.
 
   if (success) init_intr << 0.5 * gamma0, 0.5 * gamma0, _cu, _cv;
+  if (success && reproj_error) *reproj_error = minReprojErr;
 
   return success;
 }
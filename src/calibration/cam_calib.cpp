@@ -35,7 +35,14 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <basalt/calibration/cam_calib.h>
 
+#include <limits>
+
+#include <tbb/blocked_range.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/parallel_for.h>
+
 #include <basalt/utils/system_utils.h>
+#include <basalt/utils/time_utils.hpp>
 
 #include <basalt/calibration/vignette.h>
 
@@ -417,7 +424,8 @@ void CamCalib::detectCorners() {
 
     CalibHelper::detectCorners(this->vio_dataset, this->april_grid,
                                this->calib_corners,
-                               this->calib_corners_rejected);
+                               this->calib_corners_rejected,
+                               this->corner_detection_options);
 
     std::string path =
         cache_path + cache_dataset_name + "_detected_corners.cereal";
@@ -447,39 +455,93 @@ void CamCalib::initCamIntrinsics() {
 
   std::cout << "Started camera intrinsics initialization" << std::endl;
 
+  Timer timer;
+
   if (!calib_opt) calib_opt.reset(new PosesOptimization);
 
   calib_opt->resetCalib(vio_dataset->get_num_cams(), cam_types);
 
+  // Resolution from the first frame with all valid images. The images are
+  // not needed otherwise, so no other frames are loaded.
+  Eigen::aligned_vector<Eigen::Vector2i> res;
+  {
+    size_t img_idx = 1;
+    int64_t t_ns = vio_dataset->get_image_timestamps()[img_idx];
+    auto img_data = vio_dataset->get_image_data(t_ns);
+
+    // Find the frame with all valid images
+    while (img_idx < vio_dataset->get_image_timestamps().size()) {
+      bool img_data_valid = true;
+      for (size_t i = 0; i < vio_dataset->get_num_cams(); i++) {
+        if (!img_data[i].img.get()) img_data_valid = false;
+      }
+
+      if (!img_data_valid) {
+        img_idx++;
+        int64_t t_ns_new = vio_dataset->get_image_timestamps()[img_idx];
+        img_data = vio_dataset->get_image_data(t_ns_new);
+      } else {
+        break;
+      }
+    }
+
+    for (size_t i = 0; i < vio_dataset->get_num_cams(); i++) {
+      res.emplace_back(img_data[i].img->w, img_data[i].img->h);
+    }
+  }
+
   std::vector<bool> cam_initialized(vio_dataset->get_num_cams(), false);
 
   int inc = 1;
   if (vio_dataset->get_image_timestamps().size() > 100) inc = 3;
 
+  // Initialization from the detections of every image. The one with the
+  // lowest reprojection error is kept.
+  struct IntrinsicsCandidate {
+    double reproj_error = std::numeric_limits<double>::max();
+    Eigen::Vector4d init_intr;
+  };
+
   for (size_t j = 0; j < vio_dataset->get_num_cams(); j++) {
+    std::vector<const CalibCornerData *> cam_corners;
     for (size_t i = 0; i < vio_dataset->get_image_timestamps().size();
          i += inc) {
-      const int64_t timestamp_ns = vio_dataset->get_image_timestamps()[i];
-      const std::vector<basalt::ImageData> &img_vec =
-          vio_dataset->get_image_data(timestamp_ns);
+      TimeCamId tcid(vio_dataset->get_image_timestamps()[i], j);
 
-      TimeCamId tcid(timestamp_ns, j);
+      auto it = calib_corners.find(tcid);
+      if (it != calib_corners.end()) cam_corners.emplace_back(&it->second);
+    }
 
-      if (calib_corners.find(tcid) != calib_corners.end()) {
-        CalibCornerData cid = calib_corners.at(tcid);
+    tbb::enumerable_thread_specific<IntrinsicsCandidate> best_candidates;
 
-        Eigen::Vector4d init_intr;
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, cam_corners.size()),
+        [&](const tbb::blocked_range<size_t> &r) {
+          IntrinsicsCandidate &best = best_candidates.local();
 
-        bool success = CalibHelper::initializeIntrinsics(
-            cid.corners, cid.corner_ids, april_grid, img_vec[j].img->w,
-            img_vec[j].img->h, init_intr);
+          for (size_t i = r.begin(); i != r.end(); ++i) {
+            IntrinsicsCandidate c;
+            bool success = CalibHelper::initializeIntrinsics(
+                cam_corners[i]->corners, cam_corners[i]->corner_ids,
+                april_grid, res[j][0], res[j][1], c.init_intr,
+                &c.reproj_error);
 
-        if (success) {
-          cam_initialized[j] = true;
-          calib_opt->calib->intrinsics[j].setFromInit(init_intr);
-          break;
-        }
-      }
+            if (success && c.reproj_error < best.reproj_error) best = c;
+          }
+        });
+
+    IntrinsicsCandidate best;
+    for (const IntrinsicsCandidate &c : best_candidates) {
+      if (c.reproj_error < best.reproj_error) best = c;
+    }
+
+    if (best.reproj_error < std::numeric_limits<double>::max()) {
+      cam_initialized[j] = true;
+      calib_opt->calib->intrinsics[j].setFromInit(best.init_intr);
+
+      std::cout << "Cam " << j << ": best of " << cam_corners.size()
+                << " images with reprojection error " << best.reproj_error
+                << std::endl;
     }
   }
 
@@ -487,14 +549,12 @@ void CamCalib::initCamIntrinsics() {
   for (size_t j = 0; j < vio_dataset->get_num_cams(); j++) {
     if (!cam_initialized[j]) {
       std::vector<CalibCornerData *> pinhole_corners;
-      int w = 0;
-      int h = 0;
+      int w = res[j][0];
+      int h = res[j][1];
 
       for (size_t i = 0; i < vio_dataset->get_image_timestamps().size();
            i += inc) {
         const int64_t timestamp_ns = vio_dataset->get_image_timestamps()[i];
-        const std::vector<basalt::ImageData> &img_vec =
-            vio_dataset->get_image_data(timestamp_ns);
 
         TimeCamId tcid(timestamp_ns, j);
 
@@ -504,9 +564,6 @@ void CamCalib::initCamIntrinsics() {
             pinhole_corners.emplace_back(&it->second);
           }
         }
-
-        w = img_vec[j].img->w;
-        h = img_vec[j].img->h;
       }
 
       BASALT_ASSERT(w > 0 && h > 0);
@@ -528,43 +585,15 @@ void CamCalib::initCamIntrinsics() {
     }
   }
 
-  std::cout << "Done camera intrinsics initialization:" << std::endl;
+  std::cout << "Done camera intrinsics initialization in " << timer.elapsed()
+            << "s:" << std::endl;
   for (size_t j = 0; j < vio_dataset->get_num_cams(); j++) {
     std::cout << "Cam " << j << ": "
               << calib_opt->calib->intrinsics[j].getParam().transpose()
               << std::endl;
   }
 
-  // set resolution
-  {
-    size_t img_idx = 1;
-    int64_t t_ns = vio_dataset->get_image_timestamps()[img_idx];
-    auto img_data = vio_dataset->get_image_data(t_ns);
-
-    // Find the frame with all valid images
-    while (img_idx < vio_dataset->get_image_timestamps().size()) {
-      bool img_data_valid = true;
-      for (size_t i = 0; i < vio_dataset->get_num_cams(); i++) {
-        if (!img_data[i].img.get()) img_data_valid = false;
-      }
-
-      if (!img_data_valid) {
-        img_idx++;
-        int64_t t_ns_new = vio_dataset->get_image_timestamps()[img_idx];
-        img_data = vio_dataset->get_image_data(t_ns_new);
-      } else {
-        break;
-      }
-    }
-
-    Eigen::aligned_vector<Eigen::Vector2i> res;
-
-    for (size_t i = 0; i < vio_dataset->get_num_cams(); i++) {
-      res.emplace_back(img_data[i].img->w, img_data[i].img->h);
-    }
-
-    calib_opt->setResolution(res);
-  }
+  calib_opt->setResolution(res);
 }
 
 void CamCalib::initCamPoses() {
@@ -589,18 +618,23 @@ void CamCalib::initCamPoses() {
 
   std::cout << "Started initial camera pose computation " << std::endl;
 
+  Timer timer;
+
   CalibHelper::initCamPoses(calib_opt->calib,
                             april_grid.aprilgrid_corner_pos_3d,
                             this->calib_corners, this->calib_init_poses);
 
+  const double init_time = timer.elapsed();
+
   std::string path = cache_path + cache_dataset_name + "_init_poses.cereal";
   std::ofstream os(path, std::ios::binary);
   cereal::BinaryOutputArchive archive(os);
 
   archive(this->calib_init_poses);
 
-  std::cout << "Done initial camera pose computation. Saved them here: " << path
-            << std::endl;
+  std::cout << "Done initial camera pose computation of "
+            << calib_init_poses.size() << " images in " << init_time
+            << "s. Saved them here: " << path << std::endl;
 }
 
 void CamCalib::initCamExtrinsics() {
@@ -243,7 +243,8 @@ void CamImuCalib::detectCorners() {
 
     CalibHelper::detectCorners(this->vio_dataset, this->april_grid,
                                this->calib_corners,
-                               this->calib_corners_rejected);
+                               this->calib_corners_rejected,
+                               this->corner_detection_options);
 
     std::string path =
         cache_path + cache_dataset_name + "_detected_corners.cereal";
@@ -0,0 +1,381 @@
+/**
+BSD 3-Clause License
+
+This file is part of the Basalt project.
+https://gitlab.com/VladyslavUsenko/basalt.git
+
+Copyright (c) 2022, Vladyslav Usenko and Nikolaus Demmel.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the copyright holder nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Measures how the optical flow front end scales with the number of cameras.
+// A rig of N cameras with the intrinsics of cam0 of the given calibration is
+// placed in a synthetic textured environment at infinity and rotated around
+// the vertical axis. All cameras see a consistent scene, so tracking, stereo
+// matching and epipolar filtering work as on real data. Since the motion is
+// known, tracked and matched points are also checked against ground truth to
+// compare the outlier rate of the different recovery checks and of KLT and
+// epipolar stereo matching.
+
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+
+#include <CLI/CLI.hpp>
+#include <magic_enum.hpp>
+
+#include <basalt/calibration/calibration.hpp>
+#include <basalt/optical_flow/optical_flow.h>
+#include <basalt/serialization/headers_serialization.h>
+#include <basalt/utils/time_utils.hpp>
+#include <basalt/utils/vio_config.h>
+
+using basalt::Calibration;
+using basalt::ManagedImage;
+
+namespace {
+
+// Random intensity of a texture cell
+float cellValue(int64_t u, int64_t v) {
+  uint64_t h = uint64_t(u) * 0x9E3779B97F4A7C15ULL;
+  h ^= uint64_t(v) * 0xC2B2AE3D27D4EB4FULL;
+  h ^= h >> 29;
+  h *= 0xBF58476D1CE4E5B9ULL;
+  h ^= h >> 32;
+  return (h & 0xFFFF) / 65535.0f;
+}
+
+// Direction in the rig frame for every pixel of a camera, stored as longitude
+// around the vertical (camera y) axis and latitude. NaN for invalid pixels.
+struct PixelDirections {
+  int w, h;
+  std::vector<float> lon, lat;
+};
+
+PixelDirections computeDirections(const Calibration<double>& calib,
+                                  size_t cam_id) {
+  PixelDirections d;
+  d.w = calib.resolution[cam_id].x();
+  d.h = calib.resolution[cam_id].y();
+  d.lon.resize(d.w * d.h, NAN);
+  d.lat.resize(d.w * d.h, NAN);
+
+  const Eigen::Matrix3d R_i_c = calib.T_i_c[cam_id].so3().matrix();
+  for (int y = 0; y < d.h; y++) {
+    for (int x = 0; x < d.w; x++) {
+      Eigen::Vector4d p3d;
+      if (!calib.intrinsics[cam_id].unproject(Eigen::Vector2d(x, y), p3d))
+        continue;
+      Eigen::Vector3d p = R_i_c * p3d.head<3>().normalized();
+      d.lon[y * d.w + x] = std::atan2(p.x(), p.z());
+      d.lat[y * d.w + x] = std::asin(p.y());
+    }
+  }
+  return d;
+}
+
+// Render the view of a camera with the rig rotated by yaw around the vertical
+// axis. The texture has two scales of blocky cells, which gives strong corners.
+ManagedImage<uint16_t>::Ptr render(const PixelDirections& d, double yaw) {
+  constexpr double cell = M_PI / 300;  // 0.6 degrees
+  const int64_t cells_per_rev = std::llround(2 * M_PI / cell);
+
+  ManagedImage<uint16_t>::Ptr img(new ManagedImage<uint16_t>(d.w, d.h));
+  for (int y = 0; y < d.h; y++) {
+    for (int x = 0; x < d.w; x++) {
+      const float lon = d.lon[y * d.w + x];
+      const float lat = d.lat[y * d.w + x];
+      if (std::isnan(lon)) {
+        (*img)(x, y) = 0;
+        continue;
+      }
+
+      double lon_w = std::fmod(lon + yaw, 2 * M_PI);
+      if (lon_w < 0) lon_w += 2 * M_PI;
+      int64_t u = int64_t(lon_w / cell) % cells_per_rev;
+      int64_t v = int64_t(std::floor(lat / cell));
+
+      float val =
+          0.6f * cellValue(u, v) + 0.4f * cellValue(u / 4 + 7919, v / 4);
+      (*img)(x, y) = uint16_t(val * 255) << 8;
+    }
+  }
+  return img;
+}
+
+// Rig with num_cams copies of cam0 spread horizontally, yaw_step apart
+Calibration<double> makeRig(const Calibration<double>& base, int num_cams,
+                            double yaw_step, double baseline) {
+  Calibration<double> rig = base;
+  rig.intrinsics.clear();
+  rig.resolution.clear();
+  rig.T_i_c.clear();
+  for (int i = 0; i < num_cams; i++) {
+    double offset = i - (num_cams - 1) / 2.0;
+    Sophus::SO3d R_i_c = Sophus::SO3d::rotY(offset * yaw_step);
+    Eigen::Vector3d t_i_c(offset * baseline, 0, 0);
+    rig.intrinsics.push_back(base.intrinsics[0]);
+    rig.resolution.push_back(base.resolution[0]);
+    rig.T_i_c.emplace_back(R_i_c, t_i_c);
+  }
+  return rig;
+}
+
+// Whether a point seen at uv_a in cam_a with the rig at yaw_a is seen at uv_b
+// in cam_b with the rig at yaw_b. The scene is at infinity, so only the
+// rotations matter.
+bool isInlier(const Calibration<double>& calib, size_t cam_a,
+              const Eigen::Vector2d& uv_a, double yaw_a, size_t cam_b,
+              const Eigen::Vector2d& uv_b, double yaw_b, double threshold) {
+  Eigen::Vector4d p_a;
+  if (!calib.intrinsics[cam_a].unproject(uv_a, p_a)) return false;
+
+  Eigen::Vector4d p_b = Eigen::Vector4d::Zero();
+  p_b.head<3>() = calib.T_i_c[cam_b].so3().inverse() *
+                  Sophus::SO3d::rotY(yaw_a - yaw_b) * calib.T_i_c[cam_a].so3() *
+                  p_a.head<3>();
+
+  Eigen::Vector2d uv_b_gt;
+  if (!calib.intrinsics[cam_b].project(p_b, uv_b_gt)) return false;
+  return (uv_b - uv_b_gt).norm() < threshold;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string cam_calib_path;
+  std::string config_path;
+  std::string result_path = "stats_camera_scaling.json";
+  std::vector<int> num_cams_list = {2, 4, 6};
+  int num_frames = 200;
+  double yaw_step_deg = 50;
+  double yaw_per_frame_deg = 0.5;
+  double baseline = 0.08;
+  std::vector<std::string> recovery_checks = {"FULL"};
+  double outlier_threshold = 1.0;
+  bool compare_epipolar = false;
+
+  CLI::App app{"Front end scaling with the number of cameras"};
+
+  app.add_option("--cam-calib", cam_calib_path,
+                 "Calibration whose cam0 is replicated for every camera.")
+      ->required();
+  app.add_option("--config-path", config_path, "Path to config file.");
+  app.add_option("--num-cams", num_cams_list, "Camera counts to evaluate.");
+  app.add_option("--num-frames", num_frames, "Frames processed per run.");
+  app.add_option("--yaw-step", yaw_step_deg,
+                 "Yaw between neighbouring cameras in degrees.");
+  app.add_option("--yaw-per-frame", yaw_per_frame_deg,
+                 "Rotation of the rig between frames in degrees.");
+  app.add_option("--baseline", baseline,
+                 "Distance between neighbouring cameras in meters.");
+  app.add_option("--recovery-checks", recovery_checks,
+                 "Optical flow recovery checks to evaluate (FULL, "
+                 "FINEST_LEVEL, RESIDUAL).");
+  app.add_option("--outlier-threshold", outlier_threshold,
+                 "Distance to the true position in pixels above which a "
+                 "point is an outlier.");
+  app.add_flag("--compare-epipolar", compare_epipolar,
+               "Run every configuration with KLT and with epipolar stereo "
+               "matching.");
+  app.add_option("--result-path", result_path, "Path to the result json.");
+
+  try {
+    app.parse(argc, argv);
+  } catch (const CLI::ParseError& e) {
+    return app.exit(e);
+  }
+
+  basalt::VioConfig vio_config;
+  if (!config_path.empty()) vio_config.load(config_path);
+  vio_config.optical_flow_skip_frames = 1;
+
+  Calibration<double> base_calib;
+  {
+    std::ifstream os(cam_calib_path, std::ios::binary);
+    if (!os.is_open()) {
+      std::cerr << "could not load camera calibration " << cam_calib_path
+                << std::endl;
+      std::abort();
+    }
+    cereal::JSONInputArchive archive(os);
+    archive(base_calib);
+  }
+
+  const double deg = M_PI / 180;
+  basalt::ExecutionStats stats;
+
+  std::vector<basalt::RecoveryCheckType> check_types;
+  for (const std::string& name : recovery_checks) {
+    auto check = magic_enum::enum_cast<basalt::RecoveryCheckType>(name);
+    if (!check.has_value()) {
+      std::cerr << "Could not find the RecoveryCheckType for " << name
+                << std::endl;
+      std::abort();
+    }
+    check_types.push_back(check.value());
+  }
+
+  // Recovery check and stereo matching mode of every run
+  std::vector<std::pair<basalt::RecoveryCheckType, bool>> modes;
+  for (basalt::RecoveryCheckType check_type : check_types) {
+    if (compare_epipolar) {
+      modes.emplace_back(check_type, false);
+      modes.emplace_back(check_type, true);
+    } else {
+      modes.emplace_back(check_type,
+                         vio_config.optical_flow_matching_epipolar);
+    }
+  }
+
+  std::cout << "num_cams pairwise check epipolar ms_per_frame ms_per_cam "
+               "keypoints_per_cam multi_cam_keypoints outlier_rate"
+            << std::endl;
+
+  for (int num_cams : num_cams_list) {
+    Calibration<double> calib =
+        makeRig(base_calib, num_cams, yaw_step_deg * deg, baseline);
+
+    std::vector<PixelDirections> dirs;
+    for (int i = 0; i < num_cams; i++) {
+      dirs.emplace_back(computeDirections(calib, i));
+    }
+
+    for (bool pairwise : {false, true}) {
+      if (num_cams < 3 && pairwise) continue;  // Same as cam0-centric
+
+      for (const auto& [check_type, epipolar] : modes) {
+        basalt::VioConfig config = vio_config;
+        config.optical_flow_matching_pairwise = pairwise;
+        config.optical_flow_recovery_check = check_type;
+        config.optical_flow_matching_epipolar = epipolar;
+
+        tbb::concurrent_bounded_queue<basalt::OpticalFlowResult::Ptr>
+            out_queue;
+        basalt::OpticalFlowBase::Ptr opt_flow =
+            basalt::OpticalFlowFactory::getOpticalFlow(config, calib);
+        opt_flow->show_gui = false;
+        opt_flow->output_queue = &out_queue;
+
+        double total_time = 0;
+        double num_keypoints = 0;
+        double num_multi_cam = 0;
+        double num_checked = 0;
+        double num_outliers = 0;
+
+        basalt::OpticalFlowResult::Ptr prev_res;
+        double prev_yaw = 0;
+
+        for (int f = 0; f < num_frames; f++) {
+          const double yaw = f * yaw_per_frame_deg * deg;
+
+          basalt::OpticalFlowInput::Ptr data(
+              new basalt::OpticalFlowInput(num_cams));
+          data->t_ns = int64_t(f) * 50'000'000;
+          for (int i = 0; i < num_cams; i++) {
+            data->img_data[i].img = render(dirs[i], yaw);
+          }
+
+          // Frames are processed one at a time, so rendering is not timed
+          basalt::Timer t;
+          opt_flow->input_queue.push(data);
+          basalt::OpticalFlowResult::Ptr res;
+          out_queue.pop(res);
+          total_time += t.elapsed();
+
+          std::unordered_map<basalt::KeypointId, int> num_cams_seen;
+          for (const auto& obs : res->observations) {
+            num_keypoints += obs.size();
+            for (const auto& kv : obs) num_cams_seen[kv.first]++;
+          }
+          for (const auto& kv : num_cams_seen) num_multi_cam += kv.second > 1;
+
+          // Check tracks against the previous frame and matches against cam0
+          // or the first camera the point was seen in
+          for (int i = 0; i < num_cams; i++) {
+            for (const auto& [id, transform] : res->observations[i]) {
+              const Eigen::Vector2d uv = transform.translation().cast<double>();
+
+              auto check = [&](size_t cam_a, const Eigen::Vector2d& uv_a,
+                               double yaw_a) {
+                num_checked++;
+                num_outliers += !isInlier(calib, cam_a, uv_a, yaw_a, i, uv,
+                                          yaw, outlier_threshold);
+              };
+
+              if (prev_res && prev_res->observations[i].count(id)) {
+                const auto& prev = prev_res->observations[i].at(id);
+                check(i, prev.translation().cast<double>(), prev_yaw);
+              }
+
+              for (int j = 0; j < i; j++) {
+                auto it = res->observations[j].find(id);
+                if (it == res->observations[j].end()) continue;
+                check(j, it->second.translation().cast<double>(), yaw);
+                break;
+              }
+            }
+          }
+
+          prev_res = res;
+          prev_yaw = yaw;
+        }
+
+        opt_flow->input_queue.push(nullptr);
+        basalt::OpticalFlowResult::Ptr res;
+        out_queue.pop(res);
+
+        const double ms_per_frame = total_time * 1e3 / num_frames;
+        const double kp_per_cam = num_keypoints / num_frames / num_cams;
+        const double multi_cam = num_multi_cam / num_frames;
+        const double outlier_rate =
+            num_checked > 0 ? num_outliers / num_checked : 0;
+        const auto check_name = magic_enum::enum_name(check_type);
+
+        std::cout << num_cams << " " << pairwise << " " << check_name << " "
+                  << epipolar << " " << ms_per_frame << " "
+                  << ms_per_frame / num_cams << " " << kp_per_cam << " "
+                  << multi_cam << " " << outlier_rate << std::endl;
+
+        stats.add("num_cams", num_cams).format("count");
+        stats.add("pairwise", pairwise).format("count");
+        stats.add("recovery_check", int(check_type)).format("count");
+        stats.add("epipolar_matching", epipolar).format("count");
+        stats.add("frame_time", total_time / num_frames).format("ms");
+        stats.add("keypoints_per_cam", kp_per_cam).format("count");
+        stats.add("multi_cam_keypoints", multi_cam).format("count");
+        stats.add("outlier_rate", outlier_rate);
+      }
+    }
+  }
+
+  stats.save_json(result_path);
+
+  return 0;
+}
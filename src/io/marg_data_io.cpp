@@ -35,51 +35,84 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <basalt/io/marg_data_io.h>
 
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
 #include <basalt/serialization/headers_serialization.h>
 #include <basalt/utils/filesystem.h>
+#include <basalt/utils/memory_tracking.h>
 
 namespace basalt {
 
-MargDataSaver::MargDataSaver(const std::string& path) {
+MargDataSaver::MargDataSaver(const std::string& path,
+                             const VioConfig& config) {
   fs::remove_all(path);
   fs::create_directory(path);
 
-  save_image_queue.set_capacity(300);
+  const bool bounded = config.marg_data_bounded_recording;
+  const int queue_size = std::max(1, config.marg_data_queue_size);
+
+  // In bounded recording the estimator only hands data to a dispatcher that
+  // never blocks, so in_marg_queue can be generous. The actual writers get
+  // small queues and whatever does not fit is dropped.
+  save_image_queue.set_capacity(bounded ? queue_size : 300);
+  save_marg_queue.set_capacity(queue_size);
 
   std::string img_path = path + "/images/";
   fs::create_directory(img_path);
 
-  in_marg_queue.set_capacity(1000);
+  in_marg_queue.set_capacity(bounded ? 10000 : 1000);
+
+  auto write_marg_data = [&, path](const MargData::Ptr& data) {
+    int64_t kf_id = *data->kfs_to_marg.begin();
+
+    std::string p = path + "/" + std::to_string(kf_id) + ".cereal";
+    std::ofstream os(p, std::ios::binary);
+
+    {
+      cereal::BinaryOutputArchive archive(os);
+      archive(*data);
+    }
+    os.close();
+
+    counters.marg_data_saved++;
+  };
 
-  auto save_func = [&, path]() {
+  auto save_func = [&, bounded, write_marg_data]() {
     basalt::MargData::Ptr data;
 
-    std::unordered_set<int64_t> processed_opt_flow;
+    std::unordered_set<int64_t, std::hash<int64_t>, std::equal_to<int64_t>,
+                       tracked_allocator<int64_t, MemoryTag::MARG_DATA>>
+        processed_opt_flow;
 
     while (true) {
       in_marg_queue.pop(data);
 
       if (data.get()) {
-        int64_t kf_id = *data->kfs_to_marg.begin();
-
-        std::string p = path + "/" + std::to_string(kf_id) + ".cereal";
-        std::ofstream os(p, std::ios::binary);
-
-        {
-          cereal::BinaryOutputArchive archive(os);
-          archive(*data);
+        if (bounded) {
+          if (!save_marg_queue.try_push(data)) counters.marg_data_dropped++;
+        } else {
+          write_marg_data(data);
         }
-        os.close();
 
         for (const auto& d : data->opt_flow_res) {
+          // Frames restored from a checkpoint may have lost their images
+          if (!d->input_images) continue;
+
           if (processed_opt_flow.count(d->t_ns) == 0) {
-            save_image_queue.push(d);
             processed_opt_flow.emplace(d->t_ns);
+            if (!bounded) {
+              save_image_queue.push(d);
+            } else if (!save_image_queue.try_push(d)) {
+              counters.images_dropped_queue++;
+            }
           }
         }
 
       } else {
         save_image_queue.push(nullptr);
+        if (bounded) save_marg_queue.push(nullptr);
         break;
       }
     }
@@ -87,13 +120,68 @@ MargDataSaver::MargDataSaver(const std::string& path) {
     std::cout << "Finished MargDataSaver" << std::endl;
   };
 
-  auto save_image_func = [&, img_path]() {
-    basalt::OpticalFlowResult::Ptr data;
+  // Pops everything that is already queued in one go, so a writer that fell
+  // behind drains its backlog without waking up once per element.
+  auto pop_batch = [](auto& queue, auto& batch) {
+    batch.clear();
+    batch.emplace_back();
+    queue.pop(batch.back());
+    typename std::decay_t<decltype(batch)>::value_type next;
+    while (batch.back() && queue.try_pop(next)) batch.emplace_back(next);
+  };
+
+  auto save_marg_func = [&, write_marg_data, pop_batch]() {
+    std::vector<MargData::Ptr> batch;
 
     while (true) {
-      save_image_queue.pop(data);
+      pop_batch(save_marg_queue, batch);
+      for (const auto& data : batch) {
+        if (!data) return;
+        write_marg_data(data);
+      }
+    }
+  };
+
+  // Token bucket over the image bytes written per second. The bucket holds at
+  // most one second worth of budget so idle periods do not allow long bursts,
+  // or the size of the current image set if that is larger, so that large
+  // image sets are still written at a lower rate instead of never.
+  const double max_bytes_s = config.marg_data_max_write_mb_s * 1e6;
+
+  auto save_image_func = [&, img_path, max_bytes_s, pop_batch]() {
+    std::vector<OpticalFlowResult::Ptr> batch;
+
+    double budget = max_bytes_s;
+    auto last_refill = std::chrono::steady_clock::now();
+
+    while (true) {
+      pop_batch(save_image_queue, batch);
+
+      for (const auto& data : batch) {
+        if (!data) {
+          std::cout << "Finished image MargDataSaver" << std::endl;
+          return;
+        }
+
+        if (max_bytes_s > 0) {
+          size_t bytes = 0;
+          for (const auto& d : data->input_images->img_data) {
+            if (d.img) bytes += d.img->pitch * d.img->h;
+          }
+
+          auto now = std::chrono::steady_clock::now();
+          budget += max_bytes_s *
+                    std::chrono::duration<double>(now - last_refill).count();
+          budget = std::min(budget, std::max(max_bytes_s, double(bytes)));
+          last_refill = now;
+
+          if (bytes > budget) {
+            counters.images_dropped_budget++;
+            continue;
+          }
+          budget -= bytes;
+        }
 
-      if (data.get()) {
         std::string p = img_path + "/" + std::to_string(data->t_ns) + ".cereal";
         std::ofstream os(p, std::ios::binary);
 
@@ -102,17 +190,25 @@ MargDataSaver::MargDataSaver(const std::string& path) {
           archive(data);
         }
         os.close();
-      } else {
-        break;
+
+        counters.images_saved++;
       }
     }
-
-    std::cout << "Finished image MargDataSaver" << std::endl;
   };
 
   saving_thread.reset(new std::thread(save_func));
   saving_img_thread.reset(new std::thread(save_image_func));
-}  // namespace basalt
+  if (bounded) saving_marg_thread.reset(new std::thread(save_marg_func));
+}
+
+void MargDataSaver::printCounters() const {
+  std::cout << "MargDataSaver saved " << counters.marg_data_saved
+            << " marg. data (" << counters.marg_data_dropped << " dropped) and "
+            << counters.images_saved << " images ("
+            << counters.images_dropped_queue << " dropped on full queue, "
+            << counters.images_dropped_budget << " over IO budget)"
+            << std::endl;
+}
 
 MargDataLoader::MargDataLoader() : out_marg_queue(nullptr) {}
 
@@ -165,8 +261,12 @@ void MargDataLoader::start(const std::string& path) {
       }
       is.close();
 
+      // Images may be missing if they were dropped by bounded recording
       for (const auto& d : data->kfs_all) {
-        data->opt_flow_res.emplace_back(opt_flow_res.at(d));
+        auto it = opt_flow_res.find(d);
+        if (it != opt_flow_res.end()) {
+          data->opt_flow_res.emplace_back(it->second);
+        }
       }
 
       out_marg_queue->push(data);
@@ -180,47 +280,3 @@ void MargDataLoader::start(const std::string& path) {
   processing_thread.reset(new std::thread(func));
 }
 }  // namespace basalt
-
-namespace cereal {
-
-template <class Archive, class T>
-void save(Archive& ar, const basalt::ManagedImage<T>& m) {
-  ar(m.w);
-  ar(m.h);
-  ar(cereal::binary_data(m.ptr, sizeof(T) * m.w * m.h));
-}
-
-template <class Archive, class T>
-void load(Archive& ar, basalt::ManagedImage<T>& m) {
-  size_t w;
-  size_t h;
-  ar(w);
-  ar(h);
-  m.Reinitialise(w, h);
-  ar(cereal::binary_data(m.ptr, sizeof(T) * m.w * m.h));
-}
-
-template <class Archive>
-void serialize(Archive& ar, basalt::OpticalFlowResult& m) {
-  ar(m.t_ns);
-  ar(m.observations);
-  ar(m.input_images);
-}
-
-template <class Archive>
-void serialize(Archive& ar, basalt::OpticalFlowInput& m) {
-  ar(m.t_ns);
-  ar(m.img_data);
-}
-
-template <class Archive>
-void serialize(Archive& ar, basalt::ImageData& m) {
-  ar(m.exposure);
-  ar(m.img);
-}
-
-template <class Archive>
-static void serialize(Archive& ar, Eigen::AffineCompact2f& m) {
-  ar(m.matrix());
-}
-}  // namespace cereal
@@ -121,7 +121,8 @@ LinearizationAbsQR<Scalar, POSE_SIZE>::LinearizationAbsQR(
       } else if (lost_landmarks && lost_landmarks->count(k)) {
         landmark_ids.emplace_back(k);
       }
-    } else {
+    } else if (!options.active_landmarks ||
+               options.active_landmarks->count(k)) {
       landmark_ids.emplace_back(k);
     }
   }
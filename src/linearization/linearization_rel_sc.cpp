@@ -148,6 +148,15 @@ Scalar LinearizationRelSC<Scalar, POSE_SIZE>::linearizeProblem(
         }
       }
     }
+  } else if (options_.active_landmarks) {
+    for (const auto& [tcid_h, target_map] : lmdb_.getObservations()) {
+      for (const auto& [tcid_t, lm_ids] : target_map) {
+        for (const auto& lm_id : lm_ids) {
+          if (options_.active_landmarks->count(lm_id))
+            obs_to_lin[tcid_h][tcid_t].emplace(lm_id);
+        }
+      }
+    }
   } else {
     obs_to_lin = lmdb_.getObservations();
   }
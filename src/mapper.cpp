@@ -51,6 +51,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <CLI/CLI.hpp>
 
+#include <basalt/hash_bow/vocabulary_tree.h>
 #include <basalt/io/dataset_io.h>
 #include <basalt/io/marg_data_io.h>
 #include <basalt/optimization/accumulator.h>
@@ -106,6 +107,8 @@ void tracks();
 void optimize();
 void filter();
 void saveTrajectoryButton();
+void saveMapButton();
+void trainVocabulary();
 
 constexpr int UI_WIDTH = 200;
 
@@ -142,10 +145,15 @@ Button align_btn("ui.aling_se3", &alignButton);
 pangolin::Var<bool> euroc_fmt("ui.euroc_fmt", true, false, true);
 pangolin::Var<bool> tum_rgbd_fmt("ui.tum_rgbd_fmt", false, false, true);
 Button save_traj_btn("ui.save_traj", &saveTrajectoryButton);
+Button save_map_btn("ui.save_map", &saveMapButton);
 
 pangolin::OpenGlRenderState camera;
 
 std::string marg_data_path;
+std::string map_path;
+std::string vocabulary_path;
+size_t vocabulary_branching = 10;
+size_t vocabulary_depth = 5;
 
 int main(int argc, char** argv) {
   bool show_gui = true;
@@ -167,6 +175,19 @@ int main(int argc, char** argv) {
 
   app.add_option("--result-path", result_path, "Path to config file.");
 
+  app.add_option("--save-map", map_path,
+                 "Path to save the map for localization after optimization.");
+
+  app.add_option("--train-vocabulary", vocabulary_path,
+                 "Train a vocabulary tree on the keyframe images, save it to "
+                 "this path and exit.");
+
+  app.add_option("--vocabulary-branching", vocabulary_branching,
+                 "Branching factor of the trained vocabulary tree.");
+
+  app.add_option("--vocabulary-depth", vocabulary_depth,
+                 "Depth of the trained vocabulary tree.");
+
   try {
     app.parse(argc, argv);
   } catch (const CLI::ParseError& e) {
@@ -205,6 +226,11 @@ int main(int argc, char** argv) {
     std::sort(image_t_ns.begin(), image_t_ns.end());
   }
 
+  if (!vocabulary_path.empty()) {
+    trainVocabulary();
+    return 0;
+  }
+
   if (show_gui) {
     pangolin::CreateWindowAndBind("Main", 1800, 1000);
 
@@ -345,6 +371,8 @@ int main(int argc, char** argv) {
 
     auto time_end = std::chrono::high_resolution_clock::now();
 
+    if (!map_path.empty()) saveMapButton();
+
     if (!result_path.empty()) {
       double error = alignButton();
 
@@ -357,6 +385,10 @@ int main(int argc, char** argv) {
         ar(cereal::make_nvp("rms_ate", error));
         ar(cereal::make_nvp("num_frames", nrf_mapper->getFramePoses().size()));
         ar(cereal::make_nvp("exec_time_ns", exec_time_ns.count()));
+        ar(cereal::make_nvp("num_match_candidates",
+                            nrf_mapper->num_match_candidates));
+        ar(cereal::make_nvp("num_verified_pairs",
+                            nrf_mapper->num_verified_pairs));
       }
       os.close();
     }
@@ -720,3 +752,30 @@ void saveTrajectoryButton() {
         << std::endl;
   }
 }
+
+void saveMapButton() {
+  basalt::LocalizationMap map;
+  nrf_mapper->getLocalizationMap(map);
+  map.save(map_path.empty() ? "localization_map.bin" : map_path);
+}
+
+void trainVocabulary() {
+  detect();
+
+  std::vector<std::vector<basalt::Descriptor>> descriptors;
+  for (const auto& kv : nrf_mapper->feature_corners) {
+    descriptors.emplace_back(kv.second.corner_descriptors);
+  }
+
+  std::cout << "Training vocabulary with branching " << vocabulary_branching
+            << " and depth " << vocabulary_depth << " on "
+            << descriptors.size() << " images..." << std::endl;
+
+  basalt::VocabularyTree<256> vocabulary;
+  vocabulary.train(descriptors, vocabulary_branching, vocabulary_depth);
+
+  if (vocabulary.save(vocabulary_path)) {
+    std::cout << "Saved vocabulary with " << vocabulary.num_words()
+              << " words to " << vocabulary_path << std::endl;
+  }
+}
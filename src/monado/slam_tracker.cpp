@@ -1,6 +1,7 @@
 // Copyright 2022, Collabora, Ltd.
 
 #include "slam_tracker.hpp"
+#include "slam_tracker_ext.hpp"
 #include "slam_tracker_ui.hpp"
 
 #include <pangolin/display/image_view.h>
@@ -10,8 +11,10 @@
 
 #include <chrono>
 #include <cstdio>
+#include <functional>
 #include <memory>
 #include <mutex>
+#include <sstream>
 #include <string>
 #include <thread>
 #include <unordered_set>
@@ -19,6 +22,8 @@
 
 #include <basalt/io/marg_data_io.h>
 #include <basalt/serialization/headers_serialization.h>
+#include <basalt/utils/memory_tracking.h>
+#include <basalt/utils/tracker_scheduler.h>
 #include <basalt/vi_estimator/vio_estimator.h>
 #include "basalt/utils/vis_utils.h"
 
@@ -75,6 +80,8 @@ struct slam_tracker::implementation {
   string marg_data_path;
   bool print_queue = false;
   bool use_double = false;
+  int scheduler_weight = 0;
+  int scheduler_threads = 0;
 
   // VIO members
   struct {
@@ -86,6 +93,7 @@ struct slam_tracker::implementation {
   VioConfig vio_config;
   OpticalFlowBase::Ptr opt_flow_ptr;
   VioEstimatorBase::Ptr vio;
+  TrackerScheduler::Instance::Ptr scheduler_instance;
   int expecting_frame = 0;
 
   // Queues
@@ -109,6 +117,8 @@ struct slam_tracker::implementation {
       F_ADD_IMU_CALIBRATION,
       F_ENABLE_POSE_EXT_TIMING,
       F_ENABLE_POSE_EXT_FEATURES,
+      F_SAVE_CHECKPOINT,
+      F_RESTORE_CHECKPOINT,
   };
 
   // Additional calibration data
@@ -118,9 +128,12 @@ struct slam_tracker::implementation {
   // Enabled pose extensions
   bool pose_timing_enabled = false;
   bool pose_features_enabled = false;
+  bool pose_memory_enabled = false;
 
  public:
   implementation(const slam_config &config) {
+    if (MEMORY_TRACKING_ENABLED) supported_features.insert(F_ENABLE_POSE_EXT_MEMORY);
+
     cam_count = config.cam_count;
     show_gui = config.show_ui;
     cout << "Basalt with cam_count=" << cam_count << ", show_gui=" << show_gui << "\n";
@@ -154,6 +167,11 @@ struct slam_tracker::implementation {
     app.add_option("--marg-data", marg_data_path, "Path to folder where marginalization data will be stored.");
     app.add_option("--print-queue", print_queue, "Poll and print for queue sizes.");
     app.add_option("--use-double", use_double, "Whether to use a double or single precision pipeline.");
+    app.add_option("--scheduler-weight", scheduler_weight,
+                   "Share of the threads of the process for this tracker, relative to other trackers. "
+                   "0 (default) uses the global TBB arena.");
+    app.add_option("--scheduler-threads", scheduler_threads,
+                   "Threads shared by all trackers of the process, 0 for all cores. First tracker to set it wins.");
 
     try {
       // While --config-path sets the VIO configuration, --config sets the
@@ -219,6 +237,18 @@ struct slam_tracker::implementation {
       next = &pose_features->next;
     }
 
+    if (pose_memory_enabled) {
+      auto pose_memory = make_shared<pose_ext_memory>();
+      for (int i = 0; i < NUM_MEMORY_TAGS; i++) {
+        const MemoryTagCounters &c = memoryTagCounters(static_cast<MemoryTag>(i));
+        pose_memory->bytes.push_back(c.bytes);
+        pose_memory->allocations.push_back(c.allocations);
+        pose_memory->total_allocations.push_back(c.total_allocations);
+      }
+      *next = pose_memory;
+      next = &pose_memory->next;
+    }
+
     return p;
   }
 
@@ -259,6 +289,16 @@ struct slam_tracker::implementation {
     cout << "Finished queues_printer\n";
   }
 
+  void print_scheduler_stats() {
+    const TrackerScheduler::Instance &s = *scheduler_instance;
+    cout << s.getName() << " (weight " << s.getWeight() << ", " << s.getConcurrency() << " threads) latency:\n";
+    for (auto stage : {TrackerScheduler::OPTICAL_FLOW, TrackerScheduler::VIO}) {
+      TrackerScheduler::LatencyStats l = s.getLatency(stage);
+      cout << (stage == TrackerScheduler::VIO ? "  vio: " : "  optical flow: ") << l.count << " frames, mean "
+           << l.mean_ms << " ms, max " << l.max_ms << " ms\n";
+    }
+  }
+
   void print_calibration() {
     std::stringstream ss{};
     cereal::JSONOutputArchive write_to_stream(ss);
@@ -303,9 +343,20 @@ struct slam_tracker::implementation {
     vio->out_state_queue = &out_state_queue;
     vio->opt_flow_depth_guess_queue = &opt_flow_ptr->input_depth_queue;
     vio->opt_flow_state_queue = &opt_flow_ptr->input_state_queue;
+    vio->opt_flow_kf_request_queue = &opt_flow_ptr->input_kf_request_queue;
+
+    // Set before any frame is pushed, the input queues publish it to the threads
+    if (scheduler_threads > 0) TrackerScheduler::get().setNumThreads(scheduler_threads);
+    if (scheduler_weight > 0) {
+      static std::atomic<int> num_instances = 0;
+      string name = "slam_tracker" + to_string(num_instances++);
+      scheduler_instance = TrackerScheduler::get().registerInstance(name, scheduler_weight);
+      opt_flow_ptr->scheduler_instance = scheduler_instance;
+      vio->scheduler_instance = scheduler_instance;
+    }
 
     if (!marg_data_path.empty()) {
-      marg_data_saver.reset(new MargDataSaver(marg_data_path));
+      marg_data_saver.reset(new MargDataSaver(marg_data_path, vio_config));
       vio->out_marg_queue = &marg_data_saver->in_marg_queue;
     }
   }
@@ -328,6 +379,7 @@ struct slam_tracker::implementation {
     if (print_queue) queues_printer_thread.join();
     state_consumer_thread.join();
     if (show_gui) ui.stop();
+    if (scheduler_instance) print_scheduler_stats();
 
     // TODO: There is a segfault when closing monado without starting the stream
     // happens in a lambda from keypoint_vio.cpp and ends at line calib_bias.hpp:112
@@ -433,6 +485,14 @@ struct slam_tracker::implementation {
     } else if (feature_id == FID_EPEF) {
       shared_ptr<FPARAMS_EPEF> casted_params = static_pointer_cast<FPARAMS_EPEF>(params);
       enable_pose_ext_features(*casted_params);
+    } else if (feature_id == FID_EPEM && supports_feature(feature_id)) {
+      shared_ptr<FPARAMS_EPEM> casted_params = static_pointer_cast<FPARAMS_EPEM>(params);
+      result = enable_pose_ext_memory(*casted_params);
+    } else if (feature_id == FID_SC) {
+      result = save_checkpoint();
+    } else if (feature_id == FID_RC) {
+      shared_ptr<FPARAMS_RC> casted_params = static_pointer_cast<FPARAMS_RC>(params);
+      result = make_shared<FRESULT_RC>(restore_checkpoint(*casted_params));
     } else {
       return false;
     }
@@ -547,6 +607,38 @@ struct slam_tracker::implementation {
   }
 
   void enable_pose_ext_features(bool enable) { pose_features_enabled = enable; }
+
+  shared_ptr<vector<string>> enable_pose_ext_memory(bool enable) {
+    pose_memory_enabled = enable;
+    auto names = make_shared<vector<string>>();
+    for (int i = 0; i < NUM_MEMORY_TAGS; i++) names->emplace_back(memoryTagName(static_cast<MemoryTag>(i)));
+    return names;
+  }
+
+  // The checkpoint is the optical flow section followed by the VIO section
+  shared_ptr<vector<uint8_t>> save_checkpoint() {
+    ASSERT(vio != nullptr, "Checkpoints need an initialized tracker");
+    ostringstream os;
+    if (!opt_flow_ptr->saveCheckpoint(os) || !vio->saveCheckpoint(os)) return nullptr;
+    const string blob = os.str();
+    return make_shared<vector<uint8_t>>(blob.begin(), blob.end());
+  }
+
+  bool restore_checkpoint(const vector<uint8_t> &blob) {
+    ASSERT(vio != nullptr, "Restore checkpoints after initialize()");
+    ASSERT(!running, "Restore checkpoints before start()");
+    istringstream is(string(blob.begin(), blob.end()));
+
+    // Both sections are validated before any of them is applied
+    std::function<void()> apply_flow = opt_flow_ptr->prepareRestore(is);
+    if (!apply_flow) return false;
+    std::function<void()> apply_vio = vio->prepareRestore(is);
+    if (!apply_vio) return false;
+
+    apply_flow();
+    apply_vio();
+    return true;
+  }
 };
 
 EXPORT slam_tracker::slam_tracker(const slam_config &slam_config) {
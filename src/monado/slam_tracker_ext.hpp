@@ -0,0 +1,62 @@
+#pragma once
+
+#include "slam_tracker.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Basalt specific extensions of the slam_tracker interface. They are not part
+// of the upstream header, so they use IDs from a range that upstream does not
+// assign and do not change HEADER_VERSION_*. A user that wants them includes
+// this header next to slam_tracker.hpp and checks supports_feature() first.
+
+namespace xrt::auxiliary::tracking::slam {
+
+/*!
+ * Feature ENABLE_POSE_EXT_MEMORY
+ *
+ * Enable/disable adding the memory usage of each subsystem to the estimated
+ * poses. Returns a vector with names for the subsystems in `pose_ext_memory`.
+ * Only supported when Basalt is built with BASALT_MEMORY_TRACKING.
+ */
+DEFINE_FEATURE(ENABLE_POSE_EXT_MEMORY, EPEM, 1001, bool,
+               std::vector<std::string>)
+
+/*!
+ * Feature SAVE_CHECKPOINT
+ *
+ * Use it while the tracker is running to get an opaque snapshot of its state.
+ * Returns nullptr if there is nothing to save yet, e.g. before the first pose.
+ */
+DEFINE_FEATURE(SAVE_CHECKPOINT, SC, 1002, void, std::vector<std::uint8_t>)
+
+/*!
+ * Feature RESTORE_CHECKPOINT
+ *
+ * Use it after `initialize()` but before `start()` to resume tracking from a
+ * snapshot of SAVE_CHECKPOINT. The tracker must use the same configuration and
+ * calibration. Returns false if the snapshot could not be restored, in which
+ * case tracking starts from scratch as usual.
+ */
+DEFINE_FEATURE(RESTORE_CHECKPOINT, RC, 1003, std::vector<std::uint8_t>, bool)
+
+//! Type of the memory pose extension, outside of the upstream pose_ext_type
+//! values.
+constexpr pose_ext_type POSE_EXT_MEMORY = static_cast<pose_ext_type>(1001);
+
+// Memory pose extension
+struct pose_ext_memory_data {
+  //! Per subsystem, in the order of the names returned by the feature.
+  std::vector<std::int64_t> bytes{};             //!< Currently allocated
+  std::vector<std::int64_t> allocations{};       //!< Currently allocated
+  std::vector<std::int64_t> total_allocations{}; //!< Since start, for rates
+};
+
+struct pose_ext_memory : pose_extension, pose_ext_memory_data {
+  pose_ext_memory() : pose_extension{POSE_EXT_MEMORY} {}
+  pose_ext_memory(const pose_ext_memory_data &pemd)
+      : pose_extension{POSE_EXT_MEMORY}, pose_ext_memory_data{pemd} {}
+};
+
+} // namespace xrt::auxiliary::tracking::slam
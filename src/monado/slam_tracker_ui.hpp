@@ -20,6 +20,7 @@
 #include <basalt/optical_flow/optical_flow.h>
 #include <basalt/serialization/headers_serialization.h>
 #include <basalt/utils/keypoints.h>
+#include <basalt/utils/memory_tracking.h>
 #include <basalt/utils/vio_config.h>
 #include <basalt/utils/vis_utils.h>
 #include <basalt/vi_estimator/vio_estimator.h>
@@ -99,8 +100,11 @@ class slam_tracker_ui {
   }
 
   int64_t start_t_ns = -1;
-  std::vector<int64_t> vio_t_ns;
-  Eigen::aligned_vector<Eigen::Vector3d> vio_t_w_i;
+  std::vector<int64_t, tracked_allocator<int64_t, MemoryTag::UI>> vio_t_ns;
+  std::vector<Eigen::Vector3d,
+              tracked_allocator<Eigen::Vector3d, MemoryTag::UI,
+                                Eigen::aligned_allocator<Eigen::Vector3d>>>
+      vio_t_w_i;
 
   void log_vio_data(const PoseVelBiasState<double>::Ptr &data) {
     int64_t t_ns = data->t_ns;
@@ -41,6 +41,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <sophus/se3.hpp>
 
 #include <tbb/concurrent_unordered_map.h>
+#include <tbb/task_arena.h>
 
 #include <pangolin/display/image_view.h>
 #include <pangolin/gl/gldraw.h>
@@ -59,6 +60,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <basalt/optical_flow/optical_flow.h>
 
 #include <basalt/serialization/headers_serialization.h>
+#include <basalt/utils/time_utils.hpp>
 
 constexpr int UI_WIDTH = 200;
 
@@ -82,6 +84,8 @@ basalt::VioDatasetPtr vio_dataset;
 basalt::VioConfig vio_config;
 basalt::OpticalFlowBase::Ptr opt_flow_ptr;
 
+bool print_throughput = false;
+
 tbb::concurrent_unordered_map<int64_t, basalt::OpticalFlowResult::Ptr,
                               std::hash<int64_t>>
     observations;
@@ -117,16 +121,24 @@ void read_result() {
 
   basalt::OpticalFlowResult::Ptr res;
 
+  // Throughput is measured from the first result, so it excludes setup but
+  // includes waiting for the images to be loaded.
+  basalt::Timer timer;
+  size_t num_tracked = 0;
+
   while (true) {
     observations_queue.pop(res);
     if (!res.get()) break;
 
+    if (observations.empty()) timer.reset();
+
     res->input_images.reset();
 
     observations.emplace(res->t_ns, res);
 
     for (size_t i = 0; i < res->observations.size(); i++)
       for (const auto& kv : res->observations.at(i)) {
+        num_tracked++;
         if (keypoint_stats.count(kv.first) == 0) {
           keypoint_stats[kv.first] = 1;
         } else {
@@ -135,8 +147,18 @@ void read_result() {
       }
   }
 
+  const double elapsed_ms = timer.elapsed() * 1e3;
+  const int num_threads = tbb::this_task_arena::max_concurrency();
+
   std::cout << "Finished read_result thread " << std::endl;
 
+  if (print_throughput) {
+    std::cout << "Keypoints per ms per core: "
+              << num_tracked / elapsed_ms / num_threads
+              << " (keypoints: " << num_tracked << " time: " << elapsed_ms
+              << " ms threads: " << num_threads << ")" << std::endl;
+  }
+
   double sum = 0;
 
   for (const auto& kv : keypoint_stats) {
@@ -169,6 +191,10 @@ int main(int argc, char** argv) {
 
   app.add_option("--config-path", config_path, "Path to config file.");
 
+  app.add_option("--print-throughput", print_throughput,
+                 "Print the tracking throughput in keypoints per ms per core. "
+                 "Also works without the GUI.");
+
   try {
     app.parse(argc, argv);
   } catch (const CLI::ParseError& e) {
@@ -196,7 +222,8 @@ int main(int argc, char** argv) {
 
     opt_flow_ptr =
         basalt::OpticalFlowFactory::getOpticalFlow(vio_config, calib);
-    if (show_gui) opt_flow_ptr->output_queue = &observations_queue;
+    if (show_gui || print_throughput)
+      opt_flow_ptr->output_queue = &observations_queue;
     observations_queue.set_capacity(100);
 
     keypoint_stats.reserve(50000);
@@ -204,9 +231,11 @@ int main(int argc, char** argv) {
 
   std::thread t1(&feed_images);
 
-  if (show_gui) {
-    std::thread t2(&read_result);
+  std::shared_ptr<std::thread> t2;
+  if (show_gui || print_throughput)
+    t2.reset(new std::thread(&read_result));
 
+  if (show_gui) {
     pangolin::CreateWindowAndBind("Main", 1800, 1000);
 
     glEnable(GL_DEPTH_TEST);
@@ -272,11 +301,10 @@ int main(int argc, char** argv) {
         std::this_thread::sleep_for(std::chrono::milliseconds(50));
       }
     }
-
-    t2.join();
   }
 
   t1.join();
+  if (t2) t2->join();
 
   return 0;
 }
@@ -201,11 +201,13 @@ int main(int argc, char** argv) {
   vio->out_state_queue = &out_state_queue;
   vio->opt_flow_depth_guess_queue = &opt_flow_ptr->input_depth_queue;
   vio->opt_flow_state_queue = &opt_flow_ptr->input_state_queue;
+  vio->opt_flow_kf_request_queue = &opt_flow_ptr->input_kf_request_queue;
 
   basalt::MargDataSaver::Ptr marg_data_saver;
 
   if (!marg_data_path.empty()) {
-    marg_data_saver.reset(new basalt::MargDataSaver(marg_data_path));
+    marg_data_saver.reset(
+        new basalt::MargDataSaver(marg_data_path, vio_config));
     vio->out_marg_queue = &marg_data_saver->in_marg_queue;
   }
 
@@ -364,6 +364,67 @@ void matchDescriptors(const std::vector<std::bitset<256>>& corner_descriptors_1,
   }
 }
 
+static void matchGroupedHelper(
+    const std::vector<std::bitset<256>>& corner_descriptors_1,
+    const std::vector<uint32_t>& groups_1,
+    const std::vector<std::bitset<256>>& corner_descriptors_2,
+    const std::vector<uint32_t>& groups_2,
+    std::unordered_map<int, int>& matches, int threshold, double test_dist) {
+  matches.clear();
+
+  std::unordered_map<uint32_t, std::vector<int>> group_features_2;
+  for (size_t j = 0; j < corner_descriptors_2.size(); j++) {
+    group_features_2[groups_2[j]].emplace_back(j);
+  }
+
+  for (size_t i = 0; i < corner_descriptors_1.size(); i++) {
+    const auto it = group_features_2.find(groups_1[i]);
+    if (it == group_features_2.end()) continue;
+
+    int best_idx = -1, best_dist = 500;
+    int best2_dist = 500;
+
+    for (int j : it->second) {
+      int dist = (corner_descriptors_1[i] ^ corner_descriptors_2[j]).count();
+
+      if (dist <= best_dist) {
+        best2_dist = best_dist;
+
+        best_dist = dist;
+        best_idx = j;
+      } else if (dist < best2_dist) {
+        best2_dist = dist;
+      }
+    }
+
+    if (best_dist < threshold && best_dist * test_dist <= best2_dist) {
+      matches.emplace(i, best_idx);
+    }
+  }
+}
+
+void matchDescriptors(const std::vector<std::bitset<256>>& corner_descriptors_1,
+                      const std::vector<uint32_t>& groups_1,
+                      const std::vector<std::bitset<256>>& corner_descriptors_2,
+                      const std::vector<uint32_t>& groups_2,
+                      std::vector<std::pair<int, int>>& matches, int threshold,
+                      double dist_2_best) {
+  matches.clear();
+
+  std::unordered_map<int, int> matches_1_2, matches_2_1;
+  matchGroupedHelper(corner_descriptors_1, groups_1, corner_descriptors_2,
+                     groups_2, matches_1_2, threshold, dist_2_best);
+  matchGroupedHelper(corner_descriptors_2, groups_2, corner_descriptors_1,
+                     groups_1, matches_2_1, threshold, dist_2_best);
+
+  for (const auto& kv : matches_1_2) {
+    const auto it = matches_2_1.find(kv.second);
+    if (it != matches_2_1.end() && it->second == kv.first) {
+      matches.emplace_back(kv.first, kv.second);
+    }
+  }
+}
+
 void findInliersRansac(const KeypointsData& kd1, const KeypointsData& kd2,
                        const double ransac_thresh, const int ransac_min_inliers,
                        MatchData& md) {
@@ -0,0 +1,88 @@
+/**
+BSD 3-Clause License
+
+This file is part of the Basalt project.
+https://gitlab.com/VladyslavUsenko/basalt.git
+
+Copyright (c) 2022, Vladyslav Usenko and Nikolaus Demmel.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the copyright holder nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <basalt/utils/memory_tracking.h>
+
+#include <string>
+
+namespace basalt {
+
+const char* memoryTagName(MemoryTag tag) {
+  switch (tag) {
+    case MemoryTag::IMAGES:
+      return "images";
+    case MemoryTag::OPTICAL_FLOW:
+      return "optical_flow";
+    case MemoryTag::LANDMARK_DATABASE:
+      return "landmark_database";
+    case MemoryTag::MARG_DATA:
+      return "marg_data";
+    case MemoryTag::UI:
+      return "ui";
+    case MemoryTag::MAPPER:
+      return "mapper";
+    default:
+      return "unknown";
+  }
+}
+
+MemoryTagCounters& memoryTagCounters(MemoryTag tag) {
+  static std::array<MemoryTagCounters, NUM_MEMORY_TAGS> counters;
+  return counters.at(static_cast<int>(tag));
+}
+
+void MemoryStatsReporter::addStats(ExecutionStats& stats) {
+  if constexpr (!MEMORY_TRACKING_ENABLED) return;
+
+  const double dt = timer_.reset();
+
+  for (int i = 0; i < NUM_MEMORY_TAGS; i++) {
+    const MemoryTag tag = static_cast<MemoryTag>(i);
+    const MemoryTagCounters& c = memoryTagCounters(tag);
+    const std::string prefix = std::string("mem_") + memoryTagName(tag);
+
+    const int64_t total_allocations = c.total_allocations.load();
+    const int64_t new_allocations =
+        total_allocations - last_total_allocations_[i];
+    last_total_allocations_[i] = total_allocations;
+
+    stats.add(prefix + "_bytes", double(c.bytes.load())).format("count");
+    stats.add(prefix + "_allocs", double(c.allocations.load()))
+        .format("count");
+    stats.add(prefix + "_alloc_rate", new_allocations / dt).format("count");
+  }
+}
+
+}  // namespace basalt
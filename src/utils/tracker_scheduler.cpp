@@ -0,0 +1,168 @@
+/**
+BSD 3-Clause License
+
+This file is part of the Basalt project.
+https://gitlab.com/VladyslavUsenko/basalt.git
+
+Copyright (c) 2022, Vladyslav Usenko and Nikolaus Demmel.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the copyright holder nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <basalt/utils/tracker_scheduler.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <thread>
+
+namespace basalt {
+
+TrackerScheduler::Instance::Instance(TrackerScheduler& scheduler,
+                                     const std::string& name, int weight)
+    : scheduler(scheduler), name(name), weight(std::max(weight, 1)) {}
+
+TrackerScheduler::Instance::~Instance() { scheduler.unregisterInstance(this); }
+
+std::shared_ptr<tbb::task_arena> TrackerScheduler::Instance::arena() {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  int concurrency = 0;
+  {
+    std::lock_guard<std::mutex> scheduler_lock(scheduler.mutex);
+    if (arena_generation == scheduler.generation) return current_arena;
+    arena_generation = scheduler.generation;
+    concurrency = scheduler.concurrencyOf(weight);
+  }
+
+  // The threads of the stages enter the arena as masters, the rest of the
+  // share are workers of the shared pool
+  current_arena = std::make_shared<tbb::task_arena>(concurrency, NUM_STAGES);
+  return current_arena;
+}
+
+void TrackerScheduler::Instance::addLatency(Stage stage, int64_t ns) {
+  std::lock_guard<std::mutex> lock(mutex);
+  StageLatency& l = latency[stage];
+  l.count++;
+  l.sum_ns += ns;
+  l.max_ns = std::max(l.max_ns, ns);
+  l.last_ns = ns;
+}
+
+TrackerScheduler::LatencyStats TrackerScheduler::Instance::getLatency(
+    Stage stage) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  const StageLatency& l = latency[stage];
+
+  LatencyStats res;
+  res.count = l.count;
+  if (l.count > 0) res.mean_ms = l.sum_ns * 1e-6 / l.count;
+  res.max_ms = l.max_ns * 1e-6;
+  res.last_ms = l.last_ns * 1e-6;
+  return res;
+}
+
+int TrackerScheduler::Instance::getConcurrency() const {
+  std::lock_guard<std::mutex> lock(scheduler.mutex);
+  return scheduler.concurrencyOf(weight);
+}
+
+TrackerScheduler& TrackerScheduler::get() {
+  static TrackerScheduler scheduler;
+  return scheduler;
+}
+
+void TrackerScheduler::setNumThreads(int num_threads) {
+  if (num_threads <= 0) return;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (this->num_threads > 0) {
+    if (num_threads != this->num_threads) {
+      std::cout << "Warning: TrackerScheduler already uses "
+                << this->num_threads << " threads, ignoring the request for "
+                << num_threads << std::endl;
+    }
+    return;
+  }
+
+  this->num_threads = num_threads;
+
+  // global thread limit is in effect until global_control object is destroyed
+  global_control = std::make_unique<tbb::global_control>(
+      tbb::global_control::max_allowed_parallelism, this->num_threads);
+  generation++;
+}
+
+int TrackerScheduler::getNumThreads() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return num_threads;
+}
+
+TrackerScheduler::Instance::Ptr TrackerScheduler::registerInstance(
+    const std::string& name, int weight) {
+  Instance::Ptr instance(new Instance(*this, name, weight));
+
+  std::lock_guard<std::mutex> lock(mutex);
+  instances.emplace_back(instance);
+  total_weight += instance->weight;
+  generation++;
+  return instance;
+}
+
+std::vector<TrackerScheduler::Instance::Ptr> TrackerScheduler::getInstances()
+    const {
+  std::lock_guard<std::mutex> lock(mutex);
+  std::vector<Instance::Ptr> res;
+  for (const auto& w : instances) {
+    if (auto instance = w.lock()) res.emplace_back(instance);
+  }
+  return res;
+}
+
+void TrackerScheduler::unregisterInstance(const Instance* instance) {
+  std::lock_guard<std::mutex> lock(mutex);
+  // The weak pointer of the instance being destroyed has already expired
+  instances.erase(std::remove_if(instances.begin(), instances.end(),
+                                 [](const auto& w) { return w.expired(); }),
+                  instances.end());
+  total_weight -= instance->weight;
+  generation++;
+}
+
+int TrackerScheduler::concurrencyOf(int weight) const {
+  int pool = num_threads;
+  if (pool <= 0) pool = std::thread::hardware_concurrency();
+
+  int share = pool;
+  if (total_weight > 0) {
+    share = int(std::lround(double(pool) * weight / total_weight));
+  }
+  return std::max<int>(share, NUM_STAGES);
+}
+
+}  // namespace basalt
@@ -52,14 +52,27 @@ VioConfig::VioConfig() {
   optical_flow_detection_min_threshold = 5;
   optical_flow_detection_max_threshold = 40;
   optical_flow_detection_nonoverlap = true;
+  optical_flow_detection_min_occupancy = 1.0;
+  optical_flow_detection_max_frames = 1;
+  optical_flow_detection_regions = 1;
+  optical_flow_matching_pairwise = false;
   optical_flow_max_recovered_dist2 = 0.04f;
+  optical_flow_recovery_check = RecoveryCheckType::FULL;
+  optical_flow_batch_tracking = false;
+  optical_flow_gradient_pyramid = false;
   optical_flow_pattern = 51;
   optical_flow_max_iterations = 5;
   optical_flow_levels = 3;
+  optical_flow_base_level = 0;
+  optical_flow_base_refinement = true;
   optical_flow_epipolar_error = 0.005;
   optical_flow_skip_frames = 1;
+  optical_flow_skipped_frames_level = -1;
   optical_flow_matching_guess_type = MatchingGuessType::REPROJ_AVG_DEPTH;
   optical_flow_matching_default_depth = 2.0;
+  optical_flow_matching_epipolar = false;
+  optical_flow_matching_min_depth = 0.3;
+  optical_flow_matching_max_depth = 0;
 
   vio_linearization_type = LinearizationType::ABS_QR;
   vio_sqrt_marg = true;
@@ -74,6 +87,8 @@ VioConfig::VioConfig() {
   vio_obs_std_dev = 0.5;
   vio_obs_huber_thresh = 1.0;
   vio_min_triangulation_dist = 0.05;
+  vio_min_triangulation_parallax = 0;
+  vio_batch_triangulation = false;
   //  vio_outlier_threshold = 3.0;
   //  vio_filter_iteration = 4;
   vio_max_iterations = 7;
@@ -96,6 +111,25 @@ VioConfig::VioConfig() {
   vio_marg_lost_landmarks = true;
 
   vio_kf_marg_feature_ratio = 0.1;
+  vio_marg_sparsify_interval = 0;
+
+  vio_max_landmarks = 0;
+  vio_balance_landmark_hosts = false;
+
+  vio_map_path = "";
+  vio_map_obs_std_dev = 1.0;
+  vio_map_match_radius = 8.0;
+  vio_map_max_dist = 20.0;
+  vio_map_max_hamming_distance = 50;
+  vio_map_max_matches = 100;
+  vio_map_reloc_min_inliers = 25;
+  vio_map_reloc_min_inlier_ratio = 0.3;
+  vio_map_min_matches = 10;
+  vio_map_max_failed_kfs = 3;
+
+  marg_data_bounded_recording = false;
+  marg_data_queue_size = 100;
+  marg_data_max_write_mb_s = 0.0;
 
   mapper_obs_std_dev = 0.25;
   mapper_obs_huber_thresh = 1.5;
@@ -108,6 +142,8 @@ VioConfig::VioConfig() {
   mapper_max_hamming_distance = 70;
   mapper_second_best_test_ratio = 1.2;
   mapper_bow_num_bits = 16;
+  mapper_vocabulary_path = "";
+  mapper_vocabulary_direct_index_level = 2;
   mapper_min_triangulation_dist = 0.07;
   mapper_no_factor_weights = false;
   mapper_use_factors = true;
@@ -115,6 +151,9 @@ VioConfig::VioConfig() {
   mapper_use_lm = true;
   mapper_lm_lambda_min = 1e-32;
   mapper_lm_lambda_max = 1e3;
+
+  mapper_use_sqrt_ba = false;
+  mapper_sqrt_ba_use_double = false;
 }
 
 void VioConfig::save(const std::string& filename) {
@@ -164,6 +203,30 @@ void load_minimal(const Archive& ar, basalt::MatchingGuessType& guess_type,
   }
 }
 
+template <class Archive>
+std::string save_minimal(const Archive& ar,
+                         const basalt::RecoveryCheckType& check_type) {
+  UNUSED(ar);
+  auto name = magic_enum::enum_name(check_type);
+  return std::string(name);
+}
+
+template <class Archive>
+void load_minimal(const Archive& ar, basalt::RecoveryCheckType& check_type,
+                  const std::string& name) {
+  UNUSED(ar);
+
+  auto check_enum = magic_enum::enum_cast<basalt::RecoveryCheckType>(name);
+
+  if (check_enum.has_value()) {
+    check_type = check_enum.value();
+  } else {
+    std::cerr << "Could not find the RecoveryCheckType for " << name
+              << std::endl;
+    std::abort();
+  }
+}
+
 template <class Archive>
 std::string save_minimal(const Archive& ar,
                          const basalt::LinearizationType& linearization_type) {
@@ -197,14 +260,27 @@ void serialize(Archive& ar, basalt::VioConfig& config) {
   ar(CEREAL_NVP(config.optical_flow_detection_min_threshold));
   ar(CEREAL_NVP(config.optical_flow_detection_max_threshold));
   ar(CEREAL_NVP(config.optical_flow_detection_nonoverlap));
+  ar(CEREAL_NVP(config.optical_flow_detection_min_occupancy));
+  ar(CEREAL_NVP(config.optical_flow_detection_max_frames));
+  ar(CEREAL_NVP(config.optical_flow_detection_regions));
+  ar(CEREAL_NVP(config.optical_flow_matching_pairwise));
   ar(CEREAL_NVP(config.optical_flow_max_recovered_dist2));
+  ar(CEREAL_NVP(config.optical_flow_recovery_check));
+  ar(CEREAL_NVP(config.optical_flow_batch_tracking));
+  ar(CEREAL_NVP(config.optical_flow_gradient_pyramid));
   ar(CEREAL_NVP(config.optical_flow_pattern));
   ar(CEREAL_NVP(config.optical_flow_max_iterations));
   ar(CEREAL_NVP(config.optical_flow_epipolar_error));
   ar(CEREAL_NVP(config.optical_flow_levels));
+  ar(CEREAL_NVP(config.optical_flow_base_level));
+  ar(CEREAL_NVP(config.optical_flow_base_refinement));
   ar(CEREAL_NVP(config.optical_flow_skip_frames));
+  ar(CEREAL_NVP(config.optical_flow_skipped_frames_level));
   ar(CEREAL_NVP(config.optical_flow_matching_guess_type));
   ar(CEREAL_NVP(config.optical_flow_matching_default_depth));
+  ar(CEREAL_NVP(config.optical_flow_matching_epipolar));
+  ar(CEREAL_NVP(config.optical_flow_matching_min_depth));
+  ar(CEREAL_NVP(config.optical_flow_matching_max_depth));
 
   ar(CEREAL_NVP(config.vio_linearization_type));
   ar(CEREAL_NVP(config.vio_sqrt_marg));
@@ -221,6 +297,8 @@ void serialize(Archive& ar, basalt::VioConfig& config) {
   ar(CEREAL_NVP(config.vio_obs_std_dev));
   ar(CEREAL_NVP(config.vio_obs_huber_thresh));
   ar(CEREAL_NVP(config.vio_min_triangulation_dist));
+  ar(CEREAL_NVP(config.vio_min_triangulation_parallax));
+  ar(CEREAL_NVP(config.vio_batch_triangulation));
 
   ar(CEREAL_NVP(config.vio_enforce_realtime));
 
@@ -237,6 +315,24 @@ void serialize(Archive& ar, basalt::VioConfig& config) {
 
   ar(CEREAL_NVP(config.vio_marg_lost_landmarks));
   ar(CEREAL_NVP(config.vio_kf_marg_feature_ratio));
+  ar(CEREAL_NVP(config.vio_marg_sparsify_interval));
+  ar(CEREAL_NVP(config.vio_max_landmarks));
+  ar(CEREAL_NVP(config.vio_balance_landmark_hosts));
+
+  ar(CEREAL_NVP(config.vio_map_path));
+  ar(CEREAL_NVP(config.vio_map_obs_std_dev));
+  ar(CEREAL_NVP(config.vio_map_match_radius));
+  ar(CEREAL_NVP(config.vio_map_max_dist));
+  ar(CEREAL_NVP(config.vio_map_max_hamming_distance));
+  ar(CEREAL_NVP(config.vio_map_max_matches));
+  ar(CEREAL_NVP(config.vio_map_reloc_min_inliers));
+  ar(CEREAL_NVP(config.vio_map_reloc_min_inlier_ratio));
+  ar(CEREAL_NVP(config.vio_map_min_matches));
+  ar(CEREAL_NVP(config.vio_map_max_failed_kfs));
+
+  ar(CEREAL_NVP(config.marg_data_bounded_recording));
+  ar(CEREAL_NVP(config.marg_data_queue_size));
+  ar(CEREAL_NVP(config.marg_data_max_write_mb_s));
 
   ar(CEREAL_NVP(config.mapper_obs_std_dev));
   ar(CEREAL_NVP(config.mapper_obs_huber_thresh));
@@ -249,6 +345,8 @@ void serialize(Archive& ar, basalt::VioConfig& config) {
   ar(CEREAL_NVP(config.mapper_max_hamming_distance));
   ar(CEREAL_NVP(config.mapper_second_best_test_ratio));
   ar(CEREAL_NVP(config.mapper_bow_num_bits));
+  ar(CEREAL_NVP(config.mapper_vocabulary_path));
+  ar(CEREAL_NVP(config.mapper_vocabulary_direct_index_level));
   ar(CEREAL_NVP(config.mapper_min_triangulation_dist));
   ar(CEREAL_NVP(config.mapper_no_factor_weights));
   ar(CEREAL_NVP(config.mapper_use_factors));
@@ -256,5 +354,8 @@ void serialize(Archive& ar, basalt::VioConfig& config) {
   ar(CEREAL_NVP(config.mapper_use_lm));
   ar(CEREAL_NVP(config.mapper_lm_lambda_min));
   ar(CEREAL_NVP(config.mapper_lm_lambda_max));
+
+  ar(CEREAL_NVP(config.mapper_use_sqrt_ba));
+  ar(CEREAL_NVP(config.mapper_sqrt_ba_use_double));
 }
 }  // namespace cereal
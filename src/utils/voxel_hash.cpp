@@ -0,0 +1,231 @@
+/**
+BSD 3-Clause License
+
+This file is part of the Basalt project.
+https://gitlab.com/VladyslavUsenko/basalt.git
+
+Copyright (c) 2022, Vladyslav Usenko and Nikolaus Demmel.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the copyright holder nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <basalt/utils/voxel_hash.h>
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace basalt {
+
+namespace {
+
+// Voxel coordinates are packed into 21 bits per axis
+constexpr int VOXEL_COORD_BITS = 21;
+constexpr int VOXEL_COORD_OFFSET = 1 << (VOXEL_COORD_BITS - 1);
+constexpr uint64_t VOXEL_COORD_MASK = (uint64_t(1) << VOXEL_COORD_BITS) - 1;
+
+}  // namespace
+
+Eigen::Vector3i VoxelHash::voxelCoords(const Eigen::Vector3d& p) const {
+  Eigen::Vector3i v;
+  for (int k = 0; k < 3; k++) {
+    const double c = std::floor(p[k] / voxel_size);
+    v[k] = int(std::clamp<double>(c, -VOXEL_COORD_OFFSET,
+                                  VOXEL_COORD_OFFSET - 1));
+  }
+  return v;
+}
+
+uint64_t VoxelHash::voxelKey(const Eigen::Vector3i& v) {
+  uint64_t key = 0;
+  for (int k = 0; k < 3; k++) {
+    key <<= VOXEL_COORD_BITS;
+    key |= uint64_t(v[k] + VOXEL_COORD_OFFSET) & VOXEL_COORD_MASK;
+  }
+  return key;
+}
+
+void VoxelHash::build(const Eigen::aligned_vector<Eigen::Vector3d>& points,
+                      double voxel_size) {
+  this->voxel_size = voxel_size;
+  voxels.clear();
+  positions.clear();
+  point_ids.clear();
+
+  std::vector<std::pair<uint64_t, uint32_t>> keys(points.size());
+  for (size_t i = 0; i < points.size(); i++) {
+    keys[i] = {voxelKey(voxelCoords(points[i])), uint32_t(i)};
+  }
+  std::sort(keys.begin(), keys.end());
+
+  positions.resize(points.size());
+  point_ids.resize(points.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    point_ids[i] = keys[i].second;
+    positions[i] = points[keys[i].second].cast<float>();
+
+    if (i == 0 || keys[i].first != keys[i - 1].first) {
+      voxels[keys[i].first] = VoxelRange{uint32_t(i), uint32_t(i)};
+    }
+    voxels[keys[i].first].end = i + 1;
+  }
+}
+
+template <class Check, class F>
+void VoxelHash::forEachVoxel(const Eigen::Vector3d& lo,
+                             const Eigen::Vector3d& hi, const Check& check,
+                             const F& f) const {
+  const Eigen::Vector3i v_lo = voxelCoords(lo);
+  const Eigen::Vector3i v_hi = voxelCoords(hi);
+  const Eigen::Vector3d half_voxel = Eigen::Vector3d::Constant(voxel_size / 2);
+
+  const double num_cells = double(v_hi[0] - v_lo[0] + 1) *
+                           double(v_hi[1] - v_lo[1] + 1) *
+                           double(v_hi[2] - v_lo[2] + 1);
+
+  // For large query regions visiting the occupied voxels is cheaper than
+  // looking up every voxel of the region.
+  if (num_cells > double(voxels.size())) {
+    for (const auto& [key, range] : voxels) {
+      Eigen::Vector3i v;
+      for (int k = 2, shift = 0; k >= 0; k--, shift += VOXEL_COORD_BITS) {
+        v[k] = int((key >> shift) & VOXEL_COORD_MASK) - VOXEL_COORD_OFFSET;
+      }
+      if ((v.array() < v_lo.array()).any() || (v.array() > v_hi.array()).any())
+        continue;
+
+      if (check(v.cast<double>() * voxel_size + half_voxel)) f(range);
+    }
+    return;
+  }
+
+  Eigen::Vector3i v;
+  for (v[0] = v_lo[0]; v[0] <= v_hi[0]; v[0]++) {
+    for (v[1] = v_lo[1]; v[1] <= v_hi[1]; v[1]++) {
+      for (v[2] = v_lo[2]; v[2] <= v_hi[2]; v[2]++) {
+        if (!check(v.cast<double>() * voxel_size + half_voxel)) continue;
+
+        auto it = voxels.find(voxelKey(v));
+        if (it != voxels.end()) f(it->second);
+      }
+    }
+  }
+}
+
+void VoxelHash::queryRadius(const Eigen::Vector3d& center, double radius,
+                            std::vector<uint32_t>& ids) const {
+  ids.clear();
+  if (voxels.empty() || radius < 0) return;
+
+  // Radius of the sphere that bounds a voxel
+  const double voxel_radius = voxel_size * std::sqrt(3.0) / 2;
+  const Eigen::Vector3f c = center.cast<float>();
+  const float radius2 = radius * radius;
+
+  forEachVoxel(
+      center - Eigen::Vector3d::Constant(radius),
+      center + Eigen::Vector3d::Constant(radius),
+      [&](const Eigen::Vector3d& voxel_center) {
+        return (voxel_center - center).norm() <= radius + voxel_radius;
+      },
+      [&](const VoxelRange& r) {
+        for (uint32_t i = r.begin; i < r.end; i++) {
+          if ((positions[i] - c).squaredNorm() <= radius2) {
+            ids.emplace_back(point_ids[i]);
+          }
+        }
+      });
+}
+
+void VoxelHash::queryCone(const Eigen::Vector3d& apex,
+                          const Eigen::Vector3d& dir, double half_angle,
+                          double max_dist, std::vector<uint32_t>& ids) const {
+  if (half_angle >= M_PI) {
+    queryRadius(apex, max_dist, ids);
+    return;
+  }
+
+  ids.clear();
+  if (voxels.empty() || max_dist < 0 || half_angle < 0) return;
+
+  // Bounding box of the intersection of the cone and the ball. Along each
+  // axis the cone reaches furthest with the direction closest to the axis.
+  Eigen::Vector3d lo, hi;
+  for (int k = 0; k < 3; k++) {
+    const double alpha = std::acos(std::clamp(dir[k], -1.0, 1.0));
+    const double beta = M_PI - alpha;
+    const double reach_hi = std::cos(std::max(alpha - half_angle, 0.0));
+    const double reach_lo = std::cos(std::max(beta - half_angle, 0.0));
+    hi[k] = apex[k] + max_dist * std::max(reach_hi, 0.0);
+    lo[k] = apex[k] - max_dist * std::max(reach_lo, 0.0);
+  }
+
+  const double voxel_radius = voxel_size * std::sqrt(3.0) / 2;
+  const double cos_half_angle = std::cos(half_angle);
+
+  const Eigen::Vector3f a = apex.cast<float>();
+  const Eigen::Vector3f d = dir.cast<float>();
+  const float max_dist2 = max_dist * max_dist;
+  const float cos_half_angle_f = cos_half_angle;
+
+  forEachVoxel(
+      lo, hi,
+      [&](const Eigen::Vector3d& voxel_center) {
+        // Cone test for the bounding sphere of the voxel
+        const Eigen::Vector3d v = voxel_center - apex;
+        const double dist = v.norm();
+        if (dist - voxel_radius > max_dist) return false;
+        if (dist <= voxel_radius) return true;
+
+        const double angle =
+            std::acos(std::clamp(v.dot(dir) / dist, -1.0, 1.0));
+        return angle - std::asin(voxel_radius / dist) <= half_angle;
+      },
+      [&](const VoxelRange& r) {
+        for (uint32_t i = r.begin; i < r.end; i++) {
+          const Eigen::Vector3f v = positions[i] - a;
+          const float dist2 = v.squaredNorm();
+          if (dist2 <= max_dist2 &&
+              v.dot(d) >= std::sqrt(dist2) * cos_half_angle_f) {
+            ids.emplace_back(point_ids[i]);
+          }
+        }
+      });
+}
+
+size_t VoxelHash::memoryBytes() const {
+  // Hash nodes hold the key, the value and the next pointer, plus one
+  // pointer per bucket.
+  const size_t node_bytes =
+      sizeof(std::pair<const uint64_t, VoxelRange>) + sizeof(void*);
+
+  return positions.capacity() * sizeof(Eigen::Vector3f) +
+         point_ids.capacity() * sizeof(uint32_t) + voxels.size() * node_bytes +
+         voxels.bucket_count() * sizeof(void*);
+}
+
+}  // namespace basalt
@@ -35,6 +35,8 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <basalt/vi_estimator/ba_base.h>
 
+#include <algorithm>
+
 #include <tbb/blocked_range.h>
 #include <tbb/parallel_for.h>
 #include <tbb/parallel_reduce.h>
@@ -141,7 +143,8 @@ template <class Scalar_>
 void BundleAdjustmentBase<Scalar_>::computeError(
     Scalar& error,
     std::map<int, std::vector<std::pair<TimeCamId, Scalar>>>* outliers,
-    Scalar outlier_threshold) const {
+    Scalar outlier_threshold,
+    const std::unordered_set<KeypointId>* active_landmarks) const {
   std::vector<TimeCamId> host_frames;
   for (const auto& [tcid, _] : lmdb.getObservations()) {
     host_frames.push_back(tcid);
@@ -175,6 +178,9 @@ void BundleAdjustmentBase<Scalar_>::computeError(
         std::visit(
             [&](const auto& cam) {
               for (KeypointId kpt_id : obs_kv.second) {
+                if (active_landmarks && active_landmarks->count(kpt_id) == 0)
+                  continue;
+
                 const Keypoint<Scalar>& kpt_pos = lmdb.getLandmark(kpt_id);
                 const Vec2& kpt_obs = kpt_pos.obs.at(tcid_t);
 
@@ -225,6 +231,86 @@ void BundleAdjustmentBase<Scalar_>::computeError(
   }
 }
 
+template <class Scalar_>
+void BundleAdjustmentBase<Scalar_>::selectActiveLandmarks(
+    size_t max_landmarks,
+    std::unordered_set<KeypointId>& active_landmarks) const {
+  // Number of grid cells per image axis used to spread the selection
+  constexpr int grid_cells = 4;
+  // Parallax (in radians) above which depth is considered well constrained
+  constexpr Scalar max_parallax = 0.1;
+
+  active_landmarks.clear();
+
+  if (lmdb.numLandmarks() <= max_landmarks) {
+    for (const auto& [lm_id, _] : lmdb.getLandmarks())
+      active_landmarks.emplace(lm_id);
+    return;
+  }
+
+  std::unordered_map<int64_t, Vec3> frame_positions;
+  for (const auto& [t_ns, state] : frame_poses)
+    frame_positions[t_ns] = state.getPose().translation();
+  for (const auto& [t_ns, state] : frame_states)
+    frame_positions[t_ns] = state.getState().T_w_i.translation();
+
+  // Landmarks grouped by (host frame, image cell), with their scores
+  using Bucket = std::vector<std::pair<Scalar, KeypointId>>;
+  std::map<std::pair<TimeCamId, int>, Bucket> buckets;
+
+  for (const auto& [lm_id, lm] : lmdb.getLandmarks()) {
+    const TimeCamId& tcid_h = lm.host_kf_id;
+    const Vec3& p_h = frame_positions.at(tcid_h.frame_id);
+
+    Scalar parallax = 0;
+    for (const auto& [tcid_t, _] : lm.obs) {
+      if (tcid_t.frame_id == tcid_h.frame_id) continue;
+      Scalar baseline = (frame_positions.at(tcid_t.frame_id) - p_h).norm();
+      parallax = std::max(parallax, baseline * lm.inv_dist);
+    }
+    parallax = std::min(parallax, max_parallax);
+
+    int cell = 0;
+    auto host_obs = lm.obs.find(tcid_h);
+    if (host_obs != lm.obs.end()) {
+      const auto& res = calib.resolution.at(tcid_h.cam_id);
+      int cx = std::clamp<int>(host_obs->second.x() * grid_cells / res.x(), 0,
+                               grid_cells - 1);
+      int cy = std::clamp<int>(host_obs->second.y() * grid_cells / res.y(), 0,
+                               grid_cells - 1);
+      cell = cy * grid_cells + cx;
+    }
+
+    // Small constant keeps landmarks without parallax ranked by observations
+    Scalar score = lm.obs.size() * (parallax + Scalar(1e-3));
+    buckets[std::make_pair(tcid_h, cell)].emplace_back(score, lm_id);
+  }
+
+  std::vector<Bucket*> bucket_order;
+  for (auto& [_, bucket] : buckets) {
+    std::sort(bucket.begin(), bucket.end(),
+              [](const auto& a, const auto& b) { return a.first > b.first; });
+    bucket_order.emplace_back(&bucket);
+  }
+
+  // Visit buckets with the most informative landmarks first in every round
+  std::sort(bucket_order.begin(), bucket_order.end(),
+            [](const Bucket* a, const Bucket* b) {
+              return a->front().first > b->front().first;
+            });
+
+  for (size_t round = 0; active_landmarks.size() < max_landmarks; round++) {
+    bool added = false;
+    for (const Bucket* bucket : bucket_order) {
+      if (round >= bucket->size()) continue;
+      active_landmarks.emplace(bucket->at(round).second);
+      added = true;
+      if (active_landmarks.size() >= max_landmarks) break;
+    }
+    if (!added) break;
+  }
+}
+
 template <class Scalar_>
 template <class Scalar2>
 void BundleAdjustmentBase<Scalar_>::get_current_points(
@@ -565,6 +651,247 @@ Scalar_ BundleAdjustmentBase<Scalar_>::computeMargPriorModelCostChange(
   return l_diff;
 }
 
+template <class Scalar>
+typename BundleAdjustmentBase<Scalar>::Vec4
+BundleAdjustmentBase<Scalar>::triangulateMultiView(
+    const Vec3& f0, const Eigen::aligned_vector<Vec3>& fs,
+    const Eigen::aligned_vector<SE3>& T_0_k, int num_iterations) {
+  using Mat34 = Eigen::Matrix<Scalar, 3, 4>;
+
+  // Linear solution: f0 and every fs[k] are parallel to the projected point
+  Mat4 AtA = Mat4::Zero();
+  Mat34 A = Mat34::Zero();
+  A.template leftCols<3>() = Sophus::SO3<Scalar>::hat(f0);
+  AtA += A.transpose() * A;
+  for (size_t k = 0; k < fs.size(); k++) {
+    A = Sophus::SO3<Scalar>::hat(fs[k]) * T_0_k[k].inverse().matrix3x4();
+    AtA += A.transpose() * A;
+  }
+
+  Eigen::SelfAdjointEigenSolver<Mat4> es(AtA);
+  Vec4 point = es.eigenvectors().col(0);
+  point /= point.template head<3>().norm();
+  if (f0.dot(point.template head<3>()) < 0) point *= -1;
+
+  // Gauss-Newton on the inverse distance rho of the point (f0, rho). The
+  // residual in view k is the offset of the point from fs[k] on the plane
+  // at unit depth along fs[k].
+  Scalar rho = point[3];
+  for (int iter = 0; iter < num_iterations; iter++) {
+    Scalar H = 0;
+    Scalar b = 0;
+    for (size_t k = 0; k < fs.size(); k++) {
+      const SE3 T_k_0 = T_0_k[k].inverse();
+      const Vec3 p = T_k_0.so3() * f0 + T_k_0.translation() * rho;
+      const Vec3& t = T_k_0.translation();
+
+      const Scalar z = fs[k].dot(p);
+      if (z < Sophus::Constants<Scalar>::epsilon()) continue;
+
+      const Vec3 r = p / z - fs[k];
+      const Vec3 J = (t - p * fs[k].dot(t) / z) / z;
+      H += J.squaredNorm();
+      b += J.dot(r);
+    }
+    if (H < Sophus::Constants<Scalar>::epsilon()) break;
+    rho -= b / H;
+  }
+
+  point.template head<3>() = f0;
+  point[3] = rho;
+  return point;
+}
+
+template <class Scalar>
+std::vector<typename BundleAdjustmentBase<Scalar>::LandmarkCandidate>
+BundleAdjustmentBase<Scalar>::collectLandmarkCandidates(
+    const std::map<KeypointId, std::vector<int>>& new_lm_cams,
+    const OpticalFlowWindow& opt_flow_res) {
+  std::vector<LandmarkCandidate> candidates;
+  candidates.reserve(new_lm_cams.size());
+  for (const auto& [lm_id, host_cams] : new_lm_cams) {
+    candidates.push_back({lm_id, host_cams, {}});
+  }
+
+  // Find all observations
+  auto body = [&](const tbb::blocked_range<size_t>& range) {
+    for (size_t c = range.begin(); c != range.end(); c++) {
+      LandmarkCandidate& cand = candidates[c];
+      for (const auto& kv : opt_flow_res) {
+        for (size_t k = 0; k < kv.second->observations.size(); k++) {
+          auto it = kv.second->observations[k].find(cand.lm_id);
+          if (it != kv.second->observations[k].end()) {
+            KeypointObservation<Scalar> kobs;
+            kobs.kpt_id = cand.lm_id;
+            kobs.pos = it->second.translation().template cast<Scalar>();
+            cand.obs[TimeCamId(kv.first, k)] = kobs;
+          }
+        }
+      }
+    }
+  };
+  tbb::parallel_for(tbb::blocked_range<size_t>(0, candidates.size()), body);
+
+  return candidates;
+}
+
+template <class Scalar>
+int BundleAdjustmentBase<Scalar>::triangulateLandmarks(
+    int64_t t_ns, const std::vector<LandmarkCandidate>& candidates,
+    Scalar min_dist, Scalar min_parallax, bool balance_hosts,
+    std::vector<int>& num_hosted) {
+  // Landmarks relative to the first of their host cameras
+  Eigen::aligned_vector<Vec4> points(candidates.size());
+  std::vector<char> valid(candidates.size(), false);
+
+  const Scalar min_dist2 = min_dist * min_dist;
+  const Scalar max_parallax_cos = std::cos(min_parallax);
+
+  auto sufficient_baseline = [&](const Vec3& f0, const Vec3& f1,
+                                 const SE3& T_0_1) {
+    if (T_0_1.translation().squaredNorm() < min_dist2) return false;
+    return min_parallax <= 0 || f0.dot(T_0_1.so3() * f1) <= max_parallax_cos;
+  };
+  const SE3 T_w_i0 = getPoseStateWithLin(t_ns).getPose();
+
+  auto body = [&](const tbb::blocked_range<size_t>& range) {
+    for (size_t c = range.begin(); c != range.end(); c++) {
+      const LandmarkCandidate& cand = candidates[c];
+      const int cam0 = cand.host_cams.front();
+
+      Vec4 f0_4;
+      const auto it0 = cand.obs.find(TimeCamId(t_ns, cam0));
+      if (it0 == cand.obs.end()) continue;
+      if (!calib.intrinsics[cam0].unproject(it0->second.pos, f0_4)) continue;
+      const Vec3 f0 = f0_4.template head<3>().normalized();
+
+      const SE3 T_c0_w = (T_w_i0 * calib.T_i_c[cam0]).inverse();
+
+      Eigen::aligned_vector<Vec3> fs;
+      Eigen::aligned_vector<SE3> T_0_k;
+      bool has_baseline = false;
+      for (const auto& [tcid, kobs] : cand.obs) {
+        if (tcid == it0->first) continue;
+
+        Vec4 f1;
+        if (!calib.intrinsics[tcid.cam_id].unproject(kobs.pos, f1)) continue;
+
+        const SE3 T_w_i1 = getPoseStateWithLin(tcid.frame_id).getPose();
+        T_0_k.emplace_back(T_c0_w * T_w_i1 * calib.T_i_c[tcid.cam_id]);
+        fs.emplace_back(f1.template head<3>().normalized());
+
+        has_baseline |= sufficient_baseline(f0, fs.back(), T_0_k.back());
+      }
+      if (!has_baseline) continue;
+
+      points[c] = triangulateMultiView(f0, fs, T_0_k);
+      valid[c] = points[c].array().isFinite().all() && points[c][3] > 0 &&
+                 points[c][3] < Scalar(3.0);
+    }
+  };
+  tbb::parallel_for(tbb::blocked_range<size_t>(0, candidates.size()), body);
+
+  int num_added = 0;
+  for (size_t c = 0; c < candidates.size(); c++) {
+    if (!valid[c]) continue;
+    const LandmarkCandidate& cand = candidates[c];
+
+    // Prefer the least loaded camera as host to balance linearization work
+    int host = cand.host_cams.front();
+    Vec4 point = points[c];
+    if (balance_hosts) {
+      for (int i : cand.host_cams) {
+        if (num_hosted[i] < num_hosted[host]) host = i;
+      }
+      if (host != cand.host_cams.front()) {
+        const SE3 T_h_0 =
+            calib.T_i_c[host].inverse() * calib.T_i_c[cand.host_cams.front()];
+        point = T_h_0.matrix() * point;
+        point /= point.template head<3>().norm();
+      }
+    }
+
+    Keypoint<Scalar> kpt_pos;
+    kpt_pos.host_kf_id = TimeCamId(t_ns, host);
+    kpt_pos.direction = StereographicParam<Scalar>::project(point);
+    kpt_pos.inv_dist = point[3];
+    lmdb.addLandmark(cand.lm_id, kpt_pos);
+
+    for (const auto& [tcid, kobs] : cand.obs) lmdb.addObservation(tcid, kobs);
+
+    num_hosted[host]++;
+    num_added++;
+  }
+
+  return num_added;
+}
+
+template <class Scalar>
+int BundleAdjustmentBase<Scalar>::triangulateLandmarksTwoView(
+    int64_t t_ns, const std::vector<LandmarkCandidate>& candidates,
+    Scalar min_dist, bool balance_hosts, std::vector<int>& num_hosted) {
+  const Scalar min_dist2 = min_dist * min_dist;
+
+  int num_added = 0;
+  for (const LandmarkCandidate& cand : candidates) {
+    // Prefer the least loaded camera as host to balance linearization work
+    std::vector<int> host_cams = cand.host_cams;
+    if (balance_hosts) {
+      std::stable_sort(
+          host_cams.begin(), host_cams.end(),
+          [&](int a, int b) { return num_hosted[a] < num_hosted[b]; });
+    }
+
+    bool valid_kp = false;
+    for (int i : host_cams) {
+      if (valid_kp) break;
+      TimeCamId tcidl(t_ns, i);
+
+      const auto it0 = cand.obs.find(tcidl);
+      if (it0 == cand.obs.end()) continue;
+
+      for (const auto& [tcido, kobs] : cand.obs) {
+        if (valid_kp) break;
+
+        Vec4 p0_3d, p1_3d;
+        bool valid1 = calib.intrinsics[i].unproject(it0->second.pos, p0_3d);
+        bool valid2 = calib.intrinsics[tcido.cam_id].unproject(kobs.pos, p1_3d);
+        if (!valid1 || !valid2) continue;
+
+        SE3 T_i0_i1 = getPoseStateWithLin(tcidl.frame_id).getPose().inverse() *
+                      getPoseStateWithLin(tcido.frame_id).getPose();
+        SE3 T_0_1 =
+            calib.T_i_c[i].inverse() * T_i0_i1 * calib.T_i_c[tcido.cam_id];
+
+        if (T_0_1.translation().squaredNorm() < min_dist2) continue;
+
+        Vec4 p0_triangulated = triangulate(p0_3d.template head<3>(),
+                                           p1_3d.template head<3>(), T_0_1);
+
+        if (p0_triangulated.array().isFinite().all() &&
+            p0_triangulated[3] > 0 && p0_triangulated[3] < Scalar(3.0)) {
+          Keypoint<Scalar> kpt_pos;
+          kpt_pos.host_kf_id = tcidl;
+          kpt_pos.direction =
+              StereographicParam<Scalar>::project(p0_triangulated);
+          kpt_pos.inv_dist = p0_triangulated[3];
+          lmdb.addLandmark(cand.lm_id, kpt_pos);
+
+          num_added++;
+          num_hosted[i]++;
+          valid_kp = true;
+        }
+      }
+    }
+
+    if (valid_kp) {
+      for (const auto& [tcid, kobs] : cand.obs) lmdb.addObservation(tcid, kobs);
+    }
+  }
+
+  return num_added;
+}
+
 // //////////////////////////////////////////////////////////////////
 // instatiate templates
 
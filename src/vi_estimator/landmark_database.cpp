@@ -142,7 +142,7 @@ const std::unordered_map<TimeCamId, std::map<TimeCamId, std::set<KeypointId>>>
 }
 
 template <class Scalar_>
-const Eigen::aligned_unordered_map<KeypointId, Keypoint<Scalar_>>
+const typename LandmarkDatabase<Scalar_>::KeypointMap
     &LandmarkDatabase<Scalar_>::getLandmarks() const {
   return kpts;
 }
@@ -0,0 +1,482 @@
+/**
+BSD 3-Clause License
+
+This file is part of the Basalt project.
+https://gitlab.com/VladyslavUsenko/basalt.git
+
+Copyright (c) 2022, Vladyslav Usenko and Nikolaus Demmel.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the copyright holder nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <basalt/vi_estimator/map_localization.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include <cereal/archives/binary.hpp>
+#include <cereal/types/bitset.hpp>
+#include <cereal/types/map.hpp>
+#include <cereal/types/vector.hpp>
+
+#include <opengv/absolute_pose/CentralAbsoluteAdapter.hpp>
+#include <opengv/absolute_pose/methods.hpp>
+#include <opengv/sac/Ransac.hpp>
+#include <opengv/sac_problems/absolute_pose/AbsolutePoseSacProblem.hpp>
+
+#include <basalt/serialization/headers_serialization.h>
+
+namespace basalt {
+
+namespace {
+
+// Distance to the image border that the ORB patch of computeAngles() and
+// computeDescriptors() needs (EDGE_THRESHOLD in keypoints.cpp).
+constexpr int DESCRIPTOR_BORDER = 19;
+
+// Half opening angle of the cone around the optical axis that contains all
+// rays of the image, from unprojections along the image border. Cameras that
+// don't unproject the whole border get the full sphere.
+double viewConeHalfAngle(const GenericCamera<double>& cam, int width,
+                         int height) {
+  constexpr int NUM_SAMPLES = 16;
+
+  double max_angle = 0;
+  for (int i = 0; i <= NUM_SAMPLES; i++) {
+    const double x = double(width) * i / NUM_SAMPLES;
+    const double y = double(height) * i / NUM_SAMPLES;
+    for (const Eigen::Vector2d& p :
+         {Eigen::Vector2d(x, 0), Eigen::Vector2d(x, height),
+          Eigen::Vector2d(0, y), Eigen::Vector2d(width, y)}) {
+      Eigen::Vector4d ray;
+      if (!cam.unproject(p, ray)) return M_PI;
+
+      max_angle =
+          std::max(max_angle, std::atan2(ray.head<2>().norm(), ray[2]));
+    }
+  }
+
+  // Margin for rays between the samples
+  return max_angle + 0.05;
+}
+
+struct MapMatch {
+  int dist;
+  MapObservation ob;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+}  // namespace
+
+bool LocalizationMap::save(const std::string& path) const {
+  std::ofstream os(path, std::ios::binary);
+  if (!os.is_open()) {
+    std::cerr << "Could not open " << path << " to save the map" << std::endl;
+    return false;
+  }
+
+  {
+    cereal::BinaryOutputArchive archive(os);
+    archive(points, descriptors, keyframe_poses);
+  }
+
+  std::cout << "Saved map with " << points.size() << " landmarks and "
+            << keyframe_poses.size() << " keyframes to " << path << std::endl;
+  return true;
+}
+
+bool LocalizationMap::load(const std::string& path) {
+  std::ifstream is(path, std::ios::binary);
+  if (!is.is_open()) {
+    std::cerr << "Could not open map " << path << std::endl;
+    return false;
+  }
+
+  try {
+    cereal::BinaryInputArchive archive(is);
+    archive(points, descriptors, keyframe_poses);
+  } catch (const cereal::Exception& e) {
+    std::cerr << "Could not read map " << path << ": " << e.what()
+              << std::endl;
+    return false;
+  }
+
+  if (points.size() != descriptors.size()) {
+    std::cerr << "Map " << path << " is inconsistent" << std::endl;
+    return false;
+  }
+
+  buildIndex();
+
+  std::cout << "Loaded map with " << points.size() << " landmarks and "
+            << keyframe_poses.size() << " keyframes from " << path
+            << std::endl;
+  return true;
+}
+
+void LocalizationMap::buildIndex(double voxel_size) {
+  point_index.build(points, voxel_size);
+
+  Eigen::aligned_vector<Eigen::Vector3d> keyframe_positions;
+  keyframe_index_t_ns.clear();
+  for (const auto& [t_ns, T_w_i] : keyframe_poses) {
+    keyframe_positions.emplace_back(T_w_i.translation());
+    keyframe_index_t_ns.emplace_back(t_ns);
+  }
+  keyframe_index.build(keyframe_positions, voxel_size);
+}
+
+void LocalizationMap::queryVisiblePoints(
+    const Sophus::SE3d& T_w_c, const GenericCamera<double>& cam, int width,
+    int height, double max_dist, std::vector<uint32_t>& ids,
+    Eigen::aligned_vector<Eigen::Vector2d>* proj) const {
+  std::vector<uint32_t> candidates;
+  const Eigen::Vector3d optical_axis = T_w_c.so3() * Eigen::Vector3d::UnitZ();
+  point_index.queryCone(T_w_c.translation(), optical_axis,
+                        viewConeHalfAngle(cam, width, height), max_dist,
+                        candidates);
+
+  ids.clear();
+  if (proj) proj->clear();
+
+  const Sophus::SE3d T_c_w = T_w_c.inverse();
+  for (uint32_t id : candidates) {
+    Eigen::Vector4d p_c;
+    p_c << T_c_w * points[id], 1;
+
+    Eigen::Vector2d p;
+    if (!cam.project(p_c, p) || p.x() < 0 || p.y() < 0 || p.x() >= width ||
+        p.y() >= height) {
+      continue;
+    }
+
+    ids.emplace_back(id);
+    if (proj) proj->emplace_back(p);
+  }
+}
+
+void LocalizationMap::queryKeyframes(const Sophus::SE3d& T_w_i, double radius,
+                                     double max_angle,
+                                     std::vector<int64_t>& t_ns) const {
+  std::vector<uint32_t> candidates;
+  keyframe_index.queryRadius(T_w_i.translation(), radius, candidates);
+
+  t_ns.clear();
+  for (uint32_t id : candidates) {
+    const int64_t kf_t_ns = keyframe_index_t_ns[id];
+    const Sophus::SO3d R_kf_i =
+        keyframe_poses.at(kf_t_ns).so3().inverse() * T_w_i.so3();
+    if (R_kf_i.log().norm() <= max_angle) t_ns.emplace_back(kf_t_ns);
+  }
+  std::sort(t_ns.begin(), t_ns.end());
+}
+
+MapLocalizer::MapLocalizer(const LocalizationMap::Ptr& map,
+                           const Calibration<double>& calib,
+                           const VioConfig& config)
+    : map(map), calib(calib), config(config) {
+  reloc_thread = std::thread(&MapLocalizer::relocalizationLoop, this);
+}
+
+MapLocalizer::~MapLocalizer() {
+  {
+    std::lock_guard<std::mutex> lock(reloc_mutex);
+    reloc_stop = true;
+  }
+  reloc_cv.notify_one();
+  reloc_thread.join();
+}
+
+void MapLocalizer::match(const OpticalFlowResult& opt_flow,
+                         const Sophus::SE3d& T_w_i, MapObservations& obs) {
+  obs.clear();
+  if (!opt_flow.input_images || map->points.empty()) return;
+
+  if (!localized) {
+    std::lock_guard<std::mutex> lock(reloc_mutex);
+    if (!reloc_result) {
+      // Replaces a keyframe that is still waiting
+      reloc_images = opt_flow.input_images;
+      reloc_T_w_i = T_w_i;
+      reloc_cv.notify_one();
+      return;
+    }
+
+    T_w_map = *reloc_result;
+    reloc_result.reset();
+    reloc_images.reset();
+    localized = true;
+    num_failed_kfs = 0;
+    std::cout << "Localized in map with " << reloc_num_inliers
+              << " inliers, T_w_map\n"
+              << T_w_map.matrix() << std::endl;
+  }
+
+  matchProjected(opt_flow, T_w_i, obs);
+
+  // A wrong alignment, e.g. from a bad relocalization, leaves few landmarks
+  // that match near their projection. It is dropped after a few such
+  // keyframes in a row and the map is relocalized again.
+  if (int(obs.size()) >= config.vio_map_min_matches) {
+    num_failed_kfs = 0;
+    return;
+  }
+
+  obs.clear();
+  if (++num_failed_kfs >= config.vio_map_max_failed_kfs) {
+    std::cout << "Lost the map alignment after " << num_failed_kfs
+              << " keyframes with too few matches, relocalizing" << std::endl;
+    localized = false;
+    std::lock_guard<std::mutex> lock(reloc_mutex);
+    reloc_result.reset();
+  }
+}
+
+void MapLocalizer::relocalizationLoop() {
+  while (true) {
+    OpticalFlowInput::Ptr images;
+    Sophus::SE3d T_w_i;
+    {
+      std::unique_lock<std::mutex> lock(reloc_mutex);
+      reloc_cv.wait(lock, [&] { return reloc_stop || reloc_images; });
+      if (reloc_stop) return;
+      images = std::move(reloc_images);
+      reloc_images.reset();
+      T_w_i = reloc_T_w_i;
+    }
+
+    Sophus::SE3d T_w_map_reloc;
+    size_t num_inliers;
+    if (relocalize(*images, T_w_i, T_w_map_reloc, num_inliers)) {
+      std::lock_guard<std::mutex> lock(reloc_mutex);
+      reloc_result = T_w_map_reloc;
+      reloc_num_inliers = num_inliers;
+    }
+  }
+}
+
+bool MapLocalizer::relocalize(const OpticalFlowInput& images,
+                              const Sophus::SE3d& T_w_i,
+                              Sophus::SE3d& T_w_map_reloc,
+                              size_t& num_inliers) const {
+  if (images.img_data.empty() || !images.img_data[0].img.get()) return false;
+
+  const Image<const uint16_t> img =
+      images.img_data[0].img->Reinterpret<const uint16_t>();
+
+  KeypointsData kd;
+  detectKeypointsMapping(img, kd, config.mapper_detection_num_points);
+  computeAngles(img, kd, true);
+  computeDescriptors(img, kd);
+
+  std::vector<bool> success;
+  calib.intrinsics[0].unproject(kd.corners, kd.corners_3d, success);
+
+  // Match against all map landmarks. Only one direction with the ratio test,
+  // since the map is much larger than a single image.
+  std::vector<int> point_idx(kd.corners.size(), -1);
+  tbb::parallel_for(
+      tbb::blocked_range<size_t>(0, kd.corners.size()),
+      [&](const tbb::blocked_range<size_t>& r) {
+        for (size_t i = r.begin(); i != r.end(); ++i) {
+          if (!success[i]) continue;
+
+          int best_idx = -1, best_dist = 500, best2_dist = 500;
+          for (size_t j = 0; j < map->descriptors.size(); j++) {
+            int dist = (kd.corner_descriptors[i] ^ map->descriptors[j]).count();
+
+            if (dist <= best_dist) {
+              best2_dist = best_dist;
+              best_dist = dist;
+              best_idx = j;
+            } else if (dist < best2_dist) {
+              best2_dist = dist;
+            }
+          }
+
+          if (best_dist < config.mapper_max_hamming_distance &&
+              best_dist * config.mapper_second_best_test_ratio <= best2_dist) {
+            point_idx[i] = best_idx;
+          }
+        }
+      });
+
+  opengv::bearingVectors_t bearing_vectors;
+  opengv::points_t points;
+  for (size_t i = 0; i < point_idx.size(); i++) {
+    if (point_idx[i] < 0) continue;
+    bearing_vectors.emplace_back(kd.corners_3d[i].head<3>());
+    points.emplace_back(map->points[point_idx[i]]);
+  }
+
+  if (int(points.size()) < config.vio_map_reloc_min_inliers) return false;
+
+  opengv::absolute_pose::CentralAbsoluteAdapter adapter(bearing_vectors,
+                                                        points);
+  opengv::sac::Ransac<
+      opengv::sac_problems::absolute_pose::AbsolutePoseSacProblem>
+      ransac;
+  std::shared_ptr<opengv::sac_problems::absolute_pose::AbsolutePoseSacProblem>
+      absposeproblem_ptr(
+          new opengv::sac_problems::absolute_pose::AbsolutePoseSacProblem(
+              adapter, opengv::sac_problems::absolute_pose::
+                           AbsolutePoseSacProblem::KNEIP));
+  ransac.sac_model_ = absposeproblem_ptr;
+  ransac.threshold_ = config.mapper_ransac_threshold;
+  ransac.max_iterations_ = 500;
+  if (!ransac.computeModel()) return false;
+
+  adapter.sett(ransac.model_coefficients_.topRightCorner<3, 1>());
+  adapter.setR(ransac.model_coefficients_.topLeftCorner<3, 3>());
+
+  const opengv::transformation_t nonlinear_transformation =
+      opengv::absolute_pose::optimize_nonlinear(adapter, ransac.inliers_);
+
+  ransac.sac_model_->selectWithinDistance(nonlinear_transformation,
+                                          ransac.threshold_, ransac.inliers_);
+
+  if (int(ransac.inliers_.size()) < config.vio_map_reloc_min_inliers ||
+      ransac.inliers_.size() <
+          config.vio_map_reloc_min_inlier_ratio * points.size()) {
+    return false;
+  }
+
+  const Sophus::SE3d T_map_c(
+      Eigen::Quaterniond(nonlinear_transformation.topLeftCorner<3, 3>())
+          .normalized(),
+      nonlinear_transformation.topRightCorner<3, 1>());
+
+  T_w_map_reloc = T_w_i * calib.T_i_c[0] * T_map_c.inverse();
+  num_inliers = ransac.inliers_.size();
+
+  return true;
+}
+
+void MapLocalizer::matchProjected(const OpticalFlowResult& opt_flow,
+                                  const Sophus::SE3d& T_w_i,
+                                  MapObservations& obs) const {
+  const OpticalFlowInput& images = *opt_flow.input_images;
+  const Sophus::SE3d T_map_i = T_w_map.inverse() * T_w_i;
+  const double radius2 =
+      config.vio_map_match_radius * config.vio_map_match_radius;
+
+  Eigen::aligned_vector<MapMatch> matches;
+
+  for (size_t cam_id = 0; cam_id < opt_flow.observations.size(); cam_id++) {
+    if (cam_id >= images.img_data.size() || !images.img_data[cam_id].img.get())
+      continue;
+
+    const Image<const uint16_t> img =
+        images.img_data[cam_id].img->Reinterpret<const uint16_t>();
+
+    // Descriptors of the tracked keypoints
+    KeypointsData kd;
+    for (const auto& [kpt_id, kpt] : opt_flow.observations[cam_id]) {
+      const Eigen::Vector2d p = kpt.translation().cast<double>();
+      if (img.InBounds(p.x(), p.y(), DESCRIPTOR_BORDER)) {
+        kd.corners.emplace_back(p);
+      }
+    }
+    if (kd.corners.empty()) continue;
+
+    computeAngles(img, kd, true);
+    computeDescriptors(img, kd);
+
+    // Closest and second closest map landmark in descriptor space for every
+    // keypoint, among the landmarks that project within the search radius
+    std::vector<int> best_dist(kd.corners.size(), 500);
+    std::vector<int> best2_dist(kd.corners.size(), 500);
+    std::vector<int> best_point(kd.corners.size(), -1);
+
+    std::vector<uint32_t> visible;
+    Eigen::aligned_vector<Eigen::Vector2d> visible_proj;
+    map->queryVisiblePoints(T_map_i * calib.T_i_c[cam_id],
+                            calib.intrinsics[cam_id], img.w, img.h,
+                            config.vio_map_max_dist, visible, &visible_proj);
+
+    for (size_t j = 0; j < visible.size(); j++) {
+      for (size_t i = 0; i < kd.corners.size(); i++) {
+        if ((kd.corners[i] - visible_proj[j]).squaredNorm() > radius2) {
+          continue;
+        }
+
+        const int dist =
+            (kd.corner_descriptors[i] ^ map->descriptors[visible[j]]).count();
+        if (dist <= best_dist[i]) {
+          best2_dist[i] = best_dist[i];
+          best_dist[i] = dist;
+          best_point[i] = visible[j];
+        } else if (dist < best2_dist[i]) {
+          best2_dist[i] = dist;
+        }
+      }
+    }
+
+    // Same ratio test as matchDescriptors(), and every landmark is only kept
+    // for its closest keypoint so that it is observed at most once per camera
+    std::unordered_map<int, size_t> point_corner;
+    for (size_t i = 0; i < kd.corners.size(); i++) {
+      if (best_point[i] < 0 ||
+          best_dist[i] >= config.vio_map_max_hamming_distance ||
+          best_dist[i] * config.mapper_second_best_test_ratio > best2_dist[i]) {
+        continue;
+      }
+
+      auto [it, inserted] = point_corner.emplace(best_point[i], i);
+      if (!inserted && best_dist[i] < best_dist[it->second]) it->second = i;
+    }
+
+    for (const auto& [point, i] : point_corner) {
+      MapMatch m;
+      m.dist = best_dist[i];
+      m.ob.cam_id = cam_id;
+      m.ob.p_w = T_w_map * map->points[point];
+      m.ob.pos = kd.corners[i];
+      matches.emplace_back(m);
+    }
+  }
+
+  // Keep the most distinctive matches
+  std::sort(matches.begin(), matches.end(),
+            [](const MapMatch& a, const MapMatch& b) {
+              return a.dist < b.dist;
+            });
+  if (matches.size() > size_t(config.vio_map_max_matches)) {
+    matches.resize(config.vio_map_max_matches);
+  }
+
+  for (const MapMatch& m : matches) obs.emplace_back(m.ob);
+}
+
+}  // namespace basalt
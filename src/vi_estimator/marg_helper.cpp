@@ -36,6 +36,11 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <basalt/utils/assert.h>
 #include <basalt/vi_estimator/marg_helper.h>
 
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <vector>
+
 namespace basalt {
 
 template <class Scalar_>
@@ -346,6 +351,165 @@ void MargHelper<Scalar_>::marginalizeHelperSqrtToSqrt(
   Q2r.resize(0);
 }
 
+template <class Scalar_>
+void MargHelper<Scalar_>::sparsifyHelper(
+    const MatX& H, const VecX& b, bool is_sqrt,
+    const std::vector<Eigen::MatrixXd>& factor_J, MatX& sparse_H,
+    VecX& sparse_b) {
+  const Eigen::Index size = H.cols();
+
+  Eigen::MatrixXd info;
+  Eigen::VectorXd info_b;
+  if (is_sqrt) {
+    const Eigen::MatrixXd sqrt_H = H.template cast<double>();
+    info.noalias() = sqrt_H.transpose() * sqrt_H;
+    info_b.noalias() = sqrt_H.transpose() * b.template cast<double>();
+  } else {
+    info = H.template cast<double>();
+    info_b = b.template cast<double>();
+  }
+
+  // Eigenvalues below the threshold are treated as zero, which gives the
+  // pseudo-inverse for covariances and zero information for variances.
+  auto threshold = [](const Eigen::VectorXd& eigenvalues) {
+    return std::numeric_limits<double>::epsilon() * eigenvalues.size() *
+           std::max(eigenvalues.maxCoeff(), 0.0);
+  };
+
+  Eigen::MatrixXd cov;
+  {
+    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> es(info);
+    const double thresh = threshold(es.eigenvalues());
+    const Eigen::VectorXd inv = es.eigenvalues().unaryExpr(
+        [&](double l) { return l > thresh ? 1.0 / l : 0.0; });
+    cov = es.eigenvectors() * inv.asDiagonal() *
+          es.eigenvectors().transpose();
+  }
+
+  // Offset of the mean from the linearization point
+  const Eigen::VectorXd mean = -cov * info_b;
+
+  Eigen::Index num_rows = 0;
+  for (const auto& J : factor_J) {
+    BASALT_ASSERT(J.cols() == size);
+    num_rows += J.rows();
+  }
+
+  Eigen::MatrixXd rows(num_rows, size);
+  Eigen::Index row = 0;
+  for (const auto& J : factor_J) {
+    const Eigen::MatrixXd factor_cov = J * cov * J.transpose();
+
+    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> es(factor_cov);
+    const double thresh = threshold(es.eigenvalues());
+    const Eigen::VectorXd sqrt_inv = es.eigenvalues().unaryExpr(
+        [&](double l) { return l > thresh ? 1.0 / std::sqrt(l) : 0.0; });
+
+    rows.middleRows(row, J.rows()) =
+        sqrt_inv.asDiagonal() * es.eigenvectors().transpose() * J;
+    row += J.rows();
+  }
+
+  const Eigen::VectorXd res = -rows * mean;
+
+  if (is_sqrt) {
+    // Triangularize without marginalizing anything, so the prior has the same
+    // form as after marginalizeHelperSqrtToSqrt.
+    MatX sqrt_H = rows.template cast<Scalar>();
+    VecX sqrt_b = res.template cast<Scalar>();
+
+    std::set<int> idx_all;
+    for (Eigen::Index i = 0; i < size; i++) idx_all.emplace(i);
+
+    marginalizeHelperSqrtToSqrt(sqrt_H, sqrt_b, idx_all, {}, sparse_H,
+                                sparse_b);
+  } else {
+    sparse_H = (rows.transpose() * rows).template cast<Scalar>();
+    sparse_b = (rows.transpose() * res).template cast<Scalar>();
+  }
+}
+
+void compactMargData(MargData& m) {
+  BASALT_ASSERT(m.aom.total_size == size_t(m.abs_H.cols()));
+
+  // Visit the blocks in the order of their columns, so the kept poses end up
+  // in the same relative order in the compact factor.
+  std::vector<std::pair<int, int64_t>> blocks;
+  for (const auto& kv : m.aom.abs_order_map) {
+    blocks.emplace_back(kv.second.first, kv.first);
+  }
+  std::sort(blocks.begin(), blocks.end());
+
+  AbsOrderMap aom_new;
+  std::set<int> idx_to_keep;
+  std::set<int> idx_to_marg;
+
+  for (const auto& [start_idx, t_ns] : blocks) {
+    const size_t size = m.aom.abs_order_map.at(t_ns).second;
+
+    if (size != POSE_SIZE && size != POSE_VEL_BIAS_SIZE) {
+      std::cerr << "Unknown size" << std::endl;
+      std::abort();
+    }
+
+    const bool keep = size == POSE_SIZE || m.kfs_all.count(t_ns) > 0;
+
+    if (keep) {
+      for (size_t i = 0; i < POSE_SIZE; i++) {
+        idx_to_keep.emplace(start_idx + i);
+      }
+      for (size_t i = POSE_SIZE; i < size; i++) {
+        idx_to_marg.emplace(start_idx + i);
+      }
+
+      aom_new.abs_order_map[t_ns] =
+          std::make_pair(aom_new.total_size, POSE_SIZE);
+      aom_new.total_size += POSE_SIZE;
+      aom_new.items++;
+    } else {
+      for (size_t i = 0; i < size; i++) idx_to_marg.emplace(start_idx + i);
+    }
+
+    if (size == POSE_VEL_BIAS_SIZE) {
+      if (keep) {
+        m.frame_poses[t_ns] = PoseStateWithLin<double>(m.frame_states.at(t_ns));
+      }
+      m.frame_states.erase(t_ns);
+    }
+  }
+
+  if (m.is_sqrt && idx_to_marg.empty()) return;
+
+  Eigen::MatrixXd sqrt_H;
+  Eigen::VectorXd sqrt_b;
+
+  if (m.is_sqrt) {
+    MargHelper<double>::marginalizeHelperSqrtToSqrt(
+        m.abs_H, m.abs_b, idx_to_keep, idx_to_marg, sqrt_H, sqrt_b);
+  } else {
+    // The LDLT based square root is permuted, so it is not triangular yet.
+    // Another QR pass without marginalization takes care of that.
+    Eigen::MatrixXd permuted_sqrt_H;
+    Eigen::VectorXd permuted_sqrt_b;
+    MargHelper<double>::marginalizeHelperSqToSqrt(
+        m.abs_H, m.abs_b, idx_to_keep, idx_to_marg, permuted_sqrt_H,
+        permuted_sqrt_b);
+
+    std::set<int> idx_all;
+    for (size_t i = 0; i < aom_new.total_size; i++) idx_all.emplace(i);
+
+    MargHelper<double>::marginalizeHelperSqrtToSqrt(
+        permuted_sqrt_H, permuted_sqrt_b, idx_all, {}, sqrt_H, sqrt_b);
+  }
+
+  m.abs_H = std::move(sqrt_H);
+  m.abs_b = std::move(sqrt_b);
+  m.aom = aom_new;
+  m.is_sqrt = true;
+
+  BASALT_ASSERT(m.aom.total_size == size_t(m.abs_H.cols()));
+}
+
 // //////////////////////////////////////////////////////////////////
 // instatiate templates
 
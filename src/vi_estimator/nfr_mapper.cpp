@@ -33,7 +33,10 @@ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
 OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <basalt/linearization/landmark_block_abs_dynamic.hpp>
 #include <basalt/optimization/accumulator.h>
+#include <basalt/utils/ba_utils.h>
+#include <basalt/utils/cast_utils.hpp>
 #include <basalt/utils/keypoints.h>
 #include <basalt/utils/nfr.h>
 #include <basalt/utils/tracks.h>
@@ -41,6 +44,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <basalt/vi_estimator/nfr_mapper.h>
 
 #include <basalt/hash_bow/hash_bow.h>
+#include <basalt/hash_bow/vocabulary_tree.h>
 
 namespace basalt {
 
@@ -54,7 +58,21 @@ NfrMapper::NfrMapper(const Calibration<double>& calib, const VioConfig& config)
   this->obs_std_dev = config.mapper_obs_std_dev;
   this->huber_thresh = config.mapper_obs_huber_thresh;
 
-  hash_bow_database.reset(new HashBow<256>(config.mapper_bow_num_bits));
+  if (!config.mapper_vocabulary_path.empty()) {
+    auto vocabulary = std::make_shared<VocabularyTree<256>>();
+    if (vocabulary->load(config.mapper_vocabulary_path)) {
+      vocabulary->set_direct_index_level(
+          std::max(config.mapper_vocabulary_direct_index_level, 0));
+      hash_bow_database = vocabulary;
+    } else {
+      std::cerr << "Falling back to HashBow for place recognition"
+                << std::endl;
+    }
+  }
+
+  if (!hash_bow_database) {
+    hash_bow_database.reset(new HashBow<256>(config.mapper_bow_num_bits));
+  }
 }
 
 void NfrMapper::addMargData(MargData::Ptr& data) {
@@ -80,65 +98,9 @@ void NfrMapper::addMargData(MargData::Ptr& data) {
 }
 
 void NfrMapper::processMargData(MargData& m) {
-  BASALT_ASSERT(m.aom.total_size == size_t(m.abs_H.cols()));
-
-  //    std::cout << "rank " << m.abs_H.fullPivLu().rank() << " size "
-  //              << m.abs_H.cols() << std::endl;
-
-  AbsOrderMap aom_new;
-  std::set<int> idx_to_keep;
-  std::set<int> idx_to_marg;
-
-  for (const auto& kv : m.aom.abs_order_map) {
-    if (kv.second.second == POSE_SIZE) {
-      for (size_t i = 0; i < POSE_SIZE; i++)
-        idx_to_keep.emplace(kv.second.first + i);
-      aom_new.abs_order_map.emplace(kv);
-      aom_new.total_size += POSE_SIZE;
-    } else if (kv.second.second == POSE_VEL_BIAS_SIZE) {
-      if (m.kfs_all.count(kv.first) > 0) {
-        for (size_t i = 0; i < POSE_SIZE; i++)
-          idx_to_keep.emplace(kv.second.first + i);
-        for (size_t i = POSE_SIZE; i < POSE_VEL_BIAS_SIZE; i++)
-          idx_to_marg.emplace(kv.second.first + i);
-
-        aom_new.abs_order_map[kv.first] =
-            std::make_pair(aom_new.total_size, POSE_SIZE);
-        aom_new.total_size += POSE_SIZE;
-
-        PoseStateWithLin<double> p(m.frame_states.at(kv.first));
-        m.frame_poses[kv.first] = p;
-        m.frame_states.erase(kv.first);
-      } else {
-        for (size_t i = 0; i < POSE_VEL_BIAS_SIZE; i++)
-          idx_to_marg.emplace(kv.second.first + i);
-        m.frame_states.erase(kv.first);
-      }
-    } else {
-      std::cerr << "Unknown size" << std::endl;
-      std::abort();
-    }
-
-    //      std::cout << kv.first << " " << kv.second.first << " " <<
-    //      kv.second.second
-    //                << std::endl;
-  }
-
-  if (!idx_to_marg.empty()) {
-    Eigen::MatrixXd marg_H_new;
-    Eigen::VectorXd marg_b_new;
-    MargHelper<Scalar>::marginalizeHelperSqToSq(
-        m.abs_H, m.abs_b, idx_to_keep, idx_to_marg, marg_H_new, marg_b_new);
-
-    //    std::cout << "new rank " << marg_H_new.fullPivLu().rank() << " size "
-    //              << marg_H_new.cols() << std::endl;
-
-    m.abs_H = marg_H_new;
-    m.abs_b = marg_b_new;
-    m.aom = aom_new;
-  }
-
-  BASALT_ASSERT(m.aom.total_size == size_t(m.abs_H.cols()));
+  // Data from the estimator is already compact, but files written before the
+  // compact format still hold the dense prior over all states.
+  compactMargData(m);
 
   // save image data
   {
@@ -152,10 +114,17 @@ bool NfrMapper::extractNonlinearFactors(MargData& m) {
   size_t asize = m.aom.total_size;
   // std::cout << "asize " << asize << std::endl;
 
+  // abs_H is the upper-triangular R with H = R^T R. Fewer rows than columns
+  // mean the prior was rank deficient.
+  if (size_t(m.abs_H.rows()) != asize) return false;
+
   Eigen::FullPivHouseholderQR<Eigen::MatrixXd> qr(m.abs_H);
   if (qr.rank() != m.abs_H.cols()) return false;
 
-  Eigen::MatrixXd cov_old = qr.solve(Eigen::MatrixXd::Identity(asize, asize));
+  // H^-1 = R^-1 R^-T
+  Eigen::MatrixXd R_inv = Eigen::MatrixXd::Identity(asize, asize);
+  m.abs_H.triangularView<Eigen::Upper>().solveInPlace(R_inv);
+  Eigen::MatrixXd cov_old = R_inv * R_inv.transpose();
 
   int64_t kf_id = *m.kfs_to_marg.cbegin();
   int kf_start_idx = m.aom.abs_order_map.at(kf_id).first;
@@ -241,7 +210,398 @@ bool NfrMapper::extractNonlinearFactors(MargData& m) {
   return true;
 }
 
+namespace {
+
+// A landmark of the square-root mapper BA. The landmark block only spans the
+// poses that observe the landmark, so its storage does not grow with the map.
+template <class Scalar>
+struct MapperLandmarkBlock {
+  KeypointId lm_id;
+  Keypoint<Scalar> lm;
+
+  AbsOrderMap aom;              // poses observing the landmark
+  std::vector<int> global_idx;  // their offsets in the full pose system
+
+  LandmarkBlockAbsDynamic<Scalar, POSE_SIZE> lb;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+template <class Scalar>
+struct MapperSqrtLinearizeReduce {
+  using MatX = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>;
+  using VecX = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+
+  using BlockVec = std::vector<std::unique_ptr<MapperLandmarkBlock<Scalar>>>;
+  using RollPitchFactorConstIter =
+      Eigen::aligned_vector<RollPitchFactor>::const_iterator;
+  using RelPoseFactorConstIter =
+      Eigen::aligned_vector<RelPoseFactor>::const_iterator;
+
+  MapperSqrtLinearizeReduce(
+      const AbsOrderMap& aom, BlockVec& blocks,
+      const Eigen::aligned_map<int64_t, PoseStateWithLin<double>>* frame_poses)
+      : aom(aom), blocks(blocks), frame_poses(frame_poses) {
+    accum.reset(aom.total_size);
+  }
+
+  MapperSqrtLinearizeReduce(const MapperSqrtLinearizeReduce& other, tbb::split)
+      : aom(other.aom), blocks(other.blocks), frame_poses(other.frame_poses) {
+    accum.reset(aom.total_size);
+  }
+
+  void join(MapperSqrtLinearizeReduce& rhs) {
+    accum.join(rhs.accum);
+    roll_pitch_error += rhs.roll_pitch_error;
+    rel_error += rhs.rel_error;
+    num_failed += rhs.num_failed;
+  }
+
+  // Linearizes the landmarks, eliminates them with QR and adds the reduced
+  // pose system Q2Jp^T Q2Jp of every landmark to the sparse accumulator.
+  void operator()(const tbb::blocked_range<size_t>& range) {
+    for (size_t r = range.begin(); r != range.end(); ++r) {
+      auto& b = *blocks[r];
+
+      b.lb.linearizeLandmark();
+      if (b.lb.isNumericalFailure()) {
+        num_failed++;
+        continue;
+      }
+      b.lb.performQR();
+
+      const size_t num_poses = b.global_idx.size();
+
+      MatX H;
+      VecX g;
+      H.setZero(b.aom.total_size, b.aom.total_size);
+      g.setZero(b.aom.total_size);
+      b.lb.add_dense_H_b(H, g);
+
+      for (size_t i = 0; i < num_poses; i++) {
+        for (size_t j = 0; j < num_poses; j++) {
+          accum.template addH<POSE_SIZE, POSE_SIZE>(
+              b.global_idx[i], b.global_idx[j],
+              H.template block<POSE_SIZE, POSE_SIZE>(POSE_SIZE * i,
+                                                     POSE_SIZE * j));
+        }
+        accum.template addB<POSE_SIZE>(
+            b.global_idx[i], g.template segment<POSE_SIZE>(POSE_SIZE * i));
+      }
+    }
+  }
+
+  void operator()(const tbb::blocked_range<RollPitchFactorConstIter>& range) {
+    for (const RollPitchFactor& rpf : range) {
+      const Sophus::SE3d& pose = frame_poses->at(rpf.t_ns).getPose();
+      int idx = aom.abs_order_map.at(rpf.t_ns).first;
+      roll_pitch_error += linearizeRollPitchFactor(rpf, pose, idx, accum);
+    }
+  }
+
+  void operator()(const tbb::blocked_range<RelPoseFactorConstIter>& range) {
+    for (const RelPoseFactor& rpf : range) {
+      const Sophus::SE3d& pose_i = frame_poses->at(rpf.t_i_ns).getPose();
+      const Sophus::SE3d& pose_j = frame_poses->at(rpf.t_j_ns).getPose();
+      int idx_i = aom.abs_order_map.at(rpf.t_i_ns).first;
+      int idx_j = aom.abs_order_map.at(rpf.t_j_ns).first;
+      rel_error +=
+          linearizeRelPoseFactor(rpf, pose_i, pose_j, idx_i, idx_j, accum);
+    }
+  }
+
+  const AbsOrderMap& aom;
+  BlockVec& blocks;
+  const Eigen::aligned_map<int64_t, PoseStateWithLin<double>>* frame_poses;
+
+  SparseHashAccumulator<Scalar> accum;
+  double roll_pitch_error = 0;
+  double rel_error = 0;
+  size_t num_failed = 0;
+};
+
+}  // namespace
+
+template <class SqrtScalar>
+void NfrMapper::optimizeSqrt(int num_iterations) {
+  using VecX = Eigen::Matrix<SqrtScalar, Eigen::Dynamic, 1>;
+  using BlockT = MapperLandmarkBlock<SqrtScalar>;
+
+  AbsOrderMap aom;
+
+  for (const auto& kv : frame_poses) {
+    aom.abs_order_map[kv.first] = std::make_pair(aom.total_size, POSE_SIZE);
+    aom.total_size += POSE_SIZE;
+  }
+
+  const Calibration<SqrtScalar> calib_s = calib.cast<SqrtScalar>();
+
+  typename LandmarkBlock<SqrtScalar>::Options lb_options;
+  lb_options.huber_parameter = huber_thresh;
+  lb_options.obs_std_dev = obs_std_dev;
+
+  // The relative poses are shared by all landmarks of a host/target pair
+  Eigen::aligned_unordered_map<std::pair<TimeCamId, TimeCamId>,
+                               RelPoseLin<SqrtScalar>>
+      relative_pose_lin;
+  for (const auto& [tcid_h, target_map] : lmdb.getObservations()) {
+    for (const auto& [tcid_t, _] : target_map) {
+      relative_pose_lin.try_emplace(std::make_pair(tcid_h, tcid_t));
+    }
+  }
+
+  std::vector<KeypointId> landmark_ids;
+  for (const auto& [lm_id, lm] : lmdb.getLandmarks()) {
+    if (aom.abs_order_map.count(lm.host_kf_id.frame_id) > 0) {
+      landmark_ids.emplace_back(lm_id);
+    }
+  }
+
+  std::vector<std::unique_ptr<BlockT>> blocks(landmark_ids.size());
+
+  tbb::parallel_for(
+      tbb::blocked_range<size_t>(0, landmark_ids.size()),
+      [&](const tbb::blocked_range<size_t>& r) {
+        for (size_t i = r.begin(); i != r.end(); ++i) {
+          const auto& lm = lmdb.getLandmark(landmark_ids[i]);
+
+          blocks[i].reset(new BlockT);
+          BlockT& b = *blocks[i];
+          b.lm_id = landmark_ids[i];
+          b.lm.host_kf_id = lm.host_kf_id;
+          for (const auto& [tcid, pos] : lm.obs) {
+            b.lm.obs.emplace(tcid, pos.template cast<SqrtScalar>());
+          }
+
+          std::set<FrameId> frames = {lm.host_kf_id.frame_id};
+          for (const auto& kv : lm.obs) {
+            if (aom.abs_order_map.count(kv.first.frame_id) > 0) {
+              frames.emplace(kv.first.frame_id);
+            }
+          }
+
+          for (FrameId frame_id : frames) {
+            b.aom.abs_order_map[frame_id] =
+                std::make_pair(b.aom.total_size, POSE_SIZE);
+            b.aom.total_size += POSE_SIZE;
+            b.aom.items++;
+            b.global_idx.emplace_back(aom.abs_order_map.at(frame_id).first);
+          }
+        }
+      });
+
+  // Copies the landmark estimates of lmdb to the blocks
+  auto reset_landmarks = [&]() {
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, blocks.size()),
+                      [&](const tbb::blocked_range<size_t>& r) {
+                        for (size_t i = r.begin(); i != r.end(); ++i) {
+                          BlockT& b = *blocks[i];
+                          const auto& lm = lmdb.getLandmark(b.lm_id);
+                          b.lm.direction =
+                              lm.direction.template cast<SqrtScalar>();
+                          b.lm.inv_dist = SqrtScalar(lm.inv_dist);
+                        }
+                      });
+  };
+
+  // The blocks keep pointers to the relative poses, the keypoint and the
+  // local order, so they are only allocated once the rest is in place.
+  for (auto& b : blocks) {
+    b->lb.allocateLandmark(b->lm, relative_pose_lin, calib_s, b->aom,
+                           lb_options);
+  }
+
+  for (int iter = 0; iter < num_iterations; iter++) {
+    auto t1 = std::chrono::high_resolution_clock::now();
+
+    for (const auto& [tcid_h, target_map] : lmdb.getObservations()) {
+      for (const auto& [tcid_t, _] : target_map) {
+        RelPoseLin<SqrtScalar>& rpl =
+            relative_pose_lin.at(std::make_pair(tcid_h, tcid_t));
+
+        if (tcid_h != tcid_t && frame_poses.count(tcid_h.frame_id) > 0 &&
+            frame_poses.count(tcid_t.frame_id) > 0) {
+          Sophus::Matrix6d d_rel_d_h, d_rel_d_t;
+          Sophus::SE3d T_t_h = basalt::computeRelPose(
+              frame_poses.at(tcid_h.frame_id).getPose(),
+              calib.T_i_c[tcid_h.cam_id],
+              frame_poses.at(tcid_t.frame_id).getPose(),
+              calib.T_i_c[tcid_t.cam_id], &d_rel_d_h, &d_rel_d_t);
+
+          rpl.T_t_h = T_t_h.matrix().template cast<SqrtScalar>();
+          rpl.d_rel_d_h = d_rel_d_h.template cast<SqrtScalar>();
+          rpl.d_rel_d_t = d_rel_d_t.template cast<SqrtScalar>();
+        } else {
+          rpl.T_t_h.setIdentity();
+          rpl.d_rel_d_h.setZero();
+          rpl.d_rel_d_t.setZero();
+        }
+      }
+    }
+
+    reset_landmarks();
+
+    // Errors are computed in double, the same way as after the update
+    double vision_error;
+    computeError(vision_error);
+
+    MapperSqrtLinearizeReduce<SqrtScalar> lopt(aom, blocks, &frame_poses);
+    tbb::parallel_reduce(tbb::blocked_range<size_t>(0, blocks.size()), lopt);
+
+    if (config.mapper_use_factors) {
+      tbb::blocked_range<Eigen::aligned_vector<RollPitchFactor>::const_iterator>
+          range1(roll_pitch_factors.begin(), roll_pitch_factors.end());
+      tbb::blocked_range<Eigen::aligned_vector<RelPoseFactor>::const_iterator>
+          range2(rel_pose_factors.begin(), rel_pose_factors.end());
+
+      tbb::parallel_reduce(range1, lopt);
+      tbb::parallel_reduce(range2, lopt);
+    }
+
+    double error_total = vision_error + lopt.rel_error + lopt.roll_pitch_error;
+
+    std::cout << "[LINEARIZE] iter " << iter
+              << " before_update_error: vision: " << vision_error
+              << " rel_error: " << lopt.rel_error
+              << " roll_pitch_error: " << lopt.roll_pitch_error
+              << " total: " << error_total
+              << " failed_landmarks: " << lopt.num_failed << std::endl;
+
+    lopt.accum.iterative_solver = true;
+    lopt.accum.print_info = true;
+
+    lopt.accum.setup_solver();
+    const VecX Hdiag = lopt.accum.Hdiagonal();
+
+    // Applies the (negated) pose increment to the poses and the back
+    // substituted increments to the landmarks.
+    auto apply_inc = [&](const VecX& inc) {
+      for (auto& kv : frame_poses) {
+        int idx = aom.abs_order_map.at(kv.first).first;
+        BASALT_ASSERT(!kv.second.isLinearized());
+        kv.second.applyInc(
+            -inc.template segment<POSE_SIZE>(idx).template cast<double>());
+      }
+
+      reset_landmarks();
+
+      tbb::parallel_for(
+          tbb::blocked_range<size_t>(0, blocks.size()),
+          [&](const tbb::blocked_range<size_t>& r) {
+            for (size_t i = r.begin(); i != r.end(); ++i) {
+              BlockT& b = *blocks[i];
+              if (b.lb.isNumericalFailure()) continue;
+
+              VecX local_inc(b.aom.total_size);
+              for (size_t j = 0; j < b.global_idx.size(); j++) {
+                local_inc.template segment<POSE_SIZE>(POSE_SIZE * j) =
+                    -inc.template segment<POSE_SIZE>(b.global_idx[j]);
+              }
+
+              SqrtScalar l_diff = 0;
+              b.lb.backSubstitute(local_inc, l_diff);
+
+              auto& lm = lmdb.getLandmark(b.lm_id);
+              lm.direction = b.lm.direction.template cast<double>();
+              lm.inv_dist = b.lm.inv_dist;
+            }
+          });
+    };
+
+    bool converged = false;
+
+    if (config.mapper_use_lm) {  // Use Levenberg–Marquardt
+      bool step = false;
+      int max_iter = 10;
+
+      while (!step && max_iter > 0 && !converged) {
+        VecX Hdiag_lambda = Hdiag * SqrtScalar(lambda);
+        for (int i = 0; i < Hdiag_lambda.size(); i++)
+          Hdiag_lambda[i] = std::max(Hdiag_lambda[i], SqrtScalar(min_lambda));
+
+        const VecX inc = lopt.accum.solve(&Hdiag_lambda);
+        double max_inc = inc.array().abs().maxCoeff();
+        if (max_inc < 1e-5) converged = true;
+
+        backup();
+        apply_inc(inc);
+
+        double after_update_vision_error = 0;
+        double after_rel_error = 0;
+        double after_roll_pitch_error = 0;
+
+        computeError(after_update_vision_error);
+        if (config.mapper_use_factors) {
+          computeRelPose(after_rel_error);
+          computeRollPitch(after_roll_pitch_error);
+        }
+
+        double after_error_total = after_update_vision_error + after_rel_error +
+                                   after_roll_pitch_error;
+
+        double f_diff = (error_total - after_error_total);
+
+        if (f_diff < 0) {
+          std::cout << "\t[REJECTED] lambda:" << lambda << " f_diff: " << f_diff
+                    << " max_inc: " << max_inc
+                    << " vision_error: " << after_update_vision_error
+                    << " rel_error: " << after_rel_error
+                    << " roll_pitch_error: " << after_roll_pitch_error
+                    << " total: " << after_error_total << std::endl;
+          lambda = std::min(max_lambda, lambda_vee * lambda);
+          lambda_vee *= 2;
+
+          restore();
+        } else {
+          std::cout << "\t[ACCEPTED] lambda:" << lambda << " f_diff: " << f_diff
+                    << " max_inc: " << max_inc
+                    << " vision_error: " << after_update_vision_error
+                    << " rel_error: " << after_rel_error
+                    << " roll_pitch_error: " << after_roll_pitch_error
+                    << " total: " << after_error_total << std::endl;
+
+          lambda = std::max(min_lambda, lambda / 3);
+          lambda_vee = 2;
+
+          step = true;
+        }
+
+        max_iter--;
+      }
+    } else {  // Use Gauss-Newton
+      VecX Hdiag_lambda = Hdiag * SqrtScalar(min_lambda);
+      for (int i = 0; i < Hdiag_lambda.size(); i++)
+        Hdiag_lambda[i] = std::max(Hdiag_lambda[i], SqrtScalar(min_lambda));
+
+      const VecX inc = lopt.accum.solve(&Hdiag_lambda);
+      double max_inc = inc.array().abs().maxCoeff();
+      if (max_inc < 1e-5) converged = true;
+
+      apply_inc(inc);
+    }
+
+    auto t2 = std::chrono::high_resolution_clock::now();
+    auto elapsed =
+        std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1);
+
+    std::cout << "iter " << iter << " time : " << elapsed.count()
+              << "(us),  num_poses " << frame_poses.size() << " num_landmarks "
+              << blocks.size() << std::endl;
+
+    if (converged) break;
+  }
+}
+
 void NfrMapper::optimize(int num_iterations) {
+  if (config.mapper_use_sqrt_ba) {
+    if (config.mapper_sqrt_ba_use_double) {
+      optimizeSqrt<double>(num_iterations);
+    } else {
+      optimizeSqrt<float>(num_iterations);
+    }
+    return;
+  }
+
   AbsOrderMap aom;
 
   for (const auto& kv : frame_poses) {
@@ -610,10 +970,12 @@ void NfrMapper::match_all() {
             << std::endl;
 
   std::atomic<int> total_matched = 0;
+  std::atomic<int> total_verified = 0;
 
   tbb::blocked_range<size_t> range(0, ids_to_match.size());
   auto match_func = [&](const tbb::blocked_range<size_t>& r) {
     int matched = 0;
+    int verified = 0;
 
     for (size_t j = r.begin(); j != r.end(); ++j) {
       const TimeCamId& id1 = keys[ids_to_match[j].i];
@@ -624,8 +986,15 @@ void NfrMapper::match_all() {
 
       MatchData md;
 
-      matchDescriptors(f1.corner_descriptors, f2.corner_descriptors, md.matches,
-                       70, 1.2);
+      std::vector<uint32_t> groups1, groups2;
+      if (hash_bow_database->direct_index(f1.hashes, groups1) &&
+          hash_bow_database->direct_index(f2.hashes, groups2)) {
+        matchDescriptors(f1.corner_descriptors, groups1, f2.corner_descriptors,
+                         groups2, md.matches, 70, 1.2);
+      } else {
+        matchDescriptors(f1.corner_descriptors, f2.corner_descriptors,
+                         md.matches, 70, 1.2);
+      }
 
       if (int(md.matches.size()) > config.mapper_min_matches) {
         matched++;
@@ -634,9 +1003,13 @@ void NfrMapper::match_all() {
                           config.mapper_min_matches, md);
       }
 
-      if (!md.inliers.empty()) feature_matches[std::make_pair(id1, id2)] = md;
+      if (!md.inliers.empty()) {
+        verified++;
+        feature_matches[std::make_pair(id1, id2)] = md;
+      }
     }
     total_matched += matched;
+    total_verified += verified;
   };
 
   tbb::parallel_for(range, match_func);
@@ -666,6 +1039,9 @@ void NfrMapper::match_all() {
             << elapsed2.count() * 1e-6
             << "s. Geometric verification attemts: " << total_matched << "."
             << std::endl;
+
+  num_match_candidates = ids_to_match.size();
+  num_verified_pairs = total_verified;
 }
 
 void NfrMapper::build_tracks() {
@@ -755,4 +1131,34 @@ void NfrMapper::setup_opt() {
   }
 }
 
+void NfrMapper::getLocalizationMap(LocalizationMap& map) const {
+  map = LocalizationMap();
+
+  for (const auto& [lm_id, kpt] : lmdb.getLandmarks()) {
+    const TimeCamId& tcid_h = kpt.host_kf_id;
+
+    auto track_it = feature_tracks.find(lm_id);
+    if (track_it == feature_tracks.end()) continue;
+    auto feat_it = track_it->second.find(tcid_h);
+    if (feat_it == track_it->second.end()) continue;
+
+    const Sophus::SE3d T_w_c = frame_poses.at(tcid_h.frame_id).getPose() *
+                               calib.T_i_c[tcid_h.cam_id];
+
+    Eigen::Vector4d pt_c = StereographicParam<double>::unproject(kpt.direction);
+    pt_c[3] = kpt.inv_dist;
+    const Eigen::Vector4d pt_w = T_w_c.matrix() * pt_c;
+
+    map.points.emplace_back(pt_w.head<3>() / pt_w[3]);
+    map.descriptors.emplace_back(
+        feature_corners.at(tcid_h).corner_descriptors.at(feat_it->second));
+  }
+
+  for (const auto& [t_ns, state] : frame_poses) {
+    map.keyframe_poses[t_ns] = state.getPose();
+  }
+
+  map.buildIndex();
+}
+
 }  // namespace basalt
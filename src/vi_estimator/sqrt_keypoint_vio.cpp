@@ -36,6 +36,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <basalt/vi_estimator/marg_helper.h>
 #include <basalt/vi_estimator/sqrt_keypoint_vio.h>
 
+#include <basalt/io/checkpoint_io.h>
 #include <basalt/optical_flow/optical_flow.h>
 #include <basalt/optimization/accumulator.h>
 #include <basalt/utils/assert.h>
@@ -43,12 +44,19 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <basalt/vi_estimator/sc_ba_base.h>
 #include <basalt/utils/cast_utils.hpp>
 #include <basalt/utils/format.hpp>
+#include <basalt/utils/nfr.h>
 #include <basalt/utils/time_utils.hpp>
 
 #include <basalt/linearization/linearization_base.hpp>
+#include <basalt/linearization/map_obs_block.hpp>
 
 #include <fmt/format.h>
 
+#include <cereal/archives/binary.hpp>
+#include <cereal/types/map.hpp>
+#include <cereal/types/set.hpp>
+#include <cereal/types/vector.hpp>
+
 #include <tbb/blocked_range.h>
 #include <tbb/parallel_for.h>
 #include <tbb/parallel_reduce.h>
@@ -64,6 +72,7 @@ SqrtKeypointVioEstimator<Scalar_>::SqrtKeypointVioEstimator(
     const VioConfig& config_)
     : take_kf(true),
       frames_after_kf(0),
+      kf_requested(false),
       g(g_.cast<Scalar>()),
       initialized(false),
       config(config_),
@@ -124,6 +133,13 @@ SqrtKeypointVioEstimator<Scalar_>::SqrtKeypointVioEstimator(
 
   vision_data_queue.set_capacity(10);
   imu_data_queue.set_capacity(300);
+
+  if (!config.vio_map_path.empty()) {
+    LocalizationMap::Ptr map = std::make_shared<LocalizationMap>();
+    if (map->load(config.vio_map_path)) {
+      map_localizer.reset(new MapLocalizer(map, calib_, config));
+    }
+  }
 }
 
 template <class Scalar_>
@@ -136,6 +152,7 @@ void SqrtKeypointVioEstimator<Scalar_>::initialize(
   last_state_t_ns = t_ns;
   imu_meas[t_ns] = IntegratedImuMeasurement<Scalar>(t_ns, bg.cast<Scalar>(),
                                                     ba.cast<Scalar>());
+  imu_meas_inputs[t_ns] = {bg.cast<Scalar>(), ba.cast<Scalar>(), {}};
   frame_states[t_ns] = PoseVelBiasStateWithLin<Scalar>(
       t_ns, T_w_i_init, vel_w_i.cast<Scalar>(), bg.cast<Scalar>(),
       ba.cast<Scalar>(), true);
@@ -163,6 +180,12 @@ void SqrtKeypointVioEstimator<Scalar_>::initialize(const Eigen::Vector3d& bg_,
         calib.dicrete_time_accel_noise_std().array().square();
     const Vec3 gyro_cov = calib.dicrete_time_gyro_noise_std().array().square();
 
+    // Resume from the last frame of a restored checkpoint
+    if (initialized) {
+      auto it = prev_opt_flow_res.find(last_state_t_ns);
+      if (it != prev_opt_flow_res.end()) prev_frame = it->second;
+    }
+
     typename ImuData<Scalar>::Ptr data = popFromImuDataQueue();
 
     bool run = data != nullptr;  // End VIO otherwise
@@ -195,35 +218,9 @@ void SqrtKeypointVioEstimator<Scalar_>::initialize(const Eigen::Vector3d& bg_,
           data->gyro = calib.calib_gyro_bias.getCalibrated(data->gyro);
           // std::cout << "Skipping IMU data.." << std::endl;
         }
-
-        Vec3 vel_w_i_init;
-        vel_w_i_init.setZero();
-
-        T_w_i_init.setQuaternion(Eigen::Quaternion<Scalar>::FromTwoVectors(
-            data->accel, Vec3::UnitZ()));
-
-        last_state_t_ns = curr_frame->t_ns;
-        imu_meas[last_state_t_ns] =
-            IntegratedImuMeasurement<Scalar>(last_state_t_ns, bg, ba);
-        frame_states[last_state_t_ns] = PoseVelBiasStateWithLin<Scalar>(
-            last_state_t_ns, T_w_i_init, vel_w_i_init, bg, ba, true);
-
-        marg_data.order.abs_order_map[last_state_t_ns] =
-            std::make_pair(0, POSE_VEL_BIAS_SIZE);
-        marg_data.order.total_size = POSE_VEL_BIAS_SIZE;
-        marg_data.order.items = 1;
-
-        std::cout << "Setting up filter: t_ns " << last_state_t_ns << std::endl;
-        std::cout << "T_w_i\n" << T_w_i_init.matrix() << std::endl;
-        std::cout << "vel_w_i " << vel_w_i_init.transpose() << std::endl;
-
-        if (config.vio_debug || config.vio_extended_logging) {
-          logMargNullspace();
-        }
-
-        initialized = true;
       }
 
+      ImuMeasInput meas_input;
       if (prev_frame) {
         // preintegrate measurements
 
@@ -232,6 +229,8 @@ void SqrtKeypointVioEstimator<Scalar_>::initialize(const Eigen::Vector3d& bg_,
         meas.reset(new IntegratedImuMeasurement<Scalar>(
             prev_frame->t_ns, last_state.getState().bias_gyro,
             last_state.getState().bias_accel));
+        meas_input.bias_gyro = last_state.getState().bias_gyro;
+        meas_input.bias_accel = last_state.getState().bias_accel;
 
         BASALT_ASSERT_MSG(prev_frame->t_ns != curr_frame->t_ns,
                           "duplicate frame timestamps?! zero time delta leads "
@@ -250,6 +249,7 @@ void SqrtKeypointVioEstimator<Scalar_>::initialize(const Eigen::Vector3d& bg_,
 
         while (data->t_ns <= curr_frame->t_ns) {
           meas->integrate(*data, accel_cov, gyro_cov);
+          meas_input.samples.push_back(*data);
           data = popFromImuDataQueue();
           if (!data) break;
           data->accel = calib.calib_accel_bias.getCalibrated(data->accel);
@@ -261,12 +261,52 @@ void SqrtKeypointVioEstimator<Scalar_>::initialize(const Eigen::Vector3d& bg_,
           int64_t tmp = data->t_ns;
           data->t_ns = curr_frame->t_ns;
           meas->integrate(*data, accel_cov, gyro_cov);
+          meas_input.samples.push_back(*data);
           data->t_ns = tmp;
         }
       }
       curr_frame->input_images->addTime("imu_preintegrated");
 
-      measure(curr_frame, meas);
+      {
+        std::lock_guard<std::mutex> lock(state_mutex);
+
+        if (!initialized) {
+          Vec3 vel_w_i_init;
+          vel_w_i_init.setZero();
+
+          T_w_i_init.setQuaternion(Eigen::Quaternion<Scalar>::FromTwoVectors(
+              data->accel, Vec3::UnitZ()));
+
+          last_state_t_ns = curr_frame->t_ns;
+          imu_meas[last_state_t_ns] =
+              IntegratedImuMeasurement<Scalar>(last_state_t_ns, bg, ba);
+          imu_meas_inputs[last_state_t_ns] = {bg, ba, {}};
+          frame_states[last_state_t_ns] = PoseVelBiasStateWithLin<Scalar>(
+              last_state_t_ns, T_w_i_init, vel_w_i_init, bg, ba, true);
+
+          marg_data.order.abs_order_map[last_state_t_ns] =
+              std::make_pair(0, POSE_VEL_BIAS_SIZE);
+          marg_data.order.total_size = POSE_VEL_BIAS_SIZE;
+          marg_data.order.items = 1;
+
+          std::cout << "Setting up filter: t_ns " << last_state_t_ns
+                    << std::endl;
+          std::cout << "T_w_i\n" << T_w_i_init.matrix() << std::endl;
+          std::cout << "vel_w_i " << vel_w_i_init.transpose() << std::endl;
+
+          if (config.vio_debug || config.vio_extended_logging) {
+            logMargNullspace();
+          }
+
+          initialized = true;
+        }
+
+        if (meas) {
+          imu_meas_inputs[meas->get_start_t_ns()] = std::move(meas_input);
+        }
+        executeScheduled(scheduler_instance, TrackerScheduler::VIO,
+                         [&] { measure(curr_frame, meas); });
+      }
       prev_frame = curr_frame;
     }
 
@@ -317,6 +357,7 @@ bool SqrtKeypointVioEstimator<Scalar_>::measure(
     const OpticalFlowResult::Ptr& opt_flow_meas,
     const typename IntegratedImuMeasurement<Scalar>::Ptr& meas) {
   stats_sums_.add("frame_id", opt_flow_meas->t_ns).format("none");
+  memory_stats_.addStats(stats_sums_);
   Timer t_total;
 
   if (meas.get()) {
@@ -394,94 +435,55 @@ bool SqrtKeypointVioEstimator<Scalar_>::measure(
     // baseline) and make keyframe
     take_kf = false;
     frames_after_kf = 0;
+    kf_requested = false;
     kf_ids.emplace(last_state_t_ns);
 
-    int num_points_added = 0;
-    for (int i = 0; i < NUM_CAMS; i++) {
-      TimeCamId tcidl(opt_flow_meas->t_ns, i);
-
-      for (int lm_id : unconnected_obs[i]) {
-        if (lmdb.landmarkExists(lm_id)) continue;
-        // Find all observations
-        std::map<TimeCamId, KeypointObservation<Scalar>> kp_obs;
-
-        for (const auto& kv : prev_opt_flow_res) {
-          for (size_t k = 0; k < kv.second->observations.size(); k++) {
-            auto it = kv.second->observations[k].find(lm_id);
-            if (it != kv.second->observations[k].end()) {
-              TimeCamId tcido(kv.first, k);
-
-              KeypointObservation<Scalar> kobs;
-              kobs.kpt_id = lm_id;
-              kobs.pos = it->second.translation().template cast<Scalar>();
+    // Fixed map landmarks visible in the keyframe, predicted with the IMU
+    if (map_localizer) {
+      MapObservations obs;
+      map_localizer->match(*opt_flow_meas, get_T_w_i().template cast<double>(),
+                           obs);
+      if (!map_localizer->isLocalized()) map_obs.clear();
+      if (!obs.empty()) map_obs[last_state_t_ns] = std::move(obs);
+    }
 
-              // obs[tcidl][tcido].push_back(kobs);
-              kp_obs[tcido] = kobs;
-            }
-          }
-        }
+    int num_points_added = 0;
 
-        // triangulate
-        bool valid_kp = false;
-        const Scalar min_triang_distance2 =
-            Scalar(config.vio_min_triangulation_dist *
-                   config.vio_min_triangulation_dist);
-        for (const auto& kv_obs : kp_obs) {
-          if (valid_kp) break;
-          TimeCamId tcido = kv_obs.first;
-
-          const Vec2 p0 = opt_flow_meas->observations.at(i)
-                              .at(lm_id)
-                              .translation()
-                              .cast<Scalar>();
-          const Vec2 p1 = prev_opt_flow_res[tcido.frame_id]
-                              ->observations[tcido.cam_id]
-                              .at(lm_id)
-                              .translation()
-                              .template cast<Scalar>();
-
-          Vec4 p0_3d, p1_3d;
-          bool valid1 = calib.intrinsics[i].unproject(p0, p0_3d);
-          bool valid2 = calib.intrinsics[tcido.cam_id].unproject(p1, p1_3d);
-          if (!valid1 || !valid2) continue;
-
-          SE3 T_i0_i1 =
-              getPoseStateWithLin(tcidl.frame_id).getPose().inverse() *
-              getPoseStateWithLin(tcido.frame_id).getPose();
-          SE3 T_0_1 =
-              calib.T_i_c[i].inverse() * T_i0_i1 * calib.T_i_c[tcido.cam_id];
-
-          if (T_0_1.translation().squaredNorm() < min_triang_distance2)
-            continue;
-
-          Vec4 p0_triangulated = triangulate(p0_3d.template head<3>(),
-                                             p1_3d.template head<3>(), T_0_1);
-
-          if (p0_triangulated.array().isFinite().all() &&
-              p0_triangulated[3] > 0 && p0_triangulated[3] < 3.0) {
-            Keypoint<Scalar> kpt_pos;
-            kpt_pos.host_kf_id = tcidl;
-            kpt_pos.direction =
-                StereographicParam<Scalar>::project(p0_triangulated);
-            kpt_pos.inv_dist = p0_triangulated[3];
-            lmdb.addLandmark(lm_id, kpt_pos);
-
-            num_points_added++;
-            valid_kp = true;
-          }
-        }
+    // Cameras observing each new landmark in the current frame
+    std::map<KeypointId, std::vector<int>> new_lm_cams;
+    for (int i = 0; i < NUM_CAMS; i++) {
+      for (int lm_id : unconnected_obs[i]) new_lm_cams[lm_id].push_back(i);
+    }
 
-        if (valid_kp) {
-          for (const auto& kv_obs : kp_obs) {
-            lmdb.addObservation(kv_obs.first, kv_obs.second);
-          }
-        }
-      }
+    // Number of landmarks hosted by each camera of this keyframe
+    std::vector<int> num_hosted(NUM_CAMS, 0);
+
+    const auto candidates =
+        this->collectLandmarkCandidates(new_lm_cams, prev_opt_flow_res);
+    if (config.vio_batch_triangulation) {
+      num_points_added = this->triangulateLandmarks(
+          opt_flow_meas->t_ns, candidates,
+          Scalar(config.vio_min_triangulation_dist),
+          Scalar(config.vio_min_triangulation_parallax * M_PI / 180),
+          config.vio_balance_landmark_hosts, num_hosted);
+    } else {
+      num_points_added = this->triangulateLandmarksTwoView(
+          opt_flow_meas->t_ns, candidates,
+          Scalar(config.vio_min_triangulation_dist),
+          config.vio_balance_landmark_hosts, num_hosted);
     }
 
     num_points_kf[opt_flow_meas->t_ns] = num_points_added;
   } else {
     frames_after_kf++;
+
+    // The next frames can become keyframes, ask the optical flow for new
+    // points so that they have unconnected observations to triangulate
+    if (opt_flow_kf_request_queue && !kf_requested &&
+        frames_after_kf >= config.vio_min_frames_after_kf) {
+      opt_flow_kf_request_queue->push(opt_flow_meas->t_ns);
+      kf_requested = true;
+    }
   }
 
   std::unordered_set<KeypointId> lost_landmaks;
@@ -580,6 +582,18 @@ bool SqrtKeypointVioEstimator<Scalar_>::measure(
     out_vis_queue->push(data);
   }
 
+  // From now on only the observations of this frame are needed, and its
+  // images if it is a keyframe whose marginalization data is recorded. The
+  // optical flow and the UI keep their own reference to the full result.
+  {
+    auto it = prev_opt_flow_res.find(opt_flow_meas->t_ns);
+    if (it != prev_opt_flow_res.end()) {
+      const bool keep_images =
+          out_marg_queue && kf_ids.count(opt_flow_meas->t_ns) > 0;
+      it->second = it->second->windowCopy(keep_images);
+    }
+  }
+
   last_processed_t_ns = last_state_t_ns;
 
   stats_sums_.add("measure", t_total.elapsed()).format("ms");
@@ -821,15 +835,9 @@ void SqrtKeypointVioEstimator<Scalar_>::marginalize(
         MargData::Ptr m(new MargData);
         m->aom = aom;
 
-        if (is_lin_sqrt && marg_data.is_sqrt) {
-          m->abs_H =
-              (Q2Jp_or_H.transpose() * Q2Jp_or_H).template cast<double>();
-          m->abs_b = (Q2Jp_or_H.transpose() * Q2r_or_b).template cast<double>();
-        } else {
-          m->abs_H = Q2Jp_or_H.template cast<double>();
-
-          m->abs_b = Q2r_or_b.template cast<double>();
-        }
+        m->abs_H = Q2Jp_or_H.template cast<double>();
+        m->abs_b = Q2r_or_b.template cast<double>();
+        m->is_sqrt = is_lin_sqrt && marg_data.is_sqrt;
 
         assign_cast_map_values(m->frame_poses, frame_poses);
         assign_cast_map_values(m->frame_states, frame_states);
@@ -837,10 +845,13 @@ void SqrtKeypointVioEstimator<Scalar_>::marginalize(
         m->kfs_to_marg = kfs_to_marg;
         m->use_imu = true;
 
+        compactMargData(*m);
+
         for (int64_t t : m->kfs_all) {
           m->opt_flow_res.emplace_back(prev_opt_flow_res.at(t));
         }
 
+        m->chargeMemory();
         out_marg_queue->push(m);
       }
     }
@@ -974,6 +985,7 @@ void SqrtKeypointVioEstimator<Scalar_>::marginalize(
     for (const int64_t id : states_to_marg_all) {
       frame_states.erase(id);
       imu_meas.erase(id);
+      imu_meas_inputs.erase(id);
       prev_opt_flow_res.erase(id);
     }
 
@@ -984,6 +996,7 @@ void SqrtKeypointVioEstimator<Scalar_>::marginalize(
       frame_poses[id] = pose;
       frame_states.erase(id);
       imu_meas.erase(id);
+      imu_meas_inputs.erase(id);
     }
 
     for (const int64_t id : poses_to_marg) {
@@ -1047,6 +1060,14 @@ void SqrtKeypointVioEstimator<Scalar_>::marginalize(
     computeDelta(marg_data.order, delta);
     marg_data.b -= marg_data.H * delta;
 
+    if (config.vio_marg_sparsify_interval > 0 &&
+        ++num_margs_since_sparsify >= config.vio_marg_sparsify_interval) {
+      Timer t;
+      sparsifyMargPrior();
+      num_margs_since_sparsify = 0;
+      stats_sums_.add("marg_sparsify", t.elapsed()).format("ms");
+    }
+
     if (config.vio_debug || config.vio_extended_logging) {
       VecX delta;
       computeDelta(marg_data.order, delta);
@@ -1072,6 +1093,106 @@ void SqrtKeypointVioEstimator<Scalar_>::marginalize(
   stats_sums_.add("marginalize", t_total.elapsed()).format("ms");
 }
 
+template <class Scalar_>
+void SqrtKeypointVioEstimator<Scalar_>::sparsifyMargPrior() {
+  const AbsOrderMap& order = marg_data.order;
+  const Eigen::Index size = order.total_size;
+
+  // Keyframe poses of the prior and the state of the last marginalized frame
+  std::vector<int64_t> kfs;
+  int64_t state_t_ns = -1;
+  for (const auto& [t_ns, idx_size] : order.abs_order_map) {
+    if (idx_size.second == POSE_SIZE) {
+      kfs.emplace_back(t_ns);
+    } else {
+      state_t_ns = t_ns;
+    }
+  }
+
+  if (kfs.empty() || state_t_ns < 0) return;
+
+  auto get_pose_lin = [&](int64_t t_ns) -> Sophus::SE3d {
+    auto it = frame_poses.find(t_ns);
+    if (it != frame_poses.end()) {
+      return it->second.getPoseLin().template cast<double>();
+    }
+    return frame_states.at(t_ns).getStateLin().T_w_i.template cast<double>();
+  };
+
+  // All factors are linearized at the linearization point of the prior, like
+  // the dense prior they replace.
+  std::vector<Eigen::MatrixXd> factor_J;
+
+  // Absolute position, yaw and roll-pitch of the oldest keyframe, as in
+  // NfrMapper. Position and yaw only carry the information the prior has about
+  // them, which is none if it is not anchored.
+  {
+    const int idx = order.abs_order_map.at(kfs.front()).first;
+    const Sophus::SE3d T_w_i = get_pose_lin(kfs.front());
+
+    Eigen::Matrix<double, 3, POSE_SIZE> d_pos_d_T_w_i;
+    Eigen::Matrix<double, 1, POSE_SIZE> d_yaw_d_T_w_i;
+    Eigen::Matrix<double, 2, POSE_SIZE> d_rp_d_T_w_i;
+
+    absPositionError(T_w_i, T_w_i.translation(), &d_pos_d_T_w_i);
+    yawError(T_w_i, T_w_i.so3().inverse() * Eigen::Vector3d::UnitX(),
+             &d_yaw_d_T_w_i);
+    rollPitchError(T_w_i, T_w_i.so3(), &d_rp_d_T_w_i);
+
+    Eigen::MatrixXd J = Eigen::MatrixXd::Zero(POSE_SIZE, size);
+    J.block<3, POSE_SIZE>(0, idx) = d_pos_d_T_w_i;
+    J.block<1, POSE_SIZE>(3, idx) = d_yaw_d_T_w_i;
+    J.block<2, POSE_SIZE>(4, idx) = d_rp_d_T_w_i;
+    factor_J.emplace_back(std::move(J));
+  }
+
+  // Relative poses along the chain of keyframes and to the state
+  auto add_rel_pose = [&](int64_t t_i_ns, int64_t t_j_ns) {
+    const Sophus::SE3d T_w_i = get_pose_lin(t_i_ns);
+    const Sophus::SE3d T_w_j = get_pose_lin(t_j_ns);
+
+    Sophus::Matrix6d d_res_d_T_w_i, d_res_d_T_w_j;
+    relPoseError(T_w_i.inverse() * T_w_j, T_w_i, T_w_j, &d_res_d_T_w_i,
+                 &d_res_d_T_w_j);
+
+    Eigen::MatrixXd J = Eigen::MatrixXd::Zero(POSE_SIZE, size);
+    J.block<POSE_SIZE, POSE_SIZE>(0, order.abs_order_map.at(t_i_ns).first) =
+        d_res_d_T_w_i;
+    J.block<POSE_SIZE, POSE_SIZE>(0, order.abs_order_map.at(t_j_ns).first) =
+        d_res_d_T_w_j;
+    factor_J.emplace_back(std::move(J));
+  };
+
+  for (size_t i = 1; i < kfs.size(); i++) add_rel_pose(kfs[i - 1], kfs[i]);
+  add_rel_pose(kfs.back(), state_t_ns);
+
+  // Velocity in the body frame, which unlike the world frame velocity does
+  // not depend on yaw, and the biases
+  {
+    const int idx = order.abs_order_map.at(state_t_ns).first;
+    const PoseVelBiasState<Scalar>& state =
+        frame_states.at(state_t_ns).getStateLin();
+    const Eigen::Matrix3d R_i_w =
+        state.T_w_i.so3().inverse().matrix().template cast<double>();
+    const Eigen::Vector3d vel_w_i = state.vel_w_i.template cast<double>();
+
+    Eigen::MatrixXd J = Eigen::MatrixXd::Zero(9, size);
+    J.block<3, 3>(0, idx + 3) = R_i_w * Sophus::SO3d::hat(vel_w_i);
+    J.block<3, 3>(0, idx + 6) = R_i_w;
+    J.block<6, 6>(3, idx + 9).setIdentity();
+    factor_J.emplace_back(std::move(J));
+  }
+
+  MatX sparse_H;
+  VecX sparse_b;
+  MargHelper<Scalar>::sparsifyHelper(marg_data.H, marg_data.b,
+                                     marg_data.is_sqrt, factor_J, sparse_H,
+                                     sparse_b);
+
+  marg_data.H = std::move(sparse_H);
+  marg_data.b = std::move(sparse_b);
+}
+
 template <class Scalar_>
 void SqrtKeypointVioEstimator<Scalar_>::optimize() {
   if (config.vio_debug) {
@@ -1136,6 +1257,17 @@ void SqrtKeypointVioEstimator<Scalar_>::optimize() {
     lqr_options.lb_options.obs_std_dev = obs_std_dev;
     lqr_options.linearization_type = config.vio_linearization_type;
 
+    // optionally restrict the optimization to a budget of landmarks
+    std::unordered_set<KeypointId> active_landmarks;
+    if (config.vio_max_landmarks > 0 &&
+        this->lmdb.numLandmarks() > size_t(config.vio_max_landmarks)) {
+      Timer t;
+      this->selectActiveLandmarks(config.vio_max_landmarks, active_landmarks);
+      lqr_options.active_landmarks = &active_landmarks;
+      stats.add("selectActiveLandmarks", t.reset()).format("ms");
+      stats.add("num_lms_active", active_landmarks.size()).format("count");
+    }
+
     std::unique_ptr<LinearizationBase<Scalar, POSE_SIZE>> lqr;
 
     ImuLinData<Scalar> ild = {
@@ -1152,6 +1284,20 @@ void SqrtKeypointVioEstimator<Scalar_>::optimize() {
       lqr->log_problem_stats(stats);
     }
 
+    // Observations of map landmarks are only kept while their frame is in
+    // the window. They are not marginalized.
+    std::vector<MapObsBlock<Scalar>> map_obs_blocks;
+    for (auto it = map_obs.begin(); it != map_obs.end();) {
+      if (aom.abs_order_map.count(it->first) == 0) {
+        it = map_obs.erase(it);
+      } else {
+        map_obs_blocks.emplace_back(it->first, &it->second, aom);
+        ++it;
+      }
+    }
+    const Scalar map_obs_std_dev = Scalar(config.vio_map_obs_std_dev);
+    stats.add("num_map_obs_frames", map_obs_blocks.size()).format("count");
+
     bool terminated = false;
     bool converged = false;
     std::string message;
@@ -1177,6 +1323,11 @@ void SqrtKeypointVioEstimator<Scalar_>::optimize() {
         BASALT_ASSERT_STREAM(
             numerically_valid,
             "did not expect numerical failure during linearization");
+        for (auto& mb : map_obs_blocks) {
+          error_total += mb.linearizeMapObs(
+              getPoseStateWithLin(mb.getFrameId()), calib, map_obs_std_dev,
+              huber_thresh);
+        }
         stats.add("linearizeProblem", t.reset()).format("ms");
 
         //        // compute pose jacobian norm squared for Jacobian scaling
@@ -1265,6 +1416,7 @@ void SqrtKeypointVioEstimator<Scalar_>::optimize() {
           VecX b;
 
           lqr->get_dense_H_b(H, b);
+          for (const auto& mb : map_obs_blocks) mb.add_dense_H_b(H, b);
 
           stats.add("get_dense_H_b", t.reset()).format("ms");
 
@@ -1307,6 +1459,7 @@ void SqrtKeypointVioEstimator<Scalar_>::optimize() {
 
           Timer t;
           l_diff = lqr->backSubstitute(inc);
+          for (const auto& mb : map_obs_blocks) mb.backSubstitute(inc, l_diff);
           stats.add("backSubstitute", t.reset()).format("ms");
         }
 
@@ -1335,7 +1488,8 @@ void SqrtKeypointVioEstimator<Scalar_>::optimize() {
 
         {
           Timer t;
-          computeError(after_update_vision_and_inertial_error);
+          computeError(after_update_vision_and_inertial_error, nullptr, 0,
+                       lqr_options.active_landmarks);
           computeMargPriorError(marg_data, after_update_marg_prior_error);
 
           Scalar after_update_imu_error = 0, after_bg_error = 0,
@@ -1348,6 +1502,12 @@ void SqrtKeypointVioEstimator<Scalar_>::optimize() {
           after_update_vision_and_inertial_error +=
               after_update_imu_error + after_bg_error + after_ba_error;
 
+          for (const auto& mb : map_obs_blocks) {
+            after_update_vision_and_inertial_error +=
+                mb.computeError(getPoseStateWithLin(mb.getFrameId()), calib,
+                                map_obs_std_dev, huber_thresh);
+          }
+
           stats.add("computerError2", t.reset()).format("ms");
         }
 
@@ -1513,6 +1673,136 @@ void SqrtKeypointVioEstimator<Scalar_>::debug_finalize() {
   stats_sums_.save_json("stats_sums.json");
 }
 
+template <class Scalar_>
+bool SqrtKeypointVioEstimator<Scalar_>::saveCheckpoint(std::ostream& os) {
+  std::lock_guard<std::mutex> lock(state_mutex);
+  if (!initialized) return false;
+
+  cereal::BinaryOutputArchive ar(os);
+  ar(CheckpointHeader{"sqrt_keypoint_vio", sizeof(Scalar)});
+
+  ar(last_state_t_ns, T_w_i_init, opt_started, take_kf, frames_after_kf,
+     kf_requested);
+  ar(kf_ids, num_points_kf, lambda, lambda_vee, num_margs_since_sparsify);
+  ar(frame_states, frame_poses, lmdb, marg_data, imu_meas_inputs);
+
+  // The window frames as left by windowCopy(), with images only for the
+  // frames that kept them
+  ar(uint64_t(prev_opt_flow_res.size()));
+  for (const auto& [t_ns, res] : prev_opt_flow_res) {
+    ar(t_ns, res->observations, res->input_images);
+  }
+
+  return true;
+}
+
+template <class Scalar_>
+std::function<void()> SqrtKeypointVioEstimator<Scalar_>::prepareRestore(
+    std::istream& is) {
+  BASALT_ASSERT_MSG(!processing_thread,
+                    "checkpoints must be restored before initialize()");
+
+  const size_t num_cams = calib.intrinsics.size();
+
+  struct Restored {
+    int64_t last_state_t_ns;
+    SE3 T_w_i_init;
+    bool opt_started, take_kf, kf_requested;
+    int frames_after_kf, num_margs_since_sparsify;
+    std::set<int64_t> kf_ids;
+    std::map<int64_t, int> num_points_kf;
+    Scalar lambda, lambda_vee;
+    Eigen::aligned_map<int64_t, PoseVelBiasStateWithLin<Scalar>> states;
+    Eigen::aligned_map<int64_t, PoseStateWithLin<Scalar>> poses;
+    LandmarkDatabase<Scalar> lmdb;
+    MargLinData<Scalar> marg_data;
+    Eigen::aligned_map<int64_t, ImuMeasInput> imu_meas_inputs;
+    Eigen::aligned_map<int64_t, IntegratedImuMeasurement<Scalar>> imu_meas;
+    std::map<int64_t, OpticalFlowResult::Ptr> opt_flow_res;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+  std::shared_ptr<Restored> r(new Restored);
+
+  try {
+    cereal::BinaryInputArchive ar(is);
+    CheckpointHeader header{"sqrt_keypoint_vio", sizeof(Scalar)};
+    ar(header);
+
+    ar(r->last_state_t_ns, r->T_w_i_init, r->opt_started, r->take_kf,
+       r->frames_after_kf, r->kf_requested);
+    ar(r->kf_ids, r->num_points_kf, r->lambda, r->lambda_vee,
+       r->num_margs_since_sparsify);
+    ar(r->states, r->poses, r->lmdb, r->marg_data, r->imu_meas_inputs);
+
+    uint64_t num_frames;
+    ar(num_frames);
+    for (uint64_t i = 0; i < num_frames; i++) {
+      auto res = std::make_shared<OpticalFlowResult>();
+      int64_t t_ns;
+      ar(t_ns, res->observations, res->input_images);
+      res->t_ns = t_ns;
+      if (res->observations.size() != num_cams ||
+          (res->input_images &&
+           res->input_images->img_data.size() != num_cams)) {
+        throw std::runtime_error("Checkpoint for a different camera count");
+      }
+      r->opt_flow_res[t_ns] = res;
+    }
+  } catch (const std::exception& e) {
+    std::cerr << "Could not restore VIO checkpoint: " << e.what() << std::endl;
+    return {};
+  }
+
+  if (r->states.count(r->last_state_t_ns) == 0 ||
+      r->marg_data.is_sqrt != marg_data.is_sqrt ||
+      size_t(r->marg_data.H.cols()) != r->marg_data.order.total_size) {
+    std::cerr << "Could not restore VIO checkpoint: inconsistent state"
+              << std::endl;
+    return {};
+  }
+
+  // Integrate the IMU data again instead of storing the preintegrated values
+  const Vec3 accel_cov = calib.dicrete_time_accel_noise_std().array().square();
+  const Vec3 gyro_cov = calib.dicrete_time_gyro_noise_std().array().square();
+  for (const auto& [t_ns, input] : r->imu_meas_inputs) {
+    IntegratedImuMeasurement<Scalar> meas(t_ns, input.bias_gyro,
+                                          input.bias_accel);
+    for (const auto& d : input.samples) meas.integrate(d, accel_cov, gyro_cov);
+    r->imu_meas.emplace(t_ns, meas);
+  }
+
+  return [this, r] {
+    std::lock_guard<std::mutex> lock(state_mutex);
+
+    last_state_t_ns = r->last_state_t_ns;
+    T_w_i_init = r->T_w_i_init;
+    opt_started = r->opt_started;
+    take_kf = r->take_kf;
+    frames_after_kf = r->frames_after_kf;
+    kf_requested = r->kf_requested;
+    kf_ids = std::move(r->kf_ids);
+    num_points_kf = std::move(r->num_points_kf);
+    lambda = r->lambda;
+    lambda_vee = r->lambda_vee;
+    num_margs_since_sparsify = r->num_margs_since_sparsify;
+    frame_states = std::move(r->states);
+    frame_poses = std::move(r->poses);
+    lmdb = std::move(r->lmdb);
+    marg_data = std::move(r->marg_data);
+    imu_meas_inputs = std::move(r->imu_meas_inputs);
+    imu_meas = std::move(r->imu_meas);
+
+    prev_opt_flow_res.clear();
+    for (auto& [t_ns, res] : r->opt_flow_res) prev_opt_flow_res[t_ns] = res;
+
+    // The nullspace debug prior is not saved, start it over from the prior
+    nullspace_marg_data = marg_data;
+
+    initialized = true;
+  };
+}
+
 // //////////////////////////////////////////////////////////////////
 // instatiate templates
 
@@ -61,6 +61,7 @@ SqrtKeypointVoEstimator<Scalar_>::SqrtKeypointVoEstimator(
     const basalt::Calibration<double>& calib_, const VioConfig& config_)
     : take_kf(true),
       frames_after_kf(0),
+      kf_requested(false),
       initialized(false),
       config(config_),
       lambda(config_.vio_lm_lambda_initial),
@@ -179,7 +180,8 @@ void SqrtKeypointVoEstimator<Scalar_>::initialize(const Eigen::Vector3d& bg,
         add_pose = true;
       }
 
-      measure(curr_frame, add_pose);
+      executeScheduled(scheduler_instance, TrackerScheduler::VIO,
+                       [&] { measure(curr_frame, add_pose); });
       prev_frame = curr_frame;
     }
 
@@ -211,6 +213,7 @@ template <class Scalar_>
 bool SqrtKeypointVoEstimator<Scalar_>::measure(
     const OpticalFlowResult::Ptr& opt_flow_meas, const bool add_pose) {
   stats_sums_.add("frame_id", opt_flow_meas->t_ns).format("none");
+  memory_stats_.addStats(stats_sums_);
   Timer t_total;
 
   //  std::cout << "=== measure frame " << opt_flow_meas->t_ns << "\n";
@@ -311,98 +314,46 @@ bool SqrtKeypointVoEstimator<Scalar_>::measure(
     // baseline) and make keyframe
     take_kf = false;
     frames_after_kf = 0;
+    kf_requested = false;
     kf_ids.emplace(last_state_t_ns);
 
     int num_points_added = 0;
 
+    // Cameras observing each new landmark in the current frame
+    std::map<KeypointId, std::vector<int>> new_lm_cams;
     for (int i = 0; i < NUM_CAMS; i++) {
-      TimeCamId tcidl(opt_flow_meas->t_ns, i);
-
-      for (int lm_id : unconnected_obs[i]) {
-        if (lmdb.landmarkExists(lm_id)) continue;
-        // Find all observations
-        std::map<TimeCamId, KeypointObservation<Scalar>> kp_obs;
-
-        for (const auto& kv : prev_opt_flow_res) {
-          for (size_t k = 0; k < kv.second->observations.size(); k++) {
-            auto it = kv.second->observations[k].find(lm_id);
-            if (it != kv.second->observations[k].end()) {
-              TimeCamId tcido(kv.first, k);
-
-              KeypointObservation<Scalar> kobs;
-              kobs.kpt_id = lm_id;
-              kobs.pos = it->second.translation().template cast<Scalar>();
-
-              // obs[tcidl][tcido].push_back(kobs);
-              kp_obs[tcido] = kobs;
-            }
-          }
-        }
-
-        // triangulate
-        bool valid_kp = false;
-        const Scalar min_triang_distance2 =
-            Scalar(config.vio_min_triangulation_dist *
-                   config.vio_min_triangulation_dist);
-        for (const auto& kv_obs : kp_obs) {
-          if (valid_kp) break;
-          TimeCamId tcido = kv_obs.first;
-
-          const Vec2 p0 = opt_flow_meas->observations.at(i)
-                              .at(lm_id)
-                              .translation()
-                              .cast<Scalar>();
-          const Vec2 p1 = prev_opt_flow_res[tcido.frame_id]
-                              ->observations[tcido.cam_id]
-                              .at(lm_id)
-                              .translation()
-                              .template cast<Scalar>();
-
-          Vec4 p0_3d, p1_3d;
-          bool valid1 = calib.intrinsics[i].unproject(p0, p0_3d);
-          bool valid2 = calib.intrinsics[tcido.cam_id].unproject(p1, p1_3d);
-          if (!valid1 || !valid2) continue;
-
-          SE3 T_i0_i1 =
-              getPoseStateWithLin(tcidl.frame_id).getPose().inverse() *
-              getPoseStateWithLin(tcido.frame_id).getPose();
-          SE3 T_0_1 =
-              calib.T_i_c[i].inverse() * T_i0_i1 * calib.T_i_c[tcido.cam_id];
-
-          if (T_0_1.translation().squaredNorm() < min_triang_distance2)
-            continue;
-
-          Vec4 p0_triangulated = triangulate(p0_3d.template head<3>(),
-                                             p1_3d.template head<3>(), T_0_1);
-
-          if (p0_triangulated.array().isFinite().all() &&
-              p0_triangulated[3] > 0 && p0_triangulated[3] < Scalar(3.0)) {
-            Keypoint<Scalar> kpt_pos;
-            kpt_pos.host_kf_id = tcidl;
-            kpt_pos.direction =
-                StereographicParam<Scalar>::project(p0_triangulated);
-            kpt_pos.inv_dist = p0_triangulated[3];
-            lmdb.addLandmark(lm_id, kpt_pos);
-
-            num_points_added++;
-            valid_kp = true;
-          }
-        }
-
-        if (valid_kp) {
-          for (const auto& kv_obs : kp_obs) {
-            lmdb.addObservation(kv_obs.first, kv_obs.second);
-          }
+      for (int lm_id : unconnected_obs[i]) new_lm_cams[lm_id].push_back(i);
+    }
 
-          // TODO: non-linear refinement of landmark position from all
-          // observations; may speed up later joint optimization
-        }
-      }
+    // Number of landmarks hosted by each camera of this keyframe
+    std::vector<int> num_hosted(NUM_CAMS, 0);
+
+    const auto candidates =
+        this->collectLandmarkCandidates(new_lm_cams, prev_opt_flow_res);
+    if (config.vio_batch_triangulation) {
+      num_points_added = this->triangulateLandmarks(
+          opt_flow_meas->t_ns, candidates,
+          Scalar(config.vio_min_triangulation_dist),
+          Scalar(config.vio_min_triangulation_parallax * M_PI / 180),
+          config.vio_balance_landmark_hosts, num_hosted);
+    } else {
+      num_points_added = this->triangulateLandmarksTwoView(
+          opt_flow_meas->t_ns, candidates,
+          Scalar(config.vio_min_triangulation_dist),
+          config.vio_balance_landmark_hosts, num_hosted);
     }
 
     num_points_kf[opt_flow_meas->t_ns] = num_points_added;
   } else {
     frames_after_kf++;
+
+    // The next frames can become keyframes, ask the optical flow for new
+    // points so that they have unconnected observations to triangulate
+    if (opt_flow_kf_request_queue && !kf_requested &&
+        frames_after_kf >= config.vio_min_frames_after_kf) {
+      opt_flow_kf_request_queue->push(opt_flow_meas->t_ns);
+      kf_requested = true;
+    }
   }
 
   std::unordered_set<KeypointId> lost_landmaks;
@@ -499,6 +450,18 @@ bool SqrtKeypointVoEstimator<Scalar_>::measure(
     out_vis_queue->push(data);
   }
 
+  // From now on only the observations of this frame are needed, and its
+  // images if it is a keyframe whose marginalization data is recorded. The
+  // optical flow and the UI keep their own reference to the full result.
+  {
+    auto it = prev_opt_flow_res.find(opt_flow_meas->t_ns);
+    if (it != prev_opt_flow_res.end()) {
+      const bool keep_images =
+          out_marg_queue && kf_ids.count(opt_flow_meas->t_ns) > 0;
+      it->second = it->second->windowCopy(keep_images);
+    }
+  }
+
   last_processed_t_ns = last_state_t_ns;
 
   stats_sums_.add("measure", t_total.elapsed()).format("ms");
@@ -780,16 +743,9 @@ void SqrtKeypointVoEstimator<Scalar_>::marginalize(
           MargData::Ptr m(new MargData);
           m->aom = aom;
 
-          if (is_lin_sqrt && marg_data.is_sqrt) {
-            m->abs_H =
-                (Q2Jp_or_H.transpose() * Q2Jp_or_H).template cast<double>();
-            m->abs_b =
-                (Q2Jp_or_H.transpose() * Q2r_or_b).template cast<double>();
-          } else {
-            m->abs_H = Q2Jp_or_H.template cast<double>();
-
-            m->abs_b = Q2r_or_b.template cast<double>();
-          }
+          m->abs_H = Q2Jp_or_H.template cast<double>();
+          m->abs_b = Q2r_or_b.template cast<double>();
+          m->is_sqrt = is_lin_sqrt && marg_data.is_sqrt;
 
           assign_cast_map_values(m->frame_poses, frame_poses);
           assign_cast_map_values(m->frame_states, frame_states);
@@ -797,10 +753,13 @@ void SqrtKeypointVoEstimator<Scalar_>::marginalize(
           m->kfs_to_marg = kfs_to_marg;
           m->use_imu = false;
 
+          compactMargData(*m);
+
           for (int64_t t : m->kfs_all) {
             m->opt_flow_res.emplace_back(prev_opt_flow_res.at(t));
           }
 
+          m->chargeMemory();
           out_marg_queue->push(m);
         }
       }
@@ -1031,6 +990,18 @@ void SqrtKeypointVoEstimator<Scalar_>::optimize() {
   lqr_options.lb_options.huber_parameter = huber_thresh;
   lqr_options.lb_options.obs_std_dev = obs_std_dev;
   lqr_options.linearization_type = config.vio_linearization_type;
+
+  // optionally restrict the optimization to a budget of landmarks
+  std::unordered_set<KeypointId> active_landmarks;
+  if (config.vio_max_landmarks > 0 &&
+      lmdb.numLandmarks() > size_t(config.vio_max_landmarks)) {
+    Timer t;
+    selectActiveLandmarks(config.vio_max_landmarks, active_landmarks);
+    lqr_options.active_landmarks = &active_landmarks;
+    stats.add("selectActiveLandmarks", t.reset()).format("ms");
+    stats.add("num_lms_active", active_landmarks.size()).format("count");
+  }
+
   std::unique_ptr<LinearizationBase<Scalar, POSE_SIZE>> lqr;
 
   {
@@ -1222,7 +1193,8 @@ void SqrtKeypointVoEstimator<Scalar_>::optimize() {
 
       {
         Timer t;
-        computeError(after_update_vision_error);
+        computeError(after_update_vision_error, nullptr, 0,
+                     lqr_options.active_landmarks);
         computeMargPriorError(marg_data, after_update_marg_prior_error);
         stats.add("computerError2", t.reset()).format("ms");
       }
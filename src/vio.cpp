@@ -343,12 +343,14 @@ int main(int argc, char** argv) {
     vio->out_state_queue = &out_state_queue;
     vio->opt_flow_depth_guess_queue = &opt_flow_ptr->input_depth_queue;
     vio->opt_flow_state_queue = &opt_flow_ptr->input_state_queue;
+    vio->opt_flow_kf_request_queue = &opt_flow_ptr->input_kf_request_queue;
   }
 
   basalt::MargDataSaver::Ptr marg_data_saver;
 
   if (!marg_data_path.empty()) {
-    marg_data_saver.reset(new basalt::MargDataSaver(marg_data_path));
+    marg_data_saver.reset(
+        new basalt::MargDataSaver(marg_data_path, vio_config));
     vio->out_marg_queue = &marg_data_saver->in_marg_queue;
 
     // Save gt.
@@ -662,6 +664,7 @@ int main(int argc, char** argv) {
     stats.add("ate_rmse", ate_rmse);
     stats.add("ate_num_kfs", vio_t_w_i.size());
     stats.add("num_frames", vio_dataset->get_image_timestamps().size());
+    stats.add("vio_max_landmarks", vio_config.vio_max_landmarks);
 
     {
       basalt::MemoryInfo mi;
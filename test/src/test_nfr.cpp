@@ -2,7 +2,9 @@
 
 #include <basalt/spline/se3_spline.h>
 #include <basalt/utils/nfr.h>
+#include <basalt/vi_estimator/nfr_mapper.h>
 
+#include <chrono>
 #include <iostream>
 
 #include "gtest/gtest.h"
@@ -135,3 +137,119 @@ TEST(PreIntegrationTestSuite, RollPitchTest) {
         x0);
   }
 }
+
+// Stereo rig of two identical cameras with a 10 cm baseline.
+static void setupMapperCalib(basalt::Calibration<double>& calib) {
+  calib.T_i_c.clear();
+  calib.intrinsics.clear();
+  calib.T_i_c.emplace_back(Sophus::SE3d());
+  calib.T_i_c.emplace_back(Sophus::SO3d(), Eigen::Vector3d(0.1, 0, 0));
+
+  basalt::GenericCamera<double> cam;
+  cam.variant = basalt::KannalaBrandtCamera4<double>::getTestProjections()[0];
+  calib.intrinsics.emplace_back(cam);
+  calib.intrinsics.emplace_back(cam);
+}
+
+// Keyframes of the rig in calib along a line observing random points, with
+// perturbed poses and landmarks for the mapper to refine. Deterministic for a
+// given seed.
+static void setupMapperProblem(unsigned int seed,
+                               const basalt::Calibration<double>& calib,
+                               basalt::NfrMapper& mapper) {
+  constexpr int NUM_FRAMES = 20;
+  constexpr int NUM_POINTS = 400;
+
+  std::srand(seed);
+
+  Eigen::aligned_map<int64_t, Sophus::SE3d> gt_poses;
+  for (int i = 0; i < NUM_FRAMES; i++) {
+    Sophus::SE3d T_w_i;
+    T_w_i.so3() = Sophus::SO3d::exp(Eigen::Vector3d::Random() / 100);
+    T_w_i.translation()[0] = i * 0.1;
+    gt_poses[i] = T_w_i;
+
+    Sophus::SE3d T_w_i_noisy = T_w_i;
+    if (i > 0) T_w_i_noisy *= Sophus::se3_expd(Sophus::Vector6d::Random() / 50);
+    mapper.frame_poses[i] =
+        basalt::PoseStateWithLin<double>(i, T_w_i_noisy, false);
+  }
+
+  Eigen::MatrixXd points_3d;
+  points_3d.setRandom(3, NUM_POINTS);
+  points_3d.row(0).array() = points_3d.row(0).array() * 2 + 1;
+  points_3d.row(2).array() += 5.0;
+
+  for (int k = 0; k < NUM_POINTS; k++) {
+    const Eigen::Vector3d p3d = points_3d.col(k);
+    const basalt::TimeCamId tcid_h(k % NUM_FRAMES, 0);
+
+    Sophus::SE3d T_w_c = gt_poses.at(tcid_h.frame_id) * calib.T_i_c[0];
+    Eigen::Vector3d p3d_cam = T_w_c.inverse() * p3d;
+
+    basalt::Keypoint<double> kpt;
+    kpt.direction =
+        basalt::StereographicParam<double>::project(p3d_cam.homogeneous());
+    kpt.inv_dist = (1.0 + 0.1 * Eigen::Vector2d::Random()[0]) / p3d_cam.norm();
+    kpt.host_kf_id = tcid_h;
+
+    mapper.lmdb.addLandmark(k, kpt);
+
+    for (const auto& [frame_id, T_w_i] : gt_poses) {
+      for (size_t c = 0; c < calib.T_i_c.size(); c++) {
+        Sophus::SE3d T_c_w = (T_w_i * calib.T_i_c[c]).inverse();
+
+        Eigen::Vector2d p2d;
+        if (!calib.intrinsics[c].project(T_c_w * p3d, p2d)) continue;
+        p2d += Eigen::Vector2d::Random() / 2;
+
+        basalt::KeypointObservation<double> ko;
+        ko.kpt_id = k;
+        ko.pos = p2d;
+        mapper.lmdb.addObservation(basalt::TimeCamId(frame_id, c), ko);
+      }
+    }
+  }
+}
+
+// Compares the square-root mapper BA in float with the Schur complement BA in
+// double on the same problem.
+TEST(NfrMapperTestSuite, SqrtFloatVsSchurDouble) {
+  constexpr int NUM_ITERATIONS = 20;
+  constexpr unsigned int SEED = 42;
+
+  basalt::Calibration<double> calib;
+  setupMapperCalib(calib);
+
+  basalt::VioConfig config;
+  config.mapper_use_factors = false;
+
+  double final_error[2];
+
+  for (int use_sqrt = 0; use_sqrt < 2; use_sqrt++) {
+    config.mapper_use_sqrt_ba = use_sqrt;
+    config.mapper_sqrt_ba_use_double = false;
+
+    basalt::NfrMapper mapper(calib, config);
+    setupMapperProblem(SEED, calib, mapper);
+
+    double initial_error;
+    mapper.computeError(initial_error);
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    mapper.optimize(NUM_ITERATIONS);
+    auto t2 = std::chrono::high_resolution_clock::now();
+
+    mapper.computeError(final_error[use_sqrt]);
+
+    std::cout << (use_sqrt ? "sqrt float" : "schur double")
+              << ": initial error " << initial_error << " final error "
+              << final_error[use_sqrt] << " time "
+              << std::chrono::duration<double, std::milli>(t2 - t1).count()
+              << " ms" << std::endl;
+
+    EXPECT_LT(final_error[use_sqrt], 0.1 * initial_error);
+  }
+
+  EXPECT_NEAR(final_error[1], final_error[0], 0.01 * final_error[0]);
+}
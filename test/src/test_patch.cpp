@@ -1,9 +1,12 @@
 
 
+#include <basalt/image/image_pyr.h>
+#include <basalt/optical_flow/gradient_pyramid.h>
 #include <basalt/optical_flow/patch.h>
 #include <sophus/se2.hpp>
 
 #include <iostream>
+#include <random>
 
 #include "gtest/gtest.h"
 #include "test_utils.h"
@@ -89,3 +92,52 @@ TEST(Patch, PatchSe2Jac) {
       },
       Eigen::Vector3d::Zero());
 }
+
+TEST(Patch, GradientPyramid) {
+  basalt::ManagedImage<uint16_t> img(160, 120);
+
+  std::mt19937 gen(3);
+  std::uniform_int_distribution<int> intensity(0, 65535);
+  for (size_t y = 0; y < img.h; y++) {
+    for (size_t x = 0; x < img.w; x++) {
+      img(x, y) = intensity(gen);
+    }
+  }
+
+  const int num_levels = 2;
+  basalt::ManagedImagePyr<uint16_t> pyr;
+  pyr.setFromImage(img, num_levels);
+  basalt::GradientPyramid grads;
+  grads.setFromPyramid(pyr, num_levels);
+
+  std::uniform_real_distribution<double> coord(0, 1);
+  for (int level = 0; level <= num_levels; level++) {
+    const basalt::Image<const uint16_t> lvl = pyr.lvl(level);
+    const basalt::GradientImage& grad_lvl = grads.lvl(level);
+
+    for (int i = 0; i < 100; i++) {
+      const Eigen::Vector2d p(coord(gen) * lvl.w, coord(gen) * lvl.h);
+      ASSERT_EQ(lvl.InBounds(p, 2), grad_lvl.InBounds(p, 2));
+      if (!lvl.InBounds(p, 2)) continue;
+
+      const Eigen::Vector3d expected = lvl.interpGrad<double>(p);
+      const Eigen::Vector3d val_grad = grad_lvl.interpGrad<double>(p);
+      EXPECT_TRUE(expected.isApprox(val_grad, 1e-9))
+          << "expected " << expected.transpose() << " got "
+          << val_grad.transpose();
+    }
+  }
+
+  using PatchT = basalt::OpticalFlowPatch<float, basalt::Pattern52<float>>;
+
+  const Eigen::Vector2f pos(71.3, 52.8);
+  PatchT patch(pyr.lvl(0), pos);
+  PatchT grad_patch;
+  grad_patch.setFromImage(grads.lvl(0), pos);
+
+  ASSERT_TRUE(patch.valid);
+  ASSERT_TRUE(grad_patch.valid);
+  EXPECT_TRUE(patch.data.isApprox(grad_patch.data, 1e-5));
+  EXPECT_TRUE(patch.H_se2_inv_J_se2_T.isApprox(grad_patch.H_se2_inv_J_se2_T,
+                                               1e-4));
+}
@@ -1,9 +1,13 @@
 
 #include <Eigen/Dense>
 #include <iostream>
+#include <sstream>
 
+#include <basalt/serialization/headers_serialization.h>
 #include <basalt/vi_estimator/marg_helper.h>
 
+#include <cereal/archives/binary.hpp>
+
 #include "gtest/gtest.h"
 
 TEST(QRTestSuite, QRvsLLT) {
@@ -125,3 +129,186 @@ TEST(QRTestSuite, RankDefLeastSquares) {
   EXPECT_TRUE(sol_qr.isApprox(sol_sqrt_sc2));
 }
 #endif
+
+// Prior over a pose, a keyframe state and a non-keyframe state, as the
+// estimator hands it over before compaction.
+static basalt::MargData makeMargData(Eigen::MatrixXd& J, Eigen::VectorXd& r) {
+  basalt::MargData m;
+  m.aom.abs_order_map[10] = std::make_pair(0, POSE_SIZE);
+  m.aom.abs_order_map[20] = std::make_pair(POSE_SIZE, POSE_VEL_BIAS_SIZE);
+  m.aom.abs_order_map[30] =
+      std::make_pair(POSE_SIZE + POSE_VEL_BIAS_SIZE, POSE_VEL_BIAS_SIZE);
+  m.aom.items = 3;
+  m.aom.total_size = POSE_SIZE + 2 * POSE_VEL_BIAS_SIZE;
+
+  m.frame_poses[10] = basalt::PoseStateWithLin<double>(10, Sophus::SE3d());
+  for (int64_t t_ns : {20, 30}) {
+    m.frame_states[t_ns] = basalt::PoseVelBiasStateWithLin<double>(
+        t_ns, Sophus::SE3d(), Eigen::Vector3d::Zero(), Eigen::Vector3d::Zero(),
+        Eigen::Vector3d::Zero(), false);
+  }
+  m.kfs_all = {10, 20};
+  m.kfs_to_marg = {10};
+  m.use_imu = true;
+
+  J.setRandom(3 * m.aom.total_size, m.aom.total_size);
+  r.setRandom(J.rows());
+
+  return m;
+}
+
+TEST(QRTestSuite, CompactMargData) {
+  Eigen::MatrixXd J;
+  Eigen::VectorXd r;
+  basalt::MargData m_sq = makeMargData(J, r);
+  basalt::MargData m_sqrt = m_sq;
+
+  std::set<int> idx_to_keep, idx_to_marg;
+  for (int i = 0; i < int(m_sq.aom.total_size); i++) {
+    if (i < 2 * POSE_SIZE) {
+      idx_to_keep.emplace(i);
+    } else {
+      idx_to_marg.emplace(i);
+    }
+  }
+
+  Eigen::MatrixXd H = J.transpose() * J;
+  Eigen::VectorXd b = J.transpose() * r;
+
+  Eigen::MatrixXd marg_H;
+  Eigen::VectorXd marg_b;
+  {
+    Eigen::MatrixXd H1 = H;
+    Eigen::VectorXd b1 = b;
+    basalt::MargHelper<double>::marginalizeHelperSqToSq(
+        H1, b1, idx_to_keep, idx_to_marg, marg_H, marg_b);
+  }
+
+  m_sq.abs_H = H;
+  m_sq.abs_b = b;
+  m_sqrt.abs_H = J;
+  m_sqrt.abs_b = r;
+  m_sqrt.is_sqrt = true;
+
+  for (basalt::MargData* m : {&m_sq, &m_sqrt}) {
+    basalt::compactMargData(*m);
+
+    EXPECT_TRUE(m->is_sqrt);
+    EXPECT_EQ(m->aom.total_size, size_t(2 * POSE_SIZE));
+    EXPECT_EQ(m->abs_H.rows(), m->abs_H.cols());
+    EXPECT_TRUE(m->abs_H.isUpperTriangular(1e-10));
+    EXPECT_TRUE((m->abs_H.transpose() * m->abs_H).isApprox(marg_H, 1e-8));
+    EXPECT_TRUE((m->abs_H.transpose() * m->abs_b).isApprox(marg_b, 1e-8));
+
+    EXPECT_EQ(m->frame_poses.size(), 2u);
+    EXPECT_TRUE(m->frame_states.empty());
+  }
+
+  // Compacting again does not change anything
+  Eigen::MatrixXd R = m_sqrt.abs_H;
+  basalt::compactMargData(m_sqrt);
+  EXPECT_EQ(m_sqrt.abs_H, R);
+}
+
+TEST(QRTestSuite, MargDataLegacyFormat) {
+  Eigen::MatrixXd J;
+  Eigen::VectorXd r;
+  basalt::MargData m = makeMargData(J, r);
+  m.abs_H = J.transpose() * J;
+  m.abs_b = J.transpose() * r;
+
+  // Version 1 layout, which had no header and no is_sqrt flag
+  std::stringstream ss;
+  {
+    cereal::BinaryOutputArchive archive(ss);
+    archive(m.aom, m.abs_H, m.abs_b, m.frame_poses, m.frame_states, m.kfs_all,
+            m.kfs_to_marg, m.use_imu);
+  }
+
+  basalt::MargData loaded;
+  {
+    cereal::BinaryInputArchive archive(ss);
+    archive(loaded);
+  }
+
+  EXPECT_FALSE(loaded.is_sqrt);
+  EXPECT_EQ(loaded.aom.total_size, m.aom.total_size);
+  EXPECT_EQ(loaded.aom.abs_order_map, m.aom.abs_order_map);
+  EXPECT_EQ(loaded.abs_H, m.abs_H);
+  EXPECT_EQ(loaded.kfs_all, m.kfs_all);
+
+  // And the current version round trips
+  basalt::compactMargData(m);
+  std::stringstream ss2;
+  {
+    cereal::BinaryOutputArchive archive(ss2);
+    archive(m);
+  }
+  {
+    cereal::BinaryInputArchive archive(ss2);
+    archive(loaded);
+  }
+
+  EXPECT_TRUE(loaded.is_sqrt);
+  EXPECT_EQ(loaded.abs_H, m.abs_H);
+  EXPECT_EQ(loaded.abs_b, m.abs_b);
+  EXPECT_EQ(loaded.frame_poses.size(), m.frame_poses.size());
+
+  // Only the upper triangle of R is stored
+  basalt::MargData m_dense = m;
+  m_dense.is_sqrt = false;
+  std::stringstream ss3;
+  {
+    cereal::BinaryOutputArchive archive(ss3);
+    archive(m_dense);
+  }
+  const size_t n = m.abs_H.cols();
+  EXPECT_LE(ss2.str().size() + (n * (n - 1) / 2 - 2) * sizeof(double),
+            ss3.str().size());
+}
+
+TEST(QRTestSuite, SparsifyHelper) {
+  const int size = 2 * POSE_SIZE;
+
+  Eigen::MatrixXd J;
+  J.setRandom(3 * size, size);
+  Eigen::VectorXd r;
+  r.setRandom(J.rows());
+
+  const Eigen::MatrixXd H = J.transpose() * J;
+  const Eigen::VectorXd b = J.transpose() * r;
+  const Eigen::MatrixXd cov = H.inverse();
+  const Eigen::VectorXd mean = -H.ldlt().solve(b);
+
+  // One factor per pose, so the recovered prior has no correlations between
+  // them
+  std::vector<Eigen::MatrixXd> factor_J(2);
+  for (int i = 0; i < 2; i++) {
+    factor_J[i].setZero(POSE_SIZE, size);
+    factor_J[i].middleCols<POSE_SIZE>(i * POSE_SIZE).setIdentity();
+  }
+
+  Eigen::MatrixXd sparse_sqrt_H, sparse_H;
+  Eigen::VectorXd sparse_sqrt_b, sparse_b;
+  basalt::MargHelper<double>::sparsifyHelper(J, r, true, factor_J,
+                                             sparse_sqrt_H, sparse_sqrt_b);
+  basalt::MargHelper<double>::sparsifyHelper(H, b, false, factor_J, sparse_H,
+                                             sparse_b);
+
+  EXPECT_TRUE(sparse_sqrt_H.isUpperTriangular(1e-10));
+  EXPECT_TRUE((sparse_sqrt_H.transpose() * sparse_sqrt_H)
+                  .isApprox(sparse_H, 1e-8));
+  EXPECT_TRUE((sparse_sqrt_H.transpose() * sparse_sqrt_b)
+                  .isApprox(sparse_b, 1e-8));
+
+  EXPECT_TRUE(sparse_H.topRightCorner(POSE_SIZE, POSE_SIZE).isZero(1e-8));
+
+  // Same mean and marginals as the dense prior
+  const Eigen::MatrixXd sparse_cov = sparse_H.inverse();
+  EXPECT_TRUE((-sparse_H.ldlt().solve(sparse_b)).isApprox(mean, 1e-8));
+  for (int i = 0; i < 2; i++) {
+    const int idx = i * POSE_SIZE;
+    EXPECT_TRUE(sparse_cov.block(idx, idx, POSE_SIZE, POSE_SIZE)
+                    .isApprox(cov.block(idx, idx, POSE_SIZE, POSE_SIZE), 1e-8));
+  }
+}
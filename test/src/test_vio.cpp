@@ -3,10 +3,16 @@
 #include <basalt/imu/preintegration.h>
 #include <basalt/spline/se3_spline.h>
 #include <basalt/utils/ba_utils.h>
+#include <basalt/utils/voxel_hash.h>
 #include <basalt/vi_estimator/sc_ba_base.h>
+#include <basalt/vi_estimator/vio_estimator.h>
 #include <basalt/linearization/imu_block.hpp>
+#include <basalt/linearization/map_obs_block.hpp>
 
+#include <algorithm>
 #include <iostream>
+#include <random>
+#include <sstream>
 
 #include "gtest/gtest.h"
 #include "test_utils.h"
@@ -358,6 +364,32 @@ TEST(VioTestSuite, RelPoseTest) {
   }
 }
 
+TEST(VioTestSuite, TriangulateMultiViewTest) {
+  using BA = basalt::BundleAdjustmentBase<double>;
+
+  const Eigen::Vector3d p_0(0.3, -0.2, 2.5);
+  const Eigen::Vector3d f0 = p_0.normalized();
+
+  Eigen::aligned_vector<Eigen::Vector3d> fs;
+  Eigen::aligned_vector<Sophus::SE3d> T_0_k;
+  for (int k = 0; k < 4; k++) {
+    Sophus::Vector6d xi = Sophus::Vector6d::Random() / 10;
+    T_0_k.emplace_back(Sophus::se3_expd(xi));
+    fs.emplace_back((T_0_k.back().inverse() * p_0).normalized());
+  }
+
+  // Noise-free bearings give the exact point
+  const Eigen::Vector4d p_tri = BA::triangulateMultiView(f0, fs, T_0_k);
+  EXPECT_TRUE(p_tri.head<3>().isApprox(f0));
+  EXPECT_NEAR(p_tri[3], 1 / p_0.norm(), 1e-6);
+
+  // Same as the two-view triangulation for a single observation
+  const Eigen::Vector4d p_two = BA::triangulate(f0, fs[0], T_0_k[0]);
+  const Eigen::Vector4d p_multi =
+      BA::triangulateMultiView(f0, {fs[0]}, {T_0_k[0]});
+  EXPECT_NEAR(p_multi[3], p_two[3], 1e-6);
+}
+
 TEST(VioTestSuite, LinearizePointsTest) {
   basalt::ExtendedUnifiedCamera<double> cam =
       basalt::ExtendedUnifiedCamera<double>::getTestProjections()[0];
@@ -428,3 +460,254 @@ TEST(VioTestSuite, LinearizePointsTest) {
         x0);
   }
 }
+
+TEST(VioTestSuite, LinearizeMapPointTest) {
+  basalt::Calibration<double> calib;
+  calib.T_i_c.emplace_back(Sophus::se3_expd(Sophus::Vector6d::Random() / 10));
+  calib.intrinsics.emplace_back();
+  calib.intrinsics[0].variant =
+      basalt::ExtendedUnifiedCamera<double>::getTestProjections()[0];
+
+  Sophus::SE3d T_w_i = Sophus::se3_expd(Sophus::Vector6d::Random());
+
+  Eigen::Vector4d point3d;
+  calib.intrinsics[0].unproject(Eigen::Vector2d::Random() * 50, point3d);
+
+  basalt::MapObservation ob;
+  ob.cam_id = 0;
+  ob.p_w = T_w_i * calib.T_i_c[0] * (point3d.head<3>() * 3.0);
+  ob.pos.setRandom();
+
+  Eigen::Vector2d res;
+  Eigen::Matrix<double, 2, 6> d_res_d_xi;
+
+  ASSERT_TRUE(basalt::MapObsBlock<double>::linearizeMapPoint(
+      ob, T_w_i, calib, res, &d_res_d_xi));
+
+  {
+    Sophus::Vector6d x0;
+    x0.setZero();
+    test_jacobian(
+        "d_res_d_xi", d_res_d_xi,
+        [&](const Sophus::Vector6d& x) {
+          Sophus::SE3d T_w_i_new = T_w_i;
+          basalt::PoseState<double>::incPose(x, T_w_i_new);
+
+          Eigen::Vector2d res;
+          basalt::MapObsBlock<double>::linearizeMapPoint(ob, T_w_i_new, calib,
+                                                         res);
+
+          return res;
+        },
+        x0);
+  }
+}
+
+TEST(VioTestSuite, VoxelHashQueryTest) {
+  std::mt19937 gen(0);
+  std::uniform_real_distribution<double> dist(-20, 20);
+
+  Eigen::aligned_vector<Eigen::Vector3d> points(20000);
+  for (auto& p : points) p = Eigen::Vector3d(dist(gen), dist(gen), dist(gen));
+
+  basalt::VoxelHash index;
+  index.build(points, 1.5);
+  EXPECT_EQ(points.size(), index.size());
+
+  for (int k = 0; k < 20; k++) {
+    const Eigen::Vector3d apex(dist(gen) / 2, dist(gen) / 2, dist(gen) / 2);
+    const Eigen::Vector3d dir = Eigen::Vector3d::Random().normalized();
+    const double half_angle = 0.2 + 0.15 * k;
+    const double max_dist = 2.0 + k;
+
+    std::vector<uint32_t> cone_ids, radius_ids;
+    index.queryCone(apex, dir, half_angle, max_dist, cone_ids);
+    index.queryRadius(apex, max_dist, radius_ids);
+    std::sort(cone_ids.begin(), cone_ids.end());
+    std::sort(radius_ids.begin(), radius_ids.end());
+
+    // Brute force, ignoring points within float precision of the boundary
+    for (uint32_t i = 0; i < points.size(); i++) {
+      const Eigen::Vector3d v = points[i] - apex;
+      const double d = v.norm();
+      const double cos_angle = v.dot(dir) / d;
+
+      const bool in_cone =
+          std::binary_search(cone_ids.begin(), cone_ids.end(), i);
+      const bool in_radius =
+          std::binary_search(radius_ids.begin(), radius_ids.end(), i);
+
+      if (std::abs(d - max_dist) < 1e-4) continue;
+      EXPECT_EQ(d < max_dist, in_radius) << "point " << i;
+
+      if (std::abs(cos_angle - std::cos(half_angle)) < 1e-4) continue;
+      EXPECT_EQ(d < max_dist && cos_angle > std::cos(half_angle), in_cone)
+          << "point " << i;
+    }
+  }
+}
+
+#ifdef BASALT_INSTANTIATIONS_DOUBLE
+TEST(VioTestSuite, CheckpointRoundTripTest) {
+  basalt::Calibration<double> calib;
+  for (int i = 0; i < 2; i++) {
+    calib.T_i_c.emplace_back(Eigen::Quaterniond::Identity(),
+                             Eigen::Vector3d(0.1 * i, 0, 0));
+    calib.intrinsics.emplace_back();
+    calib.intrinsics[i].variant =
+        basalt::ExtendedUnifiedCamera<double>::getTestProjections()[0];
+    calib.resolution.emplace_back(752, 480);
+  }
+  calib.imu_update_rate = 200;
+  calib.accel_noise_std.setConstant(0.01);
+  calib.gyro_noise_std.setConstant(0.001);
+  calib.accel_bias_std.setConstant(0.001);
+  calib.gyro_bias_std.setConstant(0.0001);
+
+  // Smooth trajectory with the cameras looking up at the points
+  auto pos = [](double t) {
+    return Eigen::Vector3d(0.4 * t, 0.1 * std::sin(2 * t),
+                           0.05 * std::sin(3 * t));
+  };
+  auto vel = [](double t) {
+    return Eigen::Vector3d(0.4, 0.2 * std::cos(2 * t),
+                           0.15 * std::cos(3 * t));
+  };
+  auto acc = [](double t) {
+    return Eigen::Vector3d(0, -0.4 * std::sin(2 * t),
+                           -0.45 * std::sin(3 * t));
+  };
+  auto pose = [&](double t) {
+    return Sophus::SE3d(Sophus::SO3d::rotZ(0.1 * std::sin(t)), pos(t));
+  };
+
+  std::mt19937 gen(0);
+  std::uniform_real_distribution<double> dist_xy(-3, 3), dist_z(3, 7);
+  Eigen::aligned_vector<Eigen::Vector3d> points(300);
+  for (auto& p : points) {
+    p = Eigen::Vector3d(dist_xy(gen) + 3, dist_xy(gen), dist_z(gen));
+  }
+
+  const int64_t t0_ns = 1e9;
+  const int64_t frame_dt_ns = 5e7;
+  const int64_t imu_dt_ns = 5e6;
+  const int num_frames = 40;
+  const int checkpoint_frame = 20;
+
+  std::vector<basalt::ImuData<double>::Ptr> imu;
+  for (int64_t t_ns = t0_ns; t_ns <= t0_ns + num_frames * frame_dt_ns;
+       t_ns += imu_dt_ns) {
+    const double t = (t_ns - t0_ns) * 1e-9;
+    auto data = std::make_shared<basalt::ImuData<double>>();
+    data->t_ns = t_ns;
+    data->accel = pose(t).so3().inverse() * (acc(t) - basalt::constants::g);
+    data->gyro = Eigen::Vector3d(0, 0, 0.1 * std::cos(t));
+    imu.push_back(data);
+  }
+
+  std::vector<basalt::OpticalFlowResult::Ptr> frames;
+  for (int k = 0; k < num_frames; k++) {
+    auto frame = std::make_shared<basalt::OpticalFlowResult>();
+    frame->t_ns = t0_ns + k * frame_dt_ns;
+    frame->input_images = std::make_shared<basalt::OpticalFlowInput>(2);
+    frame->input_images->t_ns = frame->t_ns;
+    frame->observations.resize(2);
+
+    const Sophus::SE3d T_w_i = pose((frame->t_ns - t0_ns) * 1e-9);
+    for (int i = 0; i < 2; i++) {
+      const Sophus::SE3d T_c_w = (T_w_i * calib.T_i_c[i]).inverse();
+      for (size_t j = 0; j < points.size(); j++) {
+        const Eigen::Vector3d p_c = T_c_w * points[j];
+        Eigen::Vector2d uv;
+        if (p_c.z() < 0.1 ||
+            !calib.intrinsics[i].project(p_c.homogeneous(), uv) ||
+            uv.x() < 0 || uv.y() < 0 || uv.x() > 752 || uv.y() > 480) {
+          continue;
+        }
+        Eigen::AffineCompact2f kp = Eigen::AffineCompact2f::Identity();
+        kp.translation() = uv.cast<float>();
+        frame->observations[i][j] = kp;
+      }
+    }
+    frames.push_back(frame);
+  }
+
+  basalt::VioConfig config;
+  tbb::concurrent_bounded_queue<basalt::PoseVelBiasState<double>::Ptr>
+      states_a, states_b;
+  tbb::concurrent_queue<basalt::PoseVelBiasState<double>::Ptr> flow_a, flow_b;
+
+  auto vio_a = basalt::VioEstimatorFactory::getVioEstimator(
+      config, calib, basalt::constants::g, true, true);
+  vio_a->out_state_queue = &states_a;
+  vio_a->opt_flow_state_queue = &flow_a;
+  vio_a->initialize(t0_ns, pose(0), vel(0), Eigen::Vector3d::Zero(),
+                    Eigen::Vector3d::Zero());
+
+  // IMU samples are sent slightly ahead of the frames, as the estimator
+  // needs the first sample after a frame to integrate up to it. Each
+  // estimator gets its own copies, as it modifies them in place.
+  size_t imu_a = 0, imu_b = 0;
+  auto push_frame = [&](basalt::VioEstimatorBase::Ptr& vio, size_t& imu_i,
+                        int k) {
+    const int64_t t_ns = frames[k]->t_ns;
+    for (; imu_i < imu.size() && imu[imu_i]->t_ns <= t_ns + imu_dt_ns;
+         imu_i++) {
+      vio->addIMUToQueue(
+          std::make_shared<basalt::ImuData<double>>(*imu[imu_i]));
+    }
+    vio->addVisionToQueue(frames[k]);
+  };
+
+  basalt::PoseVelBiasState<double>::Ptr state;
+  for (int k = 0; k <= checkpoint_frame; k++) {
+    push_frame(vio_a, imu_a, k);
+    states_a.pop(state);
+    ASSERT_TRUE(state);
+  }
+  ASSERT_EQ(frames[checkpoint_frame]->t_ns, state->t_ns);
+
+  std::stringstream checkpoint;
+  ASSERT_TRUE(vio_a->saveCheckpoint(checkpoint));
+
+  auto vio_b = basalt::VioEstimatorFactory::getVioEstimator(
+      config, calib, basalt::constants::g, true, true);
+  vio_b->out_state_queue = &states_b;
+  vio_b->opt_flow_state_queue = &flow_b;
+  ASSERT_TRUE(vio_b->restoreCheckpoint(checkpoint));
+  vio_b->initialize(Eigen::Vector3d::Zero(), Eigen::Vector3d::Zero());
+
+  // The restored estimator gets the data after the checkpoint
+  while (imu[imu_b]->t_ns <= frames[checkpoint_frame]->t_ns) imu_b++;
+
+  for (int k = checkpoint_frame + 1; k < num_frames; k++) {
+    push_frame(vio_a, imu_a, k);
+    push_frame(vio_b, imu_b, k);
+  }
+  for (auto* vio : {vio_a.get(), vio_b.get()}) {
+    vio->addVisionToQueue(nullptr);
+    vio->addIMUToQueue(nullptr);
+  }
+
+  basalt::PoseVelBiasState<double>::Ptr state_a, state_b;
+  int num_compared = 0;
+  while (true) {
+    states_a.pop(state_a);
+    states_b.pop(state_b);
+    ASSERT_EQ(bool(state_a), bool(state_b));
+    if (!state_a) break;
+
+    EXPECT_EQ(state_a->t_ns, state_b->t_ns);
+    EXPECT_TRUE(state_a->T_w_i.translation().isApprox(
+        state_b->T_w_i.translation(), 1e-5))
+        << "frame " << state_a->t_ns;
+    EXPECT_TRUE(state_a->T_w_i.so3().unit_quaternion().isApprox(
+        state_b->T_w_i.so3().unit_quaternion(), 1e-5));
+    num_compared++;
+  }
+  EXPECT_EQ(num_frames - checkpoint_frame - 1, num_compared);
+
+  vio_a->maybe_join();
+  vio_b->maybe_join();
+}
+#endif
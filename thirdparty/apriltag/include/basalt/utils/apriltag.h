@@ -20,6 +20,19 @@ class ApriltagDetector {
                   std::vector<int>& ids_rejected,
                   std::vector<double>& radii_rejected);
 
+  /// Detects tags only inside the region [x0, x0 + w) x [y0, y0 + h) of the
+  /// image (clipped to the image). If downscale is larger than 1, the tags
+  /// are extracted on the region shrunk by this factor. The corners are
+  /// returned in full image coordinates and the sub-pixel refinement is
+  /// always done on the full resolution image.
+  void detectTagsRoi(basalt::ManagedImage<uint16_t>& img_raw, int x0, int y0,
+                     int w, int h, int downscale,
+                     Eigen::aligned_vector<Eigen::Vector2d>& corners,
+                     std::vector<int>& ids, std::vector<double>& radii,
+                     Eigen::aligned_vector<Eigen::Vector2d>& corners_rejected,
+                     std::vector<int>& ids_rejected,
+                     std::vector<double>& radii_rejected);
+
  private:
   ApriltagDetectorData* data;
 };
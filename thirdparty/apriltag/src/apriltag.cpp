@@ -48,6 +48,16 @@ void ApriltagDetector::detectTags(
     std::vector<double>& radii,
     Eigen::aligned_vector<Eigen::Vector2d>& corners_rejected,
     std::vector<int>& ids_rejected, std::vector<double>& radii_rejected) {
+  detectTagsRoi(img_raw, 0, 0, img_raw.w, img_raw.h, 1, corners, ids, radii,
+                corners_rejected, ids_rejected, radii_rejected);
+}
+
+void ApriltagDetector::detectTagsRoi(
+    basalt::ManagedImage<uint16_t>& img_raw, int x0, int y0, int w, int h,
+    int downscale, Eigen::aligned_vector<Eigen::Vector2d>& corners,
+    std::vector<int>& ids, std::vector<double>& radii,
+    Eigen::aligned_vector<Eigen::Vector2d>& corners_rejected,
+    std::vector<int>& ids_rejected, std::vector<double>& radii_rejected) {
   corners.clear();
   ids.clear();
   radii.clear();
@@ -64,9 +74,39 @@ void ApriltagDetector::detectTags(
     dst[i] = (src[i] >> 8);
   }
 
+  const cv::Rect roi =
+      cv::Rect(x0, y0, w, h) & cv::Rect(0, 0, image.cols, image.rows);
+  if (roi.area() == 0) return;
+
+  const bool full_image = roi.width == image.cols && roi.height == image.rows;
+  const int scale = std::max(downscale, 1);
+
+  cv::Mat roi_image;
+  if (scale > 1) {
+    cv::resize(image(roi), roi_image, cv::Size(), 1.0 / scale, 1.0 / scale,
+               cv::INTER_AREA);
+  } else if (full_image) {
+    roi_image = image;
+  } else {
+    // extractTags expects a continuous image
+    roi_image = image(roi).clone();
+  }
+
   // detect the tags
   std::vector<AprilTags::TagDetection> detections =
-      data->_tagDetector->extractTags(image);
+      data->_tagDetector->extractTags(roi_image);
+
+  // transform the detections back to full resolution image coordinates
+  if (scale > 1 || !full_image) {
+    const float s = static_cast<float>(roi.width) / roi_image.cols;
+    for (AprilTags::TagDetection& d : detections) {
+      for (int j = 0; j < 4; j++) {
+        d.p[j].first = (d.p[j].first + 0.5f) * s - 0.5f + roi.x;
+        d.p[j].second = (d.p[j].second + 0.5f) * s - 0.5f + roi.y;
+      }
+      d.observedPerimeter *= s;
+    }
+  }
 
   /* handle the case in which a tag is identified but not all tag
    * corners are in the image (all data bits in image but border
@@ -82,12 +122,12 @@ void ApriltagDetector::detectTags(
     bool remove = false;
 
     for (int j = 0; j < 4; j++) {
-      remove |= iter->p[j].first < data->minBorderDistance;
-      remove |= iter->p[j].first >
-                (float)(image.cols) - data->minBorderDistance;  // width
-      remove |= iter->p[j].second < data->minBorderDistance;
-      remove |= iter->p[j].second >
-                (float)(image.rows) - data->minBorderDistance;  // height
+      remove |= iter->p[j].first < roi.x + data->minBorderDistance;
+      remove |= iter->p[j].first > (float)(roi.x + roi.width) -
+                                       data->minBorderDistance;  // width
+      remove |= iter->p[j].second < roi.y + data->minBorderDistance;
+      remove |= iter->p[j].second > (float)(roi.y + roi.height) -
+                                        data->minBorderDistance;  // height
     }
 
     // also remove tags that are flagged as bad